@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# squashfs-read-bench.sh - read throughput of a squashfs image, with
+# parallel readers, under each decompressor threads= mount option.
+#
+# usage: squashfs-read-bench.sh <image> [readers] [runs]
+#
+# The image is loop mounted once per mode and run; before each run the
+# page cache is dropped and <readers> processes (default: the number of
+# cpus) read a disjoint share of the image's regular files. The time to
+# read everything and the resulting MB/s are printed.
+#
+# To build an image from a directory:
+#	mksquashfs /system system.sqfs -comp lzo -b 131072
+#
+# Must be run as root.
+
+image=$1
+readers=${2:-$(grep -c ^processor /proc/cpuinfo)}
+runs=${3:-3}
+mnt=$(mktemp -d /tmp/sqbench.XXXXXX) || exit 1
+list=$mnt.list
+
+if [ -z "$image" ] || [ ! -f "$image" ]; then
+	echo "usage: $0 <image> [readers] [runs]" >&2
+	exit 1
+fi
+
+trap 'umount $mnt 2>/dev/null; rmdir $mnt; rm -f $list $list.*' EXIT
+
+now_ms()
+{
+	awk '{ printf "%d\n", $1 * 1000 }' /proc/uptime
+}
+
+# read every file listed in $1
+reader()
+{
+	while read -r f; do
+		cat "$f" > /dev/null
+	done < "$1"
+}
+
+for mode in single percpu; do
+	if ! mount -t squashfs -o loop,ro,threads=$mode "$image" $mnt; then
+		echo "$mode: mount failed" >&2
+		continue
+	fi
+
+	find $mnt -type f > $list
+	bytes=$(while read -r f; do wc -c < "$f"; done < $list |
+		awk '{ s += $1 } END { print s + 0 }')
+	rm -f $list.*
+	awk -v n=$readers -v l=$list '{ print > (l "." (NR % n)) }' $list
+
+	run=1
+	while [ $run -le $runs ]; do
+		sync
+		echo 3 > /proc/sys/vm/drop_caches
+
+		start=$(now_ms)
+		for part in $list.*; do
+			reader $part &
+		done
+		wait
+		ms=$(( $(now_ms) - start ))
+		[ $ms -gt 0 ] || ms=1
+
+		echo "$mode: run $run, $readers readers: $bytes bytes in" \
+		     "$ms ms, $(( bytes / 1024 * 1000 / 1024 / ms )) MB/s"
+		run=$((run + 1))
+	done
+
+	umount $mnt
+done
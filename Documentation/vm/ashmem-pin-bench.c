@@ -0,0 +1,203 @@
+/*
+ * ashmem-pin-bench: hammer ASHMEM_UNPIN/ASHMEM_PIN from several threads.
+ *
+ * Each thread unpins and re-pins ranges of an ashmem area in a loop and the
+ * total rate of ioctls is reported. By default every thread has an area of
+ * its own, which is how apps use ashmem; with -s all threads share one area,
+ * taking disjoint pages of it.
+ *
+ *   ashmem-pin-bench [-t threads] [-n iterations] [-p pages] [-r range] [-s]
+ *
+ * Run it once with -t 1 to get the single-threaded rate to compare with.
+ * Pages are touched before they are unpinned, so running it under memory
+ * pressure also exercises purging; the number of ASHMEM_PIN calls that
+ * found their range purged is reported.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* from include/linux/ashmem.h, which is not exported */
+struct ashmem_pin {
+	__u32 offset;
+	__u32 len;
+};
+
+#define __ASHMEMIOC		0x77
+#define ASHMEM_SET_SIZE		_IOW(__ASHMEMIOC, 3, size_t)
+#define ASHMEM_PIN		_IOW(__ASHMEMIOC, 7, struct ashmem_pin)
+#define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
+#define ASHMEM_WAS_PURGED	1
+
+#define MAX_THREADS		64
+
+static int nr_threads = 4;
+static unsigned long iterations = 100000;
+static unsigned long area_pages = 1024;
+static unsigned long range_pages = 4;
+static int shared;
+static long page_size;
+
+struct worker {
+	pthread_t thread;
+	int fd;
+	char *map;
+	unsigned long first;		/* first page this thread uses */
+	unsigned long nr_pages;		/* and how many */
+	unsigned long purged;
+	int err;
+};
+
+static struct worker workers[MAX_THREADS];
+
+static int area_create(unsigned long pages, int *fd, char **map)
+{
+	size_t size = pages * page_size;
+
+	*fd = open("/dev/ashmem", O_RDWR);
+	if (*fd < 0) {
+		perror("open /dev/ashmem");
+		return -1;
+	}
+	if (ioctl(*fd, ASHMEM_SET_SIZE, size) < 0) {
+		perror("ASHMEM_SET_SIZE");
+		return -1;
+	}
+	/* pinning needs the backing file, which mmap creates */
+	*map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+	if (*map == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	return 0;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct ashmem_pin pin;
+	unsigned long i, slots = w->nr_pages / range_pages;
+	unsigned int seed = w->first + 1;
+	unsigned long slot;
+	int ret;
+
+	for (i = 0; i < iterations; i++) {
+		slot = rand_r(&seed) % slots;
+		pin.offset = (w->first + slot * range_pages) * page_size;
+		pin.len = range_pages * page_size;
+
+		w->map[pin.offset] = 1;
+		if (ioctl(w->fd, ASHMEM_UNPIN, &pin) < 0) {
+			perror("ASHMEM_UNPIN");
+			w->err = 1;
+			break;
+		}
+		ret = ioctl(w->fd, ASHMEM_PIN, &pin);
+		if (ret < 0) {
+			perror("ASHMEM_PIN");
+			w->err = 1;
+			break;
+		}
+		if (ret == ASHMEM_WAS_PURGED)
+			w->purged++;
+	}
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t threads] [-n iterations] "
+		"[-p pages] [-r range] [-s]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec start, end;
+	unsigned long purged = 0;
+	double secs, ops;
+	int fd = -1, i, opt;
+	char *map = NULL;
+
+	while ((opt = getopt(argc, argv, "t:n:p:r:s")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			area_pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			range_pages = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			shared = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_threads < 1 || nr_threads > MAX_THREADS || !range_pages ||
+	    area_pages < range_pages * (shared ? nr_threads : 1))
+		usage(argv[0]);
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	if (shared && area_create(area_pages, &fd, &map))
+		return 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		struct worker *w = &workers[i];
+
+		if (shared) {
+			w->fd = fd;
+			w->map = map;
+			w->nr_pages = area_pages / nr_threads;
+			w->first = i * w->nr_pages;
+		} else {
+			if (area_create(area_pages, &w->fd, &w->map))
+				return 1;
+			w->nr_pages = area_pages;
+			w->first = 0;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			return 1;
+		}
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].err)
+			return 1;
+		purged += workers[i].purged;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	ops = 2.0 * iterations * nr_threads;
+
+	printf("%d threads, %s area%s, %lu pages, %lu page ranges: "
+	       "%.0f ioctls/s, %.2f us/ioctl, %lu purged\n",
+	       nr_threads, shared ? "one shared" : "private",
+	       shared ? "" : "s", area_pages, range_pages,
+	       ops / secs, secs * 1e6 / ops * nr_threads, purged);
+
+	return 0;
+}
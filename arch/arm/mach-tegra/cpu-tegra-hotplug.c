@@ -0,0 +1,645 @@
+/*
+ * arch/arm/mach-tegra/cpu-tegra-hotplug.c
+ *
+ * CPU hotplug governor core for Tegra3 CPUs
+ *
+ * The core owns everything hotplug policies have in common: the G/LP
+ * cluster switch, the min/max online cpus PM QoS constraints and the
+ * hotplug statistics. Policies register as governors, exactly one of
+ * them is running at any time and it can be switched at runtime through
+ * /sys/kernel/tegra_hotplug/current_governor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/sched.h>
+#include <linux/cpufreq.h>
+#include <linux/err.h>
+#include <linux/cpu.h>
+#include <linux/clk.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/pm_qos_params.h>
+
+#include "pm.h"
+#include "cpu-tegra.h"
+#include "clock.h"
+
+#if defined(CONFIG_TEGRA_HOTPLUG_DEFAULT_GOV_MPDECISION)
+#define DEFAULT_GOVERNOR	"mpdecision"
+#elif defined(CONFIG_TEGRA_HOTPLUG_DEFAULT_GOV_AUTOHOTPLUG)
+#define DEFAULT_GOVERNOR	"autohotplug"
+#else
+#define DEFAULT_GOVERNOR	""
+#endif
+
+static struct mutex *tegra_cpu_lock;
+
+/* serializes governor (un)registration and switching */
+static DEFINE_MUTEX(hp_gov_lock);
+static LIST_HEAD(hp_governors);
+/* written under hp_gov_lock and tegra_cpu_lock, read under either */
+static struct tegra_hp_governor *hp_gov;
+
+static struct workqueue_struct *hp_qos_wq;
+static struct work_struct hp_qos_work;
+
+static struct clk *cpu_clk;
+static struct clk *cpu_g_clk;
+static struct clk *cpu_lp_clk;
+
+static DEFINE_SPINLOCK(hp_stats_lock);
+static u64 hp_stats_since;
+static struct {
+	cputime64_t time_up_total;
+	u64 last_update;
+	unsigned int up_down_count;
+} hp_stats[CONFIG_NR_CPUS + 1];	/* Append LP CPU entry at the end */
+
+static void hp_init_stats(void)
+{
+	int i;
+	unsigned long flags;
+	u64 cur_jiffies = get_jiffies_64();
+
+	spin_lock_irqsave(&hp_stats_lock, flags);
+	for (i = 0; i <= CONFIG_NR_CPUS; i++) {
+		hp_stats[i].time_up_total = 0;
+		hp_stats[i].last_update = cur_jiffies;
+
+		hp_stats[i].up_down_count = 0;
+		if (is_lp_cluster()) {
+			if (i == CONFIG_NR_CPUS)
+				hp_stats[i].up_down_count = 1;
+		} else {
+			if ((i < nr_cpu_ids) && cpu_online(i))
+				hp_stats[i].up_down_count = 1;
+		}
+	}
+	hp_stats_since = cur_jiffies;
+	spin_unlock_irqrestore(&hp_stats_lock, flags);
+}
+
+static void __hp_stats_update(unsigned int cpu, bool up)
+{
+	u64 cur_jiffies = get_jiffies_64();
+	bool was_up = hp_stats[cpu].up_down_count & 0x1;
+
+	if (was_up)
+		hp_stats[cpu].time_up_total = cputime64_add(
+			hp_stats[cpu].time_up_total, cputime64_sub(
+				cur_jiffies, hp_stats[cpu].last_update));
+
+	if (was_up != up) {
+		hp_stats[cpu].up_down_count++;
+		if ((hp_stats[cpu].up_down_count & 0x1) != up) {
+			/* FIXME: sysfs user space CPU control breaks stats */
+			pr_err("tegra hotplug stats out of sync with %s CPU%d",
+			       (cpu < CONFIG_NR_CPUS) ? "G" : "LP",
+			       (cpu < CONFIG_NR_CPUS) ?  cpu : 0);
+			hp_stats[cpu].up_down_count ^=  0x1;
+		}
+	}
+	hp_stats[cpu].last_update = cur_jiffies;
+}
+
+static void hp_stats_update(unsigned int cpu, bool up)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&hp_stats_lock, flags);
+	__hp_stats_update(cpu, up);
+	spin_unlock_irqrestore(&hp_stats_lock, flags);
+}
+
+unsigned int tegra_hp_min_cpus(void)
+{
+	return min_t(unsigned int, pm_qos_request(PM_QOS_MIN_ONLINE_CPUS),
+		     nr_cpu_ids);
+}
+
+unsigned int tegra_hp_max_cpus(void)
+{
+	s32 max_cpus = pm_qos_request(PM_QOS_MAX_ONLINE_CPUS);
+
+	if ((max_cpus <= 0) || (max_cpus > nr_cpu_ids))
+		return nr_cpu_ids;
+	return max_cpus;
+}
+
+/*
+ * Bring @cpu online unless that would violate the max cpus constraint.
+ * Must not be called with the tegra cpu lock held, cpu_up() ends up in
+ * the cpufreq driver.
+ */
+int tegra_hp_cpu_up(unsigned int cpu)
+{
+	int ret;
+
+	if (cpu_online(cpu))
+		return 0;
+
+	if (is_lp_cluster() || (num_online_cpus() >= tegra_hp_max_cpus()))
+		return -EBUSY;
+
+	ret = cpu_up(cpu);
+	if (!ret)
+		hp_stats_update(cpu, true);
+	return ret;
+}
+
+/*
+ * Take @cpu offline unless that would violate the min cpus constraint.
+ * Same locking rules as tegra_hp_cpu_up().
+ */
+int tegra_hp_cpu_down(unsigned int cpu)
+{
+	int ret;
+
+	if ((cpu == 0) || !cpu_online(cpu))
+		return 0;
+
+	if (num_online_cpus() <= max(tegra_hp_min_cpus(), 1U))
+		return -EBUSY;
+
+	ret = cpu_down(cpu);
+	if (!ret)
+		hp_stats_update(cpu, false);
+	return ret;
+}
+
+/*
+ * Switch cpu0 to the LP (@lp true) or the G cluster. Switching to LP is
+ * refused while secondary cpus are online or a min cpus constraint is set.
+ * The caller is responsible for catching up with the governor target speed.
+ */
+int tegra_hp_set_lp_cluster(bool lp)
+{
+	unsigned long flags;
+	int ret;
+
+	if (!is_g_cluster_present() || (!!is_lp_cluster() == lp))
+		return 0;
+
+	if (lp && ((num_online_cpus() > 1) || tegra_hp_min_cpus()))
+		return -EBUSY;
+
+	ret = clk_set_parent(cpu_clk, lp ? cpu_lp_clk : cpu_g_clk);
+	if (ret)
+		return ret;
+
+	spin_lock_irqsave(&hp_stats_lock, flags);
+	__hp_stats_update(CONFIG_NR_CPUS, lp);
+	__hp_stats_update(0, !lp);
+	spin_unlock_irqrestore(&hp_stats_lock, flags);
+	return 0;
+}
+
+static void tegra_hp_qos_work_func(struct work_struct *work)
+{
+	unsigned int min_cpus = tegra_hp_min_cpus();
+	unsigned int max_cpus = tegra_hp_max_cpus();
+	unsigned int cpu;
+
+	if ((min_cpus >= 1) && is_lp_cluster()) {
+		mutex_lock(tegra_cpu_lock);
+		/* make sure cpu rate is within g-mode range before switching */
+		tegra_update_cpu_speed(max_t(unsigned long, tegra_getspeed(0),
+					   clk_get_min_rate(cpu_g_clk) / 1000));
+		tegra_hp_set_lp_cluster(false);
+		/* update governor state machine */
+		tegra_cpu_set_speed_cap(NULL);
+		mutex_unlock(tegra_cpu_lock);
+	}
+
+	while (num_online_cpus() < min_cpus) {
+		cpu = cpumask_next_zero(0, cpu_online_mask);
+		if ((cpu >= nr_cpu_ids) || tegra_hp_cpu_up(cpu))
+			break;
+	}
+
+	while (num_online_cpus() > max_cpus) {
+		cpu = tegra_get_slowest_cpu_n();
+		if ((cpu >= nr_cpu_ids) || tegra_hp_cpu_down(cpu))
+			break;
+	}
+}
+
+void tegra_hp_check_constraints(void)
+{
+	if (hp_qos_wq)
+		queue_work(hp_qos_wq, &hp_qos_work);
+}
+
+static int hp_cpus_notify(struct notifier_block *nb, unsigned long n, void *p)
+{
+	tegra_hp_check_constraints();
+	return NOTIFY_OK;
+}
+
+static struct notifier_block min_cpus_notifier = {
+	.notifier_call = hp_cpus_notify,
+};
+
+static struct notifier_block max_cpus_notifier = {
+	.notifier_call = hp_cpus_notify,
+};
+
+/* called by the cpufreq driver with the tegra cpu lock held */
+void tegra_hp_speed_change(unsigned int cpu_freq, bool suspend)
+{
+	if (hp_gov && hp_gov->speed_change)
+		hp_gov->speed_change(cpu_freq, suspend);
+}
+
+/*
+ * Called by the cpufreq driver, with the tegra cpu lock held, when a rate
+ * above the LP cluster range is requested while running on LP. Returns
+ * non-zero if cpu0 is on the G cluster afterwards.
+ */
+int tegra_hp_gmode_request(void)
+{
+	if (!is_lp_cluster())
+		return 1;
+
+	if (hp_gov && hp_gov->gmode_request)
+		return hp_gov->gmode_request();
+
+	return !tegra_hp_set_lp_cluster(false);
+}
+
+static struct tegra_hp_governor *__find_governor(const char *name)
+{
+	struct tegra_hp_governor *gov;
+
+	list_for_each_entry(gov, &hp_governors, list)
+		if (!strnicmp(name, gov->name, TEGRA_HP_NAME_LEN))
+			return gov;
+	return NULL;
+}
+
+/* hp_gov_lock must be held */
+static int __tegra_hp_set_governor(struct tegra_hp_governor *new_gov)
+{
+	struct tegra_hp_governor *old_gov = hp_gov;
+	int ret = 0;
+
+	if (old_gov == new_gov)
+		return 0;
+
+	mutex_lock(tegra_cpu_lock);
+	hp_gov = NULL;
+	mutex_unlock(tegra_cpu_lock);
+
+	if (old_gov) {
+		old_gov->stop();
+		pr_info("Tegra hotplug governor %s stopped\n", old_gov->name);
+	}
+
+	if (!new_gov)
+		return 0;
+
+	hp_init_stats();
+	ret = new_gov->start(tegra_cpu_lock);
+	if (ret) {
+		pr_err("%s: failed to start hotplug governor %s: %d\n",
+		       __func__, new_gov->name, ret);
+		return ret;
+	}
+
+	mutex_lock(tegra_cpu_lock);
+	hp_gov = new_gov;
+	/* catch-up with cpufreq governor target speed */
+	tegra_cpu_set_speed_cap(NULL);
+	mutex_unlock(tegra_cpu_lock);
+
+	pr_info("Tegra hotplug governor %s started\n", new_gov->name);
+	return 0;
+}
+
+/* Switch to the governor called @name, "none" stops hotplugging */
+int tegra_hp_set_governor(const char *name)
+{
+	struct tegra_hp_governor *gov = NULL;
+	int ret = -EINVAL;
+
+	mutex_lock(&hp_gov_lock);
+	if (!tegra_cpu_lock) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	if (strnicmp(name, "none", TEGRA_HP_NAME_LEN)) {
+		gov = __find_governor(name);
+		if (!gov)
+			goto out;
+	}
+	ret = __tegra_hp_set_governor(gov);
+out:
+	mutex_unlock(&hp_gov_lock);
+	return ret;
+}
+
+/* Used on restart and power off to keep cpus where they are */
+void disable_auto_hotplug(void)
+{
+	mutex_lock(&hp_gov_lock);
+	if (tegra_cpu_lock)
+		__tegra_hp_set_governor(NULL);
+	mutex_unlock(&hp_gov_lock);
+}
+
+int tegra_hp_register_governor(struct tegra_hp_governor *gov)
+{
+	int ret = 0;
+
+	if (!gov || !gov->start || !gov->stop)
+		return -EINVAL;
+
+	mutex_lock(&hp_gov_lock);
+	if (__find_governor(gov->name)) {
+		ret = -EBUSY;
+		goto out;
+	}
+	list_add_tail(&gov->list, &hp_governors);
+
+	if (tegra_cpu_lock && !hp_gov &&
+	    !strnicmp(gov->name, DEFAULT_GOVERNOR, TEGRA_HP_NAME_LEN))
+		__tegra_hp_set_governor(gov);
+out:
+	mutex_unlock(&hp_gov_lock);
+	return ret;
+}
+
+void tegra_hp_unregister_governor(struct tegra_hp_governor *gov)
+{
+	mutex_lock(&hp_gov_lock);
+	if (hp_gov == gov)
+		__tegra_hp_set_governor(NULL);
+	list_del(&gov->list);
+	mutex_unlock(&hp_gov_lock);
+}
+
+/**************************** SYSFS ****************************/
+static struct kobject *hp_kobject;
+
+static ssize_t show_current_governor(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	ssize_t len;
+
+	mutex_lock(&hp_gov_lock);
+	len = sprintf(buf, "%s\n", hp_gov ? hp_gov->name : "none");
+	mutex_unlock(&hp_gov_lock);
+	return len;
+}
+
+static ssize_t store_current_governor(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	char name[TEGRA_HP_NAME_LEN];
+	int ret;
+
+	ret = sscanf(buf, "%15s", name);
+	if (ret != 1)
+		return -EINVAL;
+
+	ret = tegra_hp_set_governor(name);
+	return ret ? ret : count;
+}
+
+static ssize_t show_available_governors(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	struct tegra_hp_governor *gov;
+	ssize_t len = 0;
+
+	mutex_lock(&hp_gov_lock);
+	list_for_each_entry(gov, &hp_governors, list)
+		len += sprintf(buf + len, "%s ", gov->name);
+	mutex_unlock(&hp_gov_lock);
+	len += sprintf(buf + len, "none\n");
+	return len;
+}
+
+static struct kobj_attribute current_governor_attr =
+	__ATTR(current_governor, 0644, show_current_governor,
+	       store_current_governor);
+static struct kobj_attribute available_governors_attr =
+	__ATTR(available_governors, 0444, show_available_governors, NULL);
+
+static struct attribute *hp_attributes[] = {
+	&current_governor_attr.attr,
+	&available_governors_attr.attr,
+	NULL
+};
+
+static struct attribute_group hp_attr_group = {
+	.attrs = hp_attributes,
+};
+
+int tegra_hp_init(struct mutex *cpu_lock)
+{
+	/*
+	 * Not bound to the issuer CPU (=> high-priority), has rescue worker
+	 * task, single-threaded, freezable.
+	 */
+	hp_qos_wq = alloc_workqueue(
+		"cpu-tegra-hp", WQ_UNBOUND | WQ_RESCUER | WQ_FREEZABLE, 1);
+	if (!hp_qos_wq)
+		return -ENOMEM;
+	INIT_WORK(&hp_qos_work, tegra_hp_qos_work_func);
+
+	cpu_clk = clk_get_sys(NULL, "cpu");
+	cpu_g_clk = clk_get_sys(NULL, "cpu_g");
+	cpu_lp_clk = clk_get_sys(NULL, "cpu_lp");
+	if (IS_ERR(cpu_clk) || IS_ERR(cpu_g_clk) || IS_ERR(cpu_lp_clk))
+		return -ENOENT;
+
+	hp_init_stats();
+
+	if (pm_qos_add_notifier(PM_QOS_MIN_ONLINE_CPUS, &min_cpus_notifier))
+		pr_err("%s: Failed to register min cpus PM QoS notifier\n",
+			__func__);
+	if (pm_qos_add_notifier(PM_QOS_MAX_ONLINE_CPUS, &max_cpus_notifier))
+		pr_err("%s: Failed to register max cpus PM QoS notifier\n",
+			__func__);
+
+	hp_kobject = kobject_create_and_add("tegra_hotplug", kernel_kobj);
+	if (!hp_kobject || sysfs_create_group(hp_kobject, &hp_attr_group))
+		pr_warn("%s: Failed to create sysfs interface\n", __func__);
+
+	mutex_lock(&hp_gov_lock);
+	tegra_cpu_lock = cpu_lock;
+	mutex_unlock(&hp_gov_lock);
+
+	pr_info("Tegra hotplug core initialized, default governor: %s\n",
+		strlen(DEFAULT_GOVERNOR) ? DEFAULT_GOVERNOR : "none");
+	return 0;
+}
+
+#ifdef CONFIG_DEBUG_FS
+
+static struct dentry *hp_debugfs_root;
+
+static struct pm_qos_request_list min_cpu_req;
+static struct pm_qos_request_list max_cpu_req;
+
+static int hp_stats_show(struct seq_file *s, void *data)
+{
+	int i;
+	unsigned long flags;
+	u64 cur_jiffies = get_jiffies_64();
+
+	spin_lock_irqsave(&hp_stats_lock, flags);
+	for (i = 0; i <= CONFIG_NR_CPUS; i++) {
+		bool was_up = (hp_stats[i].up_down_count & 0x1);
+		__hp_stats_update(i, was_up);
+	}
+	spin_unlock_irqrestore(&hp_stats_lock, flags);
+
+	mutex_lock(&hp_gov_lock);
+	seq_printf(s, "%-15s %s\n", "governor:", hp_gov ? hp_gov->name : "none");
+	mutex_unlock(&hp_gov_lock);
+
+	seq_printf(s, "%-15s ", "cpu:");
+	for (i = 0; i < CONFIG_NR_CPUS; i++) {
+		seq_printf(s, "G%-9d ", i);
+	}
+	seq_printf(s, "LP\n");
+
+	seq_printf(s, "%-15s ", "transitions:");
+	for (i = 0; i <= CONFIG_NR_CPUS; i++) {
+		seq_printf(s, "%-10u ", hp_stats[i].up_down_count);
+	}
+	seq_printf(s, "\n");
+
+	seq_printf(s, "%-15s ", "time plugged:");
+	for (i = 0; i <= CONFIG_NR_CPUS; i++) {
+		seq_printf(s, "%-10llu ",
+			   cputime64_to_clock_t(hp_stats[i].time_up_total));
+	}
+	seq_printf(s, "\n");
+
+	seq_printf(s, "%-15s %llu\n", "time-stamp:",
+		   cputime64_to_clock_t(cur_jiffies));
+	seq_printf(s, "%-15s %llu\n", "since:",
+		   cputime64_to_clock_t(hp_stats_since));
+
+	return 0;
+}
+
+static int hp_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hp_stats_show, inode->i_private);
+}
+
+static const struct file_operations hp_stats_fops = {
+	.open		= hp_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int min_cpus_get(void *data, u64 *val)
+{
+	*val = pm_qos_request(PM_QOS_MIN_ONLINE_CPUS);
+	return 0;
+}
+static int min_cpus_set(void *data, u64 val)
+{
+	pm_qos_update_request(&min_cpu_req, (s32)val);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(min_cpus_fops, min_cpus_get, min_cpus_set, "%llu\n");
+
+static int max_cpus_get(void *data, u64 *val)
+{
+	*val = pm_qos_request(PM_QOS_MAX_ONLINE_CPUS);
+	return 0;
+}
+static int max_cpus_set(void *data, u64 val)
+{
+	pm_qos_update_request(&max_cpu_req, (s32)val);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(max_cpus_fops, max_cpus_get, max_cpus_set, "%llu\n");
+
+static int __init tegra_hp_debug_init(void)
+{
+	if (!tegra_cpu_lock)
+		return -ENOENT;
+
+	hp_debugfs_root = debugfs_create_dir("tegra_hotplug", NULL);
+	if (!hp_debugfs_root)
+		return -ENOMEM;
+
+	pm_qos_add_request(&min_cpu_req, PM_QOS_MIN_ONLINE_CPUS,
+			   PM_QOS_DEFAULT_VALUE);
+	pm_qos_add_request(&max_cpu_req, PM_QOS_MAX_ONLINE_CPUS,
+			   PM_QOS_DEFAULT_VALUE);
+
+	if (!debugfs_create_file(
+		"min_cpus", S_IRUGO, hp_debugfs_root, NULL, &min_cpus_fops))
+		goto err_out;
+
+	if (!debugfs_create_file(
+		"max_cpus", S_IRUGO, hp_debugfs_root, NULL, &max_cpus_fops))
+		goto err_out;
+
+	if (!debugfs_create_file(
+		"stats", S_IRUGO, hp_debugfs_root, NULL, &hp_stats_fops))
+		goto err_out;
+
+	return 0;
+
+err_out:
+	debugfs_remove_recursive(hp_debugfs_root);
+	hp_debugfs_root = NULL;
+	pm_qos_remove_request(&min_cpu_req);
+	pm_qos_remove_request(&max_cpu_req);
+	return -ENOMEM;
+}
+
+late_initcall(tegra_hp_debug_init);
+#endif
+
+void tegra_hp_exit(void)
+{
+	disable_auto_hotplug();
+	pm_qos_remove_notifier(PM_QOS_MIN_ONLINE_CPUS, &min_cpus_notifier);
+	pm_qos_remove_notifier(PM_QOS_MAX_ONLINE_CPUS, &max_cpus_notifier);
+	destroy_workqueue(hp_qos_wq);
+	if (hp_kobject)
+		kobject_put(hp_kobject);
+#ifdef CONFIG_DEBUG_FS
+	debugfs_remove_recursive(hp_debugfs_root);
+	/* Not added if tegra_hp_debug_init() bailed out or failed */
+	if (pm_qos_request_active(&min_cpu_req))
+		pm_qos_remove_request(&min_cpu_req);
+	if (pm_qos_request_active(&max_cpu_req))
+		pm_qos_remove_request(&max_cpu_req);
+#endif
+}
@@ -54,17 +54,15 @@
 DEFINE_PER_CPU(unsigned long int, tegra_cpu_min_freq);
 DEFINE_PER_CPU(unsigned long int, tegra_cpu_max_freq);
 
-#ifdef CONFIG_TEGRA_MPDECISION
-/* mpdecision notifier */
-extern int mpdecision_gmode_notifier(void);
-#endif
-
 /* tegra throttling and edp governors require frequencies in the table
    to be in ascending order */
 static struct cpufreq_frequency_table *freq_table;
 
 static struct clk *cpu_clk;
 static struct clk *emc_clk;
+#ifndef CONFIG_TEGRA_HOTPLUG
+static struct clk *cpu_g_clk;
+#endif
 
 static unsigned long policy_max_speed[CONFIG_NR_CPUS];
 static unsigned long target_cpu_speed[CONFIG_NR_CPUS];
@@ -603,7 +601,9 @@ int tegra_update_cpu_speed(unsigned long rate)
 	int ret = 0;
 	struct cpufreq_freqs freqs;
         unsigned long rate_save = rate;
+#ifdef CONFIG_TEGRA_HOTPLUG
         int status = 1;
+#endif
 
 	freqs.old = tegra_getspeed(0);
 	freqs.new = rate;
@@ -620,18 +620,21 @@ int tegra_update_cpu_speed(unsigned long rate)
 
 			/* set rate to max of LP mode */
 			ret = clk_set_rate(cpu_clk, 475000 * 1000);
-#ifndef CONFIG_TEGRA_MPDECISION
-			/* change to g mode */
-			clk_set_parent(cpu_clk, cpu_g_clk);
+#ifdef CONFIG_TEGRA_HOTPLUG
+			/*
+			 * let the hotplug core and its governor switch to
+			 * G mode so their state stays in sync
+			 */
+			status = tegra_hp_gmode_request();
+			if (status == 0)
+				pr_err("%s: couldn't switch to gmode (freq)", __func__ );
 #else
-                        /*
-                         * the above variant is now no longer preferred since
-                         * mpdecision would not know about this. Notify mpdecision
-                         * instead to switch to G mode
-                         */
-                        status = mpdecision_gmode_notifier();
-                        if (status == 0)
-                                pr_err("%s: couldn't switch to gmode (freq)", __func__ );
+			/* change to g mode */
+			ret = clk_set_parent(cpu_clk, cpu_g_clk);
+			if (ret) {
+				pr_err("cpu-tegra: Failed to switch to G mode\n");
+				return ret;
+			}
 #endif
 			/* restore the target frequency, and
 			 * let the rest of the function handle
@@ -748,7 +751,7 @@ int tegra_cpu_set_speed_cap(unsigned int *speed_cap)
 
 	ret = tegra_update_cpu_speed(new_speed);
 	if (ret == 0)
-		tegra_auto_hotplug_governor(new_speed, false);
+		tegra_hp_speed_change(new_speed, false);
 	return ret;
 }
 
@@ -810,7 +813,7 @@ static int tegra_pm_notify(struct notifier_block *nb, unsigned long event,
 		pr_info("Tegra cpufreq suspend: setting frequency to %d kHz\n",
 			freq_table[suspend_index].frequency);
 		tegra_update_cpu_speed(freq_table[suspend_index].frequency);
-		tegra_auto_hotplug_governor(
+		tegra_hp_speed_change(
 			freq_table[suspend_index].frequency, true);
 	} else if (event == PM_POST_SUSPEND) {
 		unsigned int freq;
@@ -844,6 +847,15 @@ static int tegra_cpu_init(struct cpufreq_policy *policy)
 		return PTR_ERR(emc_clk);
 	}
 
+#ifndef CONFIG_TEGRA_HOTPLUG
+	cpu_g_clk = clk_get_sys(NULL, "cpu_g");
+	if (IS_ERR(cpu_g_clk)) {
+		clk_put(emc_clk);
+		clk_put(cpu_clk);
+		return PTR_ERR(cpu_g_clk);
+	}
+#endif
+
 	clk_enable(emc_clk);
 	clk_enable(cpu_clk);
 
@@ -875,6 +887,9 @@ static int tegra_cpu_exit(struct cpufreq_policy *policy)
 	clk_disable(emc_clk);
 	clk_put(emc_clk);
 	clk_put(cpu_clk);
+#ifndef CONFIG_TEGRA_HOTPLUG
+	clk_put(cpu_g_clk);
+#endif
 	return 0;
 }
 
@@ -956,7 +971,7 @@ static int __init tegra_cpufreq_init(void)
 	if (ret)
 		return ret;
 
-	ret = tegra_auto_hotplug_init(&tegra_cpu_lock);
+	ret = tegra_hp_init(&tegra_cpu_lock);
 	if (ret)
 		return ret;
 
@@ -985,7 +1000,7 @@ static void __exit tegra_cpufreq_exit(void)
 {
 	tegra_throttle_exit();
 	tegra_cpu_edp_exit();
-	tegra_auto_hotplug_exit();
+	tegra_hp_exit();
 #ifdef CONFIG_HAS_EARLYSUSPEND
         pm_qos_remove_request(&boost_cpu_freq_req);
         pm_qos_remove_request(&cap_cpu_freq_req);
@@ -22,6 +22,7 @@
 #define __MACH_TEGRA_CPU_TEGRA_H
 
 #include <linux/dcache.h>
+#include <linux/list.h>
 
 unsigned int tegra_getspeed(unsigned int cpu);
 int tegra_update_cpu_speed(unsigned long rate);
@@ -55,17 +56,42 @@ static inline void tegra_throttling_enable(bool enable)
 {}
 #endif /* CONFIG_TEGRA_THERMAL_THROTTLE */
 
-#if defined(CONFIG_TEGRA_AUTO_HOTPLUG) && !defined(CONFIG_ARCH_TEGRA_2x_SOC)
-int tegra_auto_hotplug_init(struct mutex *cpu_lock);
-void tegra_auto_hotplug_exit(void);
-void tegra_auto_hotplug_governor(unsigned int cpu_freq, bool suspend);
+#ifdef CONFIG_TEGRA_HOTPLUG
+#define TEGRA_HP_NAME_LEN 16
+
+/*
+ * A cpu hotplug policy. start() gets the tegra cpu lock, which is held
+ * around speed_change() and gmode_request(). stop() must not return
+ * before all of the governor's deferred work is cancelled.
+ */
+struct tegra_hp_governor {
+	const char *name;
+	int (*start)(struct mutex *cpu_lock);
+	void (*stop)(void);
+	void (*speed_change)(unsigned int cpu_freq, bool suspend);
+	int (*gmode_request)(void);
+	struct list_head list;
+};
+
+int tegra_hp_init(struct mutex *cpu_lock);
+void tegra_hp_exit(void);
+int tegra_hp_register_governor(struct tegra_hp_governor *gov);
+void tegra_hp_unregister_governor(struct tegra_hp_governor *gov);
+int tegra_hp_set_governor(const char *name);
+void tegra_hp_speed_change(unsigned int cpu_freq, bool suspend);
+int tegra_hp_gmode_request(void);
+int tegra_hp_cpu_up(unsigned int cpu);
+int tegra_hp_cpu_down(unsigned int cpu);
+int tegra_hp_set_lp_cluster(bool lp);
+unsigned int tegra_hp_min_cpus(void);
+unsigned int tegra_hp_max_cpus(void);
+void tegra_hp_check_constraints(void);
 #else
-static inline int tegra_auto_hotplug_init(struct mutex *cpu_lock)
+static inline int tegra_hp_init(struct mutex *cpu_lock)
 { return 0; }
-static inline void tegra_auto_hotplug_exit(void)
+static inline void tegra_hp_exit(void)
 { }
-static inline void tegra_auto_hotplug_governor(unsigned int cpu_freq,
-					       bool suspend)
+static inline void tegra_hp_speed_change(unsigned int cpu_freq, bool suspend)
 { }
 #endif
 
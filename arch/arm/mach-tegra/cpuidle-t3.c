@@ -76,11 +76,27 @@ module_param(lp2_0_in_idle, bool, 0644);
 static bool lp2_n_in_idle = true;
 module_param(lp2_n_in_idle, bool, 0644);
 
+static bool lp2_predict = true;
+module_param(lp2_predict, bool, 0644);
+
 static struct clk *cpu_clk_for_dvfs;
 static struct clk *twd_clk;
 
 static int lp2_exit_latencies[5];
 
+/*
+ * Recent idle durations and the interrupts that ended them, per CPU. A CPU
+ * that keeps being woken up before LP2 pays off is sent to LP3 instead.
+ */
+#define LP2_HISTORY		8
+#define LP2_HISTORY_SHORT	6	/* short idles to predict a short one */
+
+static struct lp2_history {
+	unsigned int idle_us[LP2_HISTORY];
+	int irq[LP2_HISTORY];
+	unsigned int next;
+} lp2_history[5];
+
 static struct {
 	unsigned int cpu_ready_count[5];
 	unsigned int tear_down_count[5];
@@ -90,6 +106,12 @@ static struct {
 	unsigned int lp2_completed_count;
 	unsigned int lp2_count_bin[32];
 	unsigned int lp2_completed_count_bin[32];
+	unsigned int lp2_predict_short_count[5];
+	unsigned int lp2_predict_ok_count[5];
+	unsigned int lp2_predict_failed_count[5];
+	unsigned int lp2_predict_short_count_bin[32];
+	unsigned int lp2_predict_ok_count_bin[32];
+	unsigned int lp2_predict_failed_count_bin[32];
 	unsigned int lp2_int_count[NR_IRQS];
 	unsigned int last_lp2_int_count[NR_IRQS];
 } idle_stats;
@@ -178,6 +200,65 @@ bool tegra3_lp2_is_allowed(struct cpuidle_device *dev,
 	return true;
 }
 
+/*
+ * Predict that the coming idle period is too short for LP2: either most of
+ * the recent ones were, or the interrupt that ended the last one has ended
+ * at least half of the recent ones, every time too early.
+ */
+static bool tegra3_lp2_predict_short(struct lp2_history *h,
+				     unsigned int target_residency)
+{
+	int last_irq = h->irq[(h->next + LP2_HISTORY - 1) % LP2_HISTORY];
+	int short_count = 0;
+	int irq_count = 0;
+	int irq_short_count = 0;
+	int i;
+
+	for (i = 0; i < LP2_HISTORY; i++) {
+		bool is_short = h->idle_us[i] < target_residency;
+
+		short_count += is_short;
+		if (h->irq[i] == last_irq) {
+			irq_count++;
+			irq_short_count += is_short;
+		}
+	}
+
+	if (short_count >= LP2_HISTORY_SHORT)
+		return true;
+
+	return (irq_count >= LP2_HISTORY / 2) &&
+		(irq_short_count == irq_count);
+}
+
+static void tegra3_lp2_predict_update(struct cpuidle_device *dev,
+	struct cpuidle_state *state, s64 request, bool predict_short, s64 us)
+{
+	unsigned int cpu = cpu_number(dev->cpu);
+	struct lp2_history *h = &lp2_history[cpu];
+	bool was_short = us < state->target_residency;
+	int bin = time_to_bin((u32)request / 1000);
+
+	if (lp2_predict) {
+		if (predict_short) {
+			idle_stats.lp2_predict_short_count[cpu]++;
+			idle_stats.lp2_predict_short_count_bin[bin]++;
+		}
+		if (predict_short == was_short) {
+			idle_stats.lp2_predict_ok_count[cpu]++;
+			idle_stats.lp2_predict_ok_count_bin[bin]++;
+		} else {
+			idle_stats.lp2_predict_failed_count[cpu]++;
+			idle_stats.lp2_predict_failed_count_bin[bin]++;
+		}
+	}
+
+	/* interrupts are still disabled, the one that woke us is pending */
+	h->idle_us[h->next] = min_t(s64, us, UINT_MAX);
+	h->irq[h->next] = tegra_gic_pending_interrupt();
+	h->next = (h->next + 1) % LP2_HISTORY;
+}
+
 static inline void tegra3_lp3_fall_back(struct cpuidle_device *dev)
 {
 	tegra_cpu_wfi();
@@ -413,8 +494,17 @@ void tegra3_idle_lp2(struct cpuidle_device *dev,
 			   struct cpuidle_state *state)
 {
 	s64 request = ktime_to_us(tick_nohz_get_sleep_length());
-	bool last_cpu = tegra_set_cpu_in_lp2(dev->cpu);
+	ktime_t entry_time = ktime_get();
+	bool predict_short = lp2_predict && tegra3_lp2_predict_short(
+		&lp2_history[cpu_number(dev->cpu)], state->target_residency);
+	bool last_cpu;
 
+	if (predict_short) {
+		tegra3_lp3_fall_back(dev);
+		goto out;
+	}
+
+	last_cpu = tegra_set_cpu_in_lp2(dev->cpu);
 	cpu_pm_enter();
 
 	if (dev->cpu == 0) {
@@ -427,6 +517,9 @@ void tegra3_idle_lp2(struct cpuidle_device *dev,
 
 	cpu_pm_exit();
 	tegra_clear_cpu_in_lp2(dev->cpu);
+out:
+	tegra3_lp2_predict_update(dev, state, request, predict_short,
+		ktime_us_delta(ktime_get(), entry_time));
 }
 
 int tegra3_cpudile_init_soc(void)
@@ -439,6 +532,16 @@ int tegra3_cpudile_init_soc(void)
 	for (i = 0; i < ARRAY_SIZE(lp2_exit_latencies); i++)
 		lp2_exit_latencies[i] = tegra_lp2_exit_latency;
 
+	/* start out predicting long idles */
+	for (i = 0; i < ARRAY_SIZE(lp2_history); i++) {
+		int j;
+
+		for (j = 0; j < LP2_HISTORY; j++) {
+			lp2_history[i].idle_us[j] = UINT_MAX;
+			lp2_history[i].irq[j] = -1;
+		}
+	}
+
 	return 0;
 }
 
@@ -461,6 +564,24 @@ int tegra3_lp2_debug_show(struct seq_file *s, void *data)
 		idle_stats.tear_down_count[2],
 		idle_stats.tear_down_count[3],
 		idle_stats.tear_down_count[4]);
+	seq_printf(s, "predicted short:                %8u %8u %8u %8u %8u\n",
+		idle_stats.lp2_predict_short_count[0],
+		idle_stats.lp2_predict_short_count[1],
+		idle_stats.lp2_predict_short_count[2],
+		idle_stats.lp2_predict_short_count[3],
+		idle_stats.lp2_predict_short_count[4]);
+	seq_printf(s, "prediction ok:                  %8u %8u %8u %8u %8u\n",
+		idle_stats.lp2_predict_ok_count[0],
+		idle_stats.lp2_predict_ok_count[1],
+		idle_stats.lp2_predict_ok_count[2],
+		idle_stats.lp2_predict_ok_count[3],
+		idle_stats.lp2_predict_ok_count[4]);
+	seq_printf(s, "prediction failed:              %8u %8u %8u %8u %8u\n",
+		idle_stats.lp2_predict_failed_count[0],
+		idle_stats.lp2_predict_failed_count[1],
+		idle_stats.lp2_predict_failed_count[2],
+		idle_stats.lp2_predict_failed_count[3],
+		idle_stats.lp2_predict_failed_count[4]);
 	seq_printf(s, "lp2:            %8u\n", idle_stats.lp2_count);
 	seq_printf(s, "lp2 completed:  %8u %7u%%\n",
 		idle_stats.lp2_completed_count,
@@ -500,17 +621,22 @@ int tegra3_lp2_debug_show(struct seq_file *s, void *data)
 			idle_stats.cpu_wants_lp2_time[4]) : 0));
 	seq_printf(s, "\n");
 
-	seq_printf(s, "%19s %8s %8s %8s\n", "", "lp2", "comp", "%");
-	seq_printf(s, "-------------------------------------------------\n");
+	seq_printf(s, "%19s %8s %8s %8s %8s %8s %8s\n", "", "lp2", "comp", "%",
+		"short", "ok", "failed");
+	seq_printf(s, "--------------------------------------------------------------------------\n");
 	for (bin = 0; bin < 32; bin++) {
-		if (idle_stats.lp2_count_bin[bin] == 0)
+		if (idle_stats.lp2_count_bin[bin] == 0 &&
+		    idle_stats.lp2_predict_short_count_bin[bin] == 0)
 			continue;
-		seq_printf(s, "%6u - %6u ms: %8u %8u %7u%%\n",
+		seq_printf(s, "%6u - %6u ms: %8u %8u %7u%% %8u %8u %8u\n",
 			1 << (bin - 1), 1 << bin,
 			idle_stats.lp2_count_bin[bin],
 			idle_stats.lp2_completed_count_bin[bin],
 			idle_stats.lp2_completed_count_bin[bin] * 100 /
-				idle_stats.lp2_count_bin[bin]);
+				(idle_stats.lp2_count_bin[bin] ?: 1),
+			idle_stats.lp2_predict_short_count_bin[bin],
+			idle_stats.lp2_predict_ok_count_bin[bin],
+			idle_stats.lp2_predict_failed_count_bin[bin]);
 	}
 
 	seq_printf(s, "\n");
@@ -0,0 +1,55 @@
+/*
+ * arch/arm/mach-tegra/include/mach/emc_bw.h
+ *
+ * Copyright (C) 2011 NVIDIA Corporation
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _MACH_TEGRA_EMC_BW_H_
+#define _MACH_TEGRA_EMC_BW_H_
+
+#include <linux/list.h>
+
+/*
+ * Isochronous clients (display) must get their bandwidth every frame and
+ * are budgeted against the worst case bus efficiency. Non-isochronous
+ * clients (video, 3D, camera) only need their average rate, and that is
+ * weighed against the traffic the EMC activity monitor actually sees.
+ */
+enum tegra_emc_bw_class {
+	TEGRA_EMC_BW_NON_ISO = 0,
+	TEGRA_EMC_BW_ISO,
+};
+
+struct tegra_emc_bw_client {
+	const char			*name;
+	enum tegra_emc_bw_class		class;
+	unsigned int			mbps;
+	struct list_head		node;
+};
+
+#ifdef CONFIG_ARCH_TEGRA_3x_SOC
+void tegra_emc_bw_register(struct tegra_emc_bw_client *client);
+void tegra_emc_bw_unregister(struct tegra_emc_bw_client *client);
+int tegra_emc_bw_request(struct tegra_emc_bw_client *client,
+			 unsigned int mbps);
+#else
+static inline void tegra_emc_bw_register(struct tegra_emc_bw_client *client)
+{ }
+static inline void tegra_emc_bw_unregister(struct tegra_emc_bw_client *client)
+{ }
+static inline int tegra_emc_bw_request(struct tegra_emc_bw_client *client,
+				       unsigned int mbps)
+{ return 0; }
+#endif
+
+#endif
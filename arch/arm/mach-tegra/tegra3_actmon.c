@@ -31,6 +31,7 @@
 #include <mach/clk.h>
 
 #include "clock.h"
+#include "tegra3_emc.h"
 
 #define ACTMON_GLB_STATUS			0x00
 #define ACTMON_GLB_PERIOD_CTRL			0x04
@@ -214,6 +215,8 @@ static unsigned long actmon_dev_avg_freq_get(struct actmon_dev *dev)
 	return (u32)val;
 }
 
+static struct actmon_dev actmon_dev_emc;
+
 /* Activity monitor sampling operations */
 irqreturn_t actmon_dev_isr(int irq, void *dev_id)
 {
@@ -289,6 +292,10 @@ irqreturn_t actmon_dev_fn(int irq, void *dev_id)
 			dev->target_freq, dev->cur_freq);
 	clk_set_rate(dev->clk, freq * 1000);
 
+	/* bandwidth requests are weighed against the measured average */
+	if (dev == &actmon_dev_emc)
+		tegra_emc_bw_actmon_update(dev->avg_actv_freq);
+
 	return IRQ_HANDLED;
 }
 
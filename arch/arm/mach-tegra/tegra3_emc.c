@@ -28,11 +28,13 @@
 #include <linux/suspend.h>
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
+#include <linux/mutex.h>
 
 #include <asm/cputime.h>
 #include <asm/cacheflush.h>
 
 #include <mach/iomap.h>
+#include <mach/emc_bw.h>
 
 #include "clock.h"
 #include "dvfs.h"
@@ -1191,6 +1193,144 @@ int tegra_emc_set_eack_state(unsigned long state)
 	return 0;
 }
 
+/*
+ * Bandwidth requests. Clients declare a floor in MB/s before they start
+ * moving data; the floors are converted into an EMC rate and applied through
+ * the "bw.emc" shared bus user, where they combine with every other EMC user,
+ * the activity monitor's "mon.emc" included. The floor is recomputed on each
+ * request and on each activity monitor sample.
+ */
+#define EMC_BW_ISO_EFFICIENCY		50	/* % of peak */
+#define EMC_BW_NON_ISO_EFFICIENCY	80	/* % of peak */
+
+static DEFINE_MUTEX(emc_bw_lock);
+static LIST_HEAD(emc_bw_clients);
+static struct clk *emc_bw_clk;
+static unsigned int emc_bw_iso_efficiency = EMC_BW_ISO_EFFICIENCY;
+static unsigned int emc_bw_non_iso_efficiency = EMC_BW_NON_ISO_EFFICIENCY;
+static unsigned long emc_bw_actmon_avg;		/* kHz */
+static unsigned long emc_bw_rate;		/* kHz */
+
+/* EMC rate in kHz that moves mbps MB/s at efficiency percent of peak */
+static unsigned long emc_bw_to_khz(unsigned long mbps, unsigned int efficiency)
+{
+	/* DDR: 8 bytes transfer per clock, so 1 MB/s needs 125 kHz */
+	u64 khz = (u64)mbps * 125 * CONFIG_TEGRA_EMC_TO_DDR_CLOCK * 100;
+
+	do_div(khz, efficiency);
+	return min_t(u64, khz, ULONG_MAX / 1000);
+}
+
+static void emc_bw_totals(unsigned long *iso, unsigned long *non_iso)
+{
+	struct tegra_emc_bw_client *c;
+
+	*iso = 0;
+	*non_iso = 0;
+	list_for_each_entry(c, &emc_bw_clients, node) {
+		if (c->class == TEGRA_EMC_BW_ISO)
+			*iso += c->mbps;
+		else
+			*non_iso += c->mbps;
+	}
+}
+
+/*
+ * Isochronous requests are budgeted at the worst case efficiency and are
+ * reserved on top of everything else. The activity monitor average counts
+ * the isochronous traffic at its actual cost; the rest of it is what the
+ * non-isochronous clients really use, which may be more than they declared.
+ */
+static unsigned long emc_bw_floor(void)
+{
+	unsigned long iso, non_iso, seen, iso_seen;
+
+	emc_bw_totals(&iso, &non_iso);
+	if (!iso && !non_iso)
+		return 0;
+
+	iso_seen = emc_bw_to_khz(iso, 100);
+	seen = emc_bw_actmon_avg > iso_seen ? emc_bw_actmon_avg - iso_seen : 0;
+
+	return emc_bw_to_khz(iso, emc_bw_iso_efficiency) +
+		max(emc_bw_to_khz(non_iso, emc_bw_non_iso_efficiency), seen);
+}
+
+/* Must be called with emc_bw_lock held */
+static void emc_bw_update(void)
+{
+	unsigned long rate = emc_bw_floor();
+
+	if (!emc_bw_clk || rate == emc_bw_rate)
+		return;
+
+	if (rate) {
+		clk_set_rate(emc_bw_clk, rate * 1000);
+		if (!emc_bw_rate)
+			clk_enable(emc_bw_clk);
+	} else {
+		clk_disable(emc_bw_clk);
+	}
+	emc_bw_rate = rate;
+}
+
+void tegra_emc_bw_register(struct tegra_emc_bw_client *client)
+{
+	mutex_lock(&emc_bw_lock);
+	client->mbps = 0;
+	list_add_tail(&client->node, &emc_bw_clients);
+	mutex_unlock(&emc_bw_lock);
+}
+EXPORT_SYMBOL(tegra_emc_bw_register);
+
+void tegra_emc_bw_unregister(struct tegra_emc_bw_client *client)
+{
+	mutex_lock(&emc_bw_lock);
+	list_del(&client->node);
+	emc_bw_update();
+	mutex_unlock(&emc_bw_lock);
+}
+EXPORT_SYMBOL(tegra_emc_bw_unregister);
+
+int tegra_emc_bw_request(struct tegra_emc_bw_client *client,
+			 unsigned int mbps)
+{
+	mutex_lock(&emc_bw_lock);
+	if (client->mbps != mbps) {
+		client->mbps = mbps;
+		emc_bw_update();
+	}
+	mutex_unlock(&emc_bw_lock);
+	return 0;
+}
+EXPORT_SYMBOL(tegra_emc_bw_request);
+
+void tegra_emc_bw_actmon_update(unsigned long avg_khz)
+{
+	mutex_lock(&emc_bw_lock);
+	emc_bw_actmon_avg = avg_khz;
+	if (!list_empty(&emc_bw_clients))
+		emc_bw_update();
+	mutex_unlock(&emc_bw_lock);
+}
+
+static int __init tegra_emc_bw_init(void)
+{
+	struct clk *c = clk_get_sys("tegra_emc_bw", "emc");
+
+	if (IS_ERR(c)) {
+		pr_err("%s: Failed to find bw.emc clock\n", __func__);
+		return 0;
+	}
+
+	mutex_lock(&emc_bw_lock);
+	emc_bw_clk = c;
+	emc_bw_update();
+	mutex_unlock(&emc_bw_lock);
+	return 0;
+}
+late_initcall(tegra_emc_bw_init);
+
 #ifdef CONFIG_DEBUG_FS
 
 static struct dentry *emc_debugfs_root;
@@ -1273,6 +1413,64 @@ static int eack_state_set(void *data, u64 val)
 DEFINE_SIMPLE_ATTRIBUTE(eack_state_fops, eack_state_get,
 			eack_state_set, "%llu\n");
 
+static int emc_bw_show(struct seq_file *s, void *data)
+{
+	struct tegra_emc_bw_client *c;
+	unsigned long iso, non_iso;
+
+	mutex_lock(&emc_bw_lock);
+
+	seq_printf(s, "%-16s %-8s %-10s\n", "client", "class", "MB/s");
+	list_for_each_entry(c, &emc_bw_clients, node)
+		seq_printf(s, "%-16s %-8s %-10u\n", c->name,
+			   c->class == TEGRA_EMC_BW_ISO ? "iso" : "non-iso",
+			   c->mbps);
+
+	emc_bw_totals(&iso, &non_iso);
+	seq_printf(s, "%-20s %lu MB/s -> %lu kHz\n", "iso total:", iso,
+		   emc_bw_to_khz(iso, emc_bw_iso_efficiency));
+	seq_printf(s, "%-20s %lu MB/s -> %lu kHz\n", "non-iso total:", non_iso,
+		   emc_bw_to_khz(non_iso, emc_bw_non_iso_efficiency));
+	seq_printf(s, "%-20s %lu kHz\n", "actmon average:", emc_bw_actmon_avg);
+	seq_printf(s, "%-20s %lu kHz\n", "bandwidth floor:", emc_bw_rate);
+
+	mutex_unlock(&emc_bw_lock);
+
+	seq_printf(s, "%-20s %lu kHz\n", "emc rate:", clk_get_rate(emc) / 1000);
+	return 0;
+}
+
+static int emc_bw_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, emc_bw_show, inode->i_private);
+}
+
+static const struct file_operations emc_bw_fops = {
+	.open		= emc_bw_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int bw_efficiency_get(void *data, u64 *val)
+{
+	*val = *(unsigned int *)data;
+	return 0;
+}
+static int bw_efficiency_set(void *data, u64 val)
+{
+	if (!val || val > 100)
+		return -EINVAL;
+
+	mutex_lock(&emc_bw_lock);
+	*(unsigned int *)data = val;
+	emc_bw_update();
+	mutex_unlock(&emc_bw_lock);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(bw_efficiency_fops, bw_efficiency_get,
+			bw_efficiency_set, "%llu\n");
+
 static int __init tegra_emc_debug_init(void)
 {
 	if (!tegra_emc_table)
@@ -1298,6 +1496,20 @@ static int __init tegra_emc_debug_init(void)
 		"eack_state", S_IRUGO | S_IWUSR, emc_debugfs_root, NULL, &eack_state_fops))
 		goto err_out;
 
+	if (!debugfs_create_file(
+		"bw_requests", S_IRUGO, emc_debugfs_root, NULL, &emc_bw_fops))
+		goto err_out;
+
+	if (!debugfs_create_file("bw_iso_efficiency", S_IRUGO | S_IWUSR,
+				 emc_debugfs_root, &emc_bw_iso_efficiency,
+				 &bw_efficiency_fops))
+		goto err_out;
+
+	if (!debugfs_create_file("bw_non_iso_efficiency", S_IRUGO | S_IWUSR,
+				 emc_debugfs_root, &emc_bw_non_iso_efficiency,
+				 &bw_efficiency_fops))
+		goto err_out;
+
 	return 0;
 
 err_out:
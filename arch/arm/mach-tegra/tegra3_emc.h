@@ -59,6 +59,7 @@ void tegra_emc_dram_type_init(struct clk *c);
 int tegra_emc_get_dram_type(void);
 int tegra_emc_get_dram_temperature(void);
 int tegra_emc_set_over_temp_state(unsigned long state);
+void tegra_emc_bw_actmon_update(unsigned long avg_khz);
 
 #ifdef CONFIG_PM_SLEEP
 void tegra_mc_timing_restore(void);
@@ -3,9 +3,11 @@
  *
  * This program features:
  * -cpu auto-hotplug/unplug based on system load (runqueue) for tegra quadcore
+ *   -optionally based on per-cpu decayed runnable/utilization averages
  *   -automatic decision wether to switch to low power core or not
  * -low power single core while screen is off
  * -extensive sysfs tuneables
+ * -runs as a governor of the tegra hotplug core (cpu-tegra-hotplug.c)
  *
  * Copyright (c) 2012-2013, Dennis Rassmann <showp1984@gmail.com>
  *
@@ -37,6 +39,10 @@
 #include <asm-generic/cputime.h>
 #include <linux/hrtimer.h>
 #include <linux/delay.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/math64.h>
+#include <linux/pm_qos_params.h>
 #include <linux/tegra_minmax_cpufreq.h>
 #ifdef CONFIG_TEGRA_MPDECISION_INPUTBOOST_CPUMIN
 #include <linux/input.h>
@@ -72,6 +78,28 @@
 #define TEGRA_MPDEC_LPCPU_UP_HYS            4
 #define TEGRA_MPDEC_LPCPU_DOWN_HYS          2
 
+/*
+ * Decision modes:
+ * RQ uses the global run-queue average against NwNs/TwTs thresholds,
+ * LOAD uses the per-cpu runnable/utilization averages from the scheduler.
+ */
+#define TEGRA_MPDEC_MODE_RQ                 0
+#define TEGRA_MPDEC_MODE_LOAD               1
+
+/*
+ * LOAD mode defaults, in percent of one runnable task per core.
+ * A core is added once the online cores carry more than LOAD_UP each,
+ * one is removed once the remaining cores would carry less than
+ * LOAD_DOWN each. The holds (ms) are how long a condition must persist.
+ */
+#define TEGRA_MPDEC_LOAD_UP                 125
+#define TEGRA_MPDEC_LOAD_DOWN               80
+#define TEGRA_MPDEC_LOAD_UP_HOLD            0
+#define TEGRA_MPDEC_LOAD_DOWN_HOLD          390
+
+/* number of decisions kept for the stats/decision_trace file */
+#define TEGRA_MPDEC_TRACE_SIZE              32
+
 #ifdef CONFIG_TEGRA_MPDECISION_INPUTBOOST_CPUMIN
 #define TEGRA_MPDEC_BOOSTTIME               1000
 #define TEGRA_MPDEC_BOOSTFREQ_CPU0          910000
@@ -89,6 +117,14 @@ enum {
     TEGRA_MPDEC_LPCPU_DOWN,
 };
 
+/* hotplug latencies in us */
+struct tegra_mpdec_lat_t {
+    long long unsigned int last;
+    long long unsigned int max;
+    long long unsigned int total;
+    long long unsigned int count;
+};
+
 struct tegra_mpdec_cpudata_t {
     struct mutex hotplug_mutex;
     int online;
@@ -97,6 +133,8 @@ struct tegra_mpdec_cpudata_t {
     cputime64_t on_time_total;
     long long unsigned int times_cpu_hotplugged;
     long long unsigned int times_cpu_unplugged;
+    struct tegra_mpdec_lat_t up_lat;
+    struct tegra_mpdec_lat_t down_lat;
 #ifdef CONFIG_TEGRA_MPDECISION_INPUTBOOST_CPUMIN
     struct mutex boost_mutex;
     struct mutex unboost_mutex;
@@ -136,6 +174,11 @@ static struct tegra_mpdec_tuners {
     unsigned int lp_cpu_down_hysteresis;
     unsigned int max_cpus;
     unsigned int min_cpus;
+    unsigned int decision_mode;
+    unsigned int load_up;
+    unsigned int load_down;
+    unsigned int load_up_hold;
+    unsigned int load_down_hold;
 #ifdef CONFIG_TEGRA_MPDECISION_INPUTBOOST_CPUMIN
     bool boost_enabled;
     unsigned int boost_time;
@@ -151,6 +194,11 @@ static struct tegra_mpdec_tuners {
     .lp_cpu_down_hysteresis = TEGRA_MPDEC_LPCPU_DOWN_HYS,
     .max_cpus = CONFIG_NR_CPUS,
     .min_cpus = 1,
+    .decision_mode = TEGRA_MPDEC_MODE_RQ,
+    .load_up = TEGRA_MPDEC_LOAD_UP,
+    .load_down = TEGRA_MPDEC_LOAD_DOWN,
+    .load_up_hold = TEGRA_MPDEC_LOAD_UP_HOLD,
+    .load_down_hold = TEGRA_MPDEC_LOAD_DOWN_HOLD,
 #ifdef CONFIG_TEGRA_MPDECISION_INPUTBOOST_CPUMIN
     .boost_enabled = true,
     .boost_time = TEGRA_MPDEC_BOOSTTIME,
@@ -163,10 +211,14 @@ static struct tegra_mpdec_tuners {
 #endif
 };
 
-static struct clk *cpu_clk;
 static struct clk *cpu_g_clk;
 static struct clk *cpu_lp_clk;
 
+/* true while mpdecision is the current tegra hotplug governor */
+static bool mpdec_active = false;
+static struct pm_qos_request_list mpdec_min_cpus_req;
+static struct pm_qos_request_list mpdec_max_cpus_req;
+
 static unsigned int idle_top_freq;
 static unsigned int idle_bottom_freq;
 
@@ -175,6 +227,33 @@ static unsigned int TwTs_Threshold[8] = {140, 0, 140, 190, 140, 190, 0, 190};
 
 extern unsigned int get_rq_info(void);
 
+/* per-cpu load snapshot, in percent of one task resp. of a busy cpu */
+struct tegra_mpdec_load_t {
+    unsigned int total;
+    unsigned int runnable[CONFIG_NR_CPUS];
+    unsigned int util[CONFIG_NR_CPUS];
+};
+
+struct tegra_mpdec_trace_t {
+    cputime64_t time;
+    unsigned int mode;
+    int state;
+    int cpu;
+    unsigned int nr_online;
+    long long unsigned int latency;
+    struct tegra_mpdec_load_t load;
+};
+
+static struct tegra_mpdec_trace_t tegra_mpdec_trace[TEGRA_MPDEC_TRACE_SIZE];
+static unsigned int tegra_mpdec_trace_next;
+static unsigned int tegra_mpdec_trace_count;
+static DEFINE_SPINLOCK(tegra_mpdec_trace_lock);
+
+/* these are only touched from the work thread under mpdec_tegra_cpu_lock */
+static struct tegra_mpdec_load_t mpdec_load;
+static int mpdec_load_victim;
+static long long unsigned int mpdec_last_latency;
+
 unsigned int state = TEGRA_MPDEC_IDLE;
 bool was_paused = false;
 #ifdef CONFIG_TEGRA_MPDECISION_INPUTBOOST_CPUMIN
@@ -189,27 +268,6 @@ static unsigned long get_rate(int cpu) {
     return tegra_getspeed(cpu);
 }
 
-static int get_slowest_cpu(void) {
-    int i, cpu = 0;
-    unsigned long rate, slow_rate = 0;
-
-    for (i = 0; i < CONFIG_NR_CPUS; i++) {
-        if (!cpu_online(i))
-                continue;
-        rate = get_rate(i);
-        if (slow_rate == 0) {
-                slow_rate = rate;
-        }
-        if ((rate <= slow_rate) && (slow_rate != 0)) {
-            if (i == 0)
-                    continue;
-            cpu = i;
-            slow_rate = rate;
-        }
-    }
-    return cpu;
-}
-
 static int get_slowest_cpu_rate(void) {
     int i = 0;
     unsigned long rate, slow_rate = 0;
@@ -226,6 +284,68 @@ static int get_slowest_cpu_rate(void) {
     return slow_rate;
 }
 
+static void mpdec_get_load(struct tegra_mpdec_load_t *load) {
+    int cpu;
+    unsigned long runnable, util;
+
+    memset(load, 0, sizeof(*load));
+    for_each_possible_cpu(cpu) {
+        sched_get_cpu_load_track(cpu, &runnable, &util);
+        load->runnable[cpu] = (runnable * 100) >> SCHED_LOAD_TRACK_FSHIFT;
+        load->util[cpu] = (util * 100) >> SCHED_LOAD_TRACK_FSHIFT;
+        load->total += load->runnable[cpu];
+    }
+}
+
+/*
+ * Pick the online G cpu (never cpu0) doing the least work, ties are
+ * broken by the runnable average. Returns nr_cpu_ids if there is none.
+ */
+static int get_least_loaded_cpu(struct tegra_mpdec_load_t *load) {
+    int i, cpu = nr_cpu_ids;
+
+    for (i = 1; i < CONFIG_NR_CPUS; i++) {
+        if (!cpu_online(i))
+            continue;
+        if ((cpu == nr_cpu_ids) ||
+            (load->util[i] < load->util[cpu]) ||
+            ((load->util[i] == load->util[cpu]) &&
+             (load->runnable[i] < load->runnable[cpu])))
+            cpu = i;
+    }
+    return cpu;
+}
+
+static void mpdec_account_latency(struct tegra_mpdec_lat_t *lat, ktime_t start) {
+    long long unsigned int us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+    lat->last = us;
+    lat->total += us;
+    lat->count++;
+    if (us > lat->max)
+        lat->max = us;
+    mpdec_last_latency = us;
+}
+
+static void mpdec_trace_decision(int new_state, int cpu) {
+    struct tegra_mpdec_trace_t *entry;
+    unsigned long flags;
+
+    spin_lock_irqsave(&tegra_mpdec_trace_lock, flags);
+    entry = &tegra_mpdec_trace[tegra_mpdec_trace_next];
+    entry->time = ktime_to_ms(ktime_get());
+    entry->mode = tegra_mpdec_tuners_ins.decision_mode;
+    entry->state = new_state;
+    entry->cpu = cpu;
+    entry->nr_online = num_online_cpus();
+    entry->latency = mpdec_last_latency;
+    entry->load = mpdec_load;
+    tegra_mpdec_trace_next = (tegra_mpdec_trace_next + 1) % TEGRA_MPDEC_TRACE_SIZE;
+    if (tegra_mpdec_trace_count < TEGRA_MPDEC_TRACE_SIZE)
+        tegra_mpdec_trace_count++;
+    spin_unlock_irqrestore(&tegra_mpdec_trace_lock, flags);
+}
+
 static bool lp_possible(void) {
     int i = 0;
     unsigned int speed;
@@ -242,9 +362,17 @@ static bool lp_possible(void) {
 }
 
 static void mpdec_cpu_up(int cpu) {
+    ktime_t start;
+
     if (!cpu_online(cpu)) {
         mutex_lock(&per_cpu(tegra_mpdec_cpudata, cpu).hotplug_mutex);
-        cpu_up(cpu);
+        start = ktime_get();
+        if (tegra_hp_cpu_up(cpu)) {
+            /* refused by the cluster or a max cpus constraint, or failed */
+            mutex_unlock(&per_cpu(tegra_mpdec_cpudata, cpu).hotplug_mutex);
+            return;
+        }
+        mpdec_account_latency(&per_cpu(tegra_mpdec_cpudata, cpu).up_lat, start);
         per_cpu(tegra_mpdec_cpudata, cpu).on_time = ktime_to_ms(ktime_get());
         per_cpu(tegra_mpdec_cpudata, cpu).online = true;
         per_cpu(tegra_mpdec_cpudata, cpu).times_cpu_hotplugged += 1;
@@ -258,9 +386,17 @@ EXPORT_SYMBOL_GPL(mpdec_cpu_up);
 
 static void mpdec_cpu_down(int cpu) {
     cputime64_t on_time = 0;
+    ktime_t start;
+
     if (cpu_online(cpu)) {
         mutex_lock(&per_cpu(tegra_mpdec_cpudata, cpu).hotplug_mutex);
-        cpu_down(cpu);
+        start = ktime_get();
+        if (tegra_hp_cpu_down(cpu)) {
+            /* refused by a min cpus constraint, or failed */
+            mutex_unlock(&per_cpu(tegra_mpdec_cpudata, cpu).hotplug_mutex);
+            return;
+        }
+        mpdec_account_latency(&per_cpu(tegra_mpdec_cpudata, cpu).down_lat, start);
         on_time = (ktime_to_ms(ktime_get()) - per_cpu(tegra_mpdec_cpudata, cpu).on_time);
         per_cpu(tegra_mpdec_cpudata, cpu).online = false;
         per_cpu(tegra_mpdec_cpudata, cpu).on_time_total += on_time;
@@ -273,6 +409,52 @@ static void mpdec_cpu_down(int cpu) {
 }
 EXPORT_SYMBOL_GPL(mpdec_cpu_down);
 
+static int mp_decision_load(cputime64_t this_time) {
+    static cputime64_t up_time = 0;
+    static cputime64_t down_time = 0;
+    int new_state = TEGRA_MPDEC_IDLE;
+    int nr_cpu_online = num_online_cpus();
+    unsigned int up_load, down_load;
+
+    up_load = nr_cpu_online * tegra_mpdec_tuners_ins.load_up;
+    down_load = max(nr_cpu_online - 1, 1) * tegra_mpdec_tuners_ins.load_down;
+
+    if (mpdec_load.total > up_load) {
+        down_time = 0;
+        up_time += this_time;
+        if (up_time >= tegra_mpdec_tuners_ins.load_up_hold) {
+            if (is_lp_cluster())
+                new_state = TEGRA_MPDEC_LPCPU_DOWN;
+            else if ((nr_cpu_online < CONFIG_NR_CPUS) &&
+                     (nr_cpu_online < tegra_hp_max_cpus()))
+                new_state = TEGRA_MPDEC_UP;
+        }
+    } else if (mpdec_load.total < down_load) {
+        up_time = 0;
+        down_time += this_time;
+        if (down_time >= tegra_mpdec_tuners_ins.load_down_hold) {
+            if ((nr_cpu_online > 1) && (nr_cpu_online > tegra_hp_min_cpus())) {
+                mpdec_load_victim = get_least_loaded_cpu(&mpdec_load);
+                if (mpdec_load_victim < nr_cpu_ids)
+                    new_state = TEGRA_MPDEC_DOWN;
+            } else if ((nr_cpu_online == 1) && (!is_lp_cluster()) &&
+                       (get_rate(0) <= idle_top_freq)) {
+                new_state = TEGRA_MPDEC_LPCPU_UP;
+            }
+        }
+    } else {
+        up_time = 0;
+        down_time = 0;
+    }
+
+    if (new_state != TEGRA_MPDEC_IDLE) {
+        up_time = 0;
+        down_time = 0;
+    }
+
+    return new_state;
+}
+
 static int mp_decision(void) {
     static bool first_call = true;
     int new_state = TEGRA_MPDEC_IDLE;
@@ -296,6 +478,16 @@ static int mp_decision(void) {
     } else {
         this_time = current_time - last_time;
     }
+
+    mpdec_get_load(&mpdec_load);
+    mpdec_load_victim = nr_cpu_ids;
+
+    if (tegra_mpdec_tuners_ins.decision_mode == TEGRA_MPDEC_MODE_LOAD) {
+        new_state = mp_decision_load(this_time);
+        total_time = 0;
+        goto out;
+    }
+
     total_time += this_time;
 
     rq_depth = get_rq_info();
@@ -305,7 +497,7 @@ static int mp_decision(void) {
         index = (nr_cpu_online - 1) * 2;
         if ((nr_cpu_online < CONFIG_NR_CPUS) && (rq_depth >= NwNs_Threshold[index])) {
             if (total_time >= TwTs_Threshold[index]) {
-                if ((!is_lp_cluster()) && (nr_cpu_online < tegra_mpdec_tuners_ins.max_cpus))
+                if ((!is_lp_cluster()) && (nr_cpu_online < tegra_hp_max_cpus()))
                     new_state = TEGRA_MPDEC_UP;
                 else if (rq_depth > TEGRA_MPDEC_LPCPU_RQ_DOWN)
                     new_state = TEGRA_MPDEC_LPCPU_DOWN;
@@ -316,7 +508,7 @@ static int mp_decision(void) {
             }
         } else if (rq_depth <= NwNs_Threshold[index+1]) {
             if (total_time >= TwTs_Threshold[index+1] ) {
-                if ((nr_cpu_online > 1) && (nr_cpu_online > tegra_mpdec_tuners_ins.min_cpus))
+                if ((nr_cpu_online > 1) && (nr_cpu_online > tegra_hp_min_cpus()))
                     new_state = TEGRA_MPDEC_DOWN;
                 else if ((get_rate(0) <= idle_top_freq) && (!is_lp_cluster()))
                     new_state = TEGRA_MPDEC_LPCPU_UP;
@@ -338,45 +530,33 @@ static int mp_decision(void) {
         total_time = 0;
     }
 
-    last_time = ktime_to_ms(ktime_get());
-
 #if DEBUG
     pr_info(MPDEC_TAG"[DEBUG] rq: %u, new_state: %i | Mask=[%d.%d%d%d%d]\n",
             rq_depth, new_state, is_lp_cluster(), ((is_lp_cluster() == 1) ? 0 : cpu_online(0)),
             cpu_online(1), cpu_online(2), cpu_online(3));
 #endif
+
+out:
+    last_time = ktime_to_ms(ktime_get());
+
     return new_state;
 }
 
 static int tegra_lp_cpu_handler(bool state, bool notifier) {
     bool err = false;
     cputime64_t on_time = 0;
-
-    /* robustness checks */
-    if (!cpu_clk) {
-        printk(KERN_INFO "[MPDEC]: re-setting cpu_clk");
-        cpu_clk = clk_get_sys(NULL, "cpu");
-    }
-    if (!cpu_lp_clk) {
-        printk(KERN_INFO "[MPDEC]: re-setting cpu_lp_clk");
-        cpu_lp_clk = clk_get_sys(NULL, "cpu_lp");
-    }
-    if (!cpu_g_clk) {
-        printk(KERN_INFO "[MPDEC]: re-setting cpu_g_clk");
-        cpu_g_clk = clk_get_sys(NULL, "cpu_g");
-    }
-    if (IS_ERR(cpu_clk) || IS_ERR(cpu_lp_clk) || IS_ERR(cpu_g_clk)) {
-        printk(KERN_INFO "[MPDEC]: Error, cpu_clk/lp_lck/g_clk still not set");
-        return 0;
-    }
+    ktime_t start;
 
     if (!mutex_trylock(&mpdec_tegra_lpcpu_lock))
             return 0;
 
+    start = ktime_get();
+
     /* true = up, false = down */
     switch (state) {
     case true:
-        if(!clk_set_parent(cpu_clk, cpu_lp_clk)) {
+        if (!tegra_hp_set_lp_cluster(true)) {
+            mpdec_account_latency(&tegra_mpdec_lpcpudata.up_lat, start);
             /* catch-up with governor target speed */
             tegra_cpu_set_speed_cap(NULL);
 
@@ -390,12 +570,13 @@ static int tegra_lp_cpu_handler(bool state, bool notifier) {
             per_cpu(tegra_mpdec_cpudata, 0).on_time_total += on_time;
             per_cpu(tegra_mpdec_cpudata, 0).times_cpu_unplugged += 1;
         } else {
-            pr_err(MPDEC_TAG" %s (up): clk_set_parent fail\n", __func__);
+            pr_err(MPDEC_TAG" %s (up): cluster switch fail\n", __func__);
             err = true;
         }
         break;
     case false:
-        if (!clk_set_parent(cpu_clk, cpu_g_clk)) {
+        if (!tegra_hp_set_lp_cluster(false)) {
+            mpdec_account_latency(&tegra_mpdec_lpcpudata.down_lat, start);
             /* catch-up with governor target speed */
             tegra_cpu_set_speed_cap(NULL);
 
@@ -416,7 +597,7 @@ static int tegra_lp_cpu_handler(bool state, bool notifier) {
                         is_lp_cluster(), ((is_lp_cluster() == 1) ? 0 : cpu_online(0)),
                         cpu_online(1), cpu_online(2), cpu_online(3), on_time);
         } else {
-            pr_err(MPDEC_TAG" %s (down): clk_set_parent fail\n", __func__);
+            pr_err(MPDEC_TAG" %s (down): cluster switch fail\n", __func__);
             err = true;
         }
         break;
@@ -430,9 +611,10 @@ static int tegra_lp_cpu_handler(bool state, bool notifier) {
         return 1;
 }
 
-int mpdecision_gmode_notifier(void) {
+/* called by the hotplug core with the tegra cpu lock held */
+static int tegra_mpdec_gmode_request(void) {
     if (!is_lp_cluster())
-        return 0;
+        return 1;
 
     if (!mutex_trylock(&mpdec_tegra_cpu_lock))
         return 0;
@@ -452,7 +634,6 @@ int mpdecision_gmode_notifier(void) {
     mutex_unlock(&mpdec_tegra_cpu_lock);
     return 1;
 }
-EXPORT_SYMBOL_GPL(mpdecision_gmode_notifier);
 
 static void tegra_mpdec_suspended_work_thread(struct work_struct *work) {
     unsigned int rq_depth;
@@ -475,6 +656,9 @@ static void tegra_mpdec_suspended_work_thread(struct work_struct *work) {
     mutex_unlock(&mpdec_tegra_cpu_suspend_lock);
 
 out:
+    if (!mpdec_active)
+        return;
+
     /* LP CPU is not up again, reschedule for next check.
        Since we are suspended, double the delay to save resources */
     queue_delayed_work(tegra_mpdec_suspended_workq, &tegra_mpdec_suspended_work,
@@ -521,6 +705,7 @@ static void tegra_mpdec_work_thread(struct work_struct *work) {
         was_paused = false;
     }
 
+    mpdec_last_latency = 0;
     state = mp_decision();
     switch (state) {
     case TEGRA_MPDEC_IDLE:
@@ -531,7 +716,10 @@ static void tegra_mpdec_work_thread(struct work_struct *work) {
     case TEGRA_MPDEC_DOWN:
         lpup_req = 0;
         lpdown_req = 0;
-        cpu = get_slowest_cpu();
+        if (tegra_mpdec_tuners_ins.decision_mode == TEGRA_MPDEC_MODE_LOAD)
+            cpu = mpdec_load_victim;
+        else
+            cpu = tegra_get_slowest_cpu_n();
         if (cpu < nr_cpu_ids) {
             if ((per_cpu(tegra_mpdec_cpudata, cpu).online == true) && (cpu_online(cpu))) {
 #ifdef CONFIG_TEGRA_MPDECISION_INPUTBOOST_CPUMIN
@@ -596,10 +784,21 @@ static void tegra_mpdec_work_thread(struct work_struct *work) {
         pr_err(MPDEC_TAG"%s: invalid mpdec hotplug state %d\n",
                __func__, state);
     }
+
+    switch (state) {
+    case TEGRA_MPDEC_DOWN:
+    case TEGRA_MPDEC_UP:
+        mpdec_trace_decision(state, cpu);
+        break;
+    case TEGRA_MPDEC_LPCPU_DOWN:
+    case TEGRA_MPDEC_LPCPU_UP:
+        mpdec_trace_decision(state, -1);
+        break;
+    }
     mutex_unlock(&mpdec_tegra_cpu_lock);
 
 out:
-    if (state != TEGRA_MPDEC_DISABLED) {
+    if ((state != TEGRA_MPDEC_DISABLED) && mpdec_active) {
         queue_delayed_work(tegra_mpdec_workq, &tegra_mpdec_work,
                            msecs_to_jiffies(tegra_mpdec_tuners_ins.delay));
     }
@@ -719,7 +918,7 @@ static void mpdec_input_event(struct input_handle *handle, unsigned int type,
         unsigned int code, int value) {
     int i = 0;
 
-    if (!tegra_mpdec_tuners_ins.boost_enabled)
+    if (!tegra_mpdec_tuners_ins.boost_enabled || !mpdec_active)
         return;
 
     if (!is_screen_on)
@@ -798,7 +997,7 @@ static void tegra_mpdec_early_suspend(struct early_suspend *h) {
     is_screen_on = false;
 #endif
 
-    if (!tegra_mpdec_tuners_ins.scroff_single_core) {
+    if (!tegra_mpdec_tuners_ins.scroff_single_core || !mpdec_active) {
         pr_info(MPDEC_TAG"Screen -> off\n");
         return;
     }
@@ -836,6 +1035,11 @@ static void tegra_mpdec_late_resume(struct early_suspend *h) {
     for_each_possible_cpu(cpu)
         per_cpu(tegra_mpdec_cpudata, cpu).device_suspended = false;
 
+    if (!mpdec_active) {
+        pr_info(MPDEC_TAG"Screen -> on\n");
+        return;
+    }
+
     /* always switch back to g mode on resume */
     if (is_lp_cluster())
         if(!tegra_lp_cpu_handler(false, false))
@@ -848,15 +1052,7 @@ static void tegra_mpdec_late_resume(struct early_suspend *h) {
                            msecs_to_jiffies(tegra_mpdec_tuners_ins.delay));
 
         /* restore min/max cpus limits */
-        for (cpu=1; cpu<CONFIG_NR_CPUS; cpu++) {
-            if (cpu < tegra_mpdec_tuners_ins.min_cpus) {
-                if (!cpu_online(cpu))
-                    mpdec_cpu_up(cpu);
-            } else if (cpu > tegra_mpdec_tuners_ins.max_cpus) {
-                if (cpu_online(cpu))
-                    mpdec_cpu_down(cpu);
-            }
-        }
+        tegra_hp_check_constraints();
         pr_info(MPDEC_TAG"Screen -> on. Activated mpdecision. | Mask=[%d.%d%d%d%d]\n",
                 is_lp_cluster(), ((is_lp_cluster() == 1) ? 0 : cpu_online(0)),
                 cpu_online(1), cpu_online(2), cpu_online(3));
@@ -871,6 +1067,56 @@ static struct early_suspend tegra_mpdec_early_suspend_handler = {
     .resume = tegra_mpdec_late_resume,
 };
 
+static void mpdec_update_cpus_limits(void) {
+    if (mpdec_active) {
+        pm_qos_update_request(&mpdec_max_cpus_req,
+                              (s32)tegra_mpdec_tuners_ins.max_cpus);
+        /* a min of 1 must not pin us to the G cluster */
+        pm_qos_update_request(&mpdec_min_cpus_req,
+                              (tegra_mpdec_tuners_ins.min_cpus > 1) ?
+                              (s32)tegra_mpdec_tuners_ins.min_cpus :
+                              PM_QOS_DEFAULT_VALUE);
+    } else {
+        pm_qos_update_request(&mpdec_max_cpus_req, PM_QOS_DEFAULT_VALUE);
+        pm_qos_update_request(&mpdec_min_cpus_req, PM_QOS_DEFAULT_VALUE);
+    }
+}
+
+static int tegra_mpdec_start(struct mutex *cpu_lock) {
+    mpdec_active = true;
+    was_paused = true;
+    mpdec_update_cpus_limits();
+
+    if (state != TEGRA_MPDEC_DISABLED)
+        queue_delayed_work(tegra_mpdec_workq, &tegra_mpdec_work,
+                           msecs_to_jiffies(tegra_mpdec_tuners_ins.delay));
+    return 0;
+}
+
+static void tegra_mpdec_stop(void) {
+#ifdef CONFIG_TEGRA_MPDECISION_INPUTBOOST_CPUMIN
+    int cpu;
+#endif
+
+    mpdec_active = false;
+    cancel_delayed_work_sync(&tegra_mpdec_work);
+    cancel_delayed_work_sync(&tegra_mpdec_suspended_work);
+#ifdef CONFIG_TEGRA_MPDECISION_INPUTBOOST_CPUMIN
+    for_each_possible_cpu(cpu) {
+        cancel_delayed_work_sync(&per_cpu(tegra_mpdec_revib_work, cpu));
+        unboost_cpu(cpu);
+    }
+#endif
+    mpdec_update_cpus_limits();
+}
+
+static struct tegra_hp_governor tegra_mpdec_governor = {
+    .name = "mpdecision",
+    .start = tegra_mpdec_start,
+    .stop = tegra_mpdec_stop,
+    .gmode_request = tegra_mpdec_gmode_request,
+};
+
 /**************************** SYSFS START ****************************/
 struct kobject *tegra_mpdec_kobject;
 
@@ -889,6 +1135,11 @@ show_one(lpcpu_down_hysteresis, lp_cpu_down_hysteresis);
 show_one(scroff_single_core, scroff_single_core);
 show_one(min_cpus, min_cpus);
 show_one(max_cpus, max_cpus);
+show_one(decision_mode, decision_mode);
+show_one(load_up_threshold, load_up);
+show_one(load_down_threshold, load_down);
+show_one(load_up_hold, load_up_hold);
+show_one(load_down_hold, load_down_hold);
 #ifdef CONFIG_TEGRA_MPDECISION_INPUTBOOST_CPUMIN
 show_one(boost_enabled, boost_enabled);
 show_one(boost_time, boost_time);
@@ -1025,22 +1276,14 @@ static ssize_t store_max_cpus(struct kobject *a, struct attribute *b,
                    const char *buf, size_t count)
 {
     unsigned int input;
-    int ret, cpu;
+    int ret;
     ret = sscanf(buf, "%u", &input);
     if ((ret != 1) || input > CONFIG_NR_CPUS || input < tegra_mpdec_tuners_ins.min_cpus)
         return -EINVAL;
 
+    /* the hotplug core unplugs affected cpus */
     tegra_mpdec_tuners_ins.max_cpus = input;
-    if (num_online_cpus() > input) {
-        for (cpu=CONFIG_NR_CPUS; cpu>0; cpu--) {
-            if (num_online_cpus() <= input)
-                break;
-            if (!cpu_online(cpu))
-                continue;
-            mpdec_cpu_down(cpu);
-        }
-        pr_info(MPDEC_TAG"max_cpus set to %u. Affected CPUs were unplugged!\n", input);
-    }
+    mpdec_update_cpus_limits();
 
     return count;
 }
@@ -1049,22 +1292,14 @@ static ssize_t store_min_cpus(struct kobject *a, struct attribute *b,
                    const char *buf, size_t count)
 {
     unsigned int input;
-    int ret, cpu;
+    int ret;
     ret = sscanf(buf, "%u", &input);
     if ((ret != 1) || input < 1 || input > tegra_mpdec_tuners_ins.max_cpus)
         return -EINVAL;
 
+    /* the hotplug core hotplugs affected cpus */
     tegra_mpdec_tuners_ins.min_cpus = input;
-    if (num_online_cpus() < input) {
-        for (cpu=1; cpu<CONFIG_NR_CPUS; cpu++) {
-            if (num_online_cpus() >= input)
-                break;
-            if (cpu_online(cpu))
-                continue;
-            mpdec_cpu_up(cpu);
-        }
-        pr_info(MPDEC_TAG"min_cpus set to %u. Affected CPUs were hotplugged!\n", input);
-    }
+    mpdec_update_cpus_limits();
 
     return count;
 }
@@ -1125,6 +1360,76 @@ static ssize_t store_idle_freq(struct kobject *a, struct attribute *b,
     return count;
 }
 
+static ssize_t store_decision_mode(struct kobject *a, struct attribute *b,
+                   const char *buf, size_t count)
+{
+    unsigned int input;
+    int ret;
+    ret = sscanf(buf, "%u", &input);
+    if ((ret != 1) || (input > TEGRA_MPDEC_MODE_LOAD))
+        return -EINVAL;
+
+    tegra_mpdec_tuners_ins.decision_mode = input;
+
+    return count;
+}
+
+static ssize_t store_load_up_threshold(struct kobject *a, struct attribute *b,
+                   const char *buf, size_t count)
+{
+    unsigned int input;
+    int ret;
+    ret = sscanf(buf, "%u", &input);
+    if ((ret != 1) || (input <= tegra_mpdec_tuners_ins.load_down))
+        return -EINVAL;
+
+    tegra_mpdec_tuners_ins.load_up = input;
+
+    return count;
+}
+
+static ssize_t store_load_down_threshold(struct kobject *a, struct attribute *b,
+                   const char *buf, size_t count)
+{
+    unsigned int input;
+    int ret;
+    ret = sscanf(buf, "%u", &input);
+    if ((ret != 1) || (input >= tegra_mpdec_tuners_ins.load_up))
+        return -EINVAL;
+
+    tegra_mpdec_tuners_ins.load_down = input;
+
+    return count;
+}
+
+static ssize_t store_load_up_hold(struct kobject *a, struct attribute *b,
+                   const char *buf, size_t count)
+{
+    unsigned int input;
+    int ret;
+    ret = sscanf(buf, "%u", &input);
+    if (ret != 1)
+        return -EINVAL;
+
+    tegra_mpdec_tuners_ins.load_up_hold = input;
+
+    return count;
+}
+
+static ssize_t store_load_down_hold(struct kobject *a, struct attribute *b,
+                   const char *buf, size_t count)
+{
+    unsigned int input;
+    int ret;
+    ret = sscanf(buf, "%u", &input);
+    if (ret != 1)
+        return -EINVAL;
+
+    tegra_mpdec_tuners_ins.load_down_hold = input;
+
+    return count;
+}
+
 static ssize_t store_scroff_single_core(struct kobject *a, struct attribute *b,
                    const char *buf, size_t count)
 {
@@ -1187,8 +1492,9 @@ static ssize_t store_enabled(struct kobject *a, struct attribute *b,
     case '1':
         state = TEGRA_MPDEC_IDLE;
         was_paused = true;
-        queue_delayed_work(tegra_mpdec_workq, &tegra_mpdec_work,
-                           msecs_to_jiffies(tegra_mpdec_tuners_ins.delay));
+        if (mpdec_active)
+            queue_delayed_work(tegra_mpdec_workq, &tegra_mpdec_work,
+                               msecs_to_jiffies(tegra_mpdec_tuners_ins.delay));
         pr_info(MPDEC_TAG"firing up mpdecision...\n");
         break;
     default:
@@ -1274,6 +1580,11 @@ define_one_global_rw(idle_freq);
 define_one_global_rw(min_cpus);
 define_one_global_rw(max_cpus);
 define_one_global_rw(enabled);
+define_one_global_rw(decision_mode);
+define_one_global_rw(load_up_threshold);
+define_one_global_rw(load_down_threshold);
+define_one_global_rw(load_up_hold);
+define_one_global_rw(load_down_hold);
 #ifdef CONFIG_TEGRA_MPDECISION_INPUTBOOST_CPUMIN
 define_one_global_rw(boost_enabled);
 define_one_global_rw(boost_time);
@@ -1290,6 +1601,11 @@ static struct attribute *tegra_mpdec_attributes[] = {
     &enabled.attr,
     &min_cpus.attr,
     &max_cpus.attr,
+    &decision_mode.attr,
+    &load_up_threshold.attr,
+    &load_down_threshold.attr,
+    &load_up_hold.attr,
+    &load_down_hold.attr,
     &twts_threshold_0.attr,
     &twts_threshold_1.attr,
     &twts_threshold_2.attr,
@@ -1379,10 +1695,109 @@ static ssize_t show_times_cpus_unplugged(struct kobject *a, struct attribute *b,
 }
 define_one_global_ro(times_cpus_unplugged);
 
+static ssize_t sprint_latency(char *buf, struct tegra_mpdec_lat_t *lat)
+{
+    return sprintf(buf, " %llu %llu %llu", lat->last,
+                   lat->count ? div64_u64(lat->total, lat->count) : 0, lat->max);
+}
+
+/* per cpu: up last/avg/max, down last/avg/max in us, LP is the cluster switch */
+static ssize_t show_hotplug_latency(struct kobject *a, struct attribute *b,
+                   char *buf)
+{
+    ssize_t len = 0;
+    int cpu = 0;
+
+    len += sprintf(buf + len, "LP");
+    len += sprint_latency(buf + len, &tegra_mpdec_lpcpudata.up_lat);
+    len += sprint_latency(buf + len, &tegra_mpdec_lpcpudata.down_lat);
+    len += sprintf(buf + len, "\n");
+    for_each_possible_cpu(cpu) {
+        len += sprintf(buf + len, "%i", cpu);
+        len += sprint_latency(buf + len, &per_cpu(tegra_mpdec_cpudata, cpu).up_lat);
+        len += sprint_latency(buf + len, &per_cpu(tegra_mpdec_cpudata, cpu).down_lat);
+        len += sprintf(buf + len, "\n");
+    }
+
+    return len;
+}
+define_one_global_ro(hotplug_latency);
+
+/* current runnable/util per cpu, in percent */
+static ssize_t show_cpu_load(struct kobject *a, struct attribute *b,
+                   char *buf)
+{
+    struct tegra_mpdec_load_t load;
+    ssize_t len = 0;
+    int cpu = 0;
+
+    mpdec_get_load(&load);
+    for_each_possible_cpu(cpu) {
+        len += sprintf(buf + len, "%i %u %u\n", cpu,
+                       load.runnable[cpu], load.util[cpu]);
+    }
+
+    return len;
+}
+define_one_global_ro(cpu_load);
+
+static const char *mpdec_state_name(int state)
+{
+    switch (state) {
+    case TEGRA_MPDEC_UP:
+        return "up";
+    case TEGRA_MPDEC_DOWN:
+        return "down";
+    case TEGRA_MPDEC_LPCPU_UP:
+        return "lp_up";
+    case TEGRA_MPDEC_LPCPU_DOWN:
+        return "lp_down";
+    default:
+        return "idle";
+    }
+}
+
+/*
+ * Oldest first, one decision per line:
+ * time(ms) mode action cpu nr_online latency(us) total cpuN:runnable/util...
+ */
+static ssize_t show_decision_trace(struct kobject *a, struct attribute *b,
+                   char *buf)
+{
+    struct tegra_mpdec_trace_t *entry;
+    unsigned long flags;
+    unsigned int i, pos;
+    ssize_t len = 0;
+    int cpu;
+
+    spin_lock_irqsave(&tegra_mpdec_trace_lock, flags);
+    pos = (tegra_mpdec_trace_next + TEGRA_MPDEC_TRACE_SIZE -
+           tegra_mpdec_trace_count) % TEGRA_MPDEC_TRACE_SIZE;
+    for (i = 0; i < tegra_mpdec_trace_count; i++) {
+        entry = &tegra_mpdec_trace[(pos + i) % TEGRA_MPDEC_TRACE_SIZE];
+        len += sprintf(buf + len, "%llu %s %s %d %u %llu %u",
+                       entry->time,
+                       (entry->mode == TEGRA_MPDEC_MODE_LOAD) ? "load" : "rq",
+                       mpdec_state_name(entry->state), entry->cpu,
+                       entry->nr_online, entry->latency, entry->load.total);
+        for (cpu = 0; cpu < CONFIG_NR_CPUS; cpu++)
+            len += sprintf(buf + len, " %u/%u", entry->load.runnable[cpu],
+                           entry->load.util[cpu]);
+        len += sprintf(buf + len, "\n");
+    }
+    spin_unlock_irqrestore(&tegra_mpdec_trace_lock, flags);
+
+    return len;
+}
+define_one_global_ro(decision_trace);
+
 static struct attribute *tegra_mpdec_stats_attributes[] = {
     &time_cpus_on.attr,
     &times_cpus_hotplugged.attr,
     &times_cpus_unplugged.attr,
+    &hotplug_latency.attr,
+    &cpu_load.attr,
+    &decision_trace.attr,
     NULL
 };
 
@@ -1400,11 +1815,10 @@ static int __init tegra_mpdec_init(void) {
     unsigned long int boost_freq = 0;
 #endif
 
-    cpu_clk = clk_get_sys(NULL, "cpu");
     cpu_g_clk = clk_get_sys(NULL, "cpu_g");
     cpu_lp_clk = clk_get_sys(NULL, "cpu_lp");
 
-    if (IS_ERR(cpu_clk) || IS_ERR(cpu_g_clk) || IS_ERR(cpu_lp_clk))
+    if (IS_ERR(cpu_g_clk) || IS_ERR(cpu_lp_clk))
         return -ENOENT;
 
     idle_top_freq = clk_get_max_rate(cpu_lp_clk) / 1000;
@@ -1478,9 +1892,10 @@ static int __init tegra_mpdec_init(void) {
     rc = input_register_handler(&mpdec_input_handler);
 #endif
 
-    if (state != TEGRA_MPDEC_DISABLED)
-        queue_delayed_work(tegra_mpdec_workq, &tegra_mpdec_work,
-                           msecs_to_jiffies(tegra_mpdec_tuners_ins.delay));
+    pm_qos_add_request(&mpdec_min_cpus_req, PM_QOS_MIN_ONLINE_CPUS,
+                       PM_QOS_DEFAULT_VALUE);
+    pm_qos_add_request(&mpdec_max_cpus_req, PM_QOS_MAX_ONLINE_CPUS,
+                       PM_QOS_DEFAULT_VALUE);
 
     register_early_suspend(&tegra_mpdec_early_suspend_handler);
 
@@ -1501,12 +1916,19 @@ static int __init tegra_mpdec_init(void) {
 
     pr_info(MPDEC_TAG"%s init complete.", __func__);
 
+    err = tegra_hp_register_governor(&tegra_mpdec_governor);
+    if (err)
+        pr_err(MPDEC_TAG"could not register hotplug governor: %d\n", err);
+
     return err;
 }
 
 late_initcall(tegra_mpdec_init);
 
 void tegra_mpdec_exit(void) {
+    tegra_hp_unregister_governor(&tegra_mpdec_governor);
+    pm_qos_remove_request(&mpdec_min_cpus_req);
+    pm_qos_remove_request(&mpdec_max_cpus_req);
 #ifdef CONFIG_TEGRA_MPDECISION_INPUTBOOST_CPUMIN
     input_unregister_handler(&mpdec_input_handler);
     destroy_workqueue(tegra_mpdec_revib_workq);
@@ -39,6 +39,8 @@ EXPORT_TRACEPOINT_SYMBOL_GPL(block_rq_remap);
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_bio_complete);
 
 static int __make_request(struct request_queue *q, struct bio *bio);
+static void queue_unplugged(struct request_queue *q, unsigned int depth,
+			    bool from_schedule);
 
 /*
  * For the allocated request tables
@@ -511,6 +513,24 @@ blk_init_queue_node(request_fn_proc *rfn, spinlock_t *lock, int node_id)
 }
 EXPORT_SYMBOL(blk_init_queue_node);
 
+static int blk_init_sw_queues(struct request_queue *q)
+{
+	struct blk_sw_queue *sq;
+	int cpu;
+
+	q->sw_queues = alloc_percpu(struct blk_sw_queue);
+	if (!q->sw_queues)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		sq = per_cpu_ptr(q->sw_queues, cpu);
+		spin_lock_init(&sq->lock);
+		INIT_LIST_HEAD(&sq->list);
+		sq->nr = 0;
+	}
+	return 0;
+}
+
 struct request_queue *
 blk_init_allocated_queue(struct request_queue *q, request_fn_proc *rfn,
 			 spinlock_t *lock)
@@ -521,6 +541,9 @@ blk_init_allocated_queue(struct request_queue *q, request_fn_proc *rfn,
 	if (blk_init_free_list(q))
 		return NULL;
 
+	if (blk_init_sw_queues(q))
+		return NULL;
+
 	q->request_fn		= rfn;
 	q->prep_rq_fn		= NULL;
 	q->unprep_rq_fn		= NULL;
@@ -1192,6 +1215,129 @@ out:
 	return ret;
 }
 
+/*
+ * Attempts to merge with the requests staged on this cpu, whichever task
+ * plugged them. Returns true if merge was successful, otherwise false.
+ */
+static bool attempt_sw_queue_merge(struct request_queue *q, struct bio *bio)
+{
+	struct blk_sw_queue *sq;
+	struct request *rq;
+	bool ret = false;
+
+	sq = per_cpu_ptr(q->sw_queues, raw_smp_processor_id());
+	if (!sq->nr)
+		return false;
+
+	spin_lock_irq(&sq->lock);
+	list_for_each_entry_reverse(rq, &sq->list, queuelist) {
+		int el_ret = elv_try_merge(rq, bio);
+
+		if (el_ret == ELEVATOR_BACK_MERGE) {
+			ret = bio_attempt_back_merge(q, rq, bio);
+			if (ret)
+				break;
+		} else if (el_ret == ELEVATOR_FRONT_MERGE) {
+			ret = bio_attempt_front_merge(q, rq, bio);
+			if (ret)
+				break;
+		}
+	}
+	spin_unlock_irq(&sq->lock);
+	return ret;
+}
+
+/*
+ * Insert a batch of staged requests into the elevator, under a single hold
+ * of the queue lock, and run the queue.
+ */
+static void blk_insert_staged(struct request_queue *q, struct list_head *list,
+			      bool from_schedule)
+{
+	unsigned long flags;
+	struct request *rq;
+	unsigned int depth = 0;
+
+	local_irq_save(flags);
+	spin_lock(q->queue_lock);
+	while (!list_empty(list)) {
+		rq = list_entry_rq(list->next);
+		list_del_init(&rq->queuelist);
+		/*
+		 * rq is already accounted, so use raw insert
+		 */
+		__elv_add_request(q, rq, ELEVATOR_INSERT_SORT_MERGE);
+		depth++;
+	}
+
+	/*
+	 * This drops the queue lock
+	 */
+	queue_unplugged(q, depth, from_schedule);
+	local_irq_restore(flags);
+}
+
+/*
+ * Stage a request of a plugged task on its cpu. Once BLK_MAX_REQUEST_COUNT
+ * requests are staged there, they are inserted as a batch.
+ */
+static void blk_stage_request(struct request_queue *q, struct blk_plug *plug,
+			      struct request *req)
+{
+	struct blk_sw_queue *sq;
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	/* a plug only tracks one queue with staged requests */
+	if (plug->staged_q != q) {
+		if (plug->staged_q)
+			blk_flush_plug_list(plug, false);
+		plug->staged_q = q;
+	}
+
+	drive_stat_acct(req, 1);
+
+	sq = per_cpu_ptr(q->sw_queues, raw_smp_processor_id());
+	spin_lock_irqsave(&sq->lock, flags);
+	if (!sq->nr)
+		trace_block_plug(q);
+	list_add_tail(&req->queuelist, &sq->list);
+	if (++sq->nr >= BLK_MAX_REQUEST_COUNT) {
+		list_splice_init(&sq->list, &list);
+		sq->nr = 0;
+	}
+	spin_unlock_irqrestore(&sq->lock, flags);
+
+	if (!list_empty(&list))
+		blk_insert_staged(q, &list, false);
+}
+
+/*
+ * Insert what is staged on every cpu. The tasks that staged requests may
+ * have moved to other cpus since, so all of them have to be looked at.
+ */
+static void blk_drain_sw_queues(struct request_queue *q, bool from_schedule)
+{
+	struct blk_sw_queue *sq;
+	unsigned long flags;
+	LIST_HEAD(list);
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		sq = per_cpu_ptr(q->sw_queues, cpu);
+		if (!sq->nr)
+			continue;
+
+		spin_lock_irqsave(&sq->lock, flags);
+		list_splice_tail_init(&sq->list, &list);
+		sq->nr = 0;
+		spin_unlock_irqrestore(&sq->lock, flags);
+	}
+
+	if (!list_empty(&list))
+		blk_insert_staged(q, &list, from_schedule);
+}
+
 void init_request_from_bio(struct request *req, struct bio *bio)
 {
 	req->cpu = bio->bi_comp_cpu;
@@ -1235,6 +1381,18 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	if (attempt_plug_merge(current, q, bio, &request_count))
 		goto out;
 
+	/*
+	 * When staging, the elevator is not consulted before the request is
+	 * allocated: the merge is tried when the batch is inserted instead.
+	 */
+	if (blk_queue_sw_stage(q) && current->plug) {
+		if (attempt_sw_queue_merge(q, bio))
+			goto out;
+
+		spin_lock_irq(q->queue_lock);
+		goto get_rq;
+	}
+
 	spin_lock_irq(q->queue_lock);
 
 	el_ret = elv_merge(q, &req, bio);
@@ -1281,7 +1439,9 @@ get_rq:
 		req->cpu = raw_smp_processor_id();
 
 	plug = current->plug;
-	if (plug) {
+	if (plug && blk_queue_sw_stage(q) && where == ELEVATOR_INSERT_SORT) {
+		blk_stage_request(q, plug, req);
+	} else if (plug) {
 		/*
 		 * If this is the first request added after a plug, fire
 		 * of a plug trace. If others have been added before, check
@@ -2630,6 +2790,7 @@ void blk_start_plug(struct blk_plug *plug)
 	INIT_LIST_HEAD(&plug->list);
 	INIT_LIST_HEAD(&plug->cb_list);
 	plug->should_sort = 0;
+	plug->staged_q = NULL;
 
 	/*
 	 * If this is a nested plug, don't actually assign it. It will be
@@ -2709,6 +2870,12 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 	BUG_ON(plug->magic != PLUG_MAGIC);
 
 	flush_plug_callbacks(plug);
+
+	if (plug->staged_q) {
+		blk_drain_sw_queues(plug->staged_q, from_schedule);
+		plug->staged_q = NULL;
+	}
+
 	if (list_empty(&plug->list))
 		return;
 
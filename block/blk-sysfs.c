@@ -273,6 +273,32 @@ queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+static ssize_t queue_sw_stage_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(blk_queue_sw_stage(q), page);
+}
+
+static ssize_t
+queue_sw_stage_store(struct request_queue *q, const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret;
+
+	/* only queues going through __make_request can stage */
+	if (!q->sw_queues)
+		return -EINVAL;
+
+	ret = queue_var_store(&val, page, count);
+	spin_lock_irq(q->queue_lock);
+	if (val)
+		queue_flag_set(QUEUE_FLAG_SW_STAGE, q);
+	else
+		queue_flag_clear(QUEUE_FLAG_SW_STAGE, q);
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -387,6 +413,12 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+static struct queue_sysfs_entry queue_sw_stage_entry = {
+	.attr = {.name = "sw_stage", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_sw_stage_show,
+	.store = queue_sw_stage_store,
+};
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -409,6 +441,7 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+	&queue_sw_stage_entry.attr,
 	NULL,
 };
 
@@ -487,6 +520,8 @@ static void blk_release_queue(struct kobject *kobj)
 	if (rl->rq_pool)
 		mempool_destroy(rl->rq_pool);
 
+	free_percpu(q->sw_queues);
+
 	if (q->queue_tags)
 		__blk_queue_free_tags(q);
 
@@ -0,0 +1,530 @@
+/*
+ *  Flash i/o scheduler.
+ *
+ *  For devices without a seek penalty, such as eMMC, where what matters is
+ *  how long the small synchronous reads of an interactive task wait behind
+ *  writes, not the order of sectors.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/rbtree.h>
+#include <linux/hash.h>
+#include <linux/sched.h>
+
+/*
+ * See Documentation/block/flash-iosched.txt
+ */
+static const int read_quota = 16;	/* reads dispatched per round */
+static const int sync_write_quota = 4;	/* sync writes dispatched per round */
+static const int async_write_quota = 2;	/* async writes dispatched per round */
+static const int sync_write_expire = HZ / 4;	/* max time before a sync
+						   write is dispatched */
+static const int async_write_expire = HZ;	/* ditto for async writes */
+static const int proc_quantum = 2;	/* sync requests of a process
+					   dispatched before the next one's */
+
+enum flash_class {
+	FLASH_READ = 0,
+	FLASH_SYNC_WRITE,
+	FLASH_ASYNC_WRITE,
+	FLASH_NR_CLASSES,
+};
+
+/* the classes queued per process */
+#define FLASH_NR_SYNC		2
+
+#define FLASH_HASH_BITS		6
+
+/*
+ * The sync requests of a process (thread group), queued in arrival order.
+ * Exists while the process has requests queued.
+ */
+struct flash_queue {
+	struct hlist_node hash;
+	struct list_head fifo[FLASH_NR_SYNC];
+	struct list_head rr[FLASH_NR_SYNC];	/* on flash_data.rr_list */
+	pid_t tgid;
+	unsigned int nr_queued;
+};
+
+struct flash_data {
+	/*
+	 * run time data
+	 */
+
+	/* processes with requests of a sync class, served round robin */
+	struct list_head rr_list[FLASH_NR_SYNC];
+	unsigned int rr_served[FLASH_NR_SYNC];	/* by the head process */
+
+	struct list_head async_fifo;
+
+	/* all requests are also sorted by sector, for front merges */
+	struct rb_root sort_list[2];
+
+	struct hlist_head hash[1 << FLASH_HASH_BITS];
+	struct flash_queue oom_queue;	/* used when allocation fails */
+
+	unsigned int queued[FLASH_NR_CLASSES];
+	unsigned int dispatched[FLASH_NR_CLASSES];	/* in this round */
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int quota[FLASH_NR_CLASSES];
+	int sync_write_expire;
+	int async_write_expire;
+	int proc_quantum;
+};
+
+static inline enum flash_class flash_rq_class(struct request *rq)
+{
+	return (enum flash_class)(unsigned long)rq->elevator_private[1];
+}
+
+static inline struct flash_queue *flash_rq_queue(struct request *rq)
+{
+	return rq->elevator_private[0];
+}
+
+static void flash_init_fq(struct flash_queue *fq, pid_t tgid)
+{
+	int i;
+
+	INIT_HLIST_NODE(&fq->hash);
+	for (i = 0; i < FLASH_NR_SYNC; i++) {
+		INIT_LIST_HEAD(&fq->fifo[i]);
+		INIT_LIST_HEAD(&fq->rr[i]);
+	}
+	fq->tgid = tgid;
+	fq->nr_queued = 0;
+}
+
+/*
+ * find the queue of the current process, creating it if needed
+ */
+static struct flash_queue *flash_get_fq(struct flash_data *fd)
+{
+	pid_t tgid = current->tgid;
+	struct hlist_head *head = &fd->hash[hash_long(tgid, FLASH_HASH_BITS)];
+	struct hlist_node *node;
+	struct flash_queue *fq;
+
+	hlist_for_each_entry(fq, node, head, hash)
+		if (fq->tgid == tgid)
+			return fq;
+
+	/* called under the queue lock */
+	fq = kmalloc(sizeof(*fq), GFP_ATOMIC);
+	if (!fq)
+		return &fd->oom_queue;
+
+	flash_init_fq(fq, tgid);
+	hlist_add_head(&fq->hash, head);
+	return fq;
+}
+
+static void flash_put_fq(struct flash_data *fd, struct flash_queue *fq)
+{
+	if (fq->nr_queued || fq == &fd->oom_queue)
+		return;
+
+	hlist_del(&fq->hash);
+	kfree(fq);
+}
+
+/*
+ * add rq to the rbtree and to the fifo of its class
+ */
+static void
+flash_add_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	enum flash_class class;
+	struct flash_queue *fq;
+
+	if (rq_data_dir(rq) == READ)
+		class = FLASH_READ;
+	else if (rq_is_sync(rq))
+		class = FLASH_SYNC_WRITE;
+	else
+		class = FLASH_ASYNC_WRITE;
+	rq->elevator_private[1] = (void *)(unsigned long)class;
+
+	elv_rb_add(&fd->sort_list[rq_data_dir(rq)], rq);
+	fd->queued[class]++;
+
+	if (class == FLASH_ASYNC_WRITE) {
+		rq_set_fifo_time(rq, jiffies + fd->async_write_expire);
+		list_add_tail(&rq->queuelist, &fd->async_fifo);
+		return;
+	}
+
+	/* reads never expire, they go first anyway */
+	rq_set_fifo_time(rq, jiffies + fd->sync_write_expire);
+
+	fq = flash_get_fq(fd);
+	rq->elevator_private[0] = fq;
+	if (list_empty(&fq->fifo[class]))
+		list_add_tail(&fq->rr[class], &fd->rr_list[class]);
+	list_add_tail(&rq->queuelist, &fq->fifo[class]);
+	fq->nr_queued++;
+}
+
+/*
+ * remove rq from the rbtree and its fifo
+ */
+static void flash_remove_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	enum flash_class class = flash_rq_class(rq);
+	struct flash_queue *fq;
+
+	rq_fifo_clear(rq);
+	elv_rb_del(&fd->sort_list[rq_data_dir(rq)], rq);
+	fd->queued[class]--;
+
+	if (class == FLASH_ASYNC_WRITE)
+		return;
+
+	fq = flash_rq_queue(rq);
+	if (list_empty(&fq->fifo[class])) {
+		if (fd->rr_list[class].next == &fq->rr[class])
+			fd->rr_served[class] = 0;
+		list_del_init(&fq->rr[class]);
+	}
+	fq->nr_queued--;
+	flash_put_fq(fd, fq);
+}
+
+/*
+ * do not merge a sync bio into an async request, it would wait with it
+ */
+static int flash_allow_merge(struct request_queue *q, struct request *rq,
+			     struct bio *bio)
+{
+	int bio_sync = bio_data_dir(bio) == READ || (bio->bi_rw & REQ_SYNC);
+
+	return rq_is_sync(rq) == bio_sync;
+}
+
+static int
+flash_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	sector_t sector = bio->bi_sector + bio_sectors(bio);
+	struct request *__rq;
+
+	/*
+	 * check for front merge, the elevator core does the back merges
+	 */
+	__rq = elv_rb_find(&fd->sort_list[bio_data_dir(bio)], sector);
+	if (__rq) {
+		BUG_ON(sector != blk_rq_pos(__rq));
+
+		if (elv_rq_merge_ok(__rq, bio)) {
+			*req = __rq;
+			return ELEVATOR_FRONT_MERGE;
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void flash_merged_request(struct request_queue *q,
+				 struct request *req, int type)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	/*
+	 * if the merge was a front merge, we need to reposition request
+	 */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(&fd->sort_list[rq_data_dir(req)], req);
+		elv_rb_add(&fd->sort_list[rq_data_dir(req)], req);
+	}
+}
+
+static void
+flash_merged_requests(struct request_queue *q, struct request *req,
+		      struct request *next)
+{
+	/*
+	 * if next expires before rq and sits on the same fifo, assign its
+	 * expire time to rq and move into next position in the fifo
+	 */
+	if (flash_rq_class(req) == flash_rq_class(next) &&
+	    flash_rq_queue(req) == flash_rq_queue(next) &&
+	    time_before(rq_fifo_time(next), rq_fifo_time(req))) {
+		list_move(&req->queuelist, &next->queuelist);
+		rq_set_fifo_time(req, rq_fifo_time(next));
+	}
+
+	/*
+	 * kill knowledge of next, this one is a goner
+	 */
+	flash_remove_request(q, next);
+}
+
+static inline int flash_rq_expired(struct request *rq)
+{
+	return time_after(jiffies, rq_fifo_time(rq));
+}
+
+/*
+ * the oldest write that has waited longer than its expire time, if any
+ */
+static struct request *flash_expired_write(struct flash_data *fd,
+					   enum flash_class *class)
+{
+	struct flash_queue *fq;
+	struct request *rq;
+
+	if (fd->queued[FLASH_ASYNC_WRITE]) {
+		rq = rq_entry_fifo(fd->async_fifo.next);
+		if (flash_rq_expired(rq)) {
+			*class = FLASH_ASYNC_WRITE;
+			return rq;
+		}
+	}
+
+	list_for_each_entry(fq, &fd->rr_list[FLASH_SYNC_WRITE],
+			    rr[FLASH_SYNC_WRITE]) {
+		rq = rq_entry_fifo(fq->fifo[FLASH_SYNC_WRITE].next);
+		if (flash_rq_expired(rq)) {
+			*class = FLASH_SYNC_WRITE;
+			return rq;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Classes are served in order, each up to its quota in a round. Once every
+ * class with requests queued has used its quota, a new round starts. So
+ * reads go first, but cannot hold writes back for more than a round, and
+ * expired writes go before anything else.
+ */
+static struct request *flash_choose_request(struct flash_data *fd)
+{
+	enum flash_class class;
+	struct flash_queue *fq;
+	struct request *rq;
+
+	rq = flash_expired_write(fd, &class);
+	if (rq)
+		goto found;
+
+	for (class = 0; class < FLASH_NR_CLASSES; class++)
+		if (fd->queued[class] &&
+		    fd->dispatched[class] < fd->quota[class])
+			goto pick;
+
+	memset(fd->dispatched, 0, sizeof(fd->dispatched));
+
+	for (class = 0; class < FLASH_NR_CLASSES; class++)
+		if (fd->queued[class])
+			goto pick;
+
+	return NULL;
+
+pick:
+	if (class == FLASH_ASYNC_WRITE) {
+		rq = rq_entry_fifo(fd->async_fifo.next);
+		goto found;
+	}
+
+	fq = list_first_entry(&fd->rr_list[class], struct flash_queue,
+			      rr[class]);
+	rq = rq_entry_fifo(fq->fifo[class].next);
+
+	/* after its quantum, the process goes behind the others */
+	if (++fd->rr_served[class] >= fd->proc_quantum) {
+		list_move_tail(&fq->rr[class], &fd->rr_list[class]);
+		fd->rr_served[class] = 0;
+	}
+
+found:
+	fd->dispatched[class]++;
+	return rq;
+}
+
+/*
+ * there is no idling: as long as something is queued, it is dispatched
+ */
+static int flash_dispatch_requests(struct request_queue *q, int force)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	struct request *rq;
+	int dispatched = 0;
+
+	while ((rq = flash_choose_request(fd))) {
+		flash_remove_request(q, rq);
+		elv_dispatch_add_tail(q, rq);
+		dispatched++;
+
+		if (!force)
+			break;
+	}
+
+	return dispatched;
+}
+
+static void flash_exit_queue(struct elevator_queue *e)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	BUG_ON(fd->queued[FLASH_READ]);
+	BUG_ON(fd->queued[FLASH_SYNC_WRITE]);
+	BUG_ON(fd->queued[FLASH_ASYNC_WRITE]);
+
+	kfree(fd);
+}
+
+/*
+ * initialize elevator private data (flash_data).
+ */
+static void *flash_init_queue(struct request_queue *q)
+{
+	struct flash_data *fd;
+	int i;
+
+	fd = kmalloc_node(sizeof(*fd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!fd)
+		return NULL;
+
+	for (i = 0; i < FLASH_NR_SYNC; i++)
+		INIT_LIST_HEAD(&fd->rr_list[i]);
+	INIT_LIST_HEAD(&fd->async_fifo);
+	fd->sort_list[READ] = RB_ROOT;
+	fd->sort_list[WRITE] = RB_ROOT;
+	for (i = 0; i < (1 << FLASH_HASH_BITS); i++)
+		INIT_HLIST_HEAD(&fd->hash[i]);
+	flash_init_fq(&fd->oom_queue, 0);
+
+	fd->quota[FLASH_READ] = read_quota;
+	fd->quota[FLASH_SYNC_WRITE] = sync_write_quota;
+	fd->quota[FLASH_ASYNC_WRITE] = async_write_quota;
+	fd->sync_write_expire = sync_write_expire;
+	fd->async_write_expire = async_write_expire;
+	fd->proc_quantum = proc_quantum;
+	return fd;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+flash_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+flash_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return flash_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(flash_read_quota_show, fd->quota[FLASH_READ], 0);
+SHOW_FUNCTION(flash_sync_write_quota_show, fd->quota[FLASH_SYNC_WRITE], 0);
+SHOW_FUNCTION(flash_async_write_quota_show, fd->quota[FLASH_ASYNC_WRITE], 0);
+SHOW_FUNCTION(flash_sync_write_expire_show, fd->sync_write_expire, 1);
+SHOW_FUNCTION(flash_async_write_expire_show, fd->async_write_expire, 1);
+SHOW_FUNCTION(flash_proc_quantum_show, fd->proc_quantum, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data;							\
+	int ret = flash_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(flash_read_quota_store, &fd->quota[FLASH_READ], 1, INT_MAX, 0);
+STORE_FUNCTION(flash_sync_write_quota_store, &fd->quota[FLASH_SYNC_WRITE], 1, INT_MAX, 0);
+STORE_FUNCTION(flash_async_write_quota_store, &fd->quota[FLASH_ASYNC_WRITE], 1, INT_MAX, 0);
+STORE_FUNCTION(flash_sync_write_expire_store, &fd->sync_write_expire, 0, INT_MAX, 1);
+STORE_FUNCTION(flash_async_write_expire_store, &fd->async_write_expire, 0, INT_MAX, 1);
+STORE_FUNCTION(flash_proc_quantum_store, &fd->proc_quantum, 1, INT_MAX, 0);
+#undef STORE_FUNCTION
+
+#define FL_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, flash_##name##_show, \
+				      flash_##name##_store)
+
+static struct elv_fs_entry flash_attrs[] = {
+	FL_ATTR(read_quota),
+	FL_ATTR(sync_write_quota),
+	FL_ATTR(async_write_quota),
+	FL_ATTR(sync_write_expire),
+	FL_ATTR(async_write_expire),
+	FL_ATTR(proc_quantum),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_flash = {
+	.ops = {
+		.elevator_merge_fn = 		flash_merge,
+		.elevator_merged_fn =		flash_merged_request,
+		.elevator_merge_req_fn =	flash_merged_requests,
+		.elevator_allow_merge_fn =	flash_allow_merge,
+		.elevator_dispatch_fn =		flash_dispatch_requests,
+		.elevator_add_req_fn =		flash_add_request,
+		.elevator_former_req_fn =	elv_rb_former_request,
+		.elevator_latter_req_fn =	elv_rb_latter_request,
+		.elevator_init_fn =		flash_init_queue,
+		.elevator_exit_fn =		flash_exit_queue,
+	},
+
+	.elevator_attrs = flash_attrs,
+	.elevator_name = "flash",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init flash_init(void)
+{
+	elv_register(&iosched_flash);
+
+	return 0;
+}
+
+static void __exit flash_exit(void)
+{
+	elv_unregister(&iosched_flash);
+}
+
+module_init(flash_init);
+module_exit(flash_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("flash IO scheduler");
@@ -0,0 +1,181 @@
+/*
+ * Null block device driver.
+ *
+ * Completes every request it is given without moving any data, so that
+ * what is measured on top of it is the cost of the block layer itself,
+ * e.g. how submission scales with the number of cpus.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+
+struct nullb {
+	struct list_head	list;
+	unsigned int		index;
+	struct request_queue	*q;
+	struct gendisk		*disk;
+	spinlock_t		lock;
+};
+
+static LIST_HEAD(nullb_list);
+static int null_major;
+
+enum {
+	NULL_IRQ_NONE	= 0,
+	NULL_IRQ_SOFTIRQ = 1,
+};
+
+static int nr_devices = 1;
+module_param(nr_devices, int, S_IRUGO);
+MODULE_PARM_DESC(nr_devices, "Number of devices to register");
+
+static int gb = 250;
+module_param(gb, int, S_IRUGO);
+MODULE_PARM_DESC(gb, "Size in GB");
+
+static int bs = 512;
+module_param(bs, int, S_IRUGO);
+MODULE_PARM_DESC(bs, "Block size (in bytes)");
+
+static int irqmode = NULL_IRQ_SOFTIRQ;
+module_param(irqmode, int, S_IRUGO);
+MODULE_PARM_DESC(irqmode, "IRQ completion handler. 0-none, 1-softirq");
+
+static bool sw_stage;
+module_param(sw_stage, bool, S_IRUGO);
+MODULE_PARM_DESC(sw_stage, "Stage plugged requests per cpu (queue/sw_stage)");
+
+static void null_softirq_done_fn(struct request *rq)
+{
+	blk_end_request_all(rq, 0);
+}
+
+static void null_request_fn(struct request_queue *q)
+{
+	struct request *rq;
+
+	while ((rq = blk_fetch_request(q)) != NULL) {
+		if (irqmode == NULL_IRQ_SOFTIRQ)
+			blk_complete_request(rq);
+		else
+			__blk_end_request_all(rq, 0);
+	}
+}
+
+static const struct block_device_operations null_fops = {
+	.owner =	THIS_MODULE,
+};
+
+static void null_del_dev(struct nullb *nullb)
+{
+	list_del_init(&nullb->list);
+
+	del_gendisk(nullb->disk);
+	blk_cleanup_queue(nullb->q);
+	put_disk(nullb->disk);
+	kfree(nullb);
+}
+
+static int null_add_dev(unsigned int index)
+{
+	struct gendisk *disk;
+	struct nullb *nullb;
+	sector_t size;
+
+	nullb = kzalloc(sizeof(*nullb), GFP_KERNEL);
+	if (!nullb)
+		goto out;
+
+	nullb->index = index;
+	spin_lock_init(&nullb->lock);
+
+	nullb->q = blk_init_queue(null_request_fn, &nullb->lock);
+	if (!nullb->q)
+		goto out_free_nullb;
+
+	nullb->q->queuedata = nullb;
+	blk_queue_logical_block_size(nullb->q, bs);
+	blk_queue_physical_block_size(nullb->q, bs);
+	blk_queue_softirq_done(nullb->q, null_softirq_done_fn);
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
+	queue_flag_clear_unlocked(QUEUE_FLAG_ADD_RANDOM, nullb->q);
+	if (sw_stage)
+		queue_flag_set_unlocked(QUEUE_FLAG_SW_STAGE, nullb->q);
+
+	disk = nullb->disk = alloc_disk(1);
+	if (!disk)
+		goto out_cleanup_queue;
+
+	size = (sector_t)gb * 1024 * 1024 * 1024;
+	set_capacity(disk, size >> 9);
+
+	disk->major		= null_major;
+	disk->first_minor	= index;
+	disk->fops		= &null_fops;
+	disk->private_data	= nullb;
+	disk->queue		= nullb->q;
+	disk->flags |= GENHD_FL_SUPPRESS_PARTITION_INFO;
+	sprintf(disk->disk_name, "nullb%d", index);
+
+	list_add_tail(&nullb->list, &nullb_list);
+	add_disk(disk);
+	return 0;
+
+out_cleanup_queue:
+	blk_cleanup_queue(nullb->q);
+out_free_nullb:
+	kfree(nullb);
+out:
+	return -ENOMEM;
+}
+
+static int __init null_init(void)
+{
+	struct nullb *nullb, *next;
+	unsigned int i;
+
+	if (bs < 512 || bs > PAGE_SIZE || !is_power_of_2(bs)) {
+		printk(KERN_WARNING "null_blk: invalid block size %d\n", bs);
+		return -EINVAL;
+	}
+	if (nr_devices <= 0 || nr_devices > (1 << MINORBITS))
+		return -EINVAL;
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0)
+		return null_major;
+
+	for (i = 0; i < nr_devices; i++) {
+		if (null_add_dev(i))
+			goto out_del;
+	}
+
+	printk(KERN_INFO "null_blk: module loaded\n");
+	return 0;
+
+out_del:
+	list_for_each_entry_safe(nullb, next, &nullb_list, list)
+		null_del_dev(nullb);
+	unregister_blkdev(null_major, "nullb");
+	return -ENOMEM;
+}
+
+static void __exit null_exit(void)
+{
+	struct nullb *nullb, *next;
+
+	list_for_each_entry_safe(nullb, next, &nullb_list, list)
+		null_del_dev(nullb);
+	unregister_blkdev(null_major, "nullb");
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("null block device");
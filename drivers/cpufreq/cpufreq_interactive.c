@@ -35,6 +35,8 @@
 #define CREATE_TRACE_POINTS
 #include <trace/events/cpufreq_interactive.h>
 
+#include "cpufreq_interactive.h"
+
 static atomic_t active_count = ATOMIC_INIT(0);
 
 struct cpufreq_interactive_cpuinfo {
@@ -86,37 +88,19 @@ struct cpufreq_interactive_core_lock {
 static struct cpufreq_interactive_core_lock core_lock;
 
 
-/* Hi speed to bump to from lo speed when load burst (default max) */
-static u64 hispeed_freq;
+/* Decision tunables, see cpufreq_interactive.h */
+static struct cpufreq_interactive_tunables tunables;
 
 /* Boost frequency by boost_factor when CPU load at or above this value. */
 #define DEFAULT_GO_MAXSPEED_LOAD 85
-static unsigned long go_maxspeed_load;
 
 /* Go to hispeed_freq when CPU load at or above this value. */
 #define DEFAULT_GO_HISPEED_LOAD 85
-static unsigned long go_hispeed_load;
-
-/* Base of exponential raise to max speed; if 0 - jump to maximum */
-static unsigned long boost_factor;
-
-/* Max frequency boost in Hz; if 0 - no max is enforced */
-static unsigned long max_boost;
-
-/* Consider IO as busy */
-static unsigned long io_is_busy;
-
-/*
- * Targeted sustainable load relatively to current frequency.
- * If 0, target is set realtively to the max speed
- */
-static unsigned long sustain_load;
 
 /*
  * The minimum amount of time to spend at a frequency before we can ramp down.
  */
 #define DEFAULT_MIN_SAMPLE_TIME 30000;
-static unsigned long min_sample_time;
 
 /*
  * The sample rate of the timer used to increase frequency
@@ -129,7 +113,6 @@ static unsigned long timer_rate;
  * timer interval.
  */
 #define DEFAULT_ABOVE_HISPEED_DELAY DEFAULT_TIMER_RATE
-static unsigned long above_hispeed_delay_val;
 
 /*
  * Boost pulse to hispeed on touchscreen input.
@@ -143,11 +126,6 @@ struct cpufreq_interactive_inputopen {
 
 static struct cpufreq_interactive_inputopen inputopen;
 
-/*
- * Non-zero means longer-term speed boost active.
- */
-static int boost_val;
-
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event);
 
@@ -161,75 +139,6 @@ struct cpufreq_governor cpufreq_gov_interactive = {
 	.owner = THIS_MODULE,
 };
 
-static unsigned int cpufreq_interactive_get_target(
-	int cpu_load, int load_since_change,
-	struct cpufreq_interactive_cpuinfo *pcpu)
-{
-	unsigned int target_freq;
-
-	/*
-	 * Choose greater of short-term load (since last idle timer
-	 * started or timer function re-armed itself) or long-term load
-	 * (since last frequency change).
-	 */
-	if (load_since_change > cpu_load)
-		cpu_load = load_since_change;
-
-	/* Exponential boost policy */
-	if (boost_factor) {
-
-		if (cpu_load >= go_maxspeed_load) {
-			target_freq = pcpu->policy->cur * boost_factor;
-
-			if (max_boost &&
-				target_freq > pcpu->policy->cur + max_boost)
-
-				target_freq = pcpu->policy->cur + max_boost;
-		} else {
-
-			if (!sustain_load)
-				sustain_load = 100;
-
-			target_freq =
-				(pcpu->policy->cur * cpu_load / sustain_load);
-		}
-
-		goto done;
-	}
-
-	/* Jump boost policy */
-	if (cpu_load >= go_hispeed_load || boost_val) {
-		if (pcpu->target_freq <= pcpu->policy->min) {
-			target_freq = hispeed_freq;
-		} else {
-			target_freq = pcpu->policy->max * cpu_load / 100;
-
-			if (target_freq < hispeed_freq)
-				target_freq = hispeed_freq;
-
-			if (pcpu->target_freq == hispeed_freq &&
-			    target_freq > hispeed_freq &&
-			    cputime64_sub(pcpu->timer_run_time,
-					  pcpu->freq_change_time)
-			    < above_hispeed_delay_val) {
-
-				target_freq = pcpu->target_freq;
-				trace_cpufreq_interactive_notyet(
-							smp_processor_id(),
-							cpu_load,
-							pcpu->target_freq,
-							target_freq);
-			}
-		}
-	} else {
-		target_freq = pcpu->policy->max * cpu_load / 100;
-	}
-
-done:
-	target_freq = min(target_freq, pcpu->policy->max);
-	return target_freq;
-}
-
 static inline cputime64_t get_cpu_iowait_time(
 	unsigned int cpu, cputime64_t *wall)
 {
@@ -258,6 +167,7 @@ static void cpufreq_interactive_timer(unsigned long data)
 	unsigned int new_freq;
 	unsigned int index;
 	unsigned long flags;
+	int notyet;
 
 	smp_rmb();
 
@@ -295,14 +205,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 	if (delta_time < 1000)
 		goto rearm;
 
-	if (delta_idle > delta_time)
-		cpu_load = 0;
-	else {
-		if (io_is_busy && delta_idle >= delta_iowait)
-			delta_idle -= delta_iowait;
-
-		cpu_load = 100 * (delta_time - delta_idle) / delta_time;
-	}
+	cpu_load = cpufreq_interactive_load(&tunables, delta_time, delta_idle,
+					    delta_iowait);
 
 	delta_idle = (unsigned int) cputime64_sub(now_idle,
 						pcpu->freq_change_time_in_idle);
@@ -311,15 +215,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 	delta_time = (unsigned int) cputime64_sub(pcpu->timer_run_time,
 						  pcpu->freq_change_time);
 
-	if ((delta_time == 0) || (delta_idle > delta_time))
-		load_since_change = 0;
-	else {
-		if (io_is_busy && delta_idle >= delta_iowait)
-			delta_idle -= delta_iowait;
-
-		load_since_change =
-			100 * (delta_time - delta_idle) / delta_time;
-	}
+	load_since_change = cpufreq_interactive_load(&tunables, delta_time,
+						     delta_idle, delta_iowait);
 
 	/*
 	 * Combine short-term load (since last idle timer started or timer
@@ -328,8 +225,15 @@ static void cpufreq_interactive_timer(unsigned long data)
 	 *
 	 * This function implements the cpufreq scaling policy
 	 */
-	new_freq = cpufreq_interactive_get_target(cpu_load, load_since_change,
-						pcpu);
+	new_freq = cpufreq_interactive_get_target(&tunables,
+			cpu_load, load_since_change, pcpu->policy->cur,
+			pcpu->policy->min, pcpu->policy->max, pcpu->target_freq,
+			cputime64_sub(pcpu->timer_run_time,
+				      pcpu->freq_change_time), &notyet);
+	if (notyet)
+		trace_cpufreq_interactive_notyet(data,
+				max(cpu_load, load_since_change),
+				pcpu->target_freq, pcpu->target_freq);
 
 	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
 					   new_freq, CPUFREQ_RELATION_H,
@@ -345,15 +249,12 @@ static void cpufreq_interactive_timer(unsigned long data)
 	 * Do not scale below floor_freq unless we have been at or above the
 	 * floor frequency for the minimum sample time since last validated.
 	 */
-	if (new_freq < pcpu->floor_freq) {
-		if (cputime64_sub(pcpu->timer_run_time,
-				  pcpu->floor_validate_time)
-		    < min_sample_time) {
-
-			trace_cpufreq_interactive_notyet(data, cpu_load,
-					pcpu->target_freq, new_freq);
-			goto rearm;
-		}
+	if (!cpufreq_interactive_floor_ok(&tunables, new_freq, pcpu->floor_freq,
+			cputime64_sub(pcpu->timer_run_time,
+				      pcpu->floor_validate_time))) {
+		trace_cpufreq_interactive_notyet(data, cpu_load,
+				pcpu->target_freq, new_freq);
+		goto rearm;
 	}
 
 	pcpu->floor_freq = new_freq;
@@ -633,8 +534,8 @@ static void cpufreq_interactive_boost(void)
 	for_each_online_cpu(i) {
 		pcpu = &per_cpu(cpuinfo, i);
 
-		if (pcpu->target_freq < hispeed_freq) {
-			pcpu->target_freq = hispeed_freq;
+		if (pcpu->target_freq < tunables.hispeed_freq) {
+			pcpu->target_freq = tunables.hispeed_freq;
 			cpumask_set_cpu(i, &up_cpumask);
 			anyboost = 1;
 		}
@@ -643,7 +544,7 @@ static void cpufreq_interactive_boost(void)
 		 * validated.
 		 */
 
-		pcpu->floor_freq = hispeed_freq;
+		pcpu->floor_freq = tunables.hispeed_freq;
 		pcpu->floor_validate_time = ktime_to_us(ktime_get());
 	}
 
@@ -833,7 +734,7 @@ static struct input_handler cpufreq_interactive_input_handler = {
 static ssize_t show_go_maxspeed_load(struct kobject *kobj,
 				     struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", go_maxspeed_load);
+	return sprintf(buf, "%lu\n", tunables.go_maxspeed_load);
 }
 
 static ssize_t store_go_maxspeed_load(struct kobject *kobj,
@@ -845,7 +746,7 @@ static ssize_t store_go_maxspeed_load(struct kobject *kobj,
 	ret = strict_strtoul(buf, 0, &val);
 	if (ret < 0)
 		return ret;
-	go_maxspeed_load = val;
+	tunables.go_maxspeed_load = val;
 	return count;
 }
 
@@ -855,7 +756,7 @@ static struct global_attr go_maxspeed_load_attr = __ATTR(go_maxspeed_load, 0644,
 static ssize_t show_boost_factor(struct kobject *kobj,
 				     struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", boost_factor);
+	return sprintf(buf, "%lu\n", tunables.boost_factor);
 }
 
 static ssize_t store_boost_factor(struct kobject *kobj,
@@ -867,7 +768,7 @@ static ssize_t store_boost_factor(struct kobject *kobj,
 	ret = strict_strtoul(buf, 0, &val);
 	if (ret < 0)
 		return ret;
-	boost_factor = val;
+	tunables.boost_factor = val;
 	return count;
 }
 
@@ -877,13 +778,13 @@ static struct global_attr boost_factor_attr = __ATTR(boost_factor, 0644,
 static ssize_t show_io_is_busy(struct kobject *kobj,
 				     struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", io_is_busy);
+	return sprintf(buf, "%lu\n", tunables.io_is_busy);
 }
 
 static ssize_t store_io_is_busy(struct kobject *kobj,
 			struct attribute *attr, const char *buf, size_t count)
 {
-	if (!strict_strtoul(buf, 0, &io_is_busy))
+	if (!strict_strtoul(buf, 0, &tunables.io_is_busy))
 		return count;
 	return -EINVAL;
 }
@@ -894,7 +795,7 @@ static struct global_attr io_is_busy_attr = __ATTR(io_is_busy, 0644,
 static ssize_t show_sustain_load(struct kobject *kobj,
 				     struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", sustain_load);
+	return sprintf(buf, "%lu\n", tunables.sustain_load);
 }
 
 static ssize_t store_sustain_load(struct kobject *kobj,
@@ -906,7 +807,7 @@ static ssize_t store_sustain_load(struct kobject *kobj,
 	ret = strict_strtoul(buf, 0, &val);
 	if (ret < 0)
 		return ret;
-	sustain_load = val;
+	tunables.sustain_load = val;
 	return count;
 }
 
@@ -916,7 +817,7 @@ static struct global_attr sustain_load_attr = __ATTR(sustain_load, 0644,
 static ssize_t show_max_boost(struct kobject *kobj,
 				     struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", max_boost);
+	return sprintf(buf, "%lu\n", tunables.max_boost);
 }
 
 static ssize_t store_max_boost(struct kobject *kobj,
@@ -928,7 +829,7 @@ static ssize_t store_max_boost(struct kobject *kobj,
 	ret = strict_strtoul(buf, 0, &val);
 	if (ret < 0)
 		return ret;
-	max_boost = val;
+	tunables.max_boost = val;
 	return count;
 }
 
@@ -938,7 +839,7 @@ static struct global_attr max_boost_attr = __ATTR(max_boost, 0644,
 static ssize_t show_hispeed_freq(struct kobject *kobj,
 				 struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%llu\n", hispeed_freq);
+	return sprintf(buf, "%llu\n", tunables.hispeed_freq);
 }
 
 static ssize_t store_hispeed_freq(struct kobject *kobj,
@@ -951,7 +852,7 @@ static ssize_t store_hispeed_freq(struct kobject *kobj,
 	ret = strict_strtoull(buf, 0, &val);
 	if (ret < 0)
 		return ret;
-	hispeed_freq = val;
+	tunables.hispeed_freq = val;
 	return count;
 }
 
@@ -962,7 +863,7 @@ static struct global_attr hispeed_freq_attr = __ATTR(hispeed_freq, 0644,
 static ssize_t show_go_hispeed_load(struct kobject *kobj,
 				     struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", go_hispeed_load);
+	return sprintf(buf, "%lu\n", tunables.go_hispeed_load);
 }
 
 static ssize_t store_go_hispeed_load(struct kobject *kobj,
@@ -974,7 +875,7 @@ static ssize_t store_go_hispeed_load(struct kobject *kobj,
 	ret = strict_strtoul(buf, 0, &val);
 	if (ret < 0)
 		return ret;
-	go_hispeed_load = val;
+	tunables.go_hispeed_load = val;
 	return count;
 }
 
@@ -984,7 +885,7 @@ static struct global_attr go_hispeed_load_attr = __ATTR(go_hispeed_load, 0644,
 static ssize_t show_min_sample_time(struct kobject *kobj,
 				struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", min_sample_time);
+	return sprintf(buf, "%lu\n", tunables.min_sample_time);
 }
 
 static ssize_t store_min_sample_time(struct kobject *kobj,
@@ -996,7 +897,7 @@ static ssize_t store_min_sample_time(struct kobject *kobj,
 	ret = strict_strtoul(buf, 0, &val);
 	if (ret < 0)
 		return ret;
-	min_sample_time = val;
+	tunables.min_sample_time = val;
 	return count;
 }
 
@@ -1006,7 +907,7 @@ static struct global_attr min_sample_time_attr = __ATTR(min_sample_time, 0644,
 static ssize_t show_above_hispeed_delay(struct kobject *kobj,
 					struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", above_hispeed_delay_val);
+	return sprintf(buf, "%lu\n", tunables.above_hispeed_delay);
 }
 
 static ssize_t store_above_hispeed_delay(struct kobject *kobj,
@@ -1019,7 +920,7 @@ static ssize_t store_above_hispeed_delay(struct kobject *kobj,
 	ret = strict_strtoul(buf, 0, &val);
 	if (ret < 0)
 		return ret;
-	above_hispeed_delay_val = val;
+	tunables.above_hispeed_delay = val;
 	return count;
 }
 
@@ -1113,7 +1014,7 @@ define_one_global_rw(input_boost);
 static ssize_t show_boost(struct kobject *kobj, struct attribute *attr,
 			  char *buf)
 {
-	return sprintf(buf, "%d\n", boost_val);
+	return sprintf(buf, "%d\n", tunables.boost);
 }
 
 static ssize_t store_boost(struct kobject *kobj, struct attribute *attr,
@@ -1126,13 +1027,13 @@ static ssize_t store_boost(struct kobject *kobj, struct attribute *attr,
 	if (ret < 0)
 		return ret;
 
-	boost_val = val;
+	tunables.boost = val;
 
-	if (boost_val)
+	if (tunables.boost)
 		cpufreq_interactive_boost();
 
-	if (!boost_val)
-		trace_cpufreq_interactive_unboost(hispeed_freq);
+	if (!tunables.boost)
+		trace_cpufreq_interactive_unboost(tunables.hispeed_freq);
 
 	return count;
 }
@@ -1200,8 +1101,8 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			smp_wmb();
 		}
 
-		if (!hispeed_freq)
-			hispeed_freq = policy->max;
+		if (!tunables.hispeed_freq)
+			tunables.hispeed_freq = policy->max;
 
 		/*
 		 * Do not register the idle hook and create sysfs
@@ -1286,10 +1187,10 @@ static int __init cpufreq_interactive_init(void)
 	struct cpufreq_interactive_cpuinfo *pcpu;
 	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
 
-	go_maxspeed_load = DEFAULT_GO_MAXSPEED_LOAD;
-	go_hispeed_load = DEFAULT_GO_HISPEED_LOAD;
-	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
-	above_hispeed_delay_val = DEFAULT_ABOVE_HISPEED_DELAY;
+	tunables.go_maxspeed_load = DEFAULT_GO_MAXSPEED_LOAD;
+	tunables.go_hispeed_load = DEFAULT_GO_HISPEED_LOAD;
+	tunables.min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
+	tunables.above_hispeed_delay = DEFAULT_ABOVE_HISPEED_DELAY;
 	timer_rate = DEFAULT_TIMER_RATE;
 
 	/* Initalize per-cpu timers */
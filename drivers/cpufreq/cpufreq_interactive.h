@@ -0,0 +1,164 @@
+/*
+ * drivers/cpufreq/cpufreq_interactive.h
+ *
+ * Copyright (C) 2010 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * The load and frequency decisions of the interactive governor. These are
+ * also built into tools/power/cpufreq-interactive-sim, which replays
+ * recorded traces through them, so this file must not use anything but the
+ * u64 type and min(), which the includer provides. Times are in us and
+ * frequencies in kHz.
+ */
+
+#ifndef _CPUFREQ_INTERACTIVE_H
+#define _CPUFREQ_INTERACTIVE_H
+
+struct cpufreq_interactive_tunables {
+	/* Hi speed to bump to from lo speed when load burst (default max) */
+	u64 hispeed_freq;
+
+	/* Boost frequency by boost_factor when CPU load at or above this
+	 * value. */
+	unsigned long go_maxspeed_load;
+
+	/* Go to hispeed_freq when CPU load at or above this value. */
+	unsigned long go_hispeed_load;
+
+	/* Base of exponential raise to max speed; if 0 - jump to maximum */
+	unsigned long boost_factor;
+
+	/* Max frequency boost in Hz; if 0 - no max is enforced */
+	unsigned long max_boost;
+
+	/* Consider IO as busy */
+	unsigned long io_is_busy;
+
+	/*
+	 * Targeted sustainable load relatively to current frequency.
+	 * If 0, target is set realtively to the max speed
+	 */
+	unsigned long sustain_load;
+
+	/*
+	 * The minimum amount of time to spend at a frequency before we can
+	 * ramp down.
+	 */
+	unsigned long min_sample_time;
+
+	/* Wait this long before raising speed above hispeed. */
+	unsigned long above_hispeed_delay;
+
+	/* Non-zero means longer-term speed boost active. */
+	int boost;
+};
+
+/*
+ * Load in percent over a sample of delta_time, of which the CPU spent
+ * delta_idle idle, delta_iowait of that waiting for I/O.
+ */
+static inline int cpufreq_interactive_load(
+	const struct cpufreq_interactive_tunables *t,
+	unsigned int delta_time, unsigned int delta_idle,
+	unsigned int delta_iowait)
+{
+	if (delta_time == 0 || delta_idle > delta_time)
+		return 0;
+
+	if (t->io_is_busy && delta_idle >= delta_iowait)
+		delta_idle -= delta_iowait;
+
+	return 100 * (delta_time - delta_idle) / delta_time;
+}
+
+/*
+ * Target frequency for a CPU running at cur within [min_freq, max_freq],
+ * whose current target is target_freq and last changed since_change ago.
+ * Sets *notyet if above_hispeed_delay held the target at hispeed_freq.
+ */
+static inline unsigned int cpufreq_interactive_get_target(
+	const struct cpufreq_interactive_tunables *t,
+	int cpu_load, int load_since_change,
+	unsigned int cur, unsigned int min_freq, unsigned int max_freq,
+	unsigned int target_freq, u64 since_change, int *notyet)
+{
+	unsigned int new_freq;
+
+	*notyet = 0;
+
+	/*
+	 * Choose greater of short-term load (since last idle timer
+	 * started or timer function re-armed itself) or long-term load
+	 * (since last frequency change).
+	 */
+	if (load_since_change > cpu_load)
+		cpu_load = load_since_change;
+
+	/* Exponential boost policy */
+	if (t->boost_factor) {
+
+		if (cpu_load >= t->go_maxspeed_load) {
+			new_freq = cur * t->boost_factor;
+
+			if (t->max_boost &&
+				new_freq > cur + t->max_boost)
+
+				new_freq = cur + t->max_boost;
+		} else {
+			unsigned long sustain_load = t->sustain_load;
+
+			if (!sustain_load)
+				sustain_load = 100;
+
+			new_freq = (cur * cpu_load / sustain_load);
+		}
+
+		goto done;
+	}
+
+	/* Jump boost policy */
+	if (cpu_load >= t->go_hispeed_load || t->boost) {
+		if (target_freq <= min_freq) {
+			new_freq = t->hispeed_freq;
+		} else {
+			new_freq = max_freq * cpu_load / 100;
+
+			if (new_freq < t->hispeed_freq)
+				new_freq = t->hispeed_freq;
+
+			if (target_freq == t->hispeed_freq &&
+			    new_freq > t->hispeed_freq &&
+			    since_change < t->above_hispeed_delay) {
+				new_freq = target_freq;
+				*notyet = 1;
+			}
+		}
+	} else {
+		new_freq = max_freq * cpu_load / 100;
+	}
+
+done:
+	return min(new_freq, max_freq);
+}
+
+/*
+ * Whether the target may be set to new_freq: it must not go below
+ * floor_freq until min_sample_time after the floor was last validated,
+ * since_floor ago.
+ */
+static inline int cpufreq_interactive_floor_ok(
+	const struct cpufreq_interactive_tunables *t,
+	unsigned int new_freq, unsigned int floor_freq, u64 since_floor)
+{
+	return new_freq >= floor_freq || since_floor >= t->min_sample_time;
+}
+
+#endif
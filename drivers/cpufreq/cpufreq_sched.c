@@ -0,0 +1,561 @@
+/*
+ * drivers/cpufreq/cpufreq_sched.c
+ *
+ * Scheduler driven cpufreq governor.
+ *
+ * The fair scheduling class reports each enqueue, dequeue and tick through
+ * cpufreq_sched_update(). From those the governor keeps a decayed
+ * utilization of every cpu (the share of time its CFS runqueue had work,
+ * with a half-life of UTIL_HALFLIFE periods of about 1ms) and turns it into
+ * the lowest table frequency that leaves 'headroom' percent of capacity
+ * spare. A cpu going idle wants the policy minimum.
+ *
+ * The scheduler can't wake a task while holding a runqueue lock, so the
+ * update only records what the cpu wants; cpufreq_sched_kick(), called by
+ * the scheduler once the locks are dropped, wakes the kthread that sets the
+ * frequencies. Raising the frequency is bounded by up_rate_limit_us,
+ * lowering it by down_rate_limit_us since the last change of that cpu.
+ *
+ * With 'compare' set the utilization is also tracked on cpus run by other
+ * governors, and what this one would have chosen there is accounted in
+ * stats/compare_time_in_state next to the real time_in_state.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/cpufreq.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+
+#define UTIL_SHIFT		10
+#define UTIL_SCALE		(1UL << UTIL_SHIFT)
+
+/* utilization halves every UTIL_HALFLIFE periods of 2^20ns without work */
+#define UTIL_PERIOD_SHIFT	20
+#define UTIL_HALFLIFE		8
+/* (1 - 2^(-1/UTIL_HALFLIFE)) * UTIL_SCALE, the step of one period */
+#define UTIL_PERIOD_STEP	85
+
+#define DEFAULT_UP_RATE_LIMIT	500
+#define DEFAULT_DOWN_RATE_LIMIT	20000
+#define DEFAULT_HEADROOM	25
+
+/* 2^(-n/UTIL_HALFLIFE) in 16 bit fixed point */
+static const u32 util_decay[UTIL_HALFLIFE] = {
+	65536, 60097, 55109, 50535, 46341, 42495, 38968, 35734,
+};
+
+struct cpufreq_sched_cpu {
+	/* written by the scheduler, under the runqueue lock */
+	u64 last_update;
+	unsigned long util;
+	unsigned long nr_running;
+	unsigned int want_freq;
+	int pending;
+
+	/* written under sched_mutex */
+	int active;
+	struct cpufreq_policy *policy;	/* NULL in compare mode */
+	struct cpufreq_frequency_table *freq_table;
+	unsigned int min_freq;
+	unsigned int max_freq;
+	unsigned int cur_freq;
+	ktime_t last_change;
+};
+
+static DEFINE_PER_CPU(struct cpufreq_sched_cpu, sched_cpu);
+
+int cpufreq_sched_enabled __read_mostly;
+static atomic_t kick_pending = ATOMIC_INIT(0);
+static int timer_armed;
+
+static struct task_struct *sched_task;
+static DEFINE_MUTEX(sched_mutex);
+
+static unsigned long up_rate_limit_us = DEFAULT_UP_RATE_LIMIT;
+static unsigned long down_rate_limit_us = DEFAULT_DOWN_RATE_LIMIT;
+static unsigned long headroom = DEFAULT_HEADROOM;
+static unsigned long compare;
+
+static int cpufreq_governor_sched(struct cpufreq_policy *policy,
+		unsigned int event);
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHED
+static
+#endif
+struct cpufreq_governor cpufreq_gov_sched = {
+	.name = "sched",
+	.governor = cpufreq_governor_sched,
+	.max_transition_latency = 10000000,
+	.owner = THIS_MODULE,
+};
+
+static unsigned long util_decay_periods(unsigned long val, u64 periods)
+{
+	if (periods >= UTIL_HALFLIFE * UTIL_SHIFT)
+		return 0;
+
+	val >>= (unsigned int)periods / UTIL_HALFLIFE;
+	return (val * util_decay[(unsigned int)periods % UTIL_HALFLIFE]) >> 16;
+}
+
+/*
+ * Move the utilization towards 0 or UTIL_SCALE, depending on whether the
+ * runqueue had work, for the time since the last update: whole periods
+ * geometrically, the rest of a period linearly.
+ */
+static void sched_util_update(struct cpufreq_sched_cpu *sc, u64 now)
+{
+	unsigned long target = sc->nr_running ? UTIL_SCALE : 0;
+	unsigned long gap;
+	u64 delta = now - sc->last_update;
+	u32 rest;
+
+	if ((s64)delta <= 0)
+		return;
+	sc->last_update = now;
+
+	rest = ((u32)delta & ((1 << UTIL_PERIOD_SHIFT) - 1)) >> 10;
+	delta >>= UTIL_PERIOD_SHIFT;
+
+	gap = target ? target - sc->util : sc->util;
+	gap = util_decay_periods(gap, delta);
+	gap -= (gap * rest * UTIL_PERIOD_STEP) >> (2 * UTIL_SHIFT);
+	sc->util = target ? target - gap : gap;
+}
+
+/* the lowest table frequency within the limits giving util its headroom */
+static unsigned int sched_util_freq(struct cpufreq_sched_cpu *sc)
+{
+	struct cpufreq_frequency_table *table = sc->freq_table;
+	unsigned int best = UINT_MAX;
+	unsigned long freq;
+	int i;
+
+	freq = sc->max_freq * (100 + headroom) / 100;
+	freq = (freq * sc->util) >> UTIL_SHIFT;
+
+	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++) {
+		unsigned int f = table[i].frequency;
+
+		if (f == CPUFREQ_ENTRY_INVALID ||
+		    f < sc->min_freq || f > sc->max_freq)
+			continue;
+		if (f >= freq && f < best)
+			best = f;
+	}
+
+	return best == UINT_MAX ? sc->max_freq : best;
+}
+
+/*
+ * Called by the fair class with the runqueue of @cpu locked, after its
+ * number of runnable entities may have changed and on every tick.
+ */
+void __cpufreq_sched_update(int cpu, unsigned long nr_running, u64 now)
+{
+	struct cpufreq_sched_cpu *sc = &per_cpu(sched_cpu, cpu);
+	unsigned int freq;
+
+	if (!sc->active)
+		return;
+
+	if (!sc->last_update)
+		sc->last_update = now;
+	sched_util_update(sc, now);
+	sc->nr_running = nr_running;
+
+	freq = nr_running ? sched_util_freq(sc) : sc->min_freq;
+	if (freq == sc->want_freq)
+		return;
+
+	sc->want_freq = freq;
+	sc->pending = 1;
+
+	/* lowering waits for the rate limit anyway, don't wake for each */
+	if (freq > sc->cur_freq || !timer_armed) {
+		smp_wmb();
+		atomic_set(&kick_pending, 1);
+	}
+}
+
+/* Called by the scheduler where it holds no runqueue or task locks. */
+void __cpufreq_sched_kick(void)
+{
+	if (atomic_read(&kick_pending) && atomic_xchg(&kick_pending, 0))
+		wake_up_process(sched_task);
+}
+
+static void sched_set_freq(struct cpufreq_sched_cpu *sc, unsigned int cpu,
+			   unsigned int freq, ktime_t now)
+{
+	if (sc->policy)
+		__cpufreq_driver_target(sc->policy, freq, CPUFREQ_RELATION_L);
+#ifdef CONFIG_CPU_FREQ_STAT
+	else
+		cpufreq_stats_compare(cpu, freq);
+#endif
+
+	sc->cur_freq = freq;
+	sc->last_change = now;
+}
+
+/*
+ * Apply what the cpus want where their rate limit allows. If some had to
+ * wait, timer_armed is set and the time to look at them again returned.
+ */
+static ktime_t sched_apply(void)
+{
+	s64 wait = KTIME_MAX;
+	ktime_t now = ktime_get();
+	unsigned int cpu;
+
+	mutex_lock(&sched_mutex);
+
+	for_each_online_cpu(cpu) {
+		struct cpufreq_sched_cpu *sc = &per_cpu(sched_cpu, cpu);
+		unsigned int freq;
+		s64 since, limit;
+
+		xchg(&sc->pending, 0);
+		if (!sc->active)
+			continue;
+
+		freq = ACCESS_ONCE(sc->want_freq);
+		if (!freq || freq == sc->cur_freq)
+			continue;
+
+		since = ktime_us_delta(now, sc->last_change);
+		limit = freq > sc->cur_freq ? up_rate_limit_us
+					    : down_rate_limit_us;
+		if (since < limit) {
+			wait = min(wait, limit - since);
+			continue;
+		}
+
+		sched_set_freq(sc, cpu, freq, now);
+	}
+
+	timer_armed = wait != KTIME_MAX;
+	mutex_unlock(&sched_mutex);
+
+	return timer_armed ? ktime_add_us(now, wait) : now;
+}
+
+static int sched_pending(void)
+{
+	unsigned int cpu;
+
+	for_each_online_cpu(cpu)
+		if (per_cpu(sched_cpu, cpu).pending)
+			return 1;
+	return 0;
+}
+
+static int cpufreq_sched_thread(void *data)
+{
+	ktime_t expires;
+
+	while (!kthread_should_stop()) {
+		expires = sched_apply();
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (sched_pending() || kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			continue;
+		}
+
+		if (timer_armed)
+			schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+		else
+			schedule();
+	}
+
+	return 0;
+}
+
+/* must be called with sched_mutex held */
+static void sched_cpu_start(struct cpufreq_sched_cpu *sc, unsigned int cur)
+{
+	sc->cur_freq = cur;
+	sc->want_freq = cur;
+	sc->last_change = ktime_get();
+	sc->util = sc->max_freq ? (cur << UTIL_SHIFT) / sc->max_freq : 0;
+	sc->last_update = 0;
+	sc->nr_running = 0;
+	smp_wmb();
+	sc->active = 1;
+}
+
+/* must be called with sched_mutex held */
+static void sched_update_enabled(void)
+{
+	unsigned int cpu;
+	int enabled = 0;
+
+	for_each_possible_cpu(cpu)
+		enabled |= per_cpu(sched_cpu, cpu).active;
+
+	cpufreq_sched_enabled = enabled;
+}
+
+/* must be called with sched_mutex held */
+static void sched_compare_start(unsigned int cpu)
+{
+	struct cpufreq_sched_cpu *sc = &per_cpu(sched_cpu, cpu);
+
+	if (sc->policy || !sc->freq_table || !cpu_online(cpu))
+		return;
+
+	sched_cpu_start(sc, cpufreq_quick_get(cpu));
+#ifdef CONFIG_CPU_FREQ_STAT
+	cpufreq_stats_compare(cpu, sc->cur_freq);
+#endif
+}
+
+/* must be called with sched_mutex held */
+static void sched_compare_stop(unsigned int cpu)
+{
+	struct cpufreq_sched_cpu *sc = &per_cpu(sched_cpu, cpu);
+
+	if (sc->policy)
+		return;
+
+	sc->active = 0;
+#ifdef CONFIG_CPU_FREQ_STAT
+	cpufreq_stats_compare(cpu, 0);
+#endif
+}
+
+#define show_one(name)							\
+static ssize_t show_##name(struct kobject *kobj,			\
+		struct attribute *attr, char *buf)			\
+{									\
+	return sprintf(buf, "%lu\n", name);				\
+}
+
+#define store_one(name, minimum, maximum)				\
+static ssize_t store_##name(struct kobject *kobj,			\
+		struct attribute *attr, const char *buf, size_t count)	\
+{									\
+	unsigned long val;						\
+									\
+	if (strict_strtoul(buf, 0, &val) ||				\
+	    val < minimum || val > maximum)				\
+		return -EINVAL;						\
+	name = val;							\
+	return count;							\
+}
+
+#define sched_attr(name)						\
+static struct global_attr name##_attr = __ATTR(name, 0644,		\
+		show_##name, store_##name)
+
+show_one(up_rate_limit_us);
+store_one(up_rate_limit_us, 0, USEC_PER_SEC);
+sched_attr(up_rate_limit_us);
+
+show_one(down_rate_limit_us);
+store_one(down_rate_limit_us, 0, USEC_PER_SEC);
+sched_attr(down_rate_limit_us);
+
+show_one(headroom);
+store_one(headroom, 0, 100);
+sched_attr(headroom);
+
+show_one(compare);
+
+static ssize_t store_compare(struct kobject *kobj, struct attribute *attr,
+			     const char *buf, size_t count)
+{
+	unsigned long val;
+	unsigned int cpu;
+
+	if (strict_strtoul(buf, 0, &val))
+		return -EINVAL;
+
+	get_online_cpus();
+	mutex_lock(&sched_mutex);
+	compare = !!val;
+	for_each_possible_cpu(cpu) {
+		if (compare)
+			sched_compare_start(cpu);
+		else
+			sched_compare_stop(cpu);
+	}
+	sched_update_enabled();
+	mutex_unlock(&sched_mutex);
+	put_online_cpus();
+
+	return count;
+}
+
+sched_attr(compare);
+
+static struct attribute *sched_attributes[] = {
+	&up_rate_limit_us_attr.attr,
+	&down_rate_limit_us_attr.attr,
+	&headroom_attr.attr,
+	&compare_attr.attr,
+	NULL,
+};
+
+static struct attribute_group sched_attr_group = {
+	.attrs = sched_attributes,
+	.name = "sched",
+};
+
+static int cpufreq_governor_sched(struct cpufreq_policy *policy,
+		unsigned int event)
+{
+	struct cpufreq_sched_cpu *sc;
+	unsigned int j;
+
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		if (!cpu_online(policy->cpu) ||
+		    !cpufreq_frequency_get_table(policy->cpu))
+			return -EINVAL;
+
+		mutex_lock(&sched_mutex);
+		for_each_cpu(j, policy->cpus) {
+			sc = &per_cpu(sched_cpu, j);
+			sc->active = 0;
+			sc->freq_table = cpufreq_frequency_get_table(j);
+			sc->min_freq = policy->min;
+			sc->max_freq = policy->max;
+			sc->policy = policy;
+			sched_cpu_start(sc, policy->cur);
+		}
+		sched_update_enabled();
+		mutex_unlock(&sched_mutex);
+		break;
+
+	case CPUFREQ_GOV_STOP:
+		mutex_lock(&sched_mutex);
+		for_each_cpu(j, policy->cpus) {
+			sc = &per_cpu(sched_cpu, j);
+			sc->active = 0;
+			sc->policy = NULL;
+			if (compare)
+				sched_compare_start(j);
+		}
+		sched_update_enabled();
+		mutex_unlock(&sched_mutex);
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		mutex_lock(&sched_mutex);
+		if (policy->max < policy->cur)
+			__cpufreq_driver_target(policy,
+					policy->max, CPUFREQ_RELATION_H);
+		else if (policy->min > policy->cur)
+			__cpufreq_driver_target(policy,
+					policy->min, CPUFREQ_RELATION_L);
+		for_each_cpu(j, policy->cpus) {
+			sc = &per_cpu(sched_cpu, j);
+			sc->min_freq = policy->min;
+			sc->max_freq = policy->max;
+			sc->cur_freq = policy->cur;
+		}
+		mutex_unlock(&sched_mutex);
+		break;
+	}
+	return 0;
+}
+
+/* keeps the limits of cpus run by other governors for compare mode */
+static int cpufreq_sched_policy_notifier(struct notifier_block *nb,
+		unsigned long val, void *data)
+{
+	struct cpufreq_policy *policy = data;
+	struct cpufreq_sched_cpu *sc;
+	unsigned int j;
+
+	if (val != CPUFREQ_NOTIFY)
+		return 0;
+
+	mutex_lock(&sched_mutex);
+	for_each_cpu(j, policy->cpus) {
+		sc = &per_cpu(sched_cpu, j);
+		if (sc->policy)
+			continue;
+		sc->freq_table = cpufreq_frequency_get_table(j);
+		sc->min_freq = policy->min;
+		sc->max_freq = policy->max;
+		if (compare && !sc->active) {
+			sched_compare_start(j);
+			sched_update_enabled();
+		}
+	}
+	mutex_unlock(&sched_mutex);
+	return 0;
+}
+
+static struct notifier_block cpufreq_sched_policy_nb = {
+	.notifier_call = cpufreq_sched_policy_notifier,
+};
+
+static int __cpuinit cpufreq_sched_cpu_callback(struct notifier_block *nfb,
+		unsigned long action, void *hcpu)
+{
+	unsigned int cpu = (unsigned long)hcpu;
+
+	switch (action) {
+	case CPU_DOWN_PREPARE:
+	case CPU_DOWN_PREPARE_FROZEN:
+		mutex_lock(&sched_mutex);
+		sched_compare_stop(cpu);
+		sched_update_enabled();
+		mutex_unlock(&sched_mutex);
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block cpufreq_sched_cpu_nb __refdata = {
+	.notifier_call = cpufreq_sched_cpu_callback,
+};
+
+static int __init cpufreq_sched_init(void)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
+	int rc;
+
+	sched_task = kthread_create(cpufreq_sched_thread, NULL, "kschedfreq");
+	if (IS_ERR(sched_task))
+		return PTR_ERR(sched_task);
+
+	sched_setscheduler_nocheck(sched_task, SCHED_FIFO, &param);
+	get_task_struct(sched_task);
+	wake_up_process(sched_task);
+
+	rc = sysfs_create_group(cpufreq_global_kobject, &sched_attr_group);
+	if (rc)
+		goto err_stop;
+
+	cpufreq_register_notifier(&cpufreq_sched_policy_nb,
+				  CPUFREQ_POLICY_NOTIFIER);
+	register_hotcpu_notifier(&cpufreq_sched_cpu_nb);
+
+	return cpufreq_register_governor(&cpufreq_gov_sched);
+
+err_stop:
+	kthread_stop(sched_task);
+	put_task_struct(sched_task);
+	return rc;
+}
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHED
+fs_initcall(cpufreq_sched_init);
+#else
+module_init(cpufreq_sched_init);
+#endif
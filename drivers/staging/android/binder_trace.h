@@ -0,0 +1,136 @@
+/* binder_trace.h
+ *
+ * Android IPC Subsystem
+ *
+ * Copyright (C) 2007-2008 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_BINDER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BINDER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+struct binder_proc;
+struct binder_buffer;
+
+/*
+ * Buffer allocation for a transaction, from before the target's alloc_lock
+ * is taken to the allocator returning. Pair start and end by thread to get
+ * the allocation latency, as tools/perf/scripts/python/binder-alloc-latency.py
+ * does.
+ */
+TRACE_EVENT(binder_alloc_buf_start,
+	TP_PROTO(struct binder_proc *proc, size_t data_size,
+		 size_t offsets_size, int is_async),
+	TP_ARGS(proc, data_size, offsets_size, is_async),
+
+	TP_STRUCT__entry(
+		__field(int, proc)
+		__field(size_t, data_size)
+		__field(size_t, offsets_size)
+		__field(int, is_async)
+	),
+	TP_fast_assign(
+		__entry->proc = proc->pid;
+		__entry->data_size = data_size;
+		__entry->offsets_size = offsets_size;
+		__entry->is_async = is_async;
+	),
+	TP_printk("proc=%d data_size=%zd offsets_size=%zd is_async=%d",
+		  __entry->proc, __entry->data_size, __entry->offsets_size,
+		  __entry->is_async)
+);
+
+TRACE_EVENT(binder_alloc_buf_end,
+	TP_PROTO(struct binder_proc *proc, struct binder_buffer *buf),
+	TP_ARGS(proc, buf),
+
+	TP_STRUCT__entry(
+		__field(int, proc)
+		__field(int, failed)
+	),
+	TP_fast_assign(
+		__entry->proc = proc->pid;
+		__entry->failed = buf == NULL;
+	),
+	TP_printk("proc=%d failed=%d", __entry->proc, __entry->failed)
+);
+
+TRACE_EVENT(binder_update_page_range,
+	TP_PROTO(struct binder_proc *proc, int allocate,
+		 void *start, void *end),
+	TP_ARGS(proc, allocate, start, end),
+
+	TP_STRUCT__entry(
+		__field(int, proc)
+		__field(int, allocate)
+		__field(size_t, offset)
+		__field(size_t, size)
+	),
+	TP_fast_assign(
+		__entry->proc = proc->pid;
+		__entry->allocate = allocate;
+		__entry->offset = start - proc->buffer;
+		__entry->size = end - start;
+	),
+	TP_printk("proc=%d allocate=%d offset=%zu size=%zu",
+		  __entry->proc, __entry->allocate,
+		  __entry->offset, __entry->size)
+);
+
+DECLARE_EVENT_CLASS(binder_lru_page_class,
+	TP_PROTO(struct binder_proc *proc, size_t page_index),
+	TP_ARGS(proc, page_index),
+
+	TP_STRUCT__entry(
+		__field(int, proc)
+		__field(size_t, page_index)
+	),
+	TP_fast_assign(
+		__entry->proc = proc->pid;
+		__entry->page_index = page_index;
+	),
+	TP_printk("proc=%d page_index=%zu",
+		  __entry->proc, __entry->page_index)
+);
+
+/* a page still mapped from an earlier buffer was taken back into use */
+DEFINE_EVENT(binder_lru_page_class, binder_alloc_lru,
+	TP_PROTO(struct binder_proc *proc, size_t page_index),
+	TP_ARGS(proc, page_index));
+
+/* a new page had to be allocated and mapped */
+DEFINE_EVENT(binder_lru_page_class, binder_alloc_page,
+	TP_PROTO(struct binder_proc *proc, size_t page_index),
+	TP_ARGS(proc, page_index));
+
+/* a page no longer used by any buffer was left mapped on the lru */
+DEFINE_EVENT(binder_lru_page_class, binder_free_lru,
+	TP_PROTO(struct binder_proc *proc, size_t page_index),
+	TP_ARGS(proc, page_index));
+
+/* the shrinker unmapped and freed a page from the lru */
+DEFINE_EVENT(binder_lru_page_class, binder_reclaim_page,
+	TP_PROTO(struct binder_proc *proc, size_t page_index),
+	TP_ARGS(proc, page_index));
+
+#endif /* _BINDER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE binder_trace
+#include <trace/define_trace.h>
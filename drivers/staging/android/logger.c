@@ -25,16 +25,61 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/hrtimer.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+#include <linux/workqueue.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * struct logger_stage - a per-cpu staging ring for a log's writers
+ *
+ * Writers append whole records to the ring of the cpu they run on, under
+ * 'lock', and never touch the log itself. The records are moved into the
+ * log in timestamp order by logger_merge(), which advances 'head'. Both
+ * offsets run freely; a record never wraps around the end of the ring.
+ */
+struct logger_stage {
+	spinlock_t		lock;	/* protects head and tail */
+	unsigned char		*buffer;/* LOGGER_STAGE_SIZE bytes */
+	size_t			head;	/* oldest record not yet merged */
+	size_t			tail;	/* end of the last record written */
+	/* only used by logger_merge(), under log->mutex */
+	size_t			m_off;	/* next record to merge */
+	size_t			m_end;	/* tail when the merge started */
+	struct logger_staged	*m_rec;	/* record at m_off, NULL if none */
+};
+
+#define LOGGER_STAGE_SIZE	(16*1024)	/* a power of two */
+
+/* once this much is staged on a cpu, merge right away rather than later */
+#define LOGGER_WAKE_THRESHOLD	(LOGGER_STAGE_SIZE / 2)
+
+/* otherwise merge, and wake readers, this long after the first write */
+#define LOGGER_WAKE_DELAY	(HZ / 50 ? HZ / 50 : 1)
+
+/*
+ * struct logger_staged - a record in a staging ring, the logger_entry and
+ * its payload followed by padding up to an 8 byte boundary. A record with
+ * 'pad' set, or less than a header's worth of space left before the end
+ * of the ring, means the next record starts at the beginning of the ring.
+ */
+struct logger_staged {
+	s64			ts;	/* ktime_get(), the merge order */
+	__u32			size;	/* bytes taken in the ring */
+	__u32			pad;	/* nothing but padding */
+	struct logger_entry	entry;
+};
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
  * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * mutex 'mutex', except for the staging rings, which have their own locks.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
@@ -45,6 +90,9 @@ struct logger_log {
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_stage __percpu *stages; /* writers' staging rings */
+	struct work_struct	merge_work; /* merges and wakes readers */
+	struct timer_list	wake_timer; /* queues merge_work */
 };
 
 /*
@@ -230,6 +278,8 @@ static size_t get_next_entry_by_uid(struct logger_log *log,
 	return off;
 }
 
+static size_t logger_merge(struct logger_log *log);
+
 /*
  * logger_read - our log's read() method
  *
@@ -247,6 +297,7 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	size_t merged;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -255,8 +306,11 @@ start:
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
 		mutex_lock(&log->mutex);
+		merged = logger_merge(log);
 		ret = (log->w_off == reader->r_off);
 		mutex_unlock(&log->mutex);
+		if (merged)
+			wake_up_interruptible(&log->wq);
 		if (!ret)
 			break;
 
@@ -385,51 +439,227 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * stage_rec - returns the record at free-running offset 'off' in 'st'
+ */
+static inline struct logger_staged *stage_rec(struct logger_stage *st,
+					      size_t off)
+{
+	return (struct logger_staged *)
+		(st->buffer + (off & (LOGGER_STAGE_SIZE - 1)));
+}
+
+/*
+ * stage_room - returns the number of bytes from 'off' to the end of a ring
+ */
+static inline size_t stage_room(size_t off)
+{
+	return LOGGER_STAGE_SIZE - (off & (LOGGER_STAGE_SIZE - 1));
+}
+
+/*
+ * stage_reserve - finds room for a record of 'size' bytes at the tail of
+ * 'st', padding out the end of the ring if the record does not fit there.
+ * Returns the record, or NULL if the ring is full, and sets 'end' to what
+ * st->tail becomes once the record is committed.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold st->lock.
+ */
+static struct logger_staged *stage_reserve(struct logger_stage *st,
+					   size_t size, size_t *end)
+{
+	struct logger_staged *rec;
+	size_t skip = stage_room(st->tail);
+
+	if (skip >= size)
+		skip = 0;
+	if (st->tail + skip + size - st->head > LOGGER_STAGE_SIZE)
+		return NULL;
+
+	if (skip >= sizeof(struct logger_staged)) {
+		rec = stage_rec(st, st->tail);
+		rec->size = skip;
+		rec->pad = 1;
+	}
+
+	rec = stage_rec(st, st->tail + skip);
+	rec->size = size;
+	rec->pad = 0;
+	*end = st->tail + skip + size;
+	return rec;
+}
+
+/*
+ * stage_next - returns the record at st->m_off, moving m_off past any
+ * padding first, or NULL if there is none before st->m_end.
+ */
+static struct logger_staged *stage_next(struct logger_stage *st)
+{
+	struct logger_staged *rec;
+	size_t room;
+
+	while (st->m_off != st->m_end) {
+		room = stage_room(st->m_off);
+		if (room < sizeof(struct logger_staged)) {
+			st->m_off += room;
+			continue;
+		}
+		rec = stage_rec(st, st->m_off);
+		if (!rec->pad)
+			return rec;
+		st->m_off += rec->size;
+	}
+
+	return NULL;
+}
+
+/*
+ * logger_merge - moves the records staged by writers before now into the
+ * log, oldest first, and returns the number of bytes written to the log.
  *
- * Returns 'count' on success, negative error code on failure.
+ * Writers take their timestamp and commit their record under the ring's
+ * lock, so once the lock has been taken here, every record stamped before
+ * 'cutoff' is visible. Records stamped later are left for the next merge,
+ * as one of them could still be in flight on another cpu.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static size_t logger_merge(struct logger_log *log)
+{
+	s64 cutoff = ktime_to_ns(ktime_get());
+	struct logger_stage *st, *best;
+	size_t len, merged = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(log->stages, cpu);
+		spin_lock(&st->lock);
+		st->m_off = st->head;
+		st->m_end = st->tail;
+		spin_unlock(&st->lock);
+		st->m_rec = stage_next(st);
+	}
+
+	for (;;) {
+		best = NULL;
+		for_each_possible_cpu(cpu) {
+			st = per_cpu_ptr(log->stages, cpu);
+			if (!st->m_rec || st->m_rec->ts >= cutoff)
+				continue;
+			if (!best || st->m_rec->ts < best->m_rec->ts)
+				best = st;
+		}
+		if (!best)
+			break;
+
+		len = sizeof(struct logger_entry) + best->m_rec->entry.len;
+		fix_up_readers(log, len);
+		do_write_log(log, &best->m_rec->entry, len);
+		merged += len;
+
+		best->m_off += best->m_rec->size;
+		best->m_rec = stage_next(best);
+	}
+
+	if (!merged)
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(log->stages, cpu);
+		spin_lock(&st->lock);
+		st->head = st->m_off;
+		spin_unlock(&st->lock);
+	}
+
+	return merged;
+}
+
+/*
+ * logger_merge_work - merges the staged records and wakes up any blocked
+ * readers. Writers queue this once enough is staged, or from wake_timer.
+ */
+static void logger_merge_work(struct work_struct *work)
+{
+	struct logger_log *log = container_of(work, struct logger_log,
+					      merge_work);
+	size_t merged;
+
+	mutex_lock(&log->mutex);
+	merged = logger_merge(log);
+	mutex_unlock(&log->mutex);
+
+	if (merged)
+		wake_up_interruptible(&log->wq);
+}
+
+static void logger_wake_timer(unsigned long data)
+{
+	struct logger_log *log = (struct logger_log *) data;
+
+	schedule_work(&log->merge_work);
+}
+
+/*
+ * copy_payload - copies 'count' bytes of payload from the user-space
+ * vectors 'iov' to 'dst'. If 'atomic' is set, no page faults are taken
+ * and -EFAULT is also returned for payload that is not resident.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static int copy_payload(void *dst, const struct iovec *iov, size_t count,
+			int atomic)
 {
 	size_t len;
+	int ret = 0;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	if (atomic)
+		pagefault_disable();
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
+	while (count) {
+		/* figure out how much of this vector we can keep */
+		len = min_t(size_t, iov->iov_len, count);
+
+		if (atomic) {
+			if (!access_ok(VERIFY_READ, iov->iov_base, len) ||
+			    __copy_from_user_inatomic(dst, iov->iov_base, len))
+				ret = -EFAULT;
+		} else if (copy_from_user(dst, iov->iov_base, len))
+			ret = -EFAULT;
+		if (unlikely(ret))
+			break;
 
-	log->w_off = logger_offset(log->w_off + count);
+		dst += len;
+		count -= len;
+		iov++;
+	}
 
-	return count;
+	if (atomic)
+		pagefault_enable();
+
+	return ret;
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The entry is appended to this cpu's staging ring without taking the log's
+ * mutex, and readers are woken in batches: by logger_merge_work once half
+ * a ring is staged, or by wake_timer at most LOGGER_WAKE_DELAY after the
+ * first write that found it idle.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
+	struct logger_staged *rec;
+	struct logger_stage *st;
 	struct timespec now;
-	ssize_t ret = 0;
-
-	now = current_kernel_time();
+	void *bounce = NULL;
+	size_t size, end, used;
+	int ret;
 
 	header.pid = current->tgid;
 	header.tid = current->pid;
-	header.sec = now.tv_sec;
-	header.nsec = now.tv_nsec;
 	header.euid = current_euid();
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
 	header.hdr_size = sizeof(struct logger_entry);
@@ -438,43 +668,67 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	size = ALIGN(sizeof(struct logger_staged) + header.len, 8);
 
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+retry:
+	st = get_cpu_ptr(log->stages);
+	spin_lock(&st->lock);
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	rec = stage_reserve(st, size, &end);
+	if (unlikely(!rec)) {
+		spin_unlock(&st->lock);
+		put_cpu_ptr(log->stages);
 
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
+		/* this cpu's ring is full, empty it into the log now */
+		mutex_lock(&log->mutex);
+		used = logger_merge(log);
+		mutex_unlock(&log->mutex);
+		if (used)
+			wake_up_interruptible(&log->wq);
+		goto retry;
+	}
 
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+	now = current_kernel_time();
+	rec->ts = ktime_to_ns(ktime_get());
+	header.sec = now.tv_sec;
+	header.nsec = now.tv_nsec;
+	rec->entry = header;
+
+	if (unlikely(bounce))
+		memcpy(rec->entry.msg, bounce, header.len);
+	else if (unlikely(copy_payload(rec->entry.msg, iov, header.len, 1))) {
+		/*
+		 * Part of the payload is not resident. The record is not
+		 * committed yet, so drop it, copy the payload while we may
+		 * still sleep, and start over.
+		 */
+		spin_unlock(&st->lock);
+		put_cpu_ptr(log->stages);
+
+		bounce = kmalloc(header.len, GFP_KERNEL);
+		if (!bounce)
+			return -ENOMEM;
+		ret = copy_payload(bounce, iov, header.len, 0);
+		if (unlikely(ret)) {
+			kfree(bounce);
+			return ret;
 		}
-
-		iov++;
-		ret += nr;
+		goto retry;
 	}
 
-	mutex_unlock(&log->mutex);
+	st->tail = end;
+	used = st->tail - st->head;
 
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	spin_unlock(&st->lock);
+	put_cpu_ptr(log->stages);
+	kfree(bounce);
 
-	return ret;
+	if (used >= LOGGER_WAKE_THRESHOLD)
+		schedule_work(&log->merge_work);
+	else if (!timer_pending(&log->wake_timer))
+		mod_timer(&log->wake_timer, jiffies + LOGGER_WAKE_DELAY);
+
+	return header.len;
 }
 
 static struct logger_log *get_log_from_minor(int);
@@ -553,6 +807,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	struct logger_reader *reader;
 	struct logger_log *log;
 	unsigned int ret = POLLOUT | POLLWRNORM;
+	size_t merged;
 
 	if (!(file->f_mode & FMODE_READ))
 		return ret;
@@ -563,6 +818,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
+	merged = logger_merge(log);
 	if (!reader->r_all)
 		reader->r_off = get_next_entry_by_uid(log,
 			reader->r_off, current_euid());
@@ -571,6 +827,9 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
+	if (merged)
+		wake_up_interruptible(&log->wq);
+
 	return ret;
 }
 
@@ -593,9 +852,13 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct logger_reader *reader;
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
+	size_t merged;
 
 	mutex_lock(&log->mutex);
 
+	/* the lengths below, and a flush, cover what writers have staged */
+	merged = logger_merge(log);
+
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
@@ -658,6 +921,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 
 	mutex_unlock(&log->mutex);
 
+	if (merged)
+		wake_up_interruptible(&log->wq);
+
 	return ret;
 }
 
@@ -693,6 +959,10 @@ static struct logger_log VAR = { \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.merge_work = __WORK_INITIALIZER(VAR .merge_work, \
+					 logger_merge_work), \
+	.wake_timer = TIMER_INITIALIZER(logger_wake_timer, 0, \
+					(unsigned long) &VAR), \
 };
 
 DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 256*1024)
@@ -715,19 +985,41 @@ static struct logger_log *get_log_from_minor(int minor)
 
 static int __init init_log(struct logger_log *log)
 {
-	int ret;
+	struct logger_stage *st;
+	int cpu, ret;
+
+	log->stages = alloc_percpu(struct logger_stage);
+	if (unlikely(!log->stages))
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(log->stages, cpu);
+		spin_lock_init(&st->lock);
+		st->buffer = kmalloc(LOGGER_STAGE_SIZE, GFP_KERNEL);
+		if (unlikely(!st->buffer)) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+	}
 
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
-		return ret;
+		goto out_free;
 	}
 
 	printk(KERN_INFO "logger: created %luK log '%s'\n",
 	       (unsigned long) log->size >> 10, log->misc.name);
 
 	return 0;
+
+out_free:
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(log->stages, cpu)->buffer);
+	free_percpu(log->stages);
+	log->stages = NULL;
+	return ret;
 }
 
 static int __init logger_init(void)
@@ -16,6 +16,21 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Processes are kept on one list per oom_adj value and moved between lists
+ * when their oom_adj changes. Choosing a victim only walks the highest
+ * non-empty list at or above the minimum adj, re-reading the RSS of just
+ * the processes on it, instead of locking every task's mm on each shrinker
+ * call.
+ *
+ * With /sys/module/lowmemorykiller/parameters/pressure_mode set, kills are
+ * instead gated on the reclaim efficiency reported by vmpressure: nothing is
+ * killed until pressure reaches pressure_critical (or pressure_relax while
+ * swap, i.e. zram, is more than swap_full percent used), and killing stays
+ * enabled until pressure drops below pressure_relax again. The minfree table
+ * then only decides how deep to kill, counting free pages alone, and the
+ * next kill waits for the previous victim to release its memory, though no
+ * longer than the legacy timeout should the victim be stuck.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -37,6 +52,12 @@
 #include <linux/rcupdate.h>
 #include <linux/notifier.h>
 #include <linux/compaction.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/swap.h>
+#include <linux/vmpressure.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -57,8 +78,38 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+static bool lowmem_pressure_mode;
+static int lowmem_pressure_critical = 95;
+static int lowmem_pressure_relax = 60;
+static int lowmem_swap_full = 90;
+static int lowmem_pressure;
+static bool lowmem_critical;
+
+/* last pressure mode victim, held until its memory is gone */
+static struct task_struct *lowmem_victim;
+static unsigned long lowmem_victim_timeout;
+static DEFINE_SPINLOCK(lowmem_victim_lock);
+
 extern int compact_nodes(bool sync);
 
+#define LOWMEM_ADJ_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+/*
+ * One list of signal_structs per oom_adj value. Hooks run from fork, exit
+ * and the /proc oom_adj writers with siglock or tasklist_lock held, so the
+ * lock has to be irq safe.
+ */
+static struct hlist_head lowmem_buckets[LOWMEM_ADJ_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_bucket_lock);
+
+static struct {
+	unsigned long calls;
+	unsigned long scanned;
+	unsigned long max_scanned;
+	u64 time_ns;
+	u64 max_time_ns;
+} lowmem_scan_stats;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -83,15 +134,237 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
+static int lowmem_swap_used(void)
+{
+	long total = total_swap_pages;
+
+	if (total <= 0)
+		return 0;
+	return (total - nr_swap_pages) * 100 / total;
+}
+
+static int lowmem_vmpressure_notify(struct notifier_block *nb,
+				    unsigned long pressure, void *data)
+{
+	int swap_used = lowmem_swap_used();
+
+	lowmem_pressure = pressure;
+	if (pressure >= lowmem_pressure_critical ||
+	    (pressure >= lowmem_pressure_relax &&
+	     swap_used >= lowmem_swap_full))
+		lowmem_critical = true;
+	else if (pressure < lowmem_pressure_relax)
+		lowmem_critical = false;
+
+	lowmem_print(5, "vmpressure %lu, swap %d%%, critical %d\n",
+		     pressure, swap_used, lowmem_critical);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_vmpressure_nb = {
+	.notifier_call	= lowmem_vmpressure_notify,
+};
+
+/*
+ * In pressure mode the minfree table only decides how deep to kill. Page
+ * cache is not counted as free since reclaim has just shown that it is not
+ * giving memory back.
+ */
+static int lowmem_pressure_min_adj(int other_free, int array_size)
+{
+	int i;
+
+	if (!lowmem_critical || !array_size)
+		return OOM_ADJUST_MAX + 1;
+
+	for (i = 0; i < array_size; i++) {
+		if (other_free < lowmem_minfree[i])
+			return lowmem_adj[i];
+	}
+	return lowmem_adj[array_size - 1];
+}
+
+/*
+ * Is the last pressure mode victim still holding on to its memory? A victim
+ * stuck in D state is only waited for as long as in the legacy path.
+ */
+static bool lowmem_victim_pending(void)
+{
+	struct task_struct *p = NULL;
+	bool pending = false;
+
+	spin_lock(&lowmem_victim_lock);
+	if (lowmem_victim) {
+		if (time_before_eq(jiffies, lowmem_victim_timeout)) {
+			rcu_read_lock();
+			p = find_lock_task_mm(lowmem_victim);
+			rcu_read_unlock();
+		}
+		if (p) {
+			task_unlock(p);
+			pending = true;
+		} else {
+			put_task_struct(lowmem_victim);
+			lowmem_victim = NULL;
+		}
+	}
+	spin_unlock(&lowmem_victim_lock);
+
+	return pending;
+}
+
+static void lowmem_set_victim(struct task_struct *p)
+{
+	spin_lock(&lowmem_victim_lock);
+	if (lowmem_victim)
+		put_task_struct(lowmem_victim);
+	get_task_struct(p);
+	lowmem_victim = p;
+	lowmem_victim_timeout = jiffies + HZ;
+	spin_unlock(&lowmem_victim_lock);
+}
+
+static inline int lowmem_adj_bucket(int oom_adj)
+{
+	return clamp(oom_adj, OOM_DISABLE, OOM_ADJUST_MAX) - OOM_DISABLE;
+}
+
+/* Caller keeps p->mm stable (task_lock or p still being forked). */
+static void lowmem_bucket_update(struct task_struct *p)
+{
+	struct signal_struct *sig = p->signal;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	/* the group may already have passed lowmem_task_exit() */
+	if (atomic_read(&sig->live)) {
+		hlist_del_init(&sig->lmk_node);
+		sig->lmk_rss = p->mm ? get_mm_rss(p->mm) : 0;
+		hlist_add_head(&sig->lmk_node,
+			       &lowmem_buckets[lowmem_adj_bucket(sig->oom_adj)]);
+	}
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+}
+
+void lowmem_task_fork(struct task_struct *p)
+{
+	/* kernel threads stay off the lists until they exec, see below */
+	if (p->mm)
+		lowmem_bucket_update(p);
+}
+
+/*
+ * A kernel thread that execs, e.g. a usermodehelper child, gets its first
+ * mm here and becomes a candidate. Called on current, so mm is stable.
+ */
+void lowmem_task_exec(struct task_struct *p)
+{
+	lowmem_bucket_update(p);
+}
+
+void lowmem_task_exit(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	hlist_del_init(&p->signal->lmk_node);
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+}
+
+void lowmem_adj_changed(struct task_struct *p)
+{
+	lowmem_bucket_update(p);
+}
+
+/*
+ * Refresh the cached RSS of a process in the bucket being picked from; it
+ * was taken when the process last changed buckets and may be long stale.
+ * The bucket lock nests inside task_lock, so a thread whose task_lock is
+ * contended is skipped rather than waited for, and if none can be read the
+ * cached value stands.
+ */
+static unsigned long lowmem_refresh_rss(struct signal_struct *sig)
+{
+	struct task_struct *p, *t;
+
+	rcu_read_lock();
+	p = pid_task(sig->leader_pid, PIDTYPE_PID);
+	if (p) {
+		t = p;
+		do {
+			if (!spin_trylock(&t->alloc_lock))
+				continue;
+			if (t->mm) {
+				sig->lmk_rss = get_mm_rss(t->mm);
+				spin_unlock(&t->alloc_lock);
+				break;
+			}
+			spin_unlock(&t->alloc_lock);
+		} while_each_thread(p, t);
+	}
+	rcu_read_unlock();
+
+	return sig->lmk_rss;
+}
+
+/*
+ * Pick the process with the largest RSS from the highest non-empty bucket
+ * at or above min_adj and return its leader with a reference held.
+ */
+static struct task_struct *lowmem_select(int min_adj, int *oom_adj)
+{
+	struct signal_struct *sig, *selected = NULL;
+	struct hlist_node *node;
+	struct task_struct *p = NULL;
+	unsigned long selected_rss = 0;
+	unsigned long scanned = 0;
+	unsigned long flags;
+	ktime_t start;
+	u64 delta;
+	int b;
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	start = ktime_get();
+	for (b = LOWMEM_ADJ_BUCKETS - 1;
+	     b >= lowmem_adj_bucket(min_adj) && !selected; b--) {
+		hlist_for_each_entry(sig, node, &lowmem_buckets[b], lmk_node) {
+			scanned++;
+			if (lowmem_refresh_rss(sig) <= selected_rss)
+				continue;
+			selected = sig;
+			selected_rss = sig->lmk_rss;
+			*oom_adj = b + OOM_DISABLE;
+		}
+	}
+	if (selected) {
+		rcu_read_lock();
+		p = pid_task(selected->leader_pid, PIDTYPE_PID);
+		if (p)
+			get_task_struct(p);
+		rcu_read_unlock();
+	}
+
+	delta = ktime_to_ns(ktime_sub(ktime_get(), start));
+	lowmem_scan_stats.calls++;
+	lowmem_scan_stats.scanned += scanned;
+	lowmem_scan_stats.time_ns += delta;
+	if (scanned > lowmem_scan_stats.max_scanned)
+		lowmem_scan_stats.max_scanned = scanned;
+	if (delta > lowmem_scan_stats.max_time_ns)
+		lowmem_scan_stats.max_time_ns = delta;
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+
+	return p;
+}
+
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
 	struct task_struct *tsk;
 	struct task_struct *selected = NULL;
 	int rem = 0;
-	int tasksize;
+	int tasksize = 0;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
-	int selected_tasksize = 0;
 	int selected_oom_adj;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
@@ -105,84 +378,76 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	 * this pass.
 	 *
 	 */
-	if (lowmem_deathpending &&
-	    time_before_eq(jiffies, lowmem_deathpending_timeout))
+	if (lowmem_pressure_mode) {
+		if (lowmem_victim_pending())
+			return 0;
+	} else if (lowmem_deathpending &&
+		   time_before_eq(jiffies, lowmem_deathpending_timeout)) {
 		return 0;
+	}
 
 	if (lowmem_adj_size < array_size)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
+	if (lowmem_pressure_mode) {
+		min_adj = lowmem_pressure_min_adj(other_free, array_size);
+	} else {
+		for (i = 0; i < array_size; i++) {
+			if (other_free < lowmem_minfree[i] &&
+			    other_file < lowmem_minfree[i]) {
+				min_adj = lowmem_adj[i];
+				break;
+			}
 		}
 	}
 	if (sc->nr_to_scan > 0)
-		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
+		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, "
+			     "pressure %d, ma %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
-			     min_adj);
+			     lowmem_pressure, min_adj);
 	rem = global_page_state(NR_ACTIVE_ANON) +
 		global_page_state(NR_ACTIVE_FILE) +
 		global_page_state(NR_INACTIVE_ANON) +
 		global_page_state(NR_INACTIVE_FILE);
-	if (sc->nr_to_scan <= 0 || min_adj == OOM_ADJUST_MAX + 1) {
+	if (sc->nr_to_scan <= 0 || min_adj > OOM_ADJUST_MAX) {
 		lowmem_print(5, "lowmem_shrink %lu, %x, return %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
 	selected_oom_adj = min_adj;
 
-	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		int oom_adj;
-
-		if (tsk->flags & PF_KTHREAD)
-			continue;
-
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
-
-		oom_adj = p->signal->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
+	tsk = lowmem_select(min_adj, &selected_oom_adj);
+	if (tsk) {
+		rcu_read_lock();
+		selected = find_lock_task_mm(tsk);
+		rcu_read_unlock();
 		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
+			tasksize = get_mm_rss(selected->mm);
+			task_unlock(selected);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
-	if (selected) {
+	if (selected && tasksize > 0) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
-		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
+			     selected_oom_adj, tasksize);
+		if (lowmem_pressure_mode) {
+			lowmem_set_victim(tsk);
+		} else {
+			lowmem_deathpending = selected;
+			lowmem_deathpending_timeout = jiffies + HZ;
+		}
 		send_sig(SIGKILL, selected, 0);
-		rem -= selected_tasksize;
+		rem -= tasksize;
+	} else {
+		selected = NULL;
 	}
+	if (tsk)
+		put_task_struct(tsk);
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	rcu_read_unlock();
-    if (selected)
-        compact_nodes(false);
+	if (selected)
+		compact_nodes(false);
 	return rem;
 }
 
@@ -191,15 +456,82 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+#ifdef CONFIG_DEBUG_FS
+static int lowmem_scan_stats_show(struct seq_file *s, void *unused)
+{
+	unsigned long calls, scanned, max_scanned;
+	u64 time_ns, max_time_ns;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	calls = lowmem_scan_stats.calls;
+	scanned = lowmem_scan_stats.scanned;
+	max_scanned = lowmem_scan_stats.max_scanned;
+	time_ns = lowmem_scan_stats.time_ns;
+	max_time_ns = lowmem_scan_stats.max_time_ns;
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+
+	seq_printf(s, "calls:       %lu\n", calls);
+	seq_printf(s, "scanned:     %lu\n", scanned);
+	seq_printf(s, "max scanned: %lu\n", max_scanned);
+	seq_printf(s, "avg scanned: %lu\n", calls ? scanned / calls : 0);
+	seq_printf(s, "time ns:     %llu\n", time_ns);
+	seq_printf(s, "max time ns: %llu\n", max_time_ns);
+	seq_printf(s, "avg time ns: %llu\n",
+		   calls ? div64_u64(time_ns, calls) : 0);
+	return 0;
+}
+
+static int lowmem_scan_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lowmem_scan_stats_show, inode->i_private);
+}
+
+static const struct file_operations lowmem_scan_stats_fops = {
+	.open		= lowmem_scan_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static struct dentry *lowmem_debugfs_root;
+
+static void __init lowmem_debugfs_init(void)
+{
+	lowmem_debugfs_root = debugfs_create_dir("lowmemorykiller", NULL);
+	if (!lowmem_debugfs_root)
+		return;
+	debugfs_create_file("scan_stats", S_IRUGO, lowmem_debugfs_root, NULL,
+			    &lowmem_scan_stats_fops);
+}
+
+static void lowmem_debugfs_exit(void)
+{
+	debugfs_remove_recursive(lowmem_debugfs_root);
+}
+#else
+static inline void lowmem_debugfs_init(void)
+{
+}
+
+static inline void lowmem_debugfs_exit(void)
+{
+}
+#endif
+
 static int __init lowmem_init(void)
 {
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
+	vmpressure_notifier_register(&lowmem_vmpressure_nb);
+	lowmem_debugfs_init();
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	lowmem_debugfs_exit();
+	vmpressure_notifier_unregister(&lowmem_vmpressure_nb);
 	unregister_shrinker(&lowmem_shrinker);
 	task_free_unregister(&task_nb);
 }
@@ -210,6 +542,14 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_mode, lowmem_pressure_mode, bool,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_critical, lowmem_pressure_critical, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_relax, lowmem_pressure_relax, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(swap_full, lowmem_swap_full, int, S_IRUGO | S_IWUSR);
+module_param_named(pressure, lowmem_pressure, int, S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
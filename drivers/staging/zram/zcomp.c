@@ -0,0 +1,196 @@
+/*
+ * Compressed RAM block device
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/gfp.h>
+#include <linux/percpu.h>
+#include <linux/lzo.h>
+#include <linux/lz4.h>
+
+#include "zcomp.h"
+
+static int zcomp_lzo_compress(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem)
+{
+	return lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, workmem);
+}
+
+static int zcomp_lzo_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst)
+{
+	size_t dst_len = PAGE_SIZE;
+	int ret;
+
+	ret = lzo1x_decompress_safe(src, src_len, dst, &dst_len);
+	if (!ret && dst_len != PAGE_SIZE)
+		ret = LZO_E_ERROR;
+	return ret;
+}
+
+static int zcomp_lz4_compress(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem)
+{
+	return lz4_compress(src, PAGE_SIZE, dst, dst_len, workmem);
+}
+
+static int zcomp_lz4_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst)
+{
+	size_t dst_len = PAGE_SIZE;
+	int ret;
+
+	ret = lz4_decompress_safe(src, src_len, dst, &dst_len);
+	if (!ret && dst_len != PAGE_SIZE)
+		ret = LZ4_E_OUTPUT_OVERRUN;
+	return ret;
+}
+
+static const struct zcomp_backend zcomp_backends[] = {
+	{
+		.name		= "lzo",
+		.workmem_size	= LZO1X_MEM_COMPRESS,
+		.compress	= zcomp_lzo_compress,
+		.decompress	= zcomp_lzo_decompress,
+	},
+	{
+		.name		= "lz4",
+		.workmem_size	= LZ4_MEM_COMPRESS,
+		.compress	= zcomp_lz4_compress,
+		.decompress	= zcomp_lz4_decompress,
+	},
+};
+
+static const struct zcomp_backend *find_backend(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(zcomp_backends); i++) {
+		if (sysfs_streq(name, zcomp_backends[i].name))
+			return &zcomp_backends[i];
+	}
+	return NULL;
+}
+
+bool zcomp_available_algorithm(const char *name)
+{
+	return find_backend(name) != NULL;
+}
+
+/* show available compressors, the current one in brackets */
+ssize_t zcomp_available_show(const char *cur, char *buf)
+{
+	ssize_t sz = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(zcomp_backends); i++) {
+		const char *name = zcomp_backends[i].name;
+
+		if (!strcmp(cur, name))
+			sz += sprintf(buf + sz, "[%s] ", name);
+		else
+			sz += sprintf(buf + sz, "%s ", name);
+	}
+	sz += sprintf(buf + sz, "\n");
+	return sz;
+}
+
+static void zcomp_strm_free(struct zcomp_strm *zstrm)
+{
+	kfree(zstrm->workmem);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	zstrm->workmem = NULL;
+	zstrm->buffer = NULL;
+}
+
+void zcomp_destroy(struct zcomp *comp)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		zcomp_strm_free(per_cpu_ptr(comp->streams, cpu));
+	free_percpu(comp->streams);
+	kfree(comp);
+}
+
+struct zcomp *zcomp_create(const char *name)
+{
+	struct zcomp *comp;
+	int cpu;
+
+	comp = kzalloc(sizeof(*comp), GFP_KERNEL);
+	if (!comp)
+		return NULL;
+
+	comp->backend = find_backend(name);
+	if (!comp->backend) {
+		kfree(comp);
+		return NULL;
+	}
+
+	comp->streams = alloc_percpu(struct zcomp_strm);
+	if (!comp->streams) {
+		kfree(comp);
+		return NULL;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct zcomp_strm *zstrm = per_cpu_ptr(comp->streams, cpu);
+
+		mutex_init(&zstrm->lock);
+		zstrm->workmem = kzalloc(comp->backend->workmem_size,
+					GFP_KERNEL);
+		/*
+		 * Allocate two pages: compressors may expand incompressible
+		 * input beyond a page before zram decides to store it as is.
+		 */
+		zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL |
+							__GFP_ZERO, 1);
+		if (!zstrm->workmem || !zstrm->buffer) {
+			zcomp_destroy(comp);
+			return NULL;
+		}
+	}
+
+	return comp;
+}
+
+/*
+ * Take the stream of the cpu we are running on. We may sleep or migrate
+ * while holding it; the mutex, not the cpu, is what makes it ours.
+ */
+struct zcomp_strm *zcomp_strm_get(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	zstrm = per_cpu_ptr(comp->streams, raw_smp_processor_id());
+	mutex_lock(&zstrm->lock);
+	return zstrm;
+}
+
+void zcomp_strm_put(struct zcomp_strm *zstrm)
+{
+	mutex_unlock(&zstrm->lock);
+}
+
+/* compress one page from src into zstrm->buffer */
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len)
+{
+	return comp->backend->compress(src, zstrm->buffer, dst_len,
+				zstrm->workmem);
+}
+
+int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
+		size_t src_len, unsigned char *dst)
+{
+	return comp->backend->decompress(src, src_len, dst);
+}
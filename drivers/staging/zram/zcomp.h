@@ -0,0 +1,58 @@
+/*
+ * Compressed RAM block device
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/mutex.h>
+
+#define ZCOMP_NAME_LEN	16
+
+struct zcomp_backend {
+	const char *name;
+	size_t workmem_size;
+	/* compress one page from src into dst */
+	int (*compress)(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem);
+	/* decompress into exactly one page at dst */
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst);
+};
+
+/*
+ * A compression stream: working memory plus an output buffer. There is one
+ * per possible cpu, so writers on different cpus compress in parallel.
+ */
+struct zcomp_strm {
+	struct mutex lock;
+	void *workmem;
+	void *buffer;
+};
+
+struct zcomp {
+	const struct zcomp_backend *backend;
+	struct zcomp_strm __percpu *streams;
+};
+
+struct zcomp *zcomp_create(const char *name);
+void zcomp_destroy(struct zcomp *comp);
+
+bool zcomp_available_algorithm(const char *name);
+ssize_t zcomp_available_show(const char *cur, char *buf);
+
+struct zcomp_strm *zcomp_strm_get(struct zcomp *comp);
+void zcomp_strm_put(struct zcomp_strm *zstrm);
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len);
+int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
+		size_t src_len, unsigned char *dst);
+
+#endif
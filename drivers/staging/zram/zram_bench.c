@@ -0,0 +1,354 @@
+/*
+ * Compressed RAM block device throughput benchmark
+ *
+ * Writes a test pattern to each zram device given in "devs" from "threads"
+ * kernel threads working on disjoint parts of the device, reads it back and
+ * checks it, and reports write/read throughput and the compression ratio
+ * achieved by the device's compressor. Devices are benchmarked one after
+ * the other; run it on freshly reset devices with their disksize set:
+ *
+ *   echo lz4 > /sys/block/zram1/comp_algorithm
+ *   echo $((64 << 20)) > /sys/block/zram1/disksize
+ *   insmod zram_bench.ko devs=/dev/zram0,/dev/zram1 threads=4 mb=64
+ *
+ * Like tcrypt, the module fails to load once it is done.
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#define KMSG_COMPONENT "zram_bench"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/completion.h>
+#include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zram_drv.h"
+
+#define ZB_MAX_THREADS		16
+#define ZB_BIO_PAGES		32
+#define ZB_MODE			(FMODE_READ | FMODE_WRITE | FMODE_EXCL)
+
+static char *devs = "/dev/zram0";
+static unsigned int threads = 4;
+static unsigned int mb = 64;
+static unsigned int random_pct = 25;
+
+struct zb_worker {
+	struct block_device *bdev;
+	unsigned long first;		/* first page */
+	unsigned long nr_pages;
+	int rw;
+	int err;
+	struct page *pages[ZB_BIO_PAGES];
+	void *expect;
+	struct completion done;
+};
+
+struct zb_bio {
+	struct completion done;
+	int err;
+};
+
+/*
+ * Fill one page for page number "index": the first random_pct percent of
+ * it is pseudo-random, the rest repeats a short index-dependent record, so
+ * random_pct controls how well the data compresses.
+ */
+static void zb_fill(void *mem, unsigned long index)
+{
+	u32 *p = mem;
+	u32 seed = index * 2654435761U + 1;
+	unsigned int i, nr_random;
+
+	nr_random = PAGE_SIZE / sizeof(u32) * random_pct / 100;
+	for (i = 0; i < nr_random; i++) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = seed;
+	}
+	for (; i < PAGE_SIZE / sizeof(u32); i++)
+		p[i] = index + (i & 7);
+}
+
+static void zb_end_io(struct bio *bio, int err)
+{
+	struct zb_bio *zb = bio->bi_private;
+
+	zb->err = err;
+	complete(&zb->done);
+}
+
+static int zb_submit(struct zb_worker *w, unsigned long index,
+		unsigned int nr_pages)
+{
+	struct zb_bio zb;
+	struct bio *bio;
+	unsigned int i;
+
+	bio = bio_alloc(GFP_KERNEL, nr_pages);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = w->bdev;
+	bio->bi_sector = (sector_t)index << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zb_end_io;
+	bio->bi_private = &zb;
+	for (i = 0; i < nr_pages; i++) {
+		if (!bio_add_page(bio, w->pages[i], PAGE_SIZE, 0)) {
+			bio_put(bio);
+			return -EIO;
+		}
+	}
+
+	init_completion(&zb.done);
+	submit_bio(w->rw, bio);
+	wait_for_completion(&zb.done);
+	bio_put(bio);
+
+	return zb.err;
+}
+
+static int zb_thread(void *data)
+{
+	struct zb_worker *w = data;
+	unsigned long index = w->first;
+	unsigned long end = w->first + w->nr_pages;
+	unsigned int i, n;
+	void *mem;
+	int err = 0;
+
+	while (index < end && !err) {
+		n = min_t(unsigned long, ZB_BIO_PAGES, end - index);
+
+		if (w->rw == WRITE) {
+			for (i = 0; i < n; i++) {
+				mem = kmap(w->pages[i]);
+				zb_fill(mem, index + i);
+				kunmap(w->pages[i]);
+			}
+		}
+
+		err = zb_submit(w, index, n);
+
+		if (!err && w->rw == READ) {
+			for (i = 0; i < n && !err; i++) {
+				zb_fill(w->expect, index + i);
+				mem = kmap(w->pages[i]);
+				if (memcmp(mem, w->expect, PAGE_SIZE)) {
+					pr_err("data mismatch at page %lu\n",
+						index + i);
+					err = -EIO;
+				}
+				kunmap(w->pages[i]);
+			}
+		}
+
+		index += n;
+	}
+
+	w->err = err;
+	complete(&w->done);
+	return 0;
+}
+
+/* Run one phase on all workers, return elapsed ns or a negative errno */
+static s64 zb_run_phase(struct zb_worker *workers, unsigned int nr, int rw)
+{
+	struct task_struct *task;
+	ktime_t start;
+	unsigned int i;
+	int err = 0;
+	s64 ns;
+
+	start = ktime_get();
+	for (i = 0; i < nr; i++) {
+		workers[i].rw = rw;
+		workers[i].err = 0;
+		init_completion(&workers[i].done);
+		task = kthread_run(zb_thread, &workers[i], "zram_bench/%u", i);
+		if (IS_ERR(task)) {
+			workers[i].err = PTR_ERR(task);
+			complete(&workers[i].done);
+		}
+	}
+	for (i = 0; i < nr; i++) {
+		wait_for_completion(&workers[i].done);
+		if (workers[i].err && !err)
+			err = workers[i].err;
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	return err ? err : max_t(s64, ns, 1);
+}
+
+/* MB/s with two decimals, as an integer scaled by 100 */
+static u64 zb_rate(u64 bytes, s64 ns)
+{
+	return div64_u64(bytes * 100 * NSEC_PER_SEC, (u64)ns << 20);
+}
+
+static void zb_free_workers(struct zb_worker *workers, unsigned int nr)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < nr; i++) {
+		for (j = 0; j < ZB_BIO_PAGES; j++)
+			if (workers[i].pages[j])
+				__free_page(workers[i].pages[j]);
+		kfree(workers[i].expect);
+	}
+	kfree(workers);
+}
+
+static int zb_bench_dev(const char *path)
+{
+	struct block_device *bdev;
+	struct zb_worker *workers;
+	struct zram *zram;
+	unsigned long nr_pages, per_thread;
+	u64 bytes, stored, compr, ratio;
+	unsigned int i, j, nr;
+	s64 wns, rns;
+	int err = 0;
+
+	bdev = blkdev_get_by_path(path, ZB_MODE, zb_bench_dev);
+	if (IS_ERR(bdev)) {
+		pr_err("%s: cannot open: %ld\n", path, PTR_ERR(bdev));
+		return PTR_ERR(bdev);
+	}
+
+	if (strncmp(bdev->bd_disk->disk_name, "zram", 4)) {
+		pr_err("%s: not a zram device\n", path);
+		err = -EINVAL;
+		goto out_put;
+	}
+	zram = bdev->bd_disk->private_data;
+
+	nr_pages = min_t(u64, (u64)mb << (20 - PAGE_SHIFT),
+			i_size_read(bdev->bd_inode) >> PAGE_SHIFT);
+	nr = clamp_t(unsigned int, threads, 1, ZB_MAX_THREADS);
+	per_thread = nr_pages / nr;
+	if (!per_thread) {
+		pr_err("%s: device too small, set its disksize first\n", path);
+		err = -ENOSPC;
+		goto out_put;
+	}
+
+	workers = kcalloc(nr, sizeof(*workers), GFP_KERNEL);
+	if (!workers) {
+		err = -ENOMEM;
+		goto out_put;
+	}
+	for (i = 0; i < nr; i++) {
+		workers[i].bdev = bdev;
+		workers[i].first = i * per_thread;
+		workers[i].nr_pages = per_thread;
+		workers[i].expect = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!workers[i].expect)
+			err = -ENOMEM;
+		for (j = 0; j < ZB_BIO_PAGES; j++) {
+			workers[i].pages[j] = alloc_page(GFP_KERNEL);
+			if (!workers[i].pages[j])
+				err = -ENOMEM;
+		}
+	}
+	if (err)
+		goto out_free;
+
+	bytes = (u64)per_thread * nr << PAGE_SHIFT;
+	stored = zram->stats.pages_stored;
+	compr = zram->stats.compr_size;
+
+	wns = zb_run_phase(workers, nr, WRITE);
+	if (wns < 0) {
+		err = wns;
+		goto out_free;
+	}
+
+	/* pages_stored and compr_size are only read, after all I/O is done */
+	stored = ((u64)zram->stats.pages_stored - stored) << PAGE_SHIFT;
+	compr = zram->stats.compr_size - compr;
+	ratio = compr ? div64_u64(stored * 100, compr) : 0;
+
+	rns = zb_run_phase(workers, nr, READ);
+	if (rns < 0) {
+		err = rns;
+		goto out_free;
+	}
+
+	pr_info("%s: %s, %u threads, %llu MB: write %llu.%02llu MB/s, "
+		"read %llu.%02llu MB/s, ratio %llu.%02llu\n",
+		path, zram->compressor, nr, bytes >> 20,
+		zb_rate(bytes, wns) / 100, zb_rate(bytes, wns) % 100,
+		zb_rate(bytes, rns) / 100, zb_rate(bytes, rns) % 100,
+		ratio / 100, ratio % 100);
+
+out_free:
+	zb_free_workers(workers, nr);
+out_put:
+	blkdev_put(bdev, ZB_MODE);
+	if (err)
+		pr_err("%s: benchmark failed: %d\n", path, err);
+	return err;
+}
+
+static int __init zram_bench_init(void)
+{
+	char *list, *cur, *path;
+	int err = 0;
+
+	if (random_pct > 100)
+		return -EINVAL;
+
+	list = kstrdup(devs, GFP_KERNEL);
+	if (!list)
+		return -ENOMEM;
+
+	cur = list;
+	while ((path = strsep(&cur, ",")) != NULL) {
+		if (!*path)
+			continue;
+		err = zb_bench_dev(path);
+		if (err)
+			break;
+	}
+	kfree(list);
+
+	/*
+	 * The benchmark is done; fail the load so that it can simply be
+	 * run again with insmod, as tcrypt does.
+	 */
+	return err ? err : -EAGAIN;
+}
+
+static void __exit zram_bench_exit(void) { }
+
+module_init(zram_bench_init);
+module_exit(zram_bench_exit);
+
+module_param(devs, charp, 0);
+MODULE_PARM_DESC(devs, "Comma separated zram device paths");
+module_param(threads, uint, 0);
+MODULE_PARM_DESC(threads, "Threads per device (1-16)");
+module_param(mb, uint, 0);
+MODULE_PARM_DESC(mb, "Megabytes written and read per device");
+module_param(random_pct, uint, 0);
+MODULE_PARM_DESC(random_pct, "Percentage of each page filled with random "
+		"bytes (controls compressibility)");
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Compressed RAM Block Device throughput benchmark");
@@ -0,0 +1,630 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Objects are grouped by size class. Each class packs its objects back to
+ * back into "zspages" of one to ZS_MAX_PAGES_PER_ZSPAGE pages, with the
+ * page count chosen to minimise the tail waste for that class. Since all
+ * objects of a zspage have the same size, freeing never leaves holes that
+ * only smaller objects can use, and whole zspages are returned as soon as
+ * their last object goes away.
+ *
+ * Handles are indirect, so zs_compact() can move objects out of sparsely
+ * used zspages into fuller ones of the same class and free the former.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/* All pools share one handle cache */
+static DEFINE_MUTEX(zs_handle_cache_lock);
+static struct kmem_cache *zs_handle_cachep;
+static int zs_handle_cache_users;
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the zspage size, in pages, that wastes the smallest share of the
+ * zspage on a tail too short for another object.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int waste = zspage_size % class_size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	unsigned int inuse = zspage->inuse;
+	unsigned int max_objects = class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	if (inuse == max_objects)
+		return ZS_FULL;
+	if (inuse <= 3 * max_objects / ZS_FULLNESS_THRESHOLD_FRAC)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/*
+ * Move the zspage to the list matching its current use. Empty zspages are
+ * only taken off their list; the caller frees them.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	list_del(&zspage->list);
+	if (newfg != ZS_EMPTY)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+
+	return newfg;
+}
+
+static unsigned long obj_offset(struct size_class *class, unsigned long idx)
+{
+	return idx * class->size;
+}
+
+/* The header word never crosses a page: objects are 16 byte aligned */
+static unsigned long get_obj_head(struct size_class *class,
+				struct zspage *zspage, unsigned long idx)
+{
+	unsigned long off = obj_offset(class, idx);
+	unsigned long head;
+	void *addr;
+
+	addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER0);
+	head = *(unsigned long *)(addr + (off & ~PAGE_MASK));
+	kunmap_atomic(addr, KM_USER0);
+
+	return head;
+}
+
+static void set_obj_head(struct size_class *class, struct zspage *zspage,
+			unsigned long idx, unsigned long head)
+{
+	unsigned long off = obj_offset(class, idx);
+	void *addr;
+
+	addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER0);
+	*(unsigned long *)(addr + (off & ~PAGE_MASK)) = head;
+	kunmap_atomic(addr, KM_USER0);
+}
+
+/* Copy between a buffer and a byte range of a zspage */
+static void zs_copy_from(struct zspage *zspage, unsigned long off,
+			void *buf, int len)
+{
+	while (len) {
+		unsigned long poff = off & ~PAGE_MASK;
+		int n = min_t(int, len, PAGE_SIZE - poff);
+		void *addr;
+
+		addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER0);
+		memcpy(buf, addr + poff, n);
+		kunmap_atomic(addr, KM_USER0);
+
+		buf += n;
+		off += n;
+		len -= n;
+	}
+}
+
+static void zs_copy_to(struct zspage *zspage, unsigned long off,
+			const void *buf, int len)
+{
+	while (len) {
+		unsigned long poff = off & ~PAGE_MASK;
+		int n = min_t(int, len, PAGE_SIZE - poff);
+		void *addr;
+
+		addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER0);
+		memcpy(addr + poff, buf, n);
+		kunmap_atomic(addr, KM_USER0);
+
+		buf += n;
+		off += n;
+		len -= n;
+	}
+}
+
+static void free_zspage(struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		if (zspage->pages[i])
+			__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				struct size_class *class)
+{
+	struct zspage *zspage;
+	unsigned long idx;
+	int i;
+
+	zspage = kzalloc(sizeof(*zspage), pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (!zspage->pages[i]) {
+			free_zspage(zspage);
+			return NULL;
+		}
+	}
+
+	/* Chain all objects into the free list */
+	for (idx = 0; idx < class->objs_per_zspage; idx++) {
+		unsigned long next = idx + 1;
+
+		if (next == class->objs_per_zspage)
+			next = OBJ_FREE_END;
+		set_obj_head(class, zspage, idx, next << OBJ_TAG_BITS);
+	}
+	zspage->freeobj = 0;
+	zspage->fullness = ZS_EMPTY;
+	INIT_LIST_HEAD(&zspage->list);
+
+	return zspage;
+}
+
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+	struct list_head *head;
+
+	for (i = 0; i <= ZS_ALMOST_EMPTY; i++) {
+		head = &class->fullness_list[i];
+		if (!list_empty(head))
+			return list_first_entry(head, struct zspage, list);
+	}
+
+	return NULL;
+}
+
+/* Called with class->lock held, zspage must have a free object */
+static void obj_malloc(struct size_class *class, struct zspage *zspage,
+			struct zs_handle *handle)
+{
+	unsigned long idx = zspage->freeobj;
+
+	BUG_ON(idx == OBJ_FREE_END);
+
+	zspage->freeobj = get_obj_head(class, zspage, idx) >> OBJ_TAG_BITS;
+	set_obj_head(class, zspage, idx,
+			(unsigned long)handle | OBJ_ALLOCATED_TAG);
+	zspage->inuse++;
+	class->objs_inuse++;
+
+	handle->zspage = zspage;
+	handle->obj_idx = idx;
+}
+
+/* Called with class->lock held */
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned long idx)
+{
+	set_obj_head(class, zspage, idx, zspage->freeobj << OBJ_TAG_BITS);
+	zspage->freeobj = idx;
+	zspage->inuse--;
+	class->objs_inuse--;
+}
+
+static int zs_get_handle_cache(void)
+{
+	int ret = 0;
+
+	mutex_lock(&zs_handle_cache_lock);
+	if (!zs_handle_cache_users) {
+		zs_handle_cachep = kmem_cache_create("zs_handle",
+					sizeof(struct zs_handle), 0, 0, NULL);
+		if (!zs_handle_cachep)
+			ret = -ENOMEM;
+	}
+	if (!ret)
+		zs_handle_cache_users++;
+	mutex_unlock(&zs_handle_cache_lock);
+
+	return ret;
+}
+
+static void zs_put_handle_cache(void)
+{
+	mutex_lock(&zs_handle_cache_lock);
+	if (!--zs_handle_cache_users) {
+		kmem_cache_destroy(zs_handle_cachep);
+		zs_handle_cachep = NULL;
+	}
+	mutex_unlock(&zs_handle_cache_lock);
+}
+
+static void zs_free_map_areas(struct zs_pool *pool)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(pool->map_area, cpu)->buf);
+	free_percpu(pool->map_area);
+}
+
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i, j, cpu;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE /
+						class->size;
+		spin_lock_init(&class->lock);
+		for (j = 0; j < _ZS_NR_FULLNESS_GROUPS; j++)
+			INIT_LIST_HEAD(&class->fullness_list[j]);
+	}
+
+	pool->map_area = alloc_percpu(struct zs_map_area);
+	if (!pool->map_area)
+		goto free_pool;
+
+	for_each_possible_cpu(cpu) {
+		struct zs_map_area *area = per_cpu_ptr(pool->map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto free_areas;
+	}
+
+	if (zs_get_handle_cache())
+		goto free_areas;
+
+	pool->name = name;
+	pool->flags = flags;
+	atomic_long_set(&pool->pages_allocated, 0);
+
+	return pool;
+
+free_areas:
+	zs_free_map_areas(pool);
+free_pool:
+	kfree(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, fg;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		struct zspage *zspage, *tmp;
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				pr_info("Freeing non-empty zspage of class %d "
+					"in pool %s\n", class->size,
+					pool->name);
+				list_del(&zspage->list);
+				free_zspage(zspage);
+			}
+		}
+	}
+
+	zs_put_handle_cache();
+	zs_free_map_areas(pool);
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * On success, a handle to the allocated object is returned; 0 otherwise.
+ * The object has to be mapped with zs_map_object() to be accessed.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	int class_idx;
+	struct zs_handle *handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	size += ZS_HANDLE_SIZE;
+	if (unlikely(size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(zs_handle_cachep,
+				pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+
+	class_idx = get_size_class_index(size);
+	class = &pool->size_class[class_idx];
+	handle->class_idx = class_idx;
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cachep, handle);
+			return 0;
+		}
+		atomic_long_add(class->pages_per_zspage,
+				&pool->pages_allocated);
+
+		spin_lock(&class->lock);
+		class->nr_zspages++;
+	}
+
+	obj_malloc(class, zspage, handle);
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct size_class *class;
+	struct zspage *zspage;
+	enum fullness_group fullness;
+
+	if (unlikely(!handle))
+		return;
+
+	/* Compaction only moves objects within their class */
+	class = &pool->size_class[handle->class_idx];
+
+	spin_lock(&class->lock);
+	zspage = handle->zspage;
+	obj_free(class, zspage, handle->obj_idx);
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY)
+		class->nr_zspages--;
+	spin_unlock(&class->lock);
+
+	if (fullness == ZS_EMPTY) {
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+		free_zspage(zspage);
+	}
+
+	kmem_cache_free(zs_handle_cachep, handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: how the mapping is going to be used
+ *
+ * Objects that straddle a page boundary are bounced through a per-cpu
+ * buffer. Preemption stays disabled until zs_unmap_object(), so only one
+ * object can be mapped per cpu at a time and the caller must not sleep.
+ *
+ * The caller must also make sure zs_compact() does not run on the pool
+ * while the object is mapped.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long obj,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct size_class *class = &pool->size_class[handle->class_idx];
+	struct zs_map_area *area;
+	unsigned long off;
+
+	BUG_ON(!handle);
+
+	area = per_cpu_ptr(pool->map_area, get_cpu());
+	area->zspage = handle->zspage;
+	area->offset = obj_offset(class, handle->obj_idx);
+	area->size = class->size;
+	area->mm = mm;
+
+	off = area->offset & ~PAGE_MASK;
+	if (off + class->size <= PAGE_SIZE) {
+		area->kaddr = kmap_atomic(
+			area->zspage->pages[area->offset >> PAGE_SHIFT],
+			KM_USER1);
+		return area->kaddr + off + ZS_HANDLE_SIZE;
+	}
+
+	area->kaddr = NULL;
+	if (mm != ZS_MM_WO)
+		zs_copy_from(area->zspage, area->offset, area->buf,
+				class->size);
+	return area->buf + ZS_HANDLE_SIZE;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_map_area *area = this_cpu_ptr(pool->map_area);
+
+	if (area->kaddr) {
+		kunmap_atomic(area->kaddr, KM_USER1);
+	} else if (area->mm != ZS_MM_RO) {
+		/* leave the header alone, it was not read in for WO */
+		zs_copy_to(area->zspage, area->offset + ZS_HANDLE_SIZE,
+				area->buf + ZS_HANDLE_SIZE,
+				area->size - ZS_HANDLE_SIZE);
+	}
+	put_cpu();
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+static struct zspage *zs_pick_compact_source(struct size_class *class)
+{
+	struct zspage *zspage, *src = NULL;
+
+	list_for_each_entry(zspage, &class->fullness_list[ZS_ALMOST_EMPTY],
+				list) {
+		if (!src || zspage->inuse < src->inuse)
+			src = zspage;
+	}
+
+	return src;
+}
+
+/*
+ * Empty the sparsest zspages of a class into the others, as long as the
+ * rest of the class has room for all of a source's objects. Each source
+ * is migrated under class->lock in one go, so zs_free() never sees an
+ * object in flight.
+ */
+static unsigned long zs_compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	unsigned long freed = 0;
+	struct zspage *src, *dst;
+	struct zs_handle *handle;
+	unsigned long idx, head, room;
+	char *buf;
+
+	while (1) {
+		spin_lock(&class->lock);
+		src = zs_pick_compact_source(class);
+		if (!src) {
+			spin_unlock(&class->lock);
+			break;
+		}
+		room = (class->nr_zspages - 1) * class->objs_per_zspage -
+			(class->objs_inuse - src->inuse);
+		if (room < src->inuse) {
+			spin_unlock(&class->lock);
+			break;
+		}
+
+		/* keep it from being picked as a destination */
+		list_del_init(&src->list);
+
+		/* class->lock keeps us on this cpu */
+		buf = this_cpu_ptr(pool->map_area)->buf;
+		for (idx = 0; src->inuse; idx++) {
+			head = get_obj_head(class, src, idx);
+			if (!(head & OBJ_ALLOCATED_TAG))
+				continue;
+
+			handle = (struct zs_handle *)(head & ~OBJ_ALLOCATED_TAG);
+			dst = find_get_zspage(class);
+			BUG_ON(!dst);
+
+			zs_copy_from(src, obj_offset(class, idx) + ZS_HANDLE_SIZE,
+					buf, class->size - ZS_HANDLE_SIZE);
+			obj_malloc(class, dst, handle);
+			zs_copy_to(dst, obj_offset(class, handle->obj_idx) +
+					ZS_HANDLE_SIZE, buf,
+					class->size - ZS_HANDLE_SIZE);
+			obj_free(class, src, idx);
+			fix_fullness_group(class, dst);
+		}
+		class->nr_zspages--;
+		spin_unlock(&class->lock);
+
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+		freed += class->pages_per_zspage;
+		free_zspage(src);
+
+		cond_resched();
+	}
+
+	return freed;
+}
+
+/**
+ * zs_compact - migrate objects out of sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Returns the number of pages freed. May sleep; must not run concurrently
+ * with zs_map_object() users of the pool, while zs_malloc() and zs_free()
+ * are fine.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		freed += zs_compact_class(pool, &pool->size_class[i]);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+/*
+ * Returns total memory used by allocator (userdata + metadata)
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
@@ -0,0 +1,114 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/* User configurable params */
+
+/*
+ * A zspage is a group of up to this many 0-order pages holding objects of
+ * one size class back to back; objects may straddle a page boundary.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/* This must be greater than the object header */
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are separated by ZS_SIZE_CLASS_DELTA bytes, which keeps the
+ * rounding waste below 16 bytes per object for 4k pages.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A zspage with at most 3/4 of its objects in use is "almost empty" and a
+ * source for compaction; fuller ones are preferred for new allocations.
+ */
+#define ZS_FULLNESS_THRESHOLD_FRAC	4
+
+/* End of user params */
+
+/*
+ * Every object starts with a header word. For an allocated object it holds
+ * its handle, tagged with OBJ_ALLOCATED_TAG, so compaction can find and
+ * update the owner; for a free object it holds the index of the next free
+ * object of the zspage.
+ */
+#define ZS_HANDLE_SIZE		sizeof(unsigned long)
+#define OBJ_ALLOCATED_TAG	1UL
+#define OBJ_TAG_BITS		1
+#define OBJ_FREE_END		(~0UL >> OBJ_TAG_BITS)
+
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	/* not kept on any list, the zspage is freed */
+	ZS_EMPTY,
+};
+
+struct zspage {
+	struct list_head list;		/* fullness list of its class */
+	unsigned int inuse;		/* objects allocated */
+	unsigned long freeobj;		/* first free object index */
+	enum fullness_group fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+/*
+ * What callers get back from zs_malloc(). The location may change under
+ * compaction, the class never does.
+ */
+struct zs_handle {
+	struct zspage *zspage;
+	u16 obj_idx;
+	u16 class_idx;
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	int size;			/* object size, header included */
+	int pages_per_zspage;
+	int objs_per_zspage;
+	unsigned long nr_zspages;	/* stats */
+	unsigned long objs_inuse;
+};
+
+/* Per-cpu state between zs_map_object() and zs_unmap_object() */
+struct zs_map_area {
+	char *buf;			/* bounce buffer for split objects */
+	void *kaddr;			/* kmap_atomic() address otherwise */
+	struct zspage *zspage;
+	unsigned long offset;
+	int size;
+	enum zs_mapmode mm;
+};
+
+struct zs_pool {
+	const char *name;
+	gfp_t flags;
+	atomic_long_t pages_allocated;
+	struct zs_map_area __percpu *map_area;
+	struct size_class size_class[ZS_SIZE_CLASSES];
+};
+
+#endif
@@ -46,6 +46,7 @@
 #include <mach/mc.h>
 #include <linux/nvhost.h>
 #include <mach/latency_allowance.h>
+#include <mach/emc_bw.h>
 
 #include "dc_reg.h"
 #include "dc_priv.h"
@@ -984,6 +985,7 @@ static void tegra_dc_clear_bandwidth(struct tegra_dc *dc)
 	if (tegra_is_clk_enabled(dc->emc_clk))
 		clk_disable(dc->emc_clk);
 	dc->emc_clk_rate = 0;
+	tegra_emc_bw_request(&dc->emc_bw, 0);
 }
 
 static void tegra_dc_program_bandwidth(struct tegra_dc *dc)
@@ -1002,6 +1004,8 @@ static void tegra_dc_program_bandwidth(struct tegra_dc *dc)
 			clk_disable(dc->emc_clk);
 	}
 
+	tegra_emc_bw_request(&dc->emc_bw, dc->new_emc_bw);
+
 	for (i = 0; i < DC_N_WINDOWS; i++) {
 		struct tegra_dc_win *w = &dc->windows[i];
 
@@ -1022,6 +1026,13 @@ static int tegra_dc_set_dynamic_emc(struct tegra_dc_win *windows[], int n)
 
 	/* calculate the new rate based on this POST */
 	new_rate = tegra_dc_get_bandwidth(windows, n);
+	/*
+	 * The window bandwidths carry the ~35% efficiency derating that the
+	 * EMC clock and latency allowance want. The bandwidth request must
+	 * not: the EMC layer budgets isochronous clients at its own
+	 * efficiency, so it is given what the windows actually fetch.
+	 */
+	dc->new_emc_bw = DIV_ROUND_UP(new_rate * 10 / 29, 1000);
 	if (WARN_ONCE(new_rate > (ULONG_MAX / 1000), "bandwidth maxed out\n"))
 		new_rate = ULONG_MAX;
 	else
@@ -3033,6 +3044,11 @@ static int tegra_dc_probe(struct nvhost_device *ndev)
 		goto err_put_min_emc_clk;
 	}
 
+	/* declare the isochronous bandwidth of each update up front */
+	dc->emc_bw.name = dev_name(&ndev->dev);
+	dc->emc_bw.class = TEGRA_EMC_BW_ISO;
+	tegra_emc_bw_register(&dc->emc_bw);
+
 	/* hack to balance enable_irq calls in _tegra_dc_enable() */
 	disable_dc_irq(dc->irq);
 
@@ -3114,6 +3130,7 @@ static int tegra_dc_remove(struct nvhost_device *ndev)
 
 	if (dc->enabled)
 		_tegra_dc_disable(dc);
+	tegra_emc_bw_unregister(&dc->emc_bw);
 
 #ifdef CONFIG_SWITCH
 	switch_dev_unregister(&dc->modeset_switch);
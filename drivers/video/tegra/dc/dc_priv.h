@@ -25,6 +25,7 @@
 #include <linux/switch.h>
 
 #include <mach/dc.h>
+#include <mach/emc_bw.h>
 
 #include "../host/dev.h"
 #include "../host/host1x/host1x_syncpt.h"
@@ -83,6 +84,8 @@ struct tegra_dc {
 	struct clk			*min_emc_clk;
 	int				emc_clk_rate;
 	int				new_emc_clk_rate;
+	struct tegra_emc_bw_client	emc_bw;
+	unsigned int			new_emc_bw;
 	u32				shift_clk_div;
 
 	bool				connected;
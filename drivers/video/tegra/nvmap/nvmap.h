@@ -60,6 +60,9 @@ struct nvmap_pgalloc {
 	struct list_head mru_list;	/* MRU entry for IOVMM reclamation */
 	bool contig;			/* contiguous system memory */
 	bool dirty;			/* area is invalid and needs mapping */
+	bool mru_ref;			/* area was reused since last eviction
+					 * scan: give it a second chance */
+	bool evicted;			/* area was taken away while mapped */
 	u32 iovm_addr;	/* is non-zero, if client need specific iova mapping */
 };
 
@@ -121,6 +124,11 @@ struct nvmap_share {
 	struct mutex mru_lock;
 	struct list_head *mru_lists;
 	int nr_mru;
+	u32 mru_clock;		/* clock eviction, else most recent first */
+	u32 mru_hits;		/* pins which found their area still there */
+	u32 mru_misses;		/* pins which needed a new area */
+	u32 mru_evictions;	/* areas taken from unpinned handles */
+	u64 mru_remap_bytes;	/* bytes pins mapped again after eviction */
 #endif
 };
 
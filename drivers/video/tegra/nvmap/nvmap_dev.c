@@ -1321,6 +1321,7 @@ static int nvmap_probe(struct platform_device *pdev)
 					iovmm_root,
 					&dev->iovmm_master.pools[i].npages);
 			}
+			nvmap_mru_debugfs_init(&dev->iovmm_master, iovmm_root);
 		}
 	}
 
@@ -27,6 +27,12 @@
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/rbtree.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include <mach/nvmap.h>
 #include "nvmap.h"
@@ -68,10 +74,30 @@
  * and to ensure that the minimum free block size in the carveout (i.e., the
  * "small" threshold) is still a meaningful size.
  *
+ * free blocks are kept in per-size-class rbtrees, sorted by size and then by
+ * address, so "normal" allocations take the best-fitting free block in
+ * O(log n). all blocks, free or not, stay on the address-ordered all_list,
+ * which is what freeing (to merge neighbours), "huge" allocations and
+ * compaction walk.
+ *
+ * with CONFIG_NVMAP_CARVEOUT_COMPACTOR, frees that leave the heap fragmented
+ * kick a background worker which slides unpinned, unmapped blocks down into
+ * the free space below them, one block per heap lock hold.
  */
 
 #define MAX_BUDDY_NR	128	/* maximum buddies in a buddy allocator */
 
+/* free block size classes: < 1 page, then one per power of 2 pages */
+#define NR_FREE_CLASSES	16
+
+/* allocation latency buckets: < 1us, then one per power of 2 us */
+#define NR_LAT_BUCKETS	12
+
+/* background compaction starts when at least this percentage of the free
+ * space is outside of the largest free block, and stops at half of it */
+#define COMPACT_FRAG_PCT	50
+#define COMPACT_DELAY		HZ
+
 enum direction {
 	TOP_DOWN,
 	BOTTOM_UP
@@ -111,7 +137,7 @@ struct list_block {
 	size_t size;
 	size_t align;
 	struct nvmap_heap *heap;
-	struct list_head free_list;
+	struct rb_node free_node;	/* in heap->free_class[], if BLOCK_EMPTY */
 };
 
 struct combo_block {
@@ -135,7 +161,11 @@ struct buddy_heap {
 
 struct nvmap_heap {
 	struct list_head all_list;
-	struct list_head free_list;
+	struct rb_root free_class[NR_FREE_CLASSES];
+	unsigned int free_nr[NR_FREE_CLASSES];
+	unsigned int free_count;
+	size_t free_size;
+	unsigned int alloc_lat[NR_LAT_BUCKETS];
 	struct mutex lock;
 	struct list_head buddy_list;
 	unsigned int min_buddy_shift;
@@ -144,10 +174,16 @@ struct nvmap_heap {
 	const char *name;
 	void *arg;
 	struct device dev;
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+	struct delayed_work compact_work;
+#endif
 };
 
 static struct kmem_cache *buddy_heap_cache;
 static struct kmem_cache *block_cache;
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+static struct workqueue_struct *compact_wq;
+#endif
 
 static inline struct nvmap_heap *parent_of(struct buddy_heap *heap)
 {
@@ -160,6 +196,104 @@ static inline unsigned int order_of(size_t len, size_t min_shift)
 	return fls(len)-1;
 }
 
+static inline unsigned int free_class_of(size_t size)
+{
+	unsigned int class = fls(size >> PAGE_SHIFT);
+	return min_t(unsigned int, class, NR_FREE_CLASSES - 1);
+}
+
+/* adds a free block to its size class; must be called while holding the
+ * heap's lock, and the block must not change size while it is there. */
+static void free_insert(struct nvmap_heap *heap, struct list_block *b)
+{
+	unsigned int class = free_class_of(b->size);
+	struct rb_node **p = &heap->free_class[class].rb_node;
+	struct rb_node *parent = NULL;
+	struct list_block *n;
+
+	while (*p) {
+		parent = *p;
+		n = rb_entry(parent, struct list_block, free_node);
+		if (b->size < n->size ||
+		    (b->size == n->size && b->block.base < n->block.base))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&b->free_node, parent, p);
+	rb_insert_color(&b->free_node, &heap->free_class[class]);
+
+	heap->free_nr[class]++;
+	heap->free_count++;
+	heap->free_size += b->size;
+}
+
+static void free_remove(struct nvmap_heap *heap, struct list_block *b)
+{
+	unsigned int class = free_class_of(b->size);
+
+	rb_erase(&b->free_node, &heap->free_class[class]);
+	heap->free_nr[class]--;
+	heap->free_count--;
+	heap->free_size -= b->size;
+}
+
+/* returns the smallest free block which can hold len bytes aligned to align
+ * and sets *base to where the allocation would start in it. */
+static struct list_block *free_best_fit(struct nvmap_heap *heap, size_t len,
+					size_t align, unsigned long *base)
+{
+	unsigned int class;
+
+	for (class = free_class_of(len); class < NR_FREE_CLASSES; class++) {
+		struct rb_node *n = heap->free_class[class].rb_node;
+		struct list_block *fit = NULL;
+		struct list_block *b;
+
+		while (n) {
+			b = rb_entry(n, struct list_block, free_node);
+			if (b->size >= len) {
+				fit = b;
+				n = n->rb_left;
+			} else {
+				n = n->rb_right;
+			}
+		}
+
+		for (n = fit ? &fit->free_node : NULL; n; n = rb_next(n)) {
+			unsigned long skip;
+
+			b = rb_entry(n, struct list_block, free_node);
+			skip = ALIGN(b->block.base, align) - b->block.base;
+			if (skip <= b->size && b->size - skip >= len) {
+				*base = b->block.base + skip;
+				return b;
+			}
+		}
+	}
+	return NULL;
+}
+
+static size_t free_largest(struct nvmap_heap *heap)
+{
+	int class;
+
+	for (class = NR_FREE_CLASSES - 1; class >= 0; class--) {
+		struct rb_node *n = rb_last(&heap->free_class[class]);
+		if (n)
+			return rb_entry(n, struct list_block, free_node)->size;
+	}
+	return 0;
+}
+
+/* percentage of the free space which is not in the largest free block */
+static unsigned int frag_pct(size_t free, size_t largest)
+{
+	if (!free)
+		return 0;
+	return 100 - (unsigned int)div_u64((u64)largest * 100, free);
+}
+
 /* returns the free size in bytes of the buddy heap; must be called while
  * holding the parent heap's lock. */
 static void buddy_stat(struct buddy_heap *heap, struct heap_stat *stat)
@@ -210,11 +344,9 @@ static unsigned long heap_stat(struct nvmap_heap *heap, struct heap_stat *stat)
 		stat->count--;
 	}
 
-	list_for_each_entry(l, &heap->free_list, free_list) {
-		stat->free += l->size;
-		stat->free_count++;
-		stat->free_largest = max(l->size, stat->free_largest);
-	}
+	stat->free += heap->free_size;
+	stat->free_count += heap->free_count;
+	stat->free_largest = max(free_largest(heap), stat->free_largest);
 	mutex_unlock(&heap->lock);
 
 	return base;
@@ -226,6 +358,9 @@ static ssize_t heap_name_show(struct device *dev,
 static ssize_t heap_stat_show(struct device *dev,
 			      struct device_attribute *attr, char *buf);
 
+static ssize_t heap_hist_show(struct device *dev,
+			      struct device_attribute *attr, char *buf);
+
 static struct device_attribute heap_stat_total_max =
 	__ATTR(total_max, S_IRUGO, heap_stat_show, NULL);
 
@@ -247,6 +382,15 @@ static struct device_attribute heap_stat_free_size =
 static struct device_attribute heap_stat_base =
 	__ATTR(base, S_IRUGO, heap_stat_show, NULL);
 
+static struct device_attribute heap_stat_free_frag =
+	__ATTR(free_frag, S_IRUGO, heap_stat_show, NULL);
+
+static struct device_attribute heap_hist_free =
+	__ATTR(free_hist, S_IRUGO, heap_hist_show, NULL);
+
+static struct device_attribute heap_hist_alloc_latency =
+	__ATTR(alloc_latency_hist, S_IRUGO, heap_hist_show, NULL);
+
 static struct device_attribute heap_attr_name =
 	__ATTR(name, S_IRUGO, heap_name_show, NULL);
 
@@ -258,6 +402,9 @@ static struct attribute *heap_stat_attrs[] = {
 	&heap_stat_free_count.attr,
 	&heap_stat_free_size.attr,
 	&heap_stat_base.attr,
+	&heap_stat_free_frag.attr,
+	&heap_hist_free.attr,
+	&heap_hist_alloc_latency.attr,
 	&heap_attr_name.attr,
 	NULL,
 };
@@ -297,9 +444,48 @@ static ssize_t heap_stat_show(struct device *dev,
 		return sprintf(buf, "%u\n", stat.free);
 	else if (attr == &heap_stat_base)
 		return sprintf(buf, "%08lx\n", base);
+	else if (attr == &heap_stat_free_frag)
+		return sprintf(buf, "%u\n",
+			       frag_pct(stat.free, stat.free_largest));
 	else
 		return -EINVAL;
 }
+
+/* one "<bucket lower bound> <count>" line per bucket: free blocks of the
+ * list heap by size in KiB, or allocations by latency in us. */
+static ssize_t heap_hist_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct nvmap_heap *heap = container_of(dev, struct nvmap_heap, dev);
+	ssize_t len = 0;
+	int i;
+
+	mutex_lock(&heap->lock);
+	if (attr == &heap_hist_free) {
+		for (i = 0; i < NR_FREE_CLASSES; i++)
+			len += sprintf(buf + len, "%lu %u\n",
+				       i ? (PAGE_SIZE << (i - 1)) >> 10 : 0,
+				       heap->free_nr[i]);
+	} else if (attr == &heap_hist_alloc_latency) {
+		for (i = 0; i < NR_LAT_BUCKETS; i++)
+			len += sprintf(buf + len, "%u %u\n",
+				       i ? 1 << (i - 1) : 0, heap->alloc_lat[i]);
+	} else {
+		len = -EINVAL;
+	}
+	mutex_unlock(&heap->lock);
+	return len;
+}
+
+/* records the latency of an allocation which started at start; must be
+ * called while holding the heap's lock. */
+static void heap_account_alloc(struct nvmap_heap *heap, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	unsigned int bucket = us > 0 ? fls64(us) : 0;
+
+	heap->alloc_lat[min_t(unsigned int, bucket, NR_LAT_BUCKETS - 1)]++;
+}
 #ifndef CONFIG_NVMAP_CARVEOUT_COMPACTOR
 static struct nvmap_heap_block *buddy_alloc(struct buddy_heap *heap,
 					    size_t size, size_t align,
@@ -416,25 +602,31 @@ static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 	dir = (len <= heap->small_alloc) ? BOTTOM_UP : TOP_DOWN;
 #endif
 
-	if (dir == BOTTOM_UP) {
-		list_for_each_entry(i, &heap->free_list, free_list) {
+	if (dir == BOTTOM_UP && !base_max) {
+		b = free_best_fit(heap, len, align, &fix_base);
+	} else if (dir == BOTTOM_UP) {
+		/* needed for compaction: a relocated chunk should go as
+		 * low as it can and never up, so this is first-fit */
+		list_for_each_entry(i, &heap->all_list, all_list) {
 			size_t fix_size;
-			fix_base = ALIGN(i->block.base, align);
-			fix_size = i->size - (fix_base - i->block.base);
 
-			/* needed for compaction. relocated chunk
-			 * should never go up */
-			if (base_max && fix_base > base_max)
+			if (i->block.type != BLOCK_EMPTY)
+				continue;
+
+			fix_base = ALIGN(i->block.base, align);
+			if (fix_base > base_max)
 				break;
 
-			if (fix_size >= len) {
+			fix_size = i->size - (fix_base - i->block.base);
+			if (fix_base - i->block.base <= i->size &&
+			    fix_size >= len) {
 				b = i;
 				break;
 			}
 		}
 	} else {
-		list_for_each_entry_reverse(i, &heap->free_list, free_list) {
-			if (i->size >= len) {
+		list_for_each_entry_reverse(i, &heap->all_list, all_list) {
+			if (i->block.type == BLOCK_EMPTY && i->size >= len) {
 				fix_base = i->block.base + i->size - len;
 				fix_base &= ~(align-1);
 				if (fix_base >= i->block.base) {
@@ -448,8 +640,8 @@ static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 	if (!b)
 		return NULL;
 
-	if (dir == BOTTOM_UP)
-		b->block.type = BLOCK_FIRST_FIT;
+	free_remove(heap, b);
+	b->block.type = BLOCK_FIRST_FIT;
 
 	/* split free block */
 	if (b->block.base != fix_base) {
@@ -466,11 +658,12 @@ static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 		rem->block.base = b->block.base;
 		rem->orig_addr = rem->block.base;
 		rem->size = fix_base - rem->block.base;
+		rem->heap = heap;
 		b->block.base = fix_base;
 		b->orig_addr = fix_base;
 		b->size -= rem->size;
 		list_add_tail(&rem->all_list,  &b->all_list);
-		list_add_tail(&rem->free_list, &b->free_list);
+		free_insert(heap, rem);
 	}
 
 	b->orig_addr = b->block.base;
@@ -486,13 +679,13 @@ static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 		rem->size = b->size - len;
 		BUG_ON(rem->size > b->size);
 		rem->orig_addr = rem->block.base;
+		rem->heap = heap;
 		b->size = len;
 		list_add(&rem->all_list,  &b->all_list);
-		list_add(&rem->free_list, &b->free_list);
+		free_insert(heap, rem);
 	}
 
 out:
-	list_del(&b->free_list);
 	b->heap = heap;
 	b->mem_prot = mem_prot;
 	b->align = align;
@@ -508,7 +701,9 @@ static void freelist_debug(struct nvmap_heap *heap, const char *title,
 
 	dev_debug(&heap->dev, "%s\n", title);
 	i = 0;
-	list_for_each_entry(n, &heap->free_list, free_list) {
+	list_for_each_entry(n, &heap->all_list, all_list) {
+		if (n->block.type != BLOCK_EMPTY && n != token)
+			continue;
 		dev_debug(&heap->dev, "\t%d [%p..%p]%s\n", i, (void *)n->orig_addr,
 			  (void *)(n->orig_addr + n->size),
 			  (n == token) ? "<--" : "");
@@ -525,53 +720,43 @@ static struct list_block *do_heap_free(struct nvmap_heap_block *block)
 	struct list_block *n = NULL;
 	struct nvmap_heap *heap = b->heap;
 
-	BUG_ON(b->block.base > b->orig_addr);
+	BUG_ON(b->block.base < b->orig_addr);
 	b->size += (b->block.base - b->orig_addr);
 	b->block.base = b->orig_addr;
+	b->block.type = BLOCK_EMPTY;
 
 	freelist_debug(heap, "free list before", b);
 
-	/* Find position of first free block to the right of freed one */
-	list_for_each_entry(n, &heap->free_list, free_list) {
-		if (n->block.base > b->block.base)
-			break;
-	}
-
-	/* Add freed block before found free one */
-	list_add_tail(&b->free_list, &n->free_list);
-	BUG_ON(list_empty(&b->all_list));
+	/* the neighbours on all_list are the blocks right below and above
+	 * the freed one in memory: merge it with those that are free */
 
-	freelist_debug(heap, "free list pre-merge", b);
-
-	/* merge freed block with next if they connect
-	 * freed block becomes bigger, next one is destroyed */
-	if (!list_is_last(&b->free_list, &heap->free_list)) {
-		n = list_first_entry(&b->free_list, struct list_block, free_list);
-		if (n->block.base == b->block.base + b->size) {
+	/* freed block becomes bigger, next one is destroyed */
+	if (!list_is_last(&b->all_list, &heap->all_list)) {
+		n = list_first_entry(&b->all_list, struct list_block, all_list);
+		if (n->block.type == BLOCK_EMPTY) {
+			BUG_ON(n->block.base != b->block.base + b->size);
+			free_remove(heap, n);
 			list_del(&n->all_list);
-			list_del(&n->free_list);
-			BUG_ON(b->orig_addr >= n->orig_addr);
 			b->size += n->size;
 			kmem_cache_free(block_cache, n);
 		}
 	}
 
-	/* merge freed block with prev if they connect
-	 * previous free block becomes bigger, freed one is destroyed */
-	if (b->free_list.prev != &heap->free_list) {
-		n = list_entry(b->free_list.prev, struct list_block, free_list);
-		if (n->block.base + n->size == b->block.base) {
+	/* previous free block becomes bigger, freed one is destroyed */
+	if (b->all_list.prev != &heap->all_list) {
+		n = list_entry(b->all_list.prev, struct list_block, all_list);
+		if (n->block.type == BLOCK_EMPTY) {
+			BUG_ON(n->block.base + n->size != b->block.base);
+			free_remove(heap, n);
 			list_del(&b->all_list);
-			list_del(&b->free_list);
-			BUG_ON(n->orig_addr >= b->orig_addr);
 			n->size += b->size;
 			kmem_cache_free(block_cache, b);
 			b = n;
 		}
 	}
 
+	free_insert(heap, b);
 	freelist_debug(heap, "free list after", b);
-	b->block.type = BLOCK_EMPTY;
 	return b;
 }
 
@@ -683,18 +868,52 @@ fail:
 }
 
 
-static struct nvmap_heap_block *do_heap_relocate_listblock(
+/*
+ * moves block to a lower address of its heap, or leaves it where it is, and
+ * returns its new heap block. the contents are not copied. may only fail
+ * (returning NULL) when fast is set.
+ */
+static struct nvmap_heap_block *do_heap_move_listblock(
 		struct list_block *block, bool fast)
 {
 	struct nvmap_heap_block *heap_block = &block->block;
 	struct nvmap_heap_block *heap_block_new = NULL;
 	struct nvmap_heap *heap = block->heap;
-	struct nvmap_handle *handle = heap_block->handle;
 	unsigned long src_base = heap_block->base;
-	unsigned long dst_base;
 	size_t src_size = block->size;
 	size_t src_align = block->align;
 	unsigned int src_prot = block->mem_prot;
+
+	if (fast) {
+		/* Fast compaction path - first allocate, then free. */
+		heap_block_new = do_heap_alloc(heap, src_size, src_align,
+				src_prot, src_base);
+		if (heap_block_new)
+			do_heap_free(heap_block);
+	} else {
+		/* Full compaction path, first free, then allocate
+		 * It is slower but provide best compaction results */
+		do_heap_free(heap_block);
+		heap_block_new = do_heap_alloc(heap, src_size, src_align,
+				src_prot, src_base);
+		/* Allocation should always succeed*/
+		BUG_ON(!heap_block_new);
+	}
+
+	/* new allocation should never go to higher addresses */
+	BUG_ON(heap_block_new && heap_block_new->base > src_base);
+	return heap_block_new;
+}
+
+static struct nvmap_heap_block *do_heap_relocate_listblock(
+		struct list_block *block, bool fast)
+{
+	struct nvmap_heap_block *heap_block = &block->block;
+	struct nvmap_heap_block *heap_block_new = NULL;
+	struct nvmap_handle *handle = heap_block->handle;
+	unsigned long src_base = heap_block->base;
+	unsigned long dst_base;
+	size_t src_size = block->size;
 	int error = 0;
 	struct nvmap_share *share;
 
@@ -720,23 +939,9 @@ static struct nvmap_heap_block *do_heap_relocate_listblock(
 	if (handle->usecount)
 		goto fail;
 
-	if (fast) {
-		/* Fast compaction path - first allocate, then free. */
-		heap_block_new = do_heap_alloc(heap, src_size, src_align,
-				src_prot, src_base);
-		if (heap_block_new)
-			do_heap_free(heap_block);
-		else
-			goto fail;
-	} else {
-		/* Full compaction path, first free, then allocate
-		 * It is slower but provide best compaction results */
-		do_heap_free(heap_block);
-		heap_block_new = do_heap_alloc(heap, src_size, src_align,
-				src_prot, src_base);
-		/* Allocation should always succeed*/
-		BUG_ON(!heap_block_new);
-	}
+	heap_block_new = do_heap_move_listblock(block, fast);
+	if (!heap_block_new)
+		goto fail;
 
 	/* update handle */
 	handle->carveout = heap_block_new;
@@ -744,13 +949,11 @@ static struct nvmap_heap_block *do_heap_relocate_listblock(
 
 	/* copy source data to new block location */
 	dst_base = heap_block_new->base;
-
-	/* new allocation should always go lower addresses */
-	BUG_ON(dst_base >= src_base);
-
-	error = do_heap_copy_listblock(handle->dev,
-				dst_base, src_base, src_size);
-	BUG_ON(error);
+	if (dst_base != src_base) {
+		error = do_heap_copy_listblock(handle->dev,
+					dst_base, src_base, src_size);
+		BUG_ON(error);
+	}
 
 fail:
 	mutex_unlock(&share->pin_lock);
@@ -822,6 +1025,77 @@ static void nvmap_heap_compact(struct nvmap_heap *heap,
 	}
 	pr_err("Relocated %d chunks\n", relocation_count);
 }
+
+/*
+ * returns the first allocated block after pos which directly follows a free
+ * block and would move down if it was freed and allocated again.
+ */
+static struct list_block *compact_candidate(struct nvmap_heap *heap,
+					    struct list_block *pos)
+{
+	struct list_block *prev;
+
+	list_for_each_entry_continue(pos, &heap->all_list, all_list) {
+		if (pos->all_list.prev == &heap->all_list ||
+		    pos->block.type != BLOCK_FIRST_FIT)
+			continue;
+
+		prev = list_entry(pos->all_list.prev, struct list_block,
+				  all_list);
+		if (prev->block.type == BLOCK_EMPTY &&
+		    ALIGN(prev->block.base, pos->align) < pos->block.base)
+			return pos;
+	}
+	return NULL;
+}
+
+#define compact_first_candidate(_heap)					\
+	compact_candidate(_heap, list_entry(&(_heap)->all_list,		\
+					    struct list_block, all_list))
+
+static bool heap_needs_compaction(struct nvmap_heap *heap, unsigned int pct)
+{
+	return frag_pct(heap->free_size, free_largest(heap)) >= pct;
+}
+
+/* slides the lowest movable block down; returns false if there is none */
+static bool nvmap_heap_compact_step(struct nvmap_heap *heap)
+{
+	struct list_block *b;
+
+	for (b = compact_first_candidate(heap); b;
+	     b = compact_candidate(heap, b)) {
+		/* fails, leaving b alone, if it is pinned or mapped */
+		if (do_heap_relocate_listblock(b, false))
+			return true;
+	}
+	return false;
+}
+
+static void nvmap_heap_compact_work(struct work_struct *work)
+{
+	struct nvmap_heap *heap = container_of(to_delayed_work(work),
+					       struct nvmap_heap, compact_work);
+	int relocation_count = 0;
+
+	for (;;) {
+		bool moved = false;
+
+		mutex_lock(&heap->lock);
+		if (heap_needs_compaction(heap, COMPACT_FRAG_PCT / 2))
+			moved = nvmap_heap_compact_step(heap);
+		mutex_unlock(&heap->lock);
+
+		if (!moved)
+			break;
+		relocation_count++;
+		cond_resched();
+	}
+
+	if (relocation_count)
+		dev_dbg(&heap->dev, "relocated %d chunks in background\n",
+			relocation_count);
+}
 #endif
 
 void nvmap_usecount_inc(struct nvmap_handle *h)
@@ -850,6 +1124,7 @@ struct nvmap_heap_block *nvmap_heap_alloc(struct nvmap_heap *h,
 	size_t len        = handle->size;
 	size_t align      = handle->align;
 	unsigned int prot = handle->flags;
+	ktime_t start = ktime_get();
 
 	mutex_lock(&h->lock);
 
@@ -883,6 +1158,7 @@ struct nvmap_heap_block *nvmap_heap_alloc(struct nvmap_heap *h,
 		b->handle = handle;
 		handle->carveout = b;
 	}
+	heap_account_alloc(h, start);
 	mutex_unlock(&h->lock);
 	return b;
 }
@@ -914,6 +1190,11 @@ void nvmap_heap_free(struct nvmap_heap_block *b)
 		lb = container_of(b, struct list_block, block);
 		nvmap_flush_heap_block(NULL, b, lb->size, lb->mem_prot);
 		do_heap_free(b);
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+		if (heap_needs_compaction(h, COMPACT_FRAG_PCT))
+			queue_delayed_work(compact_wq, &h->compact_work,
+					   COMPACT_DELAY);
+#endif
 	}
 
 	if (bh) {
@@ -930,6 +1211,29 @@ static void heap_release(struct device *heap)
 {
 }
 
+/* sets up h to manage the len bytes at base, described by the free block l */
+static void heap_init_region(struct nvmap_heap *h, struct list_block *l,
+			     phys_addr_t base, size_t len)
+{
+	int i;
+
+	INIT_LIST_HEAD(&h->buddy_list);
+	INIT_LIST_HEAD(&h->all_list);
+	for (i = 0; i < NR_FREE_CLASSES; i++)
+		h->free_class[i] = RB_ROOT;
+	mutex_init(&h->lock);
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+	INIT_DELAYED_WORK(&h->compact_work, nvmap_heap_compact_work);
+#endif
+	l->block.base = base;
+	l->block.type = BLOCK_EMPTY;
+	l->size = len;
+	l->orig_addr = base;
+	l->heap = h;
+	list_add_tail(&l->all_list, &h->all_list);
+	free_insert(h, l);
+}
+
 /* nvmap_heap_create: create a heap object of len bytes, starting from
  * address base.
  *
@@ -1004,16 +1308,7 @@ struct nvmap_heap *nvmap_heap_create(struct device *parent, const char *name,
 	h->buddy_heap_size = buddy_size;
 	if (buddy_size)
 		h->min_buddy_shift = ilog2(buddy_size / MAX_BUDDY_NR);
-	INIT_LIST_HEAD(&h->free_list);
-	INIT_LIST_HEAD(&h->buddy_list);
-	INIT_LIST_HEAD(&h->all_list);
-	mutex_init(&h->lock);
-	l->block.base = base;
-	l->block.type = BLOCK_EMPTY;
-	l->size = len;
-	l->orig_addr = base;
-	list_add_tail(&l->free_list, &h->free_list);
-	list_add_tail(&l->all_list, &h->all_list);
+	heap_init_region(h, l, base, len);
 
 	inner_flush_cache_all();
 	outer_flush_range(base, base + len);
@@ -1045,6 +1340,9 @@ void nvmap_heap_destroy(struct nvmap_heap *heap)
 {
 	WARN_ON(!list_empty(&heap->buddy_list));
 
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+	cancel_delayed_work_sync(&heap->compact_work);
+#endif
 	sysfs_remove_group(&heap->dev.kobj, &heap_stat_attr_group);
 	device_unregister(&heap->dev);
 
@@ -1083,6 +1381,192 @@ void nvmap_heap_remove_group(struct nvmap_heap *heap,
 	sysfs_remove_group(&heap->dev.kobj, grp);
 }
 
+#ifdef CONFIG_NVMAP_HEAP_SELFTEST
+
+#define SELFTEST_HEAP_SIZE	(8 << 20)
+#define SELFTEST_BLOCKS		256
+#define SELFTEST_ROUNDS		20000
+
+/* checks that the blocks of heap tile [base, base + len) and that the free
+ * block index agrees with all_list */
+static int __init selftest_check(struct nvmap_heap *heap, unsigned long base,
+				 size_t len)
+{
+	struct list_block *b, *prev = NULL;
+	unsigned long end = base;
+	unsigned int count = 0, indexed = 0;
+	size_t free = 0;
+	struct rb_node *n;
+	int i;
+
+	list_for_each_entry(b, &heap->all_list, all_list) {
+		if (b->orig_addr != end || b->block.base < b->orig_addr)
+			return -EINVAL;
+		end = b->block.base + b->size;
+		if (b->block.type == BLOCK_EMPTY) {
+			if (prev && prev->block.type == BLOCK_EMPTY)
+				return -EINVAL;
+			free += b->size;
+			count++;
+		}
+		prev = b;
+	}
+	if (end != base + len || free != heap->free_size ||
+	    count != heap->free_count)
+		return -EINVAL;
+
+	for (i = 0; i < NR_FREE_CLASSES; i++) {
+		unsigned int nr = 0;
+
+		for (n = rb_first(&heap->free_class[i]); n; n = rb_next(n)) {
+			b = rb_entry(n, struct list_block, free_node);
+			if (b->block.type != BLOCK_EMPTY ||
+			    free_class_of(b->size) != i)
+				return -EINVAL;
+			nr++;
+		}
+		if (nr != heap->free_nr[i])
+			return -EINVAL;
+		indexed += nr;
+	}
+	return indexed == count ? 0 : -EINVAL;
+}
+
+static int __init selftest_verify(struct nvmap_heap_block *b, size_t len,
+				  u8 tag)
+{
+	u8 *p = (u8 *)b->base;
+	size_t off;
+
+	for (off = 0; off < len; off += PAGE_SIZE)
+		if (p[off] != tag)
+			return -EINVAL;
+	return p[len - 1] == tag ? 0 : -EINVAL;
+}
+
+/*
+ * exercises the list heap allocator, and with CONFIG_NVMAP_CARVEOUT_COMPACTOR
+ * the choice and moving of blocks by compaction, on a vmalloc()ed region
+ * instead of a carveout: heap addresses are used as kernel virtual
+ * addresses, blocks are filled with a tag which is checked before they are
+ * freed, and moved blocks are copied with memmove().
+ */
+static int __init nvmap_heap_selftest(void)
+{
+	struct nvmap_heap_block **blocks;
+	struct nvmap_heap *heap;
+	struct list_block *l;
+	unsigned int failed = 0, moved = 0;
+	unsigned long base;
+	size_t *lens;
+	void *mem;
+	int i, round, err = -ENOMEM;
+
+	mem = vmalloc(SELFTEST_HEAP_SIZE);
+	heap = kzalloc(sizeof(*heap), GFP_KERNEL);
+	l = kmem_cache_zalloc(block_cache, GFP_KERNEL);
+	blocks = kcalloc(SELFTEST_BLOCKS, sizeof(*blocks), GFP_KERNEL);
+	lens = kcalloc(SELFTEST_BLOCKS, sizeof(*lens), GFP_KERNEL);
+	if (!mem || !heap || !l || !blocks || !lens) {
+		if (l)
+			kmem_cache_free(block_cache, l);
+		goto out;
+	}
+
+	base = (unsigned long)mem;
+	heap->name = "selftest";
+	heap_init_region(heap, l, base, SELFTEST_HEAP_SIZE);
+
+	err = -EINVAL;
+	mutex_lock(&heap->lock);
+	for (round = 0; round < SELFTEST_ROUNDS; round++) {
+		i = random32() % SELFTEST_BLOCKS;
+
+		if (blocks[i]) {
+			if (selftest_verify(blocks[i], lens[i], i))
+				break;
+			do_heap_free(blocks[i]);
+			blocks[i] = NULL;
+		} else {
+			size_t align = PAGE_SIZE << (random32() % 3);
+			ktime_t start = ktime_get();
+
+			lens[i] = ((random32() % 32) + 1) << PAGE_SHIFT;
+			blocks[i] = do_heap_alloc(heap, lens[i], align,
+					NVMAP_HANDLE_WRITE_COMBINE, 0);
+			heap_account_alloc(heap, start);
+			if (!blocks[i])
+				failed++;
+			else if (blocks[i]->base & (align - 1))
+				break;
+			else
+				memset((void *)blocks[i]->base, i, lens[i]);
+		}
+
+		if (round % 64 == 0 && selftest_check(heap, base,
+						      SELFTEST_HEAP_SIZE))
+			break;
+
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+		if (round % 1024 == 1023) {
+			struct nvmap_heap_block *b;
+			struct list_block *c;
+			unsigned long src;
+			int j;
+
+			while ((c = compact_first_candidate(heap))) {
+				for (j = 0; blocks[j] != &c->block; j++)
+					;
+				src = c->block.base;
+				b = do_heap_move_listblock(c, false);
+				if (b->base >= src)
+					break;
+				memmove((void *)b->base, (void *)src, lens[j]);
+				blocks[j] = b;
+				moved++;
+			}
+			if (c)
+				break;
+		}
+#endif
+	}
+
+	if (round == SELFTEST_ROUNDS)
+		err = selftest_check(heap, base, SELFTEST_HEAP_SIZE);
+	if (err)
+		pr_err("%s: failed in round %d\n", __func__, round);
+
+	for (i = 0; i < SELFTEST_BLOCKS; i++)
+		if (blocks[i])
+			do_heap_free(blocks[i]);
+	mutex_unlock(&heap->lock);
+
+	if (!err && !list_is_singular(&heap->all_list))
+		err = -EINVAL;
+	if (!err)
+		pr_info("%s: passed, %u allocations failed, %u moved\n",
+			__func__, failed, moved);
+
+	while (!list_empty(&heap->all_list)) {
+		l = list_first_entry(&heap->all_list, struct list_block,
+				     all_list);
+		list_del(&l->all_list);
+		kmem_cache_free(block_cache, l);
+	}
+out:
+	kfree(lens);
+	kfree(blocks);
+	kfree(heap);
+	vfree(mem);
+	return err;
+}
+#else
+static inline int nvmap_heap_selftest(void)
+{
+	return 0;
+}
+#endif
+
 int nvmap_heap_init(void)
 {
 	BUG_ON(buddy_heap_cache != NULL);
@@ -1098,6 +1582,18 @@ int nvmap_heap_init(void)
 		pr_err("%s: unable to create block cache\n", __func__);
 		return -ENOMEM;
 	}
+
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+	compact_wq = create_singlethread_workqueue("nvmap-compact");
+	if (!compact_wq) {
+		kmem_cache_destroy(block_cache);
+		kmem_cache_destroy(buddy_heap_cache);
+		pr_err("%s: unable to create compaction workqueue\n", __func__);
+		return -ENOMEM;
+	}
+#endif
+
+	WARN_ON(nvmap_heap_selftest());
 	return 0;
 }
 
@@ -1107,6 +1603,11 @@ void nvmap_heap_deinit(void)
 		kmem_cache_destroy(buddy_heap_cache);
 	if (block_cache)
 		kmem_cache_destroy(block_cache);
+#ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
+	if (compact_wq)
+		destroy_workqueue(compact_wq);
+	compact_wq = NULL;
+#endif
 
 	block_cache = NULL;
 	buddy_heap_cache = NULL;
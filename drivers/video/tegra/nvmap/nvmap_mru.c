@@ -20,6 +20,7 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <linux/debugfs.h>
 #include <linux/list.h>
 #include <linux/slab.h>
 
@@ -31,13 +32,24 @@
 #include "nvmap_mru.h"
 
 /* if IOVMM reclamation is enabled (CONFIG_NVMAP_RECLAIM_UNPINNED_VM),
- * unpinned handles are placed onto a most-recently-used eviction list;
- * multiple lists are maintained, segmented by size (sizes were chosen to
- * roughly correspond with common sizes for graphics surfaces).
+ * unpinned handles keep their IOVMM area and are placed onto an eviction
+ * list; multiple lists are maintained, segmented by size (sizes were chosen
+ * to roughly correspond with common sizes for graphics surfaces).
  *
- * if a handle is located on the MRU list, then the code below may
+ * if a handle is located on an eviction list, then the code below may
  * steal its IOVMM area at any time to satisfy a pin operation if no
  * free IOVMM space is available
+ *
+ * each list is a clock: handles are added at the tail when they are
+ * unpinned, and the hand takes victims from the head. a handle which was
+ * pinned again while it still had its area is marked as referenced; when
+ * the hand reaches it, the mark is cleared and the handle goes back to the
+ * tail instead of being evicted. handles reused at least twice thus outlive
+ * handles used once (roughly LRU-2), and since each size class ages on its
+ * own, a burst of large surfaces does not flush out the small ones.
+ *
+ * clearing share->mru_clock (iovmm/mru_clock in debugfs) goes back to
+ * evicting the most recently unpinned handle first, for comparison.
  */
 
 static const size_t mru_cutoff[] = {
@@ -66,7 +78,48 @@ size_t nvmap_mru_vm_size(struct tegra_iovmm_client *iovmm)
 void nvmap_mru_insert_locked(struct nvmap_share *share, struct nvmap_handle *h)
 {
 	size_t len = h->pgalloc.area->iovm_length;
-	list_add(&h->pgalloc.mru_list, mru_list(share, len));
+	list_add_tail(&h->pgalloc.mru_list, mru_list(share, len));
+}
+
+/* returns the handle on mru whose IOVMM area should be taken next, giving
+ * referenced handles their second chance on the way */
+static struct nvmap_handle *mru_victim(struct nvmap_share *share,
+				       struct list_head *mru)
+{
+	struct nvmap_handle *h;
+
+	if (list_empty(mru))
+		return NULL;
+
+	if (!share->mru_clock)
+		return list_entry(mru->prev, struct nvmap_handle,
+				  pgalloc.mru_list);
+
+	/* terminates: one lap clears every mark */
+	for (;;) {
+		h = list_first_entry(mru, struct nvmap_handle,
+				     pgalloc.mru_list);
+		if (!h->pgalloc.mru_ref)
+			return h;
+		h->pgalloc.mru_ref = false;
+		list_move_tail(&h->pgalloc.mru_list, mru);
+	}
+}
+
+/* takes evict's IOVMM area away from it */
+static struct tegra_iovmm_area *mru_evict(struct nvmap_share *share,
+					  struct nvmap_handle *evict)
+{
+	struct tegra_iovmm_area *vm = evict->pgalloc.area;
+
+	BUG_ON(atomic_read(&evict->pin) != 0);
+	BUG_ON(!vm);
+	list_del_init(&evict->pgalloc.mru_list);
+	evict->pgalloc.area = NULL;
+	evict->pgalloc.mru_ref = false;
+	evict->pgalloc.evicted = true;
+	share->mru_evictions++;
+	return vm;
 }
 
 void nvmap_mru_remove(struct nvmap_share *s, struct nvmap_handle *h)
@@ -79,20 +132,22 @@ void nvmap_mru_remove(struct nvmap_share *s, struct nvmap_handle *h)
 }
 
 /* returns a tegra_iovmm_area for a handle. if the handle already has
- * an iovmm_area allocated, the handle is simply removed from its MRU list
- * and the existing iovmm_area is returned.
+ * an iovmm_area allocated (a hit), the handle is simply removed from its
+ * eviction list, marked as referenced, and the existing iovmm_area is
+ * returned.
  *
  * if no existing allocation exists, try to allocate a new IOVMM area.
  *
- * if a new area can not be allocated, try to re-use the most-recently-unpinned
- * handle's allocation.
+ * if a new area can not be allocated, try to re-use the allocation of the
+ * victim in the handle's size class.
  *
- * and if that fails, iteratively evict handles from the MRU lists and free
- * their allocations, until the new allocation succeeds.
+ * and if that fails, iteratively evict handles from the eviction lists and
+ * free their allocations, until the new allocation succeeds.
  */
 struct tegra_iovmm_area *nvmap_handle_iovmm_locked(struct nvmap_client *c,
 					    struct nvmap_handle *h)
 {
+	struct nvmap_share *share;
 	struct list_head *mru;
 	struct nvmap_handle *evict = NULL;
 	struct tegra_iovmm_area *vm = NULL;
@@ -101,15 +156,28 @@ struct tegra_iovmm_area *nvmap_handle_iovmm_locked(struct nvmap_client *c,
 
 	BUG_ON(!h || !c || !c->share);
 
+	share = c->share;
 	prot = nvmap_pgprot(h, pgprot_kernel);
 
 	if (h->pgalloc.area) {
 		BUG_ON(list_empty(&h->pgalloc.mru_list));
-		list_del(&h->pgalloc.mru_list);
-		INIT_LIST_HEAD(&h->pgalloc.mru_list);
+		list_del_init(&h->pgalloc.mru_list);
+		h->pgalloc.mru_ref = true;
+		share->mru_hits++;
+		/* zapped secure handles are mapped again */
+		if (h->pgalloc.dirty)
+			share->mru_remap_bytes += h->size;
 		return h->pgalloc.area;
 	}
 
+	h->pgalloc.mru_ref = false;
+	share->mru_misses++;
+	/* a first pin maps the handle, it is not mapping it again */
+	if (h->pgalloc.evicted) {
+		h->pgalloc.evicted = false;
+		share->mru_remap_bytes += h->size;
+	}
+
 	vm = tegra_iovmm_create_vm(c->share->iovmm, NULL,
 			h->size, h->align, prot,
 			h->pgalloc.iovm_addr);
@@ -121,40 +189,25 @@ struct tegra_iovmm_area *nvmap_handle_iovmm_locked(struct nvmap_client *c,
 	/* if client is looking for specific iovm address, return from here. */
 	if ((vm == NULL) && (h->pgalloc.iovm_addr != 0))
 		return NULL;
-	/* attempt to re-use the most recently unpinned IOVMM area in the
-	 * same size bin as the current handle. If that fails, iteratively
-	 * evict handles (starting from the current bin) until an allocation
+	/* attempt to re-use the IOVMM area of the victim in the same size
+	 * bin as the current handle. If that fails, iteratively evict
+	 * handles (starting from the current bin) until an allocation
 	 * succeeds or no more areas can be evicted */
-	mru = mru_list(c->share, h->size);
-	if (!list_empty(mru))
-		evict = list_first_entry(mru, struct nvmap_handle,
-					 pgalloc.mru_list);
-
-	if (evict && evict->pgalloc.area->iovm_length >= h->size) {
-		list_del(&evict->pgalloc.mru_list);
-		vm = evict->pgalloc.area;
-		evict->pgalloc.area = NULL;
-		INIT_LIST_HEAD(&evict->pgalloc.mru_list);
-		return vm;
-	}
+	mru = mru_list(share, h->size);
+	evict = mru_victim(share, mru);
+
+	if (evict && evict->pgalloc.area->iovm_length >= h->size)
+		return mru_evict(share, evict);
 
-	idx = mru - c->share->mru_lists;
+	idx = mru - share->mru_lists;
 
-	for (i = 0; i < c->share->nr_mru && !vm; i++, idx++) {
-		if (idx >= c->share->nr_mru)
+	for (i = 0; i < share->nr_mru && !vm; i++, idx++) {
+		if (idx >= share->nr_mru)
 			idx = 0;
-		mru = &c->share->mru_lists[idx];
-		while (!list_empty(mru) && !vm) {
-			evict = list_first_entry(mru, struct nvmap_handle,
-						 pgalloc.mru_list);
-
-			BUG_ON(atomic_read(&evict->pin) != 0);
-			BUG_ON(!evict->pgalloc.area);
-			list_del(&evict->pgalloc.mru_list);
-			INIT_LIST_HEAD(&evict->pgalloc.mru_list);
-			tegra_iovmm_free_vm(evict->pgalloc.area);
-			evict->pgalloc.area = NULL;
-			vm = tegra_iovmm_create_vm(c->share->iovmm,
+		mru = &share->mru_lists[idx];
+		while (!vm && (evict = mru_victim(share, mru))) {
+			tegra_iovmm_free_vm(mru_evict(share, evict));
+			vm = tegra_iovmm_create_vm(share->iovmm,
 					NULL, h->size, h->align,
 					prot, h->pgalloc.iovm_addr);
 		}
@@ -167,6 +220,7 @@ int nvmap_mru_init(struct nvmap_share *share)
 	int i;
 	mutex_init(&share->mru_lock);
 	share->nr_mru = ARRAY_SIZE(mru_cutoff) + 1;
+	share->mru_clock = 1;
 
 	share->mru_lists = kzalloc(sizeof(struct list_head) * share->nr_mru,
 				   GFP_KERNEL);
@@ -185,3 +239,18 @@ void nvmap_mru_destroy(struct nvmap_share *share)
 	kfree(share->mru_lists);
 	share->mru_lists = NULL;
 }
+
+/* the counters can be written, e.g. zeroed before replaying a trace */
+void nvmap_mru_debugfs_init(struct nvmap_share *share, struct dentry *root)
+{
+	debugfs_create_u32("mru_clock", S_IRUGO|S_IWUSR, root,
+			   &share->mru_clock);
+	debugfs_create_u32("mru_hits", S_IRUGO|S_IWUSR, root,
+			   &share->mru_hits);
+	debugfs_create_u32("mru_misses", S_IRUGO|S_IWUSR, root,
+			   &share->mru_misses);
+	debugfs_create_u32("mru_evictions", S_IRUGO|S_IWUSR, root,
+			   &share->mru_evictions);
+	debugfs_create_u64("mru_remap_bytes", S_IRUGO|S_IWUSR, root,
+			   &share->mru_remap_bytes);
+}
@@ -851,6 +851,8 @@ static int exec_mmap(struct mm_struct *mm)
 		return 0;
 	}
 	mmdrop(active_mm);
+	/* a kernel thread taking on a user mm */
+	lowmem_task_exec(tsk);
 	return 0;
 }
 
@@ -35,6 +35,10 @@ static void update_general_status(struct f2fs_sb_info *sbi)
 	/* valid check of the segment numbers */
 	si->hit_ext = sbi->read_hit_ext;
 	si->total_ext = sbi->total_hit_ext;
+	si->hit_largest = sbi->largest_hit_ext;
+	si->hit_cached = sbi->cached_hit_ext;
+	si->hit_rbtree = sbi->rbtree_hit_ext;
+	si->ext_node = sbi->total_ext_node;
 	si->ndirty_node = get_pages(sbi, F2FS_DIRTY_NODES);
 	si->ndirty_dent = get_pages(sbi, F2FS_DIRTY_DENTS);
 	si->ndirty_dirs = sbi->n_dirty_dirs;
@@ -58,6 +62,23 @@ static void update_general_status(struct f2fs_sb_info *sbi)
 	si->sits = SIT_I(sbi)->dirty_sentries;
 	si->fnids = NM_I(sbi)->fcnt;
 	si->bg_gc = sbi->bg_gc;
+	si->victim_count = sbi->victim_count;
+	si->victim_avg_ns = sbi->victim_count ?
+		div_u64(sbi->victim_time, sbi->victim_count) : 0;
+	si->victim_max_ns = sbi->victim_time_max;
+	si->flush_requests = atomic_read(&sbi->flush_requests);
+	si->flush_issued = atomic_read(&sbi->flush_issued);
+	if (SM_I(sbi)->dcc_info) {
+		struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+
+		spin_lock(&dcc->discard_lock);
+		si->discard_pending = dcc->nr_pending;
+		si->discard_pending_blks = dcc->pending_blks;
+		si->discard_issued = dcc->nr_issued;
+		si->discard_issued_blks = dcc->issued_blks;
+		si->discard_dropped = dcc->nr_dropped;
+		spin_unlock(&dcc->discard_lock);
+	}
 	si->util_free = (int)(free_user_blocks(sbi) >> sbi->log_blocks_per_seg)
 		* 100 / (int)(sbi->user_block_count >> sbi->log_blocks_per_seg)
 		/ 2;
@@ -154,6 +175,9 @@ static void update_mem_info(struct f2fs_sb_info *sbi)
 	si->base_mem += sizeof(struct dirty_seglist_info);
 	si->base_mem += NR_DIRTY_TYPE * f2fs_bitmap_size(TOTAL_SEGS(sbi));
 	si->base_mem += f2fs_bitmap_size(TOTAL_SECS(sbi));
+	si->base_mem += TOTAL_SECS(sbi) * sizeof(struct victim_entry);
+	si->base_mem += nr_victim_buckets(sbi) * sizeof(struct list_head);
+	si->base_mem += f2fs_bitmap_size(nr_victim_buckets(sbi));
 
 	/* buld nm */
 	si->base_mem += sizeof(struct f2fs_nm_info);
@@ -172,6 +196,7 @@ get_cache:
 	si->cache_mem += npages << PAGE_CACHE_SHIFT;
 	si->cache_mem += sbi->n_orphans * sizeof(struct orphan_inode_entry);
 	si->cache_mem += sbi->n_dirty_dirs * sizeof(struct dir_inode_entry);
+	si->cache_mem += sbi->total_ext_node * sizeof(struct extent_node);
 }
 
 static int stat_show(struct seq_file *s, void *v)
@@ -243,8 +268,23 @@ static int stat_show(struct seq_file *s, void *v)
 		seq_printf(s, "Try to move %d blocks\n", si->tot_blks);
 		seq_printf(s, "  - data blocks : %d\n", si->data_blks);
 		seq_printf(s, "  - node blocks : %d\n", si->node_blks);
+		seq_printf(s, "  - per segment : %d\n",
+			   si->tot_segs ? si->tot_blks / si->tot_segs : 0);
+		seq_printf(s, "Victim selection: %u, avg %llu ns, max %llu ns\n",
+			   si->victim_count, si->victim_avg_ns,
+			   si->victim_max_ns);
+		seq_printf(s, "\nFlush: %d issued / %d requests\n",
+			   si->flush_issued, si->flush_requests);
+		seq_printf(s, "Discard: %u issued (%u blocks), ",
+			   si->discard_issued, si->discard_issued_blks);
+		seq_printf(s, "%u pending (%u blocks), %u dropped\n",
+			   si->discard_pending, si->discard_pending_blks,
+			   si->discard_dropped);
 		seq_printf(s, "\nExtent Hit Ratio: %d / %d\n",
 			   si->hit_ext, si->total_ext);
+		seq_printf(s, "  - Hit: largest %d, cached %d, rb-tree %d\n",
+			   si->hit_largest, si->hit_cached, si->hit_rbtree);
+		seq_printf(s, "  - Extent nodes: %u\n", si->ext_node);
 		seq_puts(s, "\nBalancing F2FS Async:\n");
 		seq_printf(s, "  - nodes: %4d in %4d\n",
 			   si->ndirty_node, si->node_pages);
@@ -0,0 +1,350 @@
+/*
+ * fs/f2fs/extent_cache.c
+ *
+ * Copyright (c) 2012 Samsung Electronics Co., Ltd.
+ *             http://www.samsung.com/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/fs.h>
+#include <linux/f2fs_fs.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+
+#include "f2fs.h"
+
+/*
+ * Each inode keeps the extents of its data blocks in an rb-tree indexed by
+ * file offset, protected by fi->ext.ext_lock. All the extent nodes of a
+ * partition are also kept in an LRU list, protected by sbi->extent_lock,
+ * which the shrinker trims under memory pressure.
+ *
+ * fi->ext is the largest extent, which is stored in the inode block and
+ * looked up first. It is kept apart from the tree.
+ */
+static struct kmem_cache *extent_node_slab;
+
+static struct extent_node *__lookup_extent_node(struct f2fs_inode_info *fi,
+							pgoff_t fofs)
+{
+	struct rb_node *node = fi->ext_tree.rb_node;
+	struct extent_node *en;
+
+	while (node) {
+		en = rb_entry(node, struct extent_node, rb_node);
+
+		if (fofs < en->fofs)
+			node = node->rb_left;
+		else if (fofs >= en->fofs + en->len)
+			node = node->rb_right;
+		else
+			return en;
+	}
+	return NULL;
+}
+
+static void __insert_extent_node(struct f2fs_sb_info *sbi,
+			struct f2fs_inode_info *fi, struct extent_node *en)
+{
+	struct rb_node **p = &fi->ext_tree.rb_node;
+	struct rb_node *parent = NULL;
+	struct extent_node *ep;
+
+	while (*p) {
+		parent = *p;
+		ep = rb_entry(parent, struct extent_node, rb_node);
+
+		if (en->fofs < ep->fofs)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&en->rb_node, parent, p);
+	rb_insert_color(&en->rb_node, &fi->ext_tree);
+
+	en->fi = fi;
+	spin_lock(&sbi->extent_lock);
+	list_add_tail(&en->list, &sbi->extent_list);
+	sbi->total_ext_node++;
+	spin_unlock(&sbi->extent_lock);
+}
+
+/* caller holds fi->ext.ext_lock for write and sbi->extent_lock */
+static void __detach_extent_node(struct f2fs_sb_info *sbi,
+			struct f2fs_inode_info *fi, struct extent_node *en)
+{
+	rb_erase(&en->rb_node, &fi->ext_tree);
+	list_del(&en->list);
+	sbi->total_ext_node--;
+	if (fi->cached_en == en)
+		fi->cached_en = NULL;
+}
+
+static void __free_extent_node(struct f2fs_sb_info *sbi,
+			struct f2fs_inode_info *fi, struct extent_node *en)
+{
+	spin_lock(&sbi->extent_lock);
+	__detach_extent_node(sbi, fi, en);
+	spin_unlock(&sbi->extent_lock);
+	kmem_cache_free(extent_node_slab, en);
+}
+
+static struct extent_node *__alloc_extent_node(pgoff_t fofs, block_t blk_addr,
+							unsigned int len)
+{
+	struct extent_node *en;
+
+	/* it is only a cache, so do not dig into the reserves for it */
+	en = kmem_cache_alloc(extent_node_slab, GFP_NOWAIT);
+	if (!en)
+		return NULL;
+
+	en->fofs = fofs;
+	en->blk_addr = blk_addr;
+	en->len = len;
+	return en;
+}
+
+/* Remove fofs from the cached extents, splitting the one that covers it */
+static void __drop_extent_block(struct f2fs_sb_info *sbi,
+			struct f2fs_inode_info *fi, pgoff_t fofs)
+{
+	struct extent_node *en, *right;
+	pgoff_t end_fofs;
+
+	en = __lookup_extent_node(fi, fofs);
+	if (!en)
+		return;
+
+	end_fofs = en->fofs + en->len - 1;
+
+	if (en->len == 1) {
+		__free_extent_node(sbi, fi, en);
+	} else if (fofs == en->fofs) {
+		en->fofs++;
+		en->blk_addr++;
+		en->len--;
+	} else if (fofs == end_fofs) {
+		en->len--;
+	} else {
+		right = __alloc_extent_node(fofs + 1,
+				en->blk_addr + fofs - en->fofs + 1,
+				end_fofs - fofs);
+		en->len = fofs - en->fofs;
+		if (right)
+			__insert_extent_node(sbi, fi, right);
+	}
+}
+
+/* Map fofs to blk_addr, merging with the neighbouring extents if possible */
+static struct extent_node *__add_extent_block(struct f2fs_sb_info *sbi,
+		struct f2fs_inode_info *fi, pgoff_t fofs, block_t blk_addr)
+{
+	struct extent_node *prev = NULL, *next;
+
+	if (fofs)
+		prev = __lookup_extent_node(fi, fofs - 1);
+	next = __lookup_extent_node(fi, fofs + 1);
+	if (next && (next->fofs != fofs + 1 || next->blk_addr != blk_addr + 1))
+		next = NULL;
+
+	if (prev && prev->blk_addr + prev->len == blk_addr) {
+		prev->len++;
+		if (next) {
+			prev->len += next->len;
+			__free_extent_node(sbi, fi, next);
+		}
+		return prev;
+	}
+
+	if (next) {
+		next->fofs--;
+		next->blk_addr--;
+		next->len++;
+		return next;
+	}
+
+	next = __alloc_extent_node(fofs, blk_addr, 1);
+	if (next)
+		__insert_extent_node(sbi, fi, next);
+	return next;
+}
+
+/*
+ * Look up the block address of pgofs. On a hit, *len is the number of
+ * blocks from pgofs to the end of the extent.
+ */
+bool f2fs_lookup_extent_cache(struct inode *inode, pgoff_t pgofs,
+				block_t *blk_addr, unsigned int *len)
+{
+	struct f2fs_sb_info *sbi = F2FS_SB(inode->i_sb);
+	struct f2fs_inode_info *fi = F2FS_I(inode);
+	struct extent_node *en;
+
+	if (is_inode_flag_set(fi, FI_NO_EXTENT))
+		return false;
+
+	read_lock(&fi->ext.ext_lock);
+
+	stat_inc_total_hit(inode->i_sb);
+
+	if (fi->ext.len && pgofs >= fi->ext.fofs &&
+			pgofs < fi->ext.fofs + fi->ext.len) {
+		*blk_addr = fi->ext.blk_addr + pgofs - fi->ext.fofs;
+		*len = fi->ext.fofs + fi->ext.len - pgofs;
+		stat_inc_largest_hit(inode->i_sb);
+		goto hit;
+	}
+
+	en = fi->cached_en;
+	if (en && pgofs >= en->fofs && pgofs < en->fofs + en->len) {
+		stat_inc_cached_hit(inode->i_sb);
+	} else {
+		en = __lookup_extent_node(fi, pgofs);
+		if (!en) {
+			read_unlock(&fi->ext.ext_lock);
+			return false;
+		}
+		stat_inc_rbtree_hit(inode->i_sb);
+	}
+
+	*blk_addr = en->blk_addr + pgofs - en->fofs;
+	*len = en->fofs + en->len - pgofs;
+
+	spin_lock(&sbi->extent_lock);
+	list_move_tail(&en->list, &sbi->extent_list);
+	fi->cached_en = en;
+	spin_unlock(&sbi->extent_lock);
+hit:
+	stat_inc_read_hit(inode->i_sb);
+	read_unlock(&fi->ext.ext_lock);
+	return true;
+}
+
+/*
+ * Record that the block at fofs now lives at blk_addr, or was freed if
+ * blk_addr is NULL_ADDR. Returns true if the largest extent changed, in
+ * which case the caller has to write it back to the inode block.
+ */
+bool f2fs_update_extent_cache(struct inode *inode, pgoff_t fofs,
+							block_t blk_addr)
+{
+	struct f2fs_sb_info *sbi = F2FS_SB(inode->i_sb);
+	struct f2fs_inode_info *fi = F2FS_I(inode);
+	struct extent_info *ext = &fi->ext;
+	struct extent_node *en;
+	bool changed = false;
+
+	write_lock(&ext->ext_lock);
+
+	__drop_extent_block(sbi, fi, fofs);
+
+	/* Split the largest extent, keeping its bigger part */
+	if (ext->len && fofs >= ext->fofs && fofs < ext->fofs + ext->len) {
+		pgoff_t end_fofs = ext->fofs + ext->len - 1;
+
+		if ((end_fofs - fofs) < (ext->len >> 1)) {
+			ext->len = fofs - ext->fofs;
+		} else {
+			ext->blk_addr += fofs - ext->fofs + 1;
+			ext->len -= fofs - ext->fofs + 1;
+			ext->fofs = fofs + 1;
+		}
+		if (ext->len < F2FS_MIN_EXTENT_LEN)
+			ext->len = 0;
+		changed = true;
+	}
+
+	if (blk_addr == NULL_ADDR)
+		goto out;
+
+	en = __add_extent_block(sbi, fi, fofs, blk_addr);
+	if (en && en->len >= F2FS_MIN_EXTENT_LEN && en->len > ext->len) {
+		ext->fofs = en->fofs;
+		ext->blk_addr = en->blk_addr;
+		ext->len = en->len;
+		changed = true;
+	}
+out:
+	write_unlock(&ext->ext_lock);
+	return changed;
+}
+
+/* Drop every cached extent of an inode that is going away */
+void f2fs_destroy_extent_tree(struct inode *inode)
+{
+	struct f2fs_sb_info *sbi = F2FS_SB(inode->i_sb);
+	struct f2fs_inode_info *fi = F2FS_I(inode);
+	struct rb_node *node;
+	struct extent_node *en;
+
+	write_lock(&fi->ext.ext_lock);
+	while ((node = rb_first(&fi->ext_tree))) {
+		en = rb_entry(node, struct extent_node, rb_node);
+		__free_extent_node(sbi, fi, en);
+	}
+	write_unlock(&fi->ext.ext_lock);
+}
+
+static int f2fs_shrink_extent_cache(struct shrinker *shrink,
+					struct shrink_control *sc)
+{
+	struct f2fs_sb_info *sbi = container_of(shrink,
+				struct f2fs_sb_info, extent_shrinker);
+	int nr = sc->nr_to_scan;
+	struct f2fs_inode_info *fi;
+	struct extent_node *en;
+
+	if (nr) {
+		spin_lock(&sbi->extent_lock);
+		while (nr-- > 0 && !list_empty(&sbi->extent_list)) {
+			en = list_first_entry(&sbi->extent_list,
+						struct extent_node, list);
+			fi = en->fi;
+
+			/* lock order is tree then list, so only try here */
+			if (!write_trylock(&fi->ext.ext_lock)) {
+				list_move_tail(&en->list, &sbi->extent_list);
+				continue;
+			}
+			__detach_extent_node(sbi, fi, en);
+			write_unlock(&fi->ext.ext_lock);
+			kmem_cache_free(extent_node_slab, en);
+		}
+		spin_unlock(&sbi->extent_lock);
+	}
+	return (sbi->total_ext_node / 100) * sysctl_vfs_cache_pressure;
+}
+
+void build_extent_manager(struct f2fs_sb_info *sbi)
+{
+	INIT_LIST_HEAD(&sbi->extent_list);
+	spin_lock_init(&sbi->extent_lock);
+	sbi->total_ext_node = 0;
+
+	sbi->extent_shrinker.shrink = f2fs_shrink_extent_cache;
+	sbi->extent_shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&sbi->extent_shrinker);
+}
+
+void destroy_extent_manager(struct f2fs_sb_info *sbi)
+{
+	unregister_shrinker(&sbi->extent_shrinker);
+	f2fs_bug_on(!list_empty(&sbi->extent_list));
+}
+
+int __init create_extent_caches(void)
+{
+	extent_node_slab = f2fs_kmem_cache_create("f2fs_extent_node",
+			sizeof(struct extent_node), NULL);
+	if (!extent_node_slab)
+		return -ENOMEM;
+	return 0;
+}
+
+void destroy_extent_caches(void)
+{
+	kmem_cache_destroy(extent_node_slab);
+}
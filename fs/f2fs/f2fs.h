@@ -41,6 +41,7 @@
 #define F2FS_MOUNT_ERRORS_PANIC		0x00002000
 #define F2FS_MOUNT_ERRORS_RECOVER	0x00004000
 #define F2FS_MOUNT_INLINE_DATA		0x00000100
+#define F2FS_MOUNT_FLUSH_MERGE		0x00000200
 
 #define clear_opt(sbi, option)	(sbi->mount_opt.opt &= ~F2FS_MOUNT_##option)
 #define set_opt(sbi, option)	(sbi->mount_opt.opt |= F2FS_MOUNT_##option)
@@ -108,6 +109,13 @@ struct discard_entry {
 	int len;		/* # of consecutive blocks of the discard */
 };
 
+/* for the tree of block ranges waiting for the discard thread */
+struct discard_range {
+	struct rb_node rb_node;	/* rb node located in rb-tree */
+	block_t blkaddr;	/* start block address of the range */
+	unsigned int len;	/* # of consecutive blocks of the range */
+};
+
 /* for the list of fsync inodes, used only during recovery */
 struct fsync_inode_entry {
 	struct list_head list;	/* list head */
@@ -182,6 +190,16 @@ struct extent_info {
 	unsigned int len;	/* length of the extent */
 };
 
+/* for extents kept in the per-inode rb-tree */
+struct extent_node {
+	struct rb_node rb_node;		/* node in the inode's extent tree */
+	struct list_head list;		/* node in the global extent LRU */
+	struct f2fs_inode_info *fi;	/* inode owning this extent */
+	unsigned int fofs;		/* start offset in a file */
+	u32 blk_addr;			/* start block address of the extent */
+	unsigned int len;		/* length of the extent */
+};
+
 /*
  * i_advise uses FADVISE_XXX_BIT. We can add additional hints later.
  */
@@ -206,6 +224,8 @@ struct f2fs_inode_info {
 	nid_t i_xattr_nid;		/* node id that contains xattrs */
 	unsigned long long xattr_ver;	/* cp version of xattr modification */
 	struct extent_info ext;		/* in-memory extent cache entry */
+	struct rb_root ext_tree;	/* rb-tree of the other extents */
+	struct extent_node *cached_en;	/* extent found last in ext_tree */
 };
 
 static inline void get_extent_info(struct extent_info *ext,
@@ -303,6 +323,45 @@ enum {
 	NO_CHECK_TYPE
 };
 
+/*
+ * With flush_merge, fsync callers queue their cache flush requests and a
+ * per-partition thread issues one flush on behalf of everyone queued.
+ */
+struct flush_cmd {
+	struct list_head list;		/* link in the issue list */
+	struct completion wait;		/* completed once the flush is done */
+	int ret;			/* result of the flush */
+};
+
+struct flush_cmd_control {
+	struct task_struct *f2fs_issue_flush;	/* flush thread */
+	struct f2fs_sb_info *sbi;		/* owner, for the thread */
+	wait_queue_head_t flush_wait_queue;	/* waiting queue for wake-up */
+	spinlock_t issue_lock;			/* for the issue list */
+	struct list_head issue_list;		/* requests not issued yet */
+};
+
+/*
+ * Discards are queued at checkpoint and issued in the background while the
+ * device is idle. A range is removed from the queue once its segment is
+ * used for writing again, and the writer waits for a discard in flight.
+ */
+struct discard_cmd_control {
+	struct task_struct *f2fs_issue_discard;	/* discard thread */
+	struct f2fs_sb_info *sbi;		/* owner, for the thread */
+	wait_queue_head_t discard_wait_queue;	/* waiting queue for wake-up */
+	wait_queue_head_t inflight_wait_queue;	/* writers waiting on discard */
+	spinlock_t discard_lock;		/* for the fields below */
+	struct rb_root root;			/* pending ranges by address */
+	block_t inflight_blkaddr;		/* range being discarded */
+	unsigned int inflight_len;
+	unsigned int nr_pending;		/* # of pending ranges */
+	unsigned int pending_blks;		/* # of pending blocks */
+	unsigned int nr_issued;			/* # of discards issued */
+	unsigned int issued_blks;		/* # of blocks discarded */
+	unsigned int nr_dropped;		/* # of ranges not issued */
+};
+
 struct f2fs_sm_info {
 	struct sit_info *sit_info;		/* whole segment information */
 	struct free_segmap_info *free_info;	/* free segment information */
@@ -329,8 +388,17 @@ struct f2fs_sm_info {
 	int nr_discards;			/* # of discards in the list */
 	int max_discards;			/* max. discards to be issued */
 
+	/* for background discard */
+	struct discard_cmd_control *dcc_info;
+	unsigned int discard_granularity;	/* min. # of blocks to discard */
+	unsigned int max_discard_issue;		/* max. discards per round */
+	unsigned int discard_interval;		/* ms between rounds */
+
 	unsigned int ipu_policy;	/* in-place-update policy */
 	unsigned int min_ipu_util;	/* in-place-update threshold */
+
+	/* for flush command control */
+	struct flush_cmd_control *cmd_control_info;
 };
 
 /*
@@ -428,6 +496,12 @@ struct f2fs_sb_info {
 	struct list_head dir_inode_list;	/* dir inode list */
 	spinlock_t dir_inode_lock;		/* for dir inode list lock */
 
+	/* for extent cache management */
+	struct list_head extent_list;		/* LRU of all extent nodes */
+	spinlock_t extent_lock;			/* for extent list and count */
+	unsigned int total_ext_node;		/* # of cached extent nodes */
+	struct shrinker extent_shrinker;	/* trims the extent LRU */
+
 	/* basic file system units */
 	unsigned int log_sectors_per_block;	/* log2 sectors per block */
 	unsigned int log_blocksize;		/* log2 block size */
@@ -471,8 +545,16 @@ struct f2fs_sb_info {
 	unsigned int segment_count[2];		/* # of allocated segments */
 	unsigned int block_count[2];		/* # of allocated blocks */
 	int total_hit_ext, read_hit_ext;	/* extent cache hit ratio */
+	int largest_hit_ext;			/* hits in the largest extent */
+	int cached_hit_ext;			/* hits in the last extent */
+	int rbtree_hit_ext;			/* hits in the rb-tree */
 	int inline_inode;			/* # of inline_data inodes */
 	int bg_gc;				/* background gc calls */
+	unsigned int victim_count;		/* # of gc victim selections */
+	unsigned long long victim_time;		/* ns spent selecting victims */
+	unsigned long long victim_time_max;	/* longest victim selection */
+	atomic_t flush_requests;		/* # of fsync flush requests */
+	atomic_t flush_issued;			/* # of cache flushes issued */
 	unsigned int n_dirty_dirs;		/* # of dir inodes */
 #endif
 	unsigned int last_victim[2];		/* last victim segment # */
@@ -1168,6 +1250,10 @@ void destroy_node_manager_caches(void);
  */
 void f2fs_balance_fs(struct f2fs_sb_info *);
 void f2fs_balance_fs_bg(struct f2fs_sb_info *);
+int f2fs_issue_flush(struct f2fs_sb_info *);
+int create_discard_cmd_control(struct f2fs_sb_info *);
+int create_flush_cmd_control(struct f2fs_sb_info *);
+void destroy_flush_cmd_control(struct f2fs_sb_info *);
 void invalidate_blocks(struct f2fs_sb_info *, block_t);
 void clear_prefree_segments(struct f2fs_sb_info *);
 int npages_for_summary_flush(struct f2fs_sb_info *);
@@ -1233,6 +1319,18 @@ struct page *get_lock_data_page(struct inode *, pgoff_t);
 struct page *get_new_data_page(struct inode *, struct page *, pgoff_t, bool);
 int do_write_data_page(struct page *, struct f2fs_io_info *);
 
+/*
+ * extent_cache.c
+ */
+bool f2fs_lookup_extent_cache(struct inode *, pgoff_t, block_t *,
+							unsigned int *);
+bool f2fs_update_extent_cache(struct inode *, pgoff_t, block_t);
+void f2fs_destroy_extent_tree(struct inode *);
+void build_extent_manager(struct f2fs_sb_info *);
+void destroy_extent_manager(struct f2fs_sb_info *);
+int __init create_extent_caches(void);
+void destroy_extent_caches(void);
+
 /*
  * gc.c
  */
@@ -1261,10 +1359,17 @@ struct f2fs_stat_info {
 	int all_area_segs, sit_area_segs, nat_area_segs, ssa_area_segs;
 	int main_area_segs, main_area_sections, main_area_zones;
 	int hit_ext, total_ext;
+	int hit_largest, hit_cached, hit_rbtree;
+	unsigned int ext_node;
 	int ndirty_node, ndirty_dent, ndirty_dirs, ndirty_meta;
 	int nats, sits, fnids;
 	int total_count, utilization;
 	int bg_gc, inline_inode;
+	unsigned int victim_count;
+	unsigned long long victim_avg_ns, victim_max_ns;
+	int flush_requests, flush_issued;
+	unsigned int discard_pending, discard_pending_blks;
+	unsigned int discard_issued, discard_issued_blks, discard_dropped;
 	unsigned int valid_count, valid_node_count, valid_inode_count;
 	unsigned int bimodal, avg_vblocks;
 	int util_free, util_valid, util_invalid;
@@ -1289,10 +1394,23 @@ static inline struct f2fs_stat_info *F2FS_STAT(struct f2fs_sb_info *sbi)
 
 #define stat_inc_call_count(si)		((si)->call_count++)
 #define stat_inc_bggc_count(sbi)	((sbi)->bg_gc++)
+#define stat_inc_victim_time(sbi, start)				\
+	do {								\
+		unsigned long long delta = local_clock() - (start);	\
+		(sbi)->victim_count++;					\
+		(sbi)->victim_time += delta;				\
+		if (delta > (sbi)->victim_time_max)			\
+			(sbi)->victim_time_max = delta;			\
+	} while (0)
+#define stat_inc_flush_request(sbi)	(atomic_inc(&(sbi)->flush_requests))
+#define stat_inc_flush_issued(sbi)	(atomic_inc(&(sbi)->flush_issued))
 #define stat_inc_dirty_dir(sbi)		((sbi)->n_dirty_dirs++)
 #define stat_dec_dirty_dir(sbi)		((sbi)->n_dirty_dirs--)
 #define stat_inc_total_hit(sb)		((F2FS_SB(sb))->total_hit_ext++)
 #define stat_inc_read_hit(sb)		((F2FS_SB(sb))->read_hit_ext++)
+#define stat_inc_largest_hit(sb)	((F2FS_SB(sb))->largest_hit_ext++)
+#define stat_inc_cached_hit(sb)		((F2FS_SB(sb))->cached_hit_ext++)
+#define stat_inc_rbtree_hit(sb)		((F2FS_SB(sb))->rbtree_hit_ext++)
 #define stat_inc_inline_inode(inode)					\
 	do {								\
 		if (f2fs_has_inline_data(inode))			\
@@ -1343,10 +1461,16 @@ void f2fs_destroy_root_stats(void);
 #else
 #define stat_inc_call_count(si)
 #define stat_inc_bggc_count(si)
+#define stat_inc_victim_time(sbi, start)	((void)(start))
+#define stat_inc_flush_request(sbi)
+#define stat_inc_flush_issued(sbi)
 #define stat_inc_dirty_dir(sbi)
 #define stat_dec_dirty_dir(sbi)
 #define stat_inc_total_hit(sb)
 #define stat_inc_read_hit(sb)
+#define stat_inc_largest_hit(sb)
+#define stat_inc_cached_hit(sb)
+#define stat_inc_rbtree_hit(sb)
 #define stat_inc_inline_inode(inode)
 #define stat_dec_inline_inode(inode)
 #define stat_inc_seg_type(sbi, curseg)
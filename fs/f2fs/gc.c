@@ -232,6 +232,18 @@ static unsigned int get_cb_cost(struct f2fs_sb_info *sbi, unsigned int segno)
 	return UINT_MAX - ((100 * (100 - u) * age) / (100 + u));
 }
 
+/* The lowest cost-benefit cost a section having vblocks can reach */
+static unsigned int get_cb_min_cost(struct f2fs_sb_info *sbi,
+						unsigned int vblocks)
+{
+	unsigned char u;
+
+	vblocks = div_u64(vblocks, sbi->segs_per_sec);
+	u = (vblocks * 100) >> sbi->log_blocks_per_seg;
+
+	return UINT_MAX - ((100 * (100 - u) * 100) / (100 + u));
+}
+
 static inline unsigned int get_gc_cost(struct f2fs_sb_info *sbi,
 			unsigned int segno, struct victim_sel_policy *p)
 {
@@ -245,6 +257,57 @@ static inline unsigned int get_gc_cost(struct f2fs_sb_info *sbi,
 		return get_cb_cost(sbi, segno);
 }
 
+/*
+ * Walk the dirty sections from the fewest valid blocks up. The head of each
+ * bucket is its oldest section, so greedy takes the first one it may use,
+ * and cost-benefit stops once no bucket left can beat its best victim.
+ */
+static void get_victim_from_index(struct f2fs_sb_info *sbi, int gc_type,
+					struct victim_sel_policy *p)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	unsigned int full = nr_victim_buckets(sbi) - 1;
+	struct victim_entry *ve;
+	unsigned int vblocks, secno, cost;
+	int nsearched = 0;
+
+	spin_lock(&dirty_i->victim_lock);
+	for_each_set_bit(vblocks, dirty_i->victim_bucket_map, full) {
+		if (p->gc_mode == GC_CB &&
+				get_cb_min_cost(sbi, vblocks) >= p->min_cost)
+			break;
+
+		list_for_each_entry(ve, &dirty_i->victim_buckets[vblocks],
+								list) {
+			if (nsearched++ >= p->max_search)
+				goto out;
+
+			secno = ve - dirty_i->victim_entries;
+			if (sec_usage_check(sbi, secno))
+				continue;
+			if (gc_type == BG_GC &&
+					test_bit(secno, dirty_i->victim_secmap))
+				continue;
+
+			if (p->gc_mode == GC_GREEDY)
+				cost = vblocks;
+			else
+				cost = get_cb_cost(sbi, secno * p->ofs_unit);
+
+			if (p->min_cost > cost) {
+				p->min_segno = secno * p->ofs_unit;
+				p->min_cost = cost;
+			}
+			break;
+		}
+
+		if (p->gc_mode == GC_GREEDY && p->min_segno != NULL_SEGNO)
+			break;
+	}
+out:
+	spin_unlock(&dirty_i->victim_lock);
+}
+
 /*
  * This function is called from two paths.
  * One is garbage collection and the other is SSR segment selection.
@@ -259,6 +322,7 @@ static int get_victim_by_default(struct f2fs_sb_info *sbi,
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
 	struct victim_sel_policy p;
 	unsigned int secno, max_cost;
+	unsigned long long start = local_clock();
 	int nsearched = 0;
 
 	p.alloc_mode = alloc_mode;
@@ -275,6 +339,11 @@ static int get_victim_by_default(struct f2fs_sb_info *sbi,
 			goto got_it;
 	}
 
+	if (p.alloc_mode == LFS) {
+		get_victim_from_index(sbi, gc_type, &p);
+		goto out;
+	}
+
 	while (1) {
 		unsigned long cost;
 		unsigned int segno;
@@ -315,6 +384,10 @@ static int get_victim_by_default(struct f2fs_sb_info *sbi,
 			break;
 		}
 	}
+out:
+	if (p.alloc_mode == LFS)
+		stat_inc_victim_time(sbi, start);
+
 	if (p.min_segno != NULL_SEGNO) {
 got_it:
 		if (p.alloc_mode == LFS) {
@@ -15,15 +15,19 @@
 #include <linux/prefetch.h>
 #include <linux/vmalloc.h>
 #include <linux/swap.h>
+#include <linux/list_sort.h>
+#include <linux/kthread.h>
 
 #include "f2fs.h"
 #include "segment.h"
 #include "node.h"
+#include "gc.h"
 #include <trace/events/f2fs.h>
 
 #define __reverse_ffz(x) __reverse_ffs(~(x))
 
 static struct kmem_cache *discard_entry_slab;
+static struct kmem_cache *discard_range_slab;
 
 /*
  * __reverse_ffs is copied from include/asm-generic/bitops/__ffs.h since
@@ -195,6 +199,177 @@ void f2fs_balance_fs_bg(struct f2fs_sb_info *sbi)
 		f2fs_sync_fs(sbi->sb, true);
 }
 
+static int issue_flush_thread(void *data)
+{
+	struct flush_cmd_control *fcc = data;
+	struct f2fs_sb_info *sbi = fcc->sbi;
+	struct flush_cmd *cmd, *next;
+	LIST_HEAD(dispatch_list);
+	int ret;
+
+	while (!kthread_should_stop() || !list_empty(&fcc->issue_list)) {
+		spin_lock(&fcc->issue_lock);
+		list_splice_init(&fcc->issue_list, &dispatch_list);
+		spin_unlock(&fcc->issue_lock);
+
+		if (!list_empty(&dispatch_list)) {
+			stat_inc_flush_issued(sbi);
+			ret = blkdev_issue_flush(sbi->sb->s_bdev, GFP_NOIO,
+									NULL);
+
+			/* a waiter may return as soon as it is completed */
+			list_for_each_entry_safe(cmd, next, &dispatch_list,
+									list) {
+				cmd->ret = ret;
+				complete(&cmd->wait);
+			}
+			INIT_LIST_HEAD(&dispatch_list);
+		}
+
+		wait_event_interruptible(fcc->flush_wait_queue,
+				kthread_should_stop() ||
+				!list_empty(&fcc->issue_list));
+	}
+	return 0;
+}
+
+/*
+ * Flush the device cache for fsync. With flush_merge, the request is
+ * handed to the flush thread, so that the callers which queue while a
+ * flush is in flight share the next one.
+ */
+int f2fs_issue_flush(struct f2fs_sb_info *sbi)
+{
+	struct flush_cmd_control *fcc = SM_I(sbi)->cmd_control_info;
+	struct flush_cmd cmd;
+
+	stat_inc_flush_request(sbi);
+
+	if (!test_opt(sbi, FLUSH_MERGE) || !fcc) {
+		stat_inc_flush_issued(sbi);
+		return blkdev_issue_flush(sbi->sb->s_bdev, GFP_KERNEL, NULL);
+	}
+
+	init_completion(&cmd.wait);
+
+	spin_lock(&fcc->issue_lock);
+	list_add_tail(&cmd.list, &fcc->issue_list);
+	spin_unlock(&fcc->issue_lock);
+
+	wake_up(&fcc->flush_wait_queue);
+	wait_for_completion(&cmd.wait);
+
+	return cmd.ret;
+}
+
+int create_flush_cmd_control(struct f2fs_sb_info *sbi)
+{
+	dev_t dev = sbi->sb->s_bdev->bd_dev;
+	struct flush_cmd_control *fcc;
+	int err;
+
+	fcc = kzalloc(sizeof(struct flush_cmd_control), GFP_KERNEL);
+	if (!fcc)
+		return -ENOMEM;
+
+	fcc->sbi = sbi;
+	spin_lock_init(&fcc->issue_lock);
+	INIT_LIST_HEAD(&fcc->issue_list);
+	init_waitqueue_head(&fcc->flush_wait_queue);
+
+	/* publish only once the thread exists, nobody may see it freed */
+	fcc->f2fs_issue_flush = kthread_run(issue_flush_thread, fcc,
+				"f2fs_flush-%u:%u", MAJOR(dev), MINOR(dev));
+	if (IS_ERR(fcc->f2fs_issue_flush)) {
+		err = PTR_ERR(fcc->f2fs_issue_flush);
+		kfree(fcc);
+		return err;
+	}
+	SM_I(sbi)->cmd_control_info = fcc;
+	return 0;
+}
+
+/*
+ * Only called when the partition goes away. Turning flush_merge off on
+ * remount leaves the idle thread in place, since an fsync may still be
+ * queueing on it.
+ */
+void destroy_flush_cmd_control(struct f2fs_sb_info *sbi)
+{
+	struct flush_cmd_control *fcc = SM_I(sbi)->cmd_control_info;
+
+	if (!fcc)
+		return;
+	kthread_stop(fcc->f2fs_issue_flush);
+	kfree(fcc);
+	SM_I(sbi)->cmd_control_info = NULL;
+}
+
+static inline struct victim_entry *get_victim_entry(struct f2fs_sb_info *sbi,
+						unsigned int segno)
+{
+	return &DIRTY_I(sbi)->victim_entries[GET_SECNO(sbi, segno)];
+}
+
+static void __link_victim_entry(struct f2fs_sb_info *sbi,
+			struct victim_entry *ve, unsigned int segno)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	unsigned int vblocks = get_valid_blocks(sbi, segno, sbi->segs_per_sec);
+
+	ve->vblocks = min(vblocks, nr_victim_buckets(sbi) - 1);
+	list_add_tail(&ve->list, &dirty_i->victim_buckets[ve->vblocks]);
+	set_bit(ve->vblocks, dirty_i->victim_bucket_map);
+}
+
+static void __unlink_victim_entry(struct f2fs_sb_info *sbi,
+						struct victim_entry *ve)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+
+	list_del(&ve->list);
+	if (list_empty(&dirty_i->victim_buckets[ve->vblocks]))
+		clear_bit(ve->vblocks, dirty_i->victim_bucket_map);
+}
+
+/* A segment of the section became dirty */
+static void add_victim_entry(struct f2fs_sb_info *sbi, unsigned int segno)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	struct victim_entry *ve = get_victim_entry(sbi, segno);
+
+	spin_lock(&dirty_i->victim_lock);
+	if (!ve->nr_dirty++)
+		__link_victim_entry(sbi, ve, segno);
+	spin_unlock(&dirty_i->victim_lock);
+}
+
+/* A segment of the section is no longer dirty */
+static void del_victim_entry(struct f2fs_sb_info *sbi, unsigned int segno)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	struct victim_entry *ve = get_victim_entry(sbi, segno);
+
+	spin_lock(&dirty_i->victim_lock);
+	if (!--ve->nr_dirty)
+		__unlink_victim_entry(sbi, ve);
+	spin_unlock(&dirty_i->victim_lock);
+}
+
+/* Valid blocks of the section changed, so requeue it as the youngest */
+static void update_victim_entry(struct f2fs_sb_info *sbi, unsigned int segno)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	struct victim_entry *ve = get_victim_entry(sbi, segno);
+
+	spin_lock(&dirty_i->victim_lock);
+	if (ve->nr_dirty) {
+		__unlink_victim_entry(sbi, ve);
+		__link_victim_entry(sbi, ve, segno);
+	}
+	spin_unlock(&dirty_i->victim_lock);
+}
+
 static void __locate_dirty_segment(struct f2fs_sb_info *sbi, unsigned int segno,
 		enum dirty_type dirty_type)
 {
@@ -204,8 +379,11 @@ static void __locate_dirty_segment(struct f2fs_sb_info *sbi, unsigned int segno,
 	if (IS_CURSEG(sbi, segno))
 		return;
 
-	if (!test_and_set_bit(segno, dirty_i->dirty_segmap[dirty_type]))
+	if (!test_and_set_bit(segno, dirty_i->dirty_segmap[dirty_type])) {
 		dirty_i->nr_dirty[dirty_type]++;
+		if (dirty_type == DIRTY)
+			add_victim_entry(sbi, segno);
+	}
 
 	if (dirty_type == DIRTY) {
 		struct seg_entry *sentry = get_seg_entry(sbi, segno);
@@ -221,8 +399,11 @@ static void __remove_dirty_segment(struct f2fs_sb_info *sbi, unsigned int segno,
 {
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
 
-	if (test_and_clear_bit(segno, dirty_i->dirty_segmap[dirty_type]))
+	if (test_and_clear_bit(segno, dirty_i->dirty_segmap[dirty_type])) {
 		dirty_i->nr_dirty[dirty_type]--;
+		if (dirty_type == DIRTY)
+			del_victim_entry(sbi, segno);
+	}
 
 	if (dirty_type == DIRTY) {
 		struct seg_entry *sentry = get_seg_entry(sbi, segno);
@@ -276,6 +457,303 @@ static void f2fs_issue_discard(struct f2fs_sb_info *sbi,
 	trace_f2fs_issue_discard(sbi->sb, blkstart, blklen);
 }
 
+/* The first range ending at or after blkaddr */
+static struct discard_range *__lookup_discard_range(
+		struct discard_cmd_control *dcc, block_t blkaddr)
+{
+	struct rb_node *node = dcc->root.rb_node;
+	struct discard_range *dr, *found = NULL;
+
+	while (node) {
+		dr = rb_entry(node, struct discard_range, rb_node);
+
+		if (dr->blkaddr + dr->len >= blkaddr) {
+			found = dr;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+	return found;
+}
+
+static inline struct discard_range *__next_discard_range(
+						struct discard_range *dr)
+{
+	struct rb_node *node = rb_next(&dr->rb_node);
+
+	return node ? rb_entry(node, struct discard_range, rb_node) : NULL;
+}
+
+static void __insert_discard_range(struct discard_cmd_control *dcc,
+						struct discard_range *new)
+{
+	struct rb_node **p = &dcc->root.rb_node;
+	struct rb_node *parent = NULL;
+	struct discard_range *dr;
+
+	while (*p) {
+		parent = *p;
+		dr = rb_entry(parent, struct discard_range, rb_node);
+
+		if (new->blkaddr < dr->blkaddr)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&new->rb_node, parent, p);
+	rb_insert_color(&new->rb_node, &dcc->root);
+
+	dcc->nr_pending++;
+	dcc->pending_blks += new->len;
+}
+
+static void __remove_discard_range(struct discard_cmd_control *dcc,
+						struct discard_range *dr)
+{
+	rb_erase(&dr->rb_node, &dcc->root);
+	dcc->nr_pending--;
+	dcc->pending_blks -= dr->len;
+}
+
+/*
+ * Queue a range for the discard thread, merging it with the pending ranges
+ * it overlaps or touches. Without the thread, discard it right away.
+ */
+static void f2fs_queue_discard(struct f2fs_sb_info *sbi,
+				block_t blkstart, block_t blklen)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	struct discard_range *new, *dr, *next;
+	block_t end = blkstart + blklen;
+
+	if (!dcc) {
+		f2fs_issue_discard(sbi, blkstart, blklen);
+		return;
+	}
+
+	new = f2fs_kmem_cache_alloc(discard_range_slab, GFP_NOFS);
+
+	spin_lock(&dcc->discard_lock);
+	dr = __lookup_discard_range(dcc, blkstart);
+	while (dr && dr->blkaddr <= end) {
+		next = __next_discard_range(dr);
+		blkstart = min(blkstart, dr->blkaddr);
+		end = max(end, dr->blkaddr + dr->len);
+		__remove_discard_range(dcc, dr);
+		kmem_cache_free(discard_range_slab, dr);
+		dr = next;
+	}
+
+	/* a discard is only a hint, so give up rather than grow forever */
+	if (dcc->nr_pending >= MAX_DISCARD_PENDING) {
+		dcc->nr_dropped++;
+		spin_unlock(&dcc->discard_lock);
+		kmem_cache_free(discard_range_slab, new);
+		return;
+	}
+
+	new->blkaddr = blkstart;
+	new->len = end - blkstart;
+	__insert_discard_range(dcc, new);
+	spin_unlock(&dcc->discard_lock);
+
+	wake_up(&dcc->discard_wait_queue);
+}
+
+static bool discard_inflight(struct discard_cmd_control *dcc,
+				block_t blkstart, block_t end)
+{
+	bool ret;
+
+	spin_lock(&dcc->discard_lock);
+	ret = dcc->inflight_len && dcc->inflight_blkaddr < end &&
+		dcc->inflight_blkaddr + dcc->inflight_len > blkstart;
+	spin_unlock(&dcc->discard_lock);
+	return ret;
+}
+
+/*
+ * The blocks are about to be written, so forget the pending discards on
+ * them and wait for the one in flight, if it covers any of them.
+ */
+static void f2fs_punch_discard(struct f2fs_sb_info *sbi,
+				block_t blkstart, block_t blklen)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	struct discard_range *dr, *next, *tail;
+	block_t end = blkstart + blklen;
+	block_t dr_end;
+
+	if (!dcc)
+		return;
+
+	spin_lock(&dcc->discard_lock);
+	dr = __lookup_discard_range(dcc, blkstart);
+	while (dr && dr->blkaddr < end) {
+		next = __next_discard_range(dr);
+		dr_end = dr->blkaddr + dr->len;
+
+		if (dr_end <= blkstart) {
+			dr = next;
+			continue;
+		}
+
+		__remove_discard_range(dcc, dr);
+
+		if (dr->blkaddr < blkstart && dr_end > end) {
+			/* keep both sides, if we can get a node for the tail */
+			tail = kmem_cache_alloc(discard_range_slab, GFP_ATOMIC);
+			if (tail) {
+				tail->blkaddr = end;
+				tail->len = dr_end - end;
+				__insert_discard_range(dcc, tail);
+			} else {
+				dcc->nr_dropped++;
+			}
+			dr->len = blkstart - dr->blkaddr;
+			__insert_discard_range(dcc, dr);
+		} else if (dr->blkaddr < blkstart) {
+			dr->len = blkstart - dr->blkaddr;
+			__insert_discard_range(dcc, dr);
+		} else if (dr_end > end) {
+			dr->blkaddr = end;
+			dr->len = dr_end - end;
+			__insert_discard_range(dcc, dr);
+		} else {
+			kmem_cache_free(discard_range_slab, dr);
+		}
+		dr = next;
+	}
+	spin_unlock(&dcc->discard_lock);
+
+	wait_event(dcc->inflight_wait_queue,
+			!discard_inflight(dcc, blkstart, end));
+}
+
+/* Issue up to nr_issue discards, lowest addresses first */
+static void issue_pending_discards(struct discard_cmd_control *dcc,
+						unsigned int nr_issue)
+{
+	struct f2fs_sb_info *sbi = dcc->sbi;
+	struct rb_node *node;
+	struct discard_range *dr;
+	block_t blkaddr;
+	unsigned int len;
+
+	while (nr_issue) {
+		spin_lock(&dcc->discard_lock);
+		node = rb_first(&dcc->root);
+		if (!node) {
+			spin_unlock(&dcc->discard_lock);
+			break;
+		}
+		dr = rb_entry(node, struct discard_range, rb_node);
+
+		if (dr->len < SM_I(sbi)->discard_granularity) {
+			__remove_discard_range(dcc, dr);
+			dcc->nr_dropped++;
+			spin_unlock(&dcc->discard_lock);
+			kmem_cache_free(discard_range_slab, dr);
+			continue;
+		}
+
+		/* at most a segment at a time, not to hold writers for long */
+		blkaddr = dr->blkaddr;
+		len = min(dr->len, sbi->blocks_per_seg);
+		if (len == dr->len) {
+			__remove_discard_range(dcc, dr);
+			kmem_cache_free(discard_range_slab, dr);
+		} else {
+			dr->blkaddr += len;
+			dr->len -= len;
+			dcc->pending_blks -= len;
+		}
+		dcc->inflight_blkaddr = blkaddr;
+		dcc->inflight_len = len;
+		spin_unlock(&dcc->discard_lock);
+
+		f2fs_issue_discard(sbi, blkaddr, len);
+
+		spin_lock(&dcc->discard_lock);
+		dcc->inflight_len = 0;
+		dcc->nr_issued++;
+		dcc->issued_blks += len;
+		spin_unlock(&dcc->discard_lock);
+		wake_up_all(&dcc->inflight_wait_queue);
+
+		nr_issue--;
+	}
+}
+
+static int issue_discard_thread(void *data)
+{
+	struct discard_cmd_control *dcc = data;
+	struct f2fs_sb_info *sbi = dcc->sbi;
+	unsigned int wait_ms;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(dcc->discard_wait_queue,
+				kthread_should_stop() ||
+				!RB_EMPTY_ROOT(&dcc->root));
+
+		if (is_idle(sbi)) {
+			issue_pending_discards(dcc,
+					SM_I(sbi)->max_discard_issue);
+			wait_ms = SM_I(sbi)->discard_interval;
+		} else {
+			wait_ms = DEF_DISCARD_BUSY_INTERVAL;
+		}
+
+		wait_event_interruptible_timeout(dcc->discard_wait_queue,
+				kthread_should_stop(),
+				msecs_to_jiffies(wait_ms));
+	}
+
+	/* the partition is going away, so send what is left */
+	issue_pending_discards(dcc, UINT_MAX);
+	return 0;
+}
+
+int create_discard_cmd_control(struct f2fs_sb_info *sbi)
+{
+	dev_t dev = sbi->sb->s_bdev->bd_dev;
+	struct discard_cmd_control *dcc;
+	int err;
+
+	dcc = kzalloc(sizeof(struct discard_cmd_control), GFP_KERNEL);
+	if (!dcc)
+		return -ENOMEM;
+
+	dcc->sbi = sbi;
+	init_waitqueue_head(&dcc->discard_wait_queue);
+	init_waitqueue_head(&dcc->inflight_wait_queue);
+	spin_lock_init(&dcc->discard_lock);
+	dcc->root = RB_ROOT;
+
+	/* publish only once the thread exists, nobody may see it freed */
+	dcc->f2fs_issue_discard = kthread_run(issue_discard_thread, dcc,
+				"f2fs_discard-%u:%u", MAJOR(dev), MINOR(dev));
+	if (IS_ERR(dcc->f2fs_issue_discard)) {
+		err = PTR_ERR(dcc->f2fs_issue_discard);
+		kfree(dcc);
+		return err;
+	}
+	SM_I(sbi)->dcc_info = dcc;
+	return 0;
+}
+
+static void destroy_discard_cmd_control(struct f2fs_sb_info *sbi)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+
+	if (!dcc)
+		return;
+	kthread_stop(dcc->f2fs_issue_discard);
+	kfree(dcc);
+	SM_I(sbi)->dcc_info = NULL;
+}
+
 static void add_discard_addrs(struct f2fs_sb_info *sbi,
 			unsigned int segno, struct seg_entry *se)
 {
@@ -296,6 +774,10 @@ static void add_discard_addrs(struct f2fs_sb_info *sbi,
 	if (!se->valid_blocks || se->valid_blocks == max_blocks)
 		return;
 
+	/* SSR may write into its holes before the discard is issued */
+	if (IS_CURSEG(sbi, segno))
+		return;
+
 	/* SIT_VBLOCK_MAP_SIZE should be multiple of sizeof(unsigned long) */
 	for (i = 0; i < entries; i++)
 		dmap[i] = (cur_map[i] ^ ckpt_map[i]) & ckpt_map[i];
@@ -364,7 +846,7 @@ void clear_prefree_segments(struct f2fs_sb_info *sbi)
 		if (!test_opt(sbi, DISCARD))
 			continue;
 
-		f2fs_issue_discard(sbi, START_BLOCK(sbi, start),
+		f2fs_queue_discard(sbi, START_BLOCK(sbi, start),
 				(end - start) << sbi->log_blocks_per_seg);
 	}
 	mutex_unlock(&dirty_i->seglist_lock);
@@ -372,7 +854,7 @@ void clear_prefree_segments(struct f2fs_sb_info *sbi)
 	/* send small discards */
 	list_for_each_safe(this, next, head) {
 		entry = list_entry(this, struct discard_entry, list);
-		f2fs_issue_discard(sbi, entry->blkaddr, entry->len);
+		f2fs_queue_discard(sbi, entry->blkaddr, entry->len);
 		list_del(&entry->list);
 		SM_I(sbi)->nr_discards -= entry->len;
 		kmem_cache_free(discard_entry_slab, entry);
@@ -460,6 +942,8 @@ static void update_sit_entry(struct f2fs_sb_info *sbi, block_t blkaddr, int del)
 
 	if (sbi->segs_per_sec > 1)
 		get_sec_entry(sbi, segno)->valid_blocks += del;
+
+	update_victim_entry(sbi, segno);
 }
 
 static void refresh_sit_entry(struct f2fs_sb_info *sbi,
@@ -665,6 +1149,9 @@ static void reset_curseg(struct f2fs_sb_info *sbi, int type, int modified)
 	curseg->next_blkoff = 0;
 	curseg->next_segno = NULL_SEGNO;
 
+	f2fs_punch_discard(sbi, START_BLOCK(sbi, curseg->segno),
+						sbi->blocks_per_seg);
+
 	sum_footer = &(curseg->sum_blk->footer);
 	memset(sum_footer, 0, sizeof(struct summary_footer));
 	if (IS_DATASEG(type))
@@ -1758,10 +2245,77 @@ static int init_victim_secmap(struct f2fs_sb_info *sbi)
 	return 0;
 }
 
+static int init_victim_index(struct f2fs_sb_info *sbi)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	unsigned int nr_buckets = nr_victim_buckets(sbi);
+	unsigned int i;
+
+	spin_lock_init(&dirty_i->victim_lock);
+
+	dirty_i->victim_entries = vzalloc(TOTAL_SECS(sbi) *
+					sizeof(struct victim_entry));
+	if (!dirty_i->victim_entries)
+		return -ENOMEM;
+
+	dirty_i->victim_buckets = vzalloc(nr_buckets *
+					sizeof(struct list_head));
+	if (!dirty_i->victim_buckets)
+		return -ENOMEM;
+	for (i = 0; i < nr_buckets; i++)
+		INIT_LIST_HEAD(&dirty_i->victim_buckets[i]);
+
+	dirty_i->victim_bucket_map = kzalloc(f2fs_bitmap_size(nr_buckets),
+								GFP_KERNEL);
+	if (!dirty_i->victim_bucket_map)
+		return -ENOMEM;
+	return 0;
+}
+
+static unsigned long long get_sec_mtime(struct f2fs_sb_info *sbi,
+						unsigned int secno)
+{
+	unsigned int start = secno * sbi->segs_per_sec;
+	unsigned long long mtime = 0;
+	unsigned int i;
+
+	for (i = 0; i < sbi->segs_per_sec; i++)
+		mtime += get_seg_entry(sbi, start + i)->mtime;
+	return div_u64(mtime, sbi->segs_per_sec);
+}
+
+static int victim_mtime_cmp(void *priv, struct list_head *a,
+						struct list_head *b)
+{
+	struct f2fs_sb_info *sbi = priv;
+	struct victim_entry *victim_entries = DIRTY_I(sbi)->victim_entries;
+	unsigned long long mtime_a, mtime_b;
+
+	mtime_a = get_sec_mtime(sbi, list_entry(a, struct victim_entry,
+						list) - victim_entries);
+	mtime_b = get_sec_mtime(sbi, list_entry(b, struct victim_entry,
+						list) - victim_entries);
+	if (mtime_a < mtime_b)
+		return -1;
+	return mtime_a > mtime_b;
+}
+
+/* Order the buckets by age, as they would be after running for a while */
+static void sort_victim_index(struct f2fs_sb_info *sbi)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	unsigned int nr_buckets = nr_victim_buckets(sbi);
+	unsigned int i;
+
+	for_each_set_bit(i, dirty_i->victim_bucket_map, nr_buckets)
+		list_sort(sbi, &dirty_i->victim_buckets[i], victim_mtime_cmp);
+}
+
 static int build_dirty_segmap(struct f2fs_sb_info *sbi)
 {
 	struct dirty_seglist_info *dirty_i;
 	unsigned int bitmap_size, i;
+	int err;
 
 	/* allocate memory for dirty segments list information */
 	dirty_i = kzalloc(sizeof(struct dirty_seglist_info), GFP_KERNEL);
@@ -1779,7 +2333,12 @@ static int build_dirty_segmap(struct f2fs_sb_info *sbi)
 			return -ENOMEM;
 	}
 
+	err = init_victim_index(sbi);
+	if (err)
+		return err;
+
 	init_dirty_segmap(sbi);
+	sort_victim_index(sbi);
 	return init_victim_secmap(sbi);
 }
 
@@ -1841,6 +2400,22 @@ int build_segment_manager(struct f2fs_sb_info *sbi)
 	sm_info->nr_discards = 0;
 	sm_info->max_discards = 0;
 
+	sm_info->discard_granularity = DEF_DISCARD_GRANULARITY;
+	sm_info->max_discard_issue = DEF_MAX_DISCARD_ISSUE;
+	sm_info->discard_interval = DEF_DISCARD_INTERVAL;
+
+	if (test_opt(sbi, DISCARD) && !f2fs_readonly(sbi->sb)) {
+		err = create_discard_cmd_control(sbi);
+		if (err)
+			return err;
+	}
+
+	if (test_opt(sbi, FLUSH_MERGE) && !f2fs_readonly(sbi->sb)) {
+		err = create_flush_cmd_control(sbi);
+		if (err)
+			return err;
+	}
+
 	err = build_sit_info(sbi);
 	if (err)
 		return err;
@@ -1880,6 +2455,15 @@ static void destroy_victim_secmap(struct f2fs_sb_info *sbi)
 	kfree(dirty_i->victim_secmap);
 }
 
+static void destroy_victim_index(struct f2fs_sb_info *sbi)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+
+	kfree(dirty_i->victim_bucket_map);
+	vfree(dirty_i->victim_buckets);
+	vfree(dirty_i->victim_entries);
+}
+
 static void destroy_dirty_segmap(struct f2fs_sb_info *sbi)
 {
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
@@ -1893,6 +2477,7 @@ static void destroy_dirty_segmap(struct f2fs_sb_info *sbi)
 		discard_dirty_segmap(sbi, i);
 
 	destroy_victim_secmap(sbi);
+	destroy_victim_index(sbi);
 	SM_I(sbi)->dirty_info = NULL;
 	kfree(dirty_i);
 }
@@ -1949,6 +2534,8 @@ void destroy_segment_manager(struct f2fs_sb_info *sbi)
 	struct f2fs_sm_info *sm_info = SM_I(sbi);
 	if (!sm_info)
 		return;
+	destroy_flush_cmd_control(sbi);
+	destroy_discard_cmd_control(sbi);
 	destroy_dirty_segmap(sbi);
 	destroy_curseg(sbi);
 	destroy_free_segmap(sbi);
@@ -1963,10 +2550,18 @@ int __init create_segment_manager_caches(void)
 			sizeof(struct discard_entry), NULL);
 	if (!discard_entry_slab)
 		return -ENOMEM;
+
+	discard_range_slab = f2fs_kmem_cache_create("discard_range",
+			sizeof(struct discard_range), NULL);
+	if (!discard_range_slab) {
+		kmem_cache_destroy(discard_entry_slab);
+		return -ENOMEM;
+	}
 	return 0;
 }
 
 void destroy_segment_manager_caches(void)
 {
+	kmem_cache_destroy(discard_range_slab);
 	kmem_cache_destroy(discard_entry_slab);
 }
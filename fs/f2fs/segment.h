@@ -16,6 +16,13 @@
 
 #define DEF_RECLAIM_PREFREE_SEGMENTS	100	/* 200MB of prefree segments */
 
+/* for the background discard thread */
+#define DEF_DISCARD_GRANULARITY		1	/* blocks */
+#define DEF_MAX_DISCARD_ISSUE		8	/* discards per round */
+#define DEF_DISCARD_INTERVAL		50	/* ms */
+#define DEF_DISCARD_BUSY_INTERVAL	1000	/* ms, when the device is busy */
+#define MAX_DISCARD_PENDING		4096	/* ranges */
+
 /* L: Logical segment # in volume, R: Relative segment # in main area */
 #define GET_L2R_SEGNO(free_i, segno)	(segno - free_i->start_segno)
 #define GET_R2L_SEGNO(free_i, segno)	(segno + free_i->start_segno)
@@ -209,12 +216,29 @@ enum dirty_type {
 	NR_DIRTY_TYPE
 };
 
+/*
+ * Sections having dirty segments are indexed by their valid blocks, so that
+ * cleaning finds its victim without scanning the dirty segmap. Each bucket
+ * keeps its sections in the order they were last written, oldest first.
+ */
+struct victim_entry {
+	struct list_head list;		/* link in the bucket of vblocks */
+	unsigned int vblocks;		/* # of valid blocks when indexed */
+	unsigned int nr_dirty;		/* # of dirty segments in the section */
+};
+
 struct dirty_seglist_info {
 	const struct victim_selection *v_ops;	/* victim selction operation */
 	unsigned long *dirty_segmap[NR_DIRTY_TYPE];
 	struct mutex seglist_lock;		/* lock for segment bitmaps */
 	int nr_dirty[NR_DIRTY_TYPE];		/* # of dirty segments */
 	unsigned long *victim_secmap;		/* background GC victims */
+
+	/* index of dirty sections for victim selection */
+	spinlock_t victim_lock;			/* lock for the index */
+	struct victim_entry *victim_entries;	/* per-section entries */
+	struct list_head *victim_buckets;	/* sections by valid blocks */
+	unsigned long *victim_bucket_map;	/* non-empty buckets */
 };
 
 /* victim selection function for cleaning and SSR */
@@ -256,6 +280,11 @@ static inline struct sec_entry *get_sec_entry(struct f2fs_sb_info *sbi,
 	return &sit_i->sec_entries[GET_SECNO(sbi, segno)];
 }
 
+static inline unsigned int nr_victim_buckets(struct f2fs_sb_info *sbi)
+{
+	return sbi->blocks_per_seg * sbi->segs_per_sec + 1;
+}
+
 static inline unsigned int get_valid_blocks(struct f2fs_sb_info *sbi,
 				unsigned int segno, int section)
 {
@@ -23,6 +23,7 @@
 
 #include <linux/types.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
 #include <linux/slab.h>
 #include <linux/buffer_head.h>
 
@@ -30,6 +31,7 @@
 #include "squashfs_fs_sb.h"
 #include "decompressor.h"
 #include "squashfs.h"
+#include "page_actor.h"
 
 /*
  * This file (and decompressor.h) implements a decompressor framework for
@@ -83,34 +85,112 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 }
 
 
-void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
+/*
+ * Set up the decompressor streams of the filesystem: one shared stream
+ * serialised by read_data_mutex, or with 'percpu' set one stream per
+ * possible cpu so that readers on different cpus decompress concurrently.
+ */
+int squashfs_decompressor_setup(struct super_block *sb, unsigned short flags,
+	int percpu)
 {
 	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	struct squashfs_stream *stream;
 	void *strm, *buffer = NULL;
-	int length = 0;
+	int cpu, length = 0, err = 0;
 
 	/*
 	 * Read decompressor specific options from file system if present
 	 */
 	if (SQUASHFS_COMP_OPTS(flags)) {
+		struct squashfs_page_actor actor;
+
 		buffer = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
 		if (buffer == NULL)
-			return ERR_PTR(-ENOMEM);
+			return -ENOMEM;
 
-		length = squashfs_read_data(sb, &buffer,
-			sizeof(struct squashfs_super_block), 0, NULL,
-			PAGE_CACHE_SIZE, 1);
+		squashfs_page_actor_init(&actor, &buffer, 1, 0);
+		length = squashfs_read_data(sb,
+			sizeof(struct squashfs_super_block), 0, NULL, &actor);
 
 		if (length < 0) {
-			strm = ERR_PTR(length);
+			err = length;
 			goto finished;
 		}
 	}
 
-	strm = msblk->decompressor->init(msblk, buffer, length);
+	if (!percpu) {
+		strm = msblk->decompressor->init(msblk, buffer, length);
+		if (IS_ERR(strm))
+			err = PTR_ERR(strm);
+		else
+			msblk->stream = strm;
+		goto finished;
+	}
+
+	msblk->percpu_streams = alloc_percpu(struct squashfs_stream);
+	if (msblk->percpu_streams == NULL) {
+		err = -ENOMEM;
+		goto finished;
+	}
+
+	for_each_possible_cpu(cpu) {
+		stream = per_cpu_ptr(msblk->percpu_streams, cpu);
+		mutex_init(&stream->mutex);
+		strm = msblk->decompressor->init(msblk, buffer, length);
+		if (IS_ERR(strm)) {
+			err = PTR_ERR(strm);
+			squashfs_decompressor_destroy(msblk);
+			goto finished;
+		}
+		stream->stream = strm;
+	}
 
 finished:
 	kfree(buffer);
 
-	return strm;
+	return err;
+}
+
+
+void squashfs_decompressor_destroy(struct squashfs_sb_info *msblk)
+{
+	int cpu;
+
+	if (msblk->decompressor == NULL)
+		return;
+
+	if (msblk->percpu_streams) {
+		for_each_possible_cpu(cpu)
+			msblk->decompressor->free(
+				per_cpu_ptr(msblk->percpu_streams, cpu)->stream);
+		free_percpu(msblk->percpu_streams);
+		msblk->percpu_streams = NULL;
+	} else
+		msblk->decompressor->free(msblk->stream);
+	msblk->stream = NULL;
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk,
+	struct buffer_head **bh, int b, int offset, int length,
+	struct squashfs_page_actor *output)
+{
+	struct mutex *mutex = &msblk->read_data_mutex;
+	void *strm = msblk->stream;
+	int res;
+
+	if (msblk->percpu_streams) {
+		struct squashfs_stream *stream = per_cpu_ptr(
+			msblk->percpu_streams, raw_smp_processor_id());
+
+		mutex = &stream->mutex;
+		strm = stream->stream;
+	}
+
+	mutex_lock(mutex);
+	res = msblk->decompressor->decompress(msblk, strm, bh, b, offset,
+		length, output);
+	mutex_unlock(mutex);
+
+	return res;
 }
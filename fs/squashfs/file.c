@@ -47,11 +47,15 @@
 #include <linux/string.h>
 #include <linux/pagemap.h>
 #include <linux/mutex.h>
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#include <linux/highmem.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
 #include "squashfs_fs_i.h"
 #include "squashfs.h"
+#include "page_actor.h"
 
 /*
  * Locate cache slot in range [offset, index] for specified inode.  If
@@ -371,11 +375,115 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
+/*
+ * Decompress datablock <block>, of on-disk size <bsize> and holding <bytes>
+ * bytes of the file, straight into the page-cache pages covering it rather
+ * than through the read_page cache.
+ *
+ * <page> holds the <nr> pages of the block from page index <start>, in
+ * order.  Slots may be NULL for pages the caller does not have; these are
+ * grabbed from the page cache here and released again once read.  The
+ * caller's pages stay locked, and are up to date if 0 is returned.
+ *
+ * Returns -EAGAIN, having read nothing, if one of the missing pages is busy
+ * or already up to date, in which case the caller falls back to
+ * squashfs_readpage().
+ */
+static int squashfs_read_block_direct(struct inode *inode, u64 block,
+	int bsize, int bytes, struct page **page, pgoff_t start, int nr)
+{
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	DECLARE_BITMAP(grabbed, SQUASHFS_FILE_MAX_SIZE >> PAGE_CACHE_SHIFT);
+	struct squashfs_page_actor actor;
+	int i, avail, res = -EAGAIN;
+	void *pageaddr;
+
+	bitmap_zero(grabbed, nr);
+	for (i = 0; i < nr; i++) {
+		if (page[i])
+			continue;
+		page[i] = grab_cache_page_nowait(inode->i_mapping, start + i);
+		if (page[i] == NULL)
+			goto release;
+		__set_bit(i, grabbed);
+		if (PageUptodate(page[i]))
+			goto release;
+	}
+
+	/*
+	 * The decompressor maps the pages one at a time as it fills them, so
+	 * a whole block never pins more than one kmap slot.
+	 */
+	squashfs_page_actor_init_special(&actor, page, nr, msblk->block_size);
+	res = squashfs_read_data(inode->i_sb, block, bsize, NULL, &actor);
+	if (res < 0) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+		goto release;
+	}
+
+	for (i = 0; i < nr; i++) {
+		avail = clamp_t(int, res - (i << PAGE_CACHE_SHIFT), 0,
+			PAGE_CACHE_SIZE);
+		if (avail < PAGE_CACHE_SIZE) {
+			pageaddr = kmap_atomic(page[i], KM_USER0);
+			memset(pageaddr + avail, 0, PAGE_CACHE_SIZE - avail);
+			kunmap_atomic(pageaddr, KM_USER0);
+		}
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+	}
+	res = 0;
+
+release:
+	for (i = 0; i < nr; i++) {
+		if (!test_bit(i, grabbed))
+			continue;
+		unlock_page(page[i]);
+		page_cache_release(page[i]);
+		page[i] = NULL;
+	}
+
+	return res;
+}
+
+
+/*
+ * Read datablock <index> of the file, located at <block> with on-disk size
+ * <bsize>, into the page cache on behalf of squashfs_readpage(), which
+ * holds <page> locked.
+ */
+static int squashfs_readpage_block(struct page *page, int index, u64 block,
+	int bsize)
+{
+	struct inode *inode = page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	pgoff_t start = (pgoff_t) index << shift;
+	int bytes = min_t(loff_t, i_size_read(inode) -
+		((loff_t) index << msblk->block_log), msblk->block_size);
+	int nr = (bytes + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	struct page **pages;
+	int res;
+
+	pages = kcalloc(nr, sizeof(*pages), GFP_KERNEL);
+	if (pages == NULL)
+		return -EAGAIN;
+
+	pages[page->index - start] = page;
+	res = squashfs_read_block_direct(inode, block, bsize, bytes, pages,
+		start, nr);
+	kfree(pages);
+
+	return res;
+}
+
+
 static int squashfs_readpage(struct file *file, struct page *page)
 {
 	struct inode *inode = page->mapping->host;
 	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
-	int bytes, i, offset = 0, sparse = 0;
+	int bytes, i, res, offset = 0, sparse = 0;
 	struct squashfs_cache_entry *buffer = NULL;
 	void *pageaddr;
 
@@ -410,7 +518,21 @@ static int squashfs_readpage(struct file *file, struct page *page)
 			sparse = 1;
 		} else {
 			/*
-			 * Read and decompress datablock.
+			 * Decompress the datablock straight into the page
+			 * cache if all its pages can be had.
+			 */
+			res = squashfs_readpage_block(page, index, block,
+				bsize);
+			if (res == 0) {
+				unlock_page(page);
+				return 0;
+			}
+			if (res != -EAGAIN)
+				goto error_out;
+
+			/*
+			 * Otherwise read and decompress datablock through
+			 * the read_page cache.
 			 */
 			buffer = squashfs_get_datablock(inode->i_sb,
 								block, bsize);
@@ -496,6 +618,123 @@ out:
 }
 
 
+/*
+ * Start reading the on-disk extent of datablocks <first> to <last> of the
+ * file.  A file's datablocks are stored back to back, so with the requests
+ * plugged they are merged and go to the device as one read.
+ */
+static void squashfs_readahead_blocks(struct inode *inode, int first,
+	int last)
+{
+	struct super_block *sb = inode->i_sb;
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	struct blk_plug plug;
+	u64 start, end;
+	sector_t cur;
+	int bsize;
+
+	if (read_blocklist(inode, first, &start) < 0)
+		return;
+	bsize = read_blocklist(inode, last, &end);
+	if (bsize < 0)
+		return;
+	end += SQUASHFS_COMPRESSED_SIZE_BLOCK(bsize);
+	if (end <= start || end > msblk->bytes_used)
+		return;
+
+	blk_start_plug(&plug);
+	for (cur = start >> msblk->devblksize_log2;
+			cur <= (end - 1) >> msblk->devblksize_log2; cur++)
+		sb_breadahead(sb, cur);
+	blk_finish_plug(&plug);
+}
+
+
+/*
+ * Readahead.  The datablocks covered by <pages> are read from disk in one
+ * go, and then decompressed a block at a time straight into its pages.
+ * Blocks which cannot be handled that way (holes, fragments, or blocks
+ * with some pages busy) are read page by page by squashfs_readpage().
+ */
+static int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	int file_end = i_size_read(inode) >> msblk->block_log;
+	int first, last, index, bsize, bytes, nr, i, res;
+	struct page **block_pages, *page;
+	pgoff_t start;
+	u64 block;
+
+	block_pages = kcalloc(1 << shift, sizeof(*block_pages), GFP_KERNEL);
+	if (block_pages == NULL)
+		return -ENOMEM;
+
+	first = list_entry(pages->prev, struct page, lru)->index >> shift;
+	last = list_entry(pages->next, struct page, lru)->index >> shift;
+	if (last == file_end && squashfs_i(inode)->fragment_block !=
+					SQUASHFS_INVALID_BLK)
+		last--;
+	if (first <= last)
+		squashfs_readahead_blocks(inode, first, last);
+
+	while (!list_empty(pages)) {
+		page = list_entry(pages->prev, struct page, lru);
+		index = page->index >> shift;
+		start = (pgoff_t) index << shift;
+
+		/* Move this block's pages from the list into the page cache */
+		memset(block_pages, 0, sizeof(*block_pages) << shift);
+		do {
+			list_del(&page->lru);
+			if (add_to_page_cache_lru(page, mapping, page->index,
+							GFP_KERNEL))
+				page_cache_release(page);
+			else
+				block_pages[page->index - start] = page;
+
+			if (list_empty(pages))
+				break;
+			page = list_entry(pages->prev, struct page, lru);
+		} while (page->index >> shift == index);
+
+		res = -EAGAIN;
+		if (index < file_end || squashfs_i(inode)->fragment_block ==
+						SQUASHFS_INVALID_BLK) {
+			bsize = read_blocklist(inode, index, &block);
+			if (bsize > 0) {
+				bytes = min_t(loff_t, i_size_read(inode) -
+					((loff_t) index << msblk->block_log),
+					msblk->block_size);
+				nr = (bytes + PAGE_CACHE_SIZE - 1) >>
+					PAGE_CACHE_SHIFT;
+				res = squashfs_read_block_direct(inode, block,
+					bsize, bytes, block_pages, start, nr);
+			}
+		}
+
+		for (i = 0; i < 1 << shift; i++) {
+			if (block_pages[i] == NULL)
+				continue;
+			if (res == -EAGAIN) {
+				squashfs_readpage(file, block_pages[i]);
+			} else {
+				if (res)
+					SetPageError(block_pages[i]);
+				unlock_page(block_pages[i]);
+			}
+			page_cache_release(block_pages[i]);
+		}
+	}
+
+	kfree(block_pages);
+	return 0;
+}
+
+
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readpages = squashfs_readpages
 };
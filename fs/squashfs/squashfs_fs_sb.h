@@ -51,6 +51,17 @@ struct squashfs_cache_entry {
 	void			**data;
 };
 
+/*
+ * A decompressor stream, used by one reader at a time. With per-cpu
+ * streams, readers use the stream of the cpu they are running on; the
+ * mutex only matters if one is preempted and another reader on that cpu
+ * picks the same stream.
+ */
+struct squashfs_stream {
+	struct mutex		mutex;
+	void			*stream;
+};
+
 struct squashfs_sb_info {
 	const struct squashfs_decompressor	*decompressor;
 	int					devblksize;
@@ -66,6 +77,7 @@ struct squashfs_sb_info {
 	struct mutex				meta_index_mutex;
 	struct meta_index			*meta_index;
 	void					*stream;
+	struct squashfs_stream __percpu		*percpu_streams;
 	__le64					*inode_lookup_table;
 	u64					inode_table;
 	u64					directory_table;
@@ -378,9 +378,49 @@ extern struct cpufreq_governor cpufreq_gov_conservative;
 #elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE)
 extern struct cpufreq_governor cpufreq_gov_interactive;
 #define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_interactive)
+#elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_SCHED)
+extern struct cpufreq_governor cpufreq_gov_sched;
+#define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_sched)
 #endif
 
 
+/*********************************************************************
+ *                   SCHEDULER DRIVEN GOVERNOR                       *
+ *********************************************************************/
+
+#ifdef CONFIG_CPU_FREQ_GOV_SCHED
+extern int cpufreq_sched_enabled;
+void __cpufreq_sched_update(int cpu, unsigned long nr_running, u64 now);
+void __cpufreq_sched_kick(void);
+
+/* fair class utilization of @cpu may have changed, runqueue locked */
+static inline void cpufreq_sched_update(int cpu, unsigned long nr_running,
+					u64 now)
+{
+	if (cpufreq_sched_enabled)
+		__cpufreq_sched_update(cpu, nr_running, now);
+}
+
+/* wake the governor thread if needed, no scheduler locks held */
+static inline void cpufreq_sched_kick(void)
+{
+	if (cpufreq_sched_enabled)
+		__cpufreq_sched_kick();
+}
+#else
+static inline void cpufreq_sched_update(int cpu, unsigned long nr_running,
+					u64 now)
+{
+}
+static inline void cpufreq_sched_kick(void)
+{
+}
+#endif
+
+/* account @freq as what the comparison governor would run @cpu at, 0: off */
+void cpufreq_stats_compare(unsigned int cpu, unsigned int freq);
+
+
 /*********************************************************************
  *                     FREQUENCY TABLE HELPERS                       *
  *********************************************************************/
@@ -0,0 +1,41 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Public Kernel Interface
+ *
+ *  Compressor and decompressor for the LZ4 block format: byte oriented
+ *  LZ77 with 64KB window, no entropy coding. It trades some ratio against
+ *  LZO for noticeably faster compression and decompression.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define LZ4_HASHLOG		12
+#define LZ4_MEM_COMPRESS	((1 << LZ4_HASHLOG) * sizeof(u32))
+
+/* Worst case output size, dst must be at least this large */
+#define lz4_compressbound(isize)	((isize) + ((isize) / 255) + 16)
+
+/* This requires 'wrkmem' of size LZ4_MEM_COMPRESS */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * Safe decompression: *dst_len is the size of dst on entry and the number
+ * of bytes produced on return. Never reads or writes out of bounds on
+ * corrupted input.
+ */
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len);
+
+/*
+ * Return values (< 0 = Error)
+ */
+#define LZ4_E_OK			0
+#define LZ4_E_INPUT_OVERRUN		(-1)
+#define LZ4_E_OUTPUT_OVERRUN		(-2)
+#define LZ4_E_LOOKBEHIND_OVERRUN	(-3)
+
+#endif
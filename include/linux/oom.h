@@ -66,6 +66,29 @@ static inline void oom_killer_enable(void)
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_task_fork(struct task_struct *p);
+extern void lowmem_task_exec(struct task_struct *p);
+extern void lowmem_task_exit(struct task_struct *p);
+extern void lowmem_adj_changed(struct task_struct *p);
+#else
+static inline void lowmem_task_fork(struct task_struct *p)
+{
+}
+
+static inline void lowmem_task_exec(struct task_struct *p)
+{
+}
+
+static inline void lowmem_task_exit(struct task_struct *p)
+{
+}
+
+static inline void lowmem_adj_changed(struct task_struct *p)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
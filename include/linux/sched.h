@@ -142,6 +142,17 @@ extern unsigned long nr_iowait(void);
 extern unsigned long nr_iowait_cpu(int cpu);
 extern unsigned long this_cpu_load(void);
 
+#ifdef CONFIG_SCHED_CPU_LOAD_TRACK
+/*
+ * Per-cpu load tracking: SCHED_LOAD_TRACK_SCALE stands for one runnable
+ * task (runnable average) or a fully busy cpu (utilization average).
+ */
+#define SCHED_LOAD_TRACK_FSHIFT	10
+#define SCHED_LOAD_TRACK_SCALE	(1UL << SCHED_LOAD_TRACK_FSHIFT)
+extern void sched_get_cpu_load_track(int cpu, unsigned long *runnable,
+				     unsigned long *util);
+#endif
+
 
 extern void calc_global_load(unsigned long ticks);
 extern void prepare_idle_mask(unsigned long ticks);
@@ -648,6 +659,11 @@ struct signal_struct {
 	int oom_score_adj;	/* OOM kill score adjustment */
 	int oom_score_adj_min;	/* OOM kill score adjustment minimum value.
 				 * Only settable by CAP_SYS_RESOURCE. */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	/* lowmemorykiller oom_adj bucket, protected by its bucket lock */
+	struct hlist_node lmk_node;
+	unsigned long lmk_rss;	/* RSS as of the last bucket update or scan */
+#endif
 
 	struct mutex cred_guard_mutex;	/* guard against foreign influences on
 					 * credential calculations
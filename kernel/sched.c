@@ -52,6 +52,7 @@
 #include <linux/timer.h>
 #include <linux/rcupdate.h>
 #include <linux/cpu.h>
+#include <linux/cpufreq.h>
 #include <linux/cpuset.h>
 #include <linux/percpu.h>
 #include <linux/proc_fs.h>
@@ -529,6 +530,13 @@ struct rq {
 	u64 avg_idle;
 #endif
 
+#ifdef CONFIG_SCHED_CPU_LOAD_TRACK
+	/* decayed per-cpu runnable/utilization, see update_cpu_load_track() */
+	unsigned long lt_runnable_avg;
+	unsigned long lt_util_avg;
+	unsigned long lt_last_tick;
+#endif
+
 #ifdef CONFIG_IRQ_TIME_ACCOUNTING
 	u64 prev_irq_time;
 #endif
@@ -2614,6 +2622,7 @@ void scheduler_ipi(void)
 	 */
 	irq_enter();
 	sched_ttwu_do_pending(list);
+	cpufreq_sched_kick();
 	irq_exit();
 }
 
@@ -2747,6 +2756,7 @@ stat:
 	ttwu_stat(p, cpu, wake_flags);
 out:
 	raw_spin_unlock_irqrestore(&p->pi_lock, flags);
+	cpufreq_sched_kick();
 
 	return success;
 }
@@ -2947,6 +2957,7 @@ void wake_up_new_task(struct task_struct *p)
 		p->sched_class->task_woken(rq, p);
 #endif
 	task_rq_unlock(rq, p, &flags);
+	cpufreq_sched_kick();
 }
 
 #ifdef CONFIG_PREEMPT_NOTIFIERS
@@ -3272,6 +3283,87 @@ unsigned long this_cpu_load(void)
 	return this->cpu_load[0];
 }
 
+#ifdef CONFIG_SCHED_CPU_LOAD_TRACK
+/*
+ * Each tick the averages move 1/2^LOAD_TRACK_DECAY_SHIFT of the way
+ * towards the current sample, which gives a half-life of roughly five
+ * ticks. Ticks missed while in tickless idle are folded in as idle
+ * samples; after LOAD_TRACK_MAX_MISSED of them the average is gone.
+ */
+#define LOAD_TRACK_DECAY_SHIFT	3
+#define LOAD_TRACK_MAX_MISSED	64
+
+/* The decrement is rounded up so that an idle average reaches zero. */
+static inline unsigned long load_track_decay(unsigned long avg)
+{
+	return avg - ((avg + (1UL << LOAD_TRACK_DECAY_SHIFT) - 1) >>
+		      LOAD_TRACK_DECAY_SHIFT);
+}
+
+static unsigned long decay_load_track(unsigned long avg, unsigned long missed)
+{
+	if (missed >= LOAD_TRACK_MAX_MISSED)
+		return 0;
+
+	while (missed-- && avg)
+		avg = load_track_decay(avg);
+
+	return avg;
+}
+
+static void update_cpu_load_track(struct rq *this_rq)
+{
+	unsigned long missed = jiffies - this_rq->lt_last_tick;
+	unsigned long runnable, util;
+
+	runnable = this_rq->nr_running << SCHED_LOAD_TRACK_FSHIFT;
+	util = (this_rq->curr != this_rq->idle) ? SCHED_LOAD_TRACK_SCALE : 0;
+
+	if (missed > 1) {
+		this_rq->lt_runnable_avg =
+			decay_load_track(this_rq->lt_runnable_avg, missed - 1);
+		this_rq->lt_util_avg =
+			decay_load_track(this_rq->lt_util_avg, missed - 1);
+	}
+
+	this_rq->lt_runnable_avg = load_track_decay(this_rq->lt_runnable_avg) +
+		(runnable >> LOAD_TRACK_DECAY_SHIFT);
+	this_rq->lt_util_avg = load_track_decay(this_rq->lt_util_avg) +
+		(util >> LOAD_TRACK_DECAY_SHIFT);
+	this_rq->lt_last_tick = jiffies;
+}
+
+/*
+ * Read the tracked averages of @cpu. The values are read without the
+ * runqueue lock; a cpu sitting in tickless idle has its averages decayed
+ * for the ticks it skipped so callers never see stale busy values.
+ */
+void sched_get_cpu_load_track(int cpu, unsigned long *runnable,
+			      unsigned long *util)
+{
+	struct rq *rq = cpu_rq(cpu);
+	unsigned long missed;
+
+	if (!cpu_online(cpu)) {
+		*runnable = 0;
+		*util = 0;
+		return;
+	}
+
+	missed = jiffies - ACCESS_ONCE(rq->lt_last_tick);
+	*runnable = ACCESS_ONCE(rq->lt_runnable_avg);
+	*util = ACCESS_ONCE(rq->lt_util_avg);
+
+	if (missed > 1) {
+		*runnable = decay_load_track(*runnable, missed - 1);
+		*util = decay_load_track(*util, missed - 1);
+	}
+}
+EXPORT_SYMBOL_GPL(sched_get_cpu_load_track);
+#else
+static inline void update_cpu_load_track(struct rq *this_rq) { }
+#endif
+
 
 /* Variables and functions for calc_load */
 static atomic_long_t calc_load_tasks;
@@ -4194,8 +4286,10 @@ void scheduler_tick(void)
 	raw_spin_lock(&rq->lock);
 	update_rq_clock(rq);
 	update_cpu_load_active(rq);
+	update_cpu_load_track(rq);
 	curr->sched_class->task_tick(rq, curr, 0);
 	raw_spin_unlock(&rq->lock);
+	cpufreq_sched_kick();
 
 	perf_event_task_tick();
 
@@ -4438,6 +4532,7 @@ asmlinkage void __sched schedule(void)
 
 	sched_submit_work(tsk);
 	__schedule();
+	cpufreq_sched_kick();
 }
 EXPORT_SYMBOL(schedule);
 
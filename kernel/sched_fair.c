@@ -1297,6 +1297,15 @@ static inline void hrtick_update(struct rq *rq)
 }
 #endif
 
+/*
+ * Let the 'sched' cpufreq governor know the fair class utilization of
+ * this cpu may have changed.
+ */
+static inline void update_cpufreq_sched(struct rq *rq)
+{
+	cpufreq_sched_update(cpu_of(rq), rq->cfs.nr_running, rq->clock_task);
+}
+
 /*
  * The enqueue_task method is called before nr_running is
  * increased. Here we update the fair scheduling stats and
@@ -1324,6 +1333,7 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 	}
 
 	hrtick_update(rq);
+	update_cpufreq_sched(rq);
 }
 
 static void set_next_buddy(struct sched_entity *se);
@@ -1367,6 +1377,7 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 	}
 
 	hrtick_update(rq);
+	update_cpufreq_sched(rq);
 }
 
 #ifdef CONFIG_SMP
@@ -4132,6 +4143,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	update_cpufreq_sched(rq);
 }
 
 /*
@@ -125,7 +125,7 @@ EXPORT_SYMBOL(cad_pid);
  */
 
 void (*pm_power_off_prepare)(void);
-#ifndef CONFIG_TEGRA_MPDECISION
+#ifdef CONFIG_TEGRA_HOTPLUG
  extern void disable_auto_hotplug(void);
 #endif
 /*
@@ -369,7 +369,7 @@ EXPORT_SYMBOL(unregister_reboot_notifier);
  */
 void kernel_restart(char *cmd)
 {
-#ifndef CONFIG_TEGRA_MPDECISION
+#ifdef CONFIG_TEGRA_HOTPLUG
 	disable_auto_hotplug();
 #endif
 	kernel_restart_prepare(cmd);
@@ -421,7 +421,7 @@ void kernel_power_off(void)
 		printk(KERN_EMERG "kernel_power_off: go to charger mode!");
 		kernel_restart(cmd);
 	 }
-#ifndef CONFIG_TEGRA_MPDECISION
+#ifdef CONFIG_TEGRA_HOTPLUG
 	disable_auto_hotplug();
 #endif
 	kernel_shutdown_prepare(SYSTEM_POWER_OFF);
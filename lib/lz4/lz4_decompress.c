@@ -0,0 +1,115 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  Every length and offset is checked against the input and output
+ *  bounds, so corrupted input makes it fail instead of overrunning.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+#define HAVE_IP(x)	((size_t)(iend - ip) >= (size_t)(x))
+#define HAVE_OP(x)	((size_t)(oend - op) >= (size_t)(x))
+
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char * const iend = src + src_len;
+	unsigned char *op = dst;
+	unsigned char * const oend = dst + *dst_len;
+
+	for (;;) {
+		const unsigned char *ref;
+		unsigned int token, s;
+		size_t len, offset;
+
+		if (!HAVE_IP(1))
+			goto input_overrun;
+		token = *ip++;
+
+		/* Literals */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK) {
+			do {
+				if (!HAVE_IP(1))
+					goto input_overrun;
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+		if (!HAVE_IP(len))
+			goto input_overrun;
+		if (!HAVE_OP(len))
+			goto output_overrun;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* The last sequence has no match part */
+		if (ip == iend)
+			break;
+
+		if (!HAVE_IP(2))
+			goto input_overrun;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst))
+			goto lookbehind_overrun;
+		ref = op - offset;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK) {
+			do {
+				if (!HAVE_IP(1))
+					goto input_overrun;
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+		len += MINMATCH;
+		if (!HAVE_OP(len))
+			goto output_overrun;
+
+		/* Short offsets repeat the last bytes and overlap the copy */
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+
+input_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_INPUT_OVERRUN;
+
+output_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_OUTPUT_OVERRUN;
+
+lookbehind_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_LOOKBEHIND_OVERRUN;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ *  lz4defs.h -- LZ4 block format constants
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+/*
+ * A sequence is a token byte, literal length extension bytes, literals,
+ * a little endian 16-bit match offset and match length extension bytes.
+ * The token's high nibble is the literal length, the low nibble the match
+ * length minus MINMATCH; 15 in either means extension bytes follow, each
+ * adding up to 255. The last sequence carries literals only.
+ */
+#define MINMATCH	4
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+/*
+ * Matches must start at least MFLIMIT bytes before the end of the input
+ * and the last LASTLITERALS bytes are always literals.
+ */
+#define LASTLITERALS	5
+#define MFLIMIT		(8 + MINMATCH)
+
+#define MAX_DISTANCE	((1 << 16) - 1)
+
+/* Search step grows by one every 2^SKIPSTRENGTH misses */
+#define SKIPSTRENGTH	6
+
+#define LZ4_READ32(p)	get_unaligned((const u32 *)(p))
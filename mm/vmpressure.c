@@ -0,0 +1,122 @@
+/*
+ * mm/vmpressure.c
+ *
+ * Global memory pressure reporting based on reclaim efficiency.
+ *
+ * Reclaim reports how many pages it scanned and how many of those it
+ * managed to free. Once a window of scanned pages has accumulated, the
+ * ratio of unsuccessful scans is turned into a pressure value from 0
+ * (everything scanned was reclaimed) to 100 (nothing was) and handed to
+ * the registered notifiers. A reclaimer that has to drop to a low scan
+ * priority reports the window as fully pressured straight away.
+ *
+ * Released under the GPL, see the file COPYING for details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/notifier.h>
+#include <linux/vmpressure.h>
+
+/*
+ * Pages to scan before the ratio is evaluated. 16 reclaim batches keep the
+ * value from jittering while still reacting within a few reclaim rounds.
+ */
+static const unsigned long vmpressure_win = SWAP_CLUSTER_MAX * 16;
+
+/*
+ * Reclaim priority at which the window is treated as 100% pressure; at
+ * priority 3 reclaim is scanning an eighth of the LRUs per pass.
+ */
+static const int vmpressure_level_critical_prio = 3;
+
+static DEFINE_SPINLOCK(vmpressure_lock);
+static unsigned long vmpressure_scanned;
+static unsigned long vmpressure_reclaimed;
+
+static ATOMIC_NOTIFIER_HEAD(vmpressure_notifier);
+
+int vmpressure_notifier_register(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_notifier_register);
+
+int vmpressure_notifier_unregister(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_notifier_unregister);
+
+static unsigned long vmpressure_calc(unsigned long scanned,
+				     unsigned long reclaimed)
+{
+	unsigned long scale = scanned + reclaimed;
+	unsigned long pressure;
+
+	/*
+	 * reclaimed can exceed scanned when slab or compound pages were
+	 * freed along the way; that is no pressure at all.
+	 */
+	if (reclaimed >= scanned)
+		return 0;
+
+	pressure = scale - (reclaimed * scale / scanned);
+	return pressure * 100 / scale;
+}
+
+/**
+ * vmpressure() - account reclaim efficiency
+ * @gfp:	reclaimer's gfp mask
+ * @scanned:	number of pages scanned
+ * @reclaimed:	number of pages reclaimed
+ *
+ * Called from the LRU reclaim path for global (not memcg limit) reclaim.
+ * May be called from any reclaim context; it never sleeps.
+ */
+void vmpressure(gfp_t gfp, unsigned long scanned, unsigned long reclaimed)
+{
+	unsigned long pressure;
+
+	/*
+	 * Only allocations that could have used the reclaimed memory and that
+	 * were allowed to do IO say anything about how hard reclaim is.
+	 */
+	if (!(gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+
+	if (!scanned)
+		return;
+
+	spin_lock(&vmpressure_lock);
+	vmpressure_scanned += scanned;
+	vmpressure_reclaimed += reclaimed;
+	if (vmpressure_scanned < vmpressure_win) {
+		spin_unlock(&vmpressure_lock);
+		return;
+	}
+	scanned = vmpressure_scanned;
+	reclaimed = vmpressure_reclaimed;
+	vmpressure_scanned = vmpressure_reclaimed = 0;
+	spin_unlock(&vmpressure_lock);
+
+	pressure = vmpressure_calc(scanned, reclaimed);
+	atomic_notifier_call_chain(&vmpressure_notifier, pressure, NULL);
+}
+
+/**
+ * vmpressure_prio() - account reclaim priority
+ * @gfp:	reclaimer's gfp mask
+ * @prio:	reclaimer's current scan priority
+ *
+ * A reclaimer that keeps lowering its priority is about to fail, so report
+ * a full window of unsuccessful scans instead of waiting for it to fill.
+ */
+void vmpressure_prio(gfp_t gfp, int prio)
+{
+	if (prio > vmpressure_level_critical_prio)
+		return;
+
+	vmpressure(gfp, vmpressure_win, 0);
+}
@@ -0,0 +1,111 @@
+# binder buffer allocation latency
+# Licensed under the terms of the GNU GPL License version 2
+#
+# Pairs the binder:binder_alloc_buf_start/end tracepoints by thread and
+# reports, per target process, how long transaction buffer allocation
+# took. Allocations are split by where their pages came from: none needed,
+# all still mapped from the lru, or at least one newly mapped page.
+# Shrinker reclaim of lru pages is counted as well.
+# If a [pid] arg is specified, only that target process is displayed.
+
+import os
+import sys
+
+sys.path.append(os.environ['PERF_EXEC_PATH'] + \
+	'/scripts/python/Perf-Trace-Util/lib/Perf/Trace')
+
+from perf_trace_context import *
+from Core import *
+from Util import *
+
+usage = "perf script -s binder-alloc-latency.py [pid]\n";
+
+for_proc = None
+
+if len(sys.argv) > 2:
+	sys.exit(usage)
+
+if len(sys.argv) > 1:
+	for_proc = int(sys.argv[1])
+
+kinds = ("no new pages", "lru pages", "mapped pages")
+
+in_flight = {}	# tid -> [start ns, lru pages, mapped pages]
+latency = {}	# (proc, kind) -> [count, total, min, max]
+failed = {}	# proc -> count
+reclaimed = {}	# proc -> count
+
+def trace_begin():
+	print "Press control+C to stop and show the summary"
+
+def binder__binder_alloc_buf_start(event_name, context, common_cpu,
+	common_secs, common_nsecs, common_pid, common_comm,
+	proc, data_size, offsets_size, is_async):
+	in_flight[common_pid] = [nsecs(common_secs, common_nsecs), 0, 0]
+
+def binder__binder_alloc_lru(event_name, context, common_cpu,
+	common_secs, common_nsecs, common_pid, common_comm,
+	proc, page_index):
+	if in_flight.has_key(common_pid):
+		in_flight[common_pid][1] += 1
+
+def binder__binder_alloc_page(event_name, context, common_cpu,
+	common_secs, common_nsecs, common_pid, common_comm,
+	proc, page_index):
+	if in_flight.has_key(common_pid):
+		in_flight[common_pid][2] += 1
+
+def binder__binder_reclaim_page(event_name, context, common_cpu,
+	common_secs, common_nsecs, common_pid, common_comm,
+	proc, page_index):
+	reclaimed[proc] = reclaimed.get(proc, 0) + 1
+
+def binder__binder_alloc_buf_end(event_name, context, common_cpu,
+	common_secs, common_nsecs, common_pid, common_comm,
+	proc, failed_alloc):
+	if not in_flight.has_key(common_pid):
+		return
+	start, lru, mapped = in_flight.pop(common_pid)
+	if failed_alloc:
+		failed[proc] = failed.get(proc, 0) + 1
+		return
+	elapsed = nsecs(common_secs, common_nsecs) - start
+	if mapped:
+		kind = 2
+	elif lru:
+		kind = 1
+	else:
+		kind = 0
+	key = (proc, kind)
+	if not latency.has_key(key):
+		latency[key] = [0, 0, elapsed, elapsed]
+	stats = latency[key]
+	stats[0] += 1
+	stats[1] += elapsed
+	stats[2] = min(stats[2], elapsed)
+	stats[3] = max(stats[3], elapsed)
+
+def trace_end():
+	procs = set([proc for (proc, kind) in latency.keys()])
+	procs |= set(failed.keys()) | set(reclaimed.keys())
+	if for_proc is not None:
+		procs &= set([for_proc])
+
+	print "\nbinder buffer allocation latency:\n"
+	print "%-8s %-14s %10s %10s %10s %10s" % \
+	      ("proc", "pages", "count", "min ns", "avg ns", "max ns")
+	print "%-8s %-14s %10s %10s %10s %10s" % \
+	      ("--------", "--------------", "----------", "----------",
+	       "----------", "----------")
+	for proc in sorted(procs):
+		for kind in range(len(kinds)):
+			if not latency.has_key((proc, kind)):
+				continue
+			count, total, lo, hi = latency[proc, kind]
+			print "%-8d %-14s %10d %10d %10d %10d" % \
+			      (proc, kinds[kind], count, lo, total / count, hi)
+		if failed.has_key(proc):
+			print "%-8d %-14s %10d" % (proc, "failed", failed[proc])
+		if reclaimed.has_key(proc):
+			print "%-8d %-14s %10d" % \
+			      (proc, "reclaimed", reclaimed[proc])
@@ -0,0 +1,696 @@
+/*
+ * cpufreq-interactive-sim: replay a cpu_idle/cpu_frequency trace through
+ * the interactive governor.
+ *
+ * The trace is the text output of ftrace with the power:cpu_idle and
+ * power:cpu_frequency events enabled:
+ *
+ *	echo 1 > /sys/kernel/debug/tracing/events/power/cpu_idle/enable
+ *	echo 1 > /sys/kernel/debug/tracing/events/power/cpu_frequency/enable
+ *	cat /sys/kernel/debug/tracing/trace_pipe > trace.txt
+ *
+ * Every interval a CPU spent out of idle becomes a job, whose work is the
+ * cycles it took at the recorded frequency. The jobs are then run again,
+ * arriving at the times they did in the trace, at the frequency chosen by
+ * the governor decisions in drivers/cpufreq/cpufreq_interactive.h, driven
+ * the way cpufreq_interactive.c drives them (per-CPU timer, idle entry and
+ * exit hooks). As on Tegra, all CPUs share one clock running at the highest
+ * of their targets.
+ *
+ * Reported are the time spent at each frequency, recorded and simulated,
+ * the dynamic energy of both (V^2 x cycles, from the dvfs table) and how
+ * many jobs finished later than they did in the trace: missed deadlines.
+ *
+ * Not modelled: iowait (not in the trace), CPU hotplug, the core_lock
+ * pm_qos requests, and the time the up task and down work take to run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+typedef uint64_t u64;
+#define min(a, b)	((a) < (b) ? (a) : (b))
+
+#include "../../../drivers/cpufreq/cpufreq_interactive.h"
+
+#define MAX_CPUS	8
+#define MAX_OPPS	64
+#define STATE_EXIT	4294967295UL	/* cpu_idle state on idle exit */
+
+struct opp {
+	unsigned int khz;
+	unsigned int mv;
+	u64 rec_time;		/* us at this frequency, recorded */
+	u64 sim_time;		/* and simulated */
+};
+
+/*
+ * Tegra3 CPU frequencies (freq_table_1p5GHz in tegra3_clocks.c) and the
+ * lowest cpu_millivolts at which each runs in the cpu_g dvfs table
+ * (speedo 4, process 2) of tegra3_dvfs.c.
+ */
+static struct opp opps[MAX_OPPS] = {
+	{   51000,  800 }, {  102000,  800 }, {  204000,  800 },
+	{  340000,  800 }, {  475000,  800 }, {  640000,  850 },
+	{  760000,  900 }, {  860000,  900 }, { 1000000,  975 },
+	{ 1100000, 1000 }, { 1200000, 1025 }, { 1300000, 1075 },
+	{ 1400000, 1150 }, { 1500000, 1150 },
+};
+static int nr_opps = 14;
+
+struct job {
+	u64 start;		/* left idle, us */
+	u64 end;		/* went idle again in the trace */
+	double work;		/* kHz x us */
+};
+
+struct event {
+	u64 t;
+	int cpu;
+	int idle;		/* cpu_idle, else cpu_frequency */
+	unsigned long state;
+};
+
+struct cpu {
+	struct job *jobs;
+	int nr_jobs, max_jobs;
+	int online;		/* has cpu_idle events */
+
+	/* simulation */
+	int next;		/* job running or to arrive */
+	double left;		/* work left of it */
+	int busy;
+	u64 idle_total;
+
+	/* governor state, as in struct cpufreq_interactive_cpuinfo */
+	int timer_pending;
+	u64 timer_expires;
+	int timer_idlecancel;
+	int idling;
+	u64 time_in_idle;
+	u64 idle_exit_time;
+	u64 timer_run_time;
+	u64 freq_change_time;
+	u64 freq_change_time_in_idle;
+	unsigned int target_freq;
+	unsigned int floor_freq;
+	u64 floor_validate_time;
+};
+
+static struct cpufreq_interactive_tunables tunables = {
+	.go_maxspeed_load = 85,
+	.go_hispeed_load = 85,
+	.min_sample_time = 30000,
+	.above_hispeed_delay = 20000,
+};
+static unsigned long timer_rate = 20000;
+static unsigned int tick_us = 10000;	/* timers expire on ticks, HZ=100 */
+static u64 slack;			/* deadline slack, us */
+static unsigned int policy_min, policy_max;
+
+static struct cpu cpus[MAX_CPUS];
+static int nr_cpus;
+static struct event *events;
+static int nr_events, max_events;
+
+static u64 now;
+static unsigned int cur_freq;		/* simulated cluster frequency */
+static unsigned long sim_changes, rec_changes;
+static unsigned long missed, nr_jobs;
+static u64 lateness, worst;
+static double rec_energy, sim_energy;
+
+static void *grow(void *p, int *max, size_t size)
+{
+	*max = *max ? *max * 2 : 1024;
+	p = realloc(p, *max * size);
+	if (!p) {
+		perror("realloc");
+		exit(1);
+	}
+	return p;
+}
+
+static struct opp *opp_of(unsigned int khz)
+{
+	int i;
+
+	for (i = 0; i < nr_opps; i++)
+		if (opps[i].khz >= khz)
+			return &opps[i];
+	return &opps[nr_opps - 1];
+}
+
+/* V^2 x Gcycles of running at khz for us */
+static double energy(unsigned int khz, u64 us)
+{
+	double v = opp_of(khz)->mv / 1000.0;
+
+	return v * v * khz * us / 1e12;
+}
+
+/* cpufreq_frequency_table_target() with CPUFREQ_RELATION_H */
+static unsigned int table_target(unsigned int khz)
+{
+	unsigned int best = 0, lowest = 0;
+	int i;
+
+	for (i = 0; i < nr_opps; i++) {
+		unsigned int f = opps[i].khz;
+
+		if (f < policy_min || f > policy_max)
+			continue;
+		if (!lowest)
+			lowest = f;
+		if (f <= khz)
+			best = f;
+	}
+	return best ? best : lowest;
+}
+
+static int read_opps(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	unsigned int khz, mv;
+	char line[256];
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	nr_opps = 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || sscanf(line, "%u %u", &khz, &mv) != 2)
+			continue;
+		if (nr_opps == MAX_OPPS ||
+		    (nr_opps && khz <= opps[nr_opps - 1].khz)) {
+			fprintf(stderr, "%s: too many or unsorted entries\n",
+				path);
+			fclose(f);
+			return -1;
+		}
+		opps[nr_opps].khz = khz;
+		opps[nr_opps++].mv = mv;
+	}
+	fclose(f);
+	return nr_opps ? 0 : -1;
+}
+
+/*
+ * The timestamp is the "secs.usecs:" field just before the event name;
+ * the fields in front of it differ between kernel versions.
+ */
+static int parse_line(const char *line, struct event *e)
+{
+	const char *ev, *p;
+	double ts;
+
+	ev = strstr(line, " cpu_idle: ");
+	e->idle = ev != NULL;
+	if (!ev)
+		ev = strstr(line, " cpu_frequency: ");
+	if (!ev || ev == line)
+		return 0;
+
+	for (p = ev; p > line && p[-1] != ' '; p--)
+		;
+	ts = strtod(p, NULL);
+
+	p = strstr(ev, "state=");
+	if (!p || sscanf(p, "state=%lu cpu_id=%d", &e->state, &e->cpu) != 2)
+		return 0;
+	if (e->cpu < 0 || e->cpu >= MAX_CPUS)
+		return 0;
+
+	e->t = (u64)(ts * 1e6 + 0.5);
+	return 1;
+}
+
+static void add_job(struct cpu *c, u64 start, u64 end, double work)
+{
+	if (c->nr_jobs == c->max_jobs)
+		c->jobs = grow(c->jobs, &c->max_jobs, sizeof(*c->jobs));
+	c->jobs[c->nr_jobs].start = start;
+	c->jobs[c->nr_jobs].end = end;
+	c->jobs[c->nr_jobs++].work = work;
+}
+
+/*
+ * Turn the trace into jobs, accounting the recorded residency and energy
+ * on the way. A CPU whose first cpu_idle event is an entry was busy from
+ * the start of the trace.
+ */
+static void build_jobs(u64 *start, u64 *end)
+{
+	int busy[MAX_CPUS], seen[MAX_CPUS] = { 0 };
+	u64 since[MAX_CPUS];
+	double work[MAX_CPUS];
+	unsigned int freq = 0;
+	u64 last;
+	int i, j;
+
+	*start = last = nr_events ? events[0].t : 0;
+	*end = nr_events ? events[nr_events - 1].t : 0;
+
+	for (i = 0; i < nr_events; i++) {
+		struct event *e = &events[i];
+
+		if (e->idle && !seen[e->cpu]) {
+			seen[e->cpu] = 1;
+			busy[e->cpu] = e->state != STATE_EXIT;
+			since[e->cpu] = *start;
+			work[e->cpu] = 0;
+			cpus[e->cpu].online = 1;
+			if (e->cpu >= nr_cpus)
+				nr_cpus = e->cpu + 1;
+		}
+		if (!e->idle && !freq)
+			freq = e->state;
+	}
+	if (!freq)
+		freq = opps[nr_opps - 1].khz;
+
+	for (i = 0; i <= nr_events; i++) {
+		struct event *e = i < nr_events ? &events[i] : NULL;
+		u64 t = e ? e->t : *end;
+
+		opp_of(freq)->rec_time += t - last;
+		for (j = 0; j < nr_cpus; j++) {
+			if (!cpus[j].online || !busy[j])
+				continue;
+			work[j] += (double)freq * (t - last);
+			rec_energy += energy(freq, t - last);
+		}
+		last = t;
+
+		if (!e) {
+			for (j = 0; j < nr_cpus; j++)
+				if (cpus[j].online && busy[j])
+					add_job(&cpus[j], since[j], t, work[j]);
+		} else if (!e->idle) {
+			if (e->state != freq)
+				rec_changes++;
+			freq = e->state;
+		} else if (e->state == STATE_EXIT) {
+			if (!busy[e->cpu]) {
+				busy[e->cpu] = 1;
+				since[e->cpu] = t;
+				work[e->cpu] = 0;
+			}
+		} else if (busy[e->cpu]) {
+			busy[e->cpu] = 0;
+			add_job(&cpus[e->cpu], since[e->cpu], t, work[e->cpu]);
+		}
+	}
+}
+
+static void mod_timer(struct cpu *c)
+{
+	u64 delay = (timer_rate + tick_us - 1) / tick_us * tick_us;
+
+	c->timer_expires = now / tick_us * tick_us + delay;
+	if (c->timer_expires <= now)
+		c->timer_expires = now + 1;
+	c->timer_pending = 1;
+}
+
+static void start_sample(struct cpu *c)
+{
+	c->time_in_idle = c->idle_total;
+	c->idle_exit_time = now;
+}
+
+/* the up task and the down work: set the cluster to the highest target */
+static void set_speed(struct cpu *c)
+{
+	unsigned int freq = 0;
+	int i;
+
+	for (i = 0; i < nr_cpus; i++)
+		if (cpus[i].online && cpus[i].target_freq > freq)
+			freq = cpus[i].target_freq;
+
+	freq = table_target(freq);
+	if (freq != cur_freq) {
+		cur_freq = freq;
+		sim_changes++;
+	}
+
+	c->freq_change_time = now;
+	c->freq_change_time_in_idle = c->idle_total;
+}
+
+/* cpufreq_interactive_timer() */
+static void gov_timer(struct cpu *c)
+{
+	unsigned int delta_time, delta_idle, new_freq;
+	int cpu_load, load_since_change, notyet;
+
+	c->timer_pending = 0;
+	c->timer_run_time = now;
+
+	if (!c->idle_exit_time)
+		return;
+
+	delta_idle = c->idle_total - c->time_in_idle;
+	delta_time = now - c->idle_exit_time;
+
+	if (delta_time < 1000)
+		goto rearm;
+
+	cpu_load = cpufreq_interactive_load(&tunables, delta_time,
+					    delta_idle, 0);
+	load_since_change = cpufreq_interactive_load(&tunables,
+			now - c->freq_change_time,
+			c->idle_total - c->freq_change_time_in_idle, 0);
+
+	new_freq = cpufreq_interactive_get_target(&tunables,
+			cpu_load, load_since_change, cur_freq,
+			policy_min, policy_max, c->target_freq,
+			now - c->freq_change_time, &notyet);
+	new_freq = table_target(new_freq);
+
+	if (!cpufreq_interactive_floor_ok(&tunables, new_freq, c->floor_freq,
+					  now - c->floor_validate_time))
+		goto rearm;
+
+	c->floor_freq = new_freq;
+	c->floor_validate_time = now;
+
+	if (c->target_freq != new_freq) {
+		c->target_freq = new_freq;
+		set_speed(c);
+	}
+
+	if (c->target_freq == policy_max)
+		return;
+
+rearm:
+	if (!c->timer_pending) {
+		if (c->target_freq == policy_min) {
+			if (c->idling)
+				return;
+			c->timer_idlecancel = 1;
+		}
+		start_sample(c);
+		mod_timer(c);
+	}
+}
+
+/* cpufreq_interactive_idle_start() */
+static void gov_idle_start(struct cpu *c)
+{
+	c->idling = 1;
+
+	if (c->target_freq != policy_min) {
+		if (!c->timer_pending) {
+			start_sample(c);
+			c->timer_idlecancel = 0;
+			mod_timer(c);
+		}
+	} else if (c->timer_pending && c->timer_idlecancel) {
+		c->timer_pending = 0;
+		c->idle_exit_time = 0;
+		c->timer_idlecancel = 0;
+	}
+}
+
+/* cpufreq_interactive_idle_end() */
+static void gov_idle_end(struct cpu *c)
+{
+	c->idling = 0;
+
+	if (!c->timer_pending && c->timer_run_time >= c->idle_exit_time) {
+		start_sample(c);
+		c->timer_idlecancel = 0;
+		mod_timer(c);
+	}
+}
+
+static void finish_job(struct cpu *c)
+{
+	struct job *j = &c->jobs[c->next++];
+
+	nr_jobs++;
+	if (now > j->end + slack) {
+		missed++;
+		lateness += now - j->end;
+		if (now - j->end > worst)
+			worst = now - j->end;
+	}
+}
+
+static void simulate(u64 start, u64 end)
+{
+	int i;
+
+	now = start;
+	cur_freq = table_target(policy_max);
+
+	/* cpufreq_governor_interactive(CPUFREQ_GOV_START) */
+	for (i = 0; i < nr_cpus; i++) {
+		struct cpu *c = &cpus[i];
+
+		if (!c->online)
+			continue;
+		c->target_freq = c->floor_freq = cur_freq;
+		c->floor_validate_time = c->freq_change_time = now;
+		start_sample(c);
+		mod_timer(c);
+		if (c->nr_jobs && c->jobs[0].start <= now) {
+			c->busy = 1;
+			c->left = c->jobs[0].work;
+		} else {
+			c->idling = 1;
+		}
+	}
+
+	while (now < end) {
+		u64 next = end, dt;
+
+		for (i = 0; i < nr_cpus; i++) {
+			struct cpu *c = &cpus[i];
+			u64 t;
+
+			if (!c->online)
+				continue;
+			if (c->busy)
+				t = now + (u64)((c->left + cur_freq - 1) /
+						cur_freq);
+			else if (c->next < c->nr_jobs)
+				t = c->jobs[c->next].start;
+			else
+				t = end;
+			if (t < next)
+				next = t;
+			if (c->timer_pending && c->timer_expires < next)
+				next = c->timer_expires;
+		}
+		if (next <= now)
+			next = now + 1;
+
+		dt = next - now;
+		opp_of(cur_freq)->sim_time += dt;
+		for (i = 0; i < nr_cpus; i++) {
+			struct cpu *c = &cpus[i];
+
+			if (!c->online)
+				continue;
+			if (c->busy) {
+				c->left -= (double)cur_freq * dt;
+				sim_energy += energy(cur_freq, dt);
+			} else {
+				c->idle_total += dt;
+			}
+		}
+		now = next;
+
+		for (i = 0; i < nr_cpus; i++) {
+			struct cpu *c = &cpus[i];
+
+			if (!c->online)
+				continue;
+			if (c->busy && c->left < 1) {
+				finish_job(c);
+				if (c->next < c->nr_jobs &&
+				    c->jobs[c->next].start <= now) {
+					c->left += c->jobs[c->next].work;
+				} else {
+					c->busy = 0;
+					gov_idle_start(c);
+				}
+			} else if (!c->busy && c->next < c->nr_jobs &&
+				   c->jobs[c->next].start <= now) {
+				c->busy = 1;
+				c->left = c->jobs[c->next].work;
+				gov_idle_end(c);
+			}
+		}
+
+		for (i = 0; i < nr_cpus; i++)
+			if (cpus[i].online && cpus[i].timer_pending &&
+			    cpus[i].timer_expires <= now)
+				gov_timer(&cpus[i]);
+	}
+
+	/* what is still running at the end of the trace is late */
+	for (i = 0; i < nr_cpus; i++)
+		while (cpus[i].online && cpus[i].next < cpus[i].nr_jobs)
+			finish_job(&cpus[i]);
+}
+
+static void report(u64 start, u64 end)
+{
+	double total = end > start ? end - start : 1;
+	int i, online = 0;
+
+	for (i = 0; i < nr_cpus; i++)
+		online += cpus[i].online;
+
+	printf("trace: %d cpus, %.6f s, %d events\n",
+	       online, (end - start) / 1e6, nr_events);
+	printf("\n%10s %6s %24s %24s\n", "", "", "recorded", "simulated");
+	printf("%10s %6s %14s %9s %14s %9s\n",
+	       "kHz", "mV", "ms", "%", "ms", "%");
+	for (i = 0; i < nr_opps; i++) {
+		struct opp *o = &opps[i];
+
+		if (!o->rec_time && !o->sim_time)
+			continue;
+		printf("%10u %6u %14.3f %8.2f%% %14.3f %8.2f%%\n",
+		       o->khz, o->mv,
+		       o->rec_time / 1e3, 100.0 * o->rec_time / total,
+		       o->sim_time / 1e3, 100.0 * o->sim_time / total);
+	}
+
+	printf("\nfrequency changes: recorded %lu, simulated %lu\n",
+	       rec_changes, sim_changes);
+	printf("dynamic energy (V^2 x Gcycles): recorded %.4f, "
+	       "simulated %.4f (%+.1f%%)\n", rec_energy, sim_energy,
+	       rec_energy ? 100.0 * (sim_energy - rec_energy) / rec_energy
+			  : 0.0);
+	printf("jobs: %lu, missed deadlines: %lu (%.2f%%), "
+	       "mean lateness %.3f ms, worst %.3f ms\n",
+	       nr_jobs, missed, nr_jobs ? 100.0 * missed / nr_jobs : 0.0,
+	       missed ? lateness / 1e3 / missed : 0.0, worst / 1e3);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] [trace]\n"
+		"  -o file   frequency table, \"kHz mV\" per line\n"
+		"  -n kHz    policy min (default: lowest frequency)\n"
+		"  -x kHz    policy max (default: highest frequency)\n"
+		"  -H hz     timer tick rate (default 100)\n"
+		"  -d us     deadline slack (default 0)\n"
+		"governor tunables, as in sysfs:\n"
+		"  -r us     timer_rate (default 20000)\n"
+		"  -s us     min_sample_time (default 30000)\n"
+		"  -a us     above_hispeed_delay (default 20000)\n"
+		"  -f kHz    hispeed_freq (default: policy max)\n"
+		"  -g pct    go_hispeed_load (default 85)\n"
+		"  -m pct    go_maxspeed_load (default 85)\n"
+		"  -F n      boost_factor (default 0)\n"
+		"  -M kHz    max_boost (default 0)\n"
+		"  -l pct    sustain_load (default 0)\n"
+		"  -b        boost\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *in = stdin;
+	char line[1024];
+	u64 start, end;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:n:x:H:d:r:s:a:f:g:m:F:M:l:b"))
+	       != -1) {
+		switch (opt) {
+		case 'o':
+			if (read_opps(optarg))
+				return 1;
+			break;
+		case 'n':
+			policy_min = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			policy_max = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			tick_us = 1000000 / strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			slack = strtoull(optarg, NULL, 0);
+			break;
+		case 'r':
+			timer_rate = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			tunables.min_sample_time = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			tunables.above_hispeed_delay =
+				strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			tunables.hispeed_freq = strtoull(optarg, NULL, 0);
+			break;
+		case 'g':
+			tunables.go_hispeed_load = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			tunables.go_maxspeed_load = strtoul(optarg, NULL, 0);
+			break;
+		case 'F':
+			tunables.boost_factor = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			tunables.max_boost = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			tunables.sustain_load = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			tunables.boost = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc - 1 || !tick_us)
+		usage(argv[0]);
+	if (optind == argc - 1) {
+		in = fopen(argv[optind], "r");
+		if (!in) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	if (!policy_min)
+		policy_min = opps[0].khz;
+	if (!policy_max)
+		policy_max = opps[nr_opps - 1].khz;
+	if (!tunables.hispeed_freq)
+		tunables.hispeed_freq = policy_max;
+
+	while (fgets(line, sizeof(line), in)) {
+		if (nr_events == max_events)
+			events = grow(events, &max_events, sizeof(*events));
+		nr_events += parse_line(line, &events[nr_events]);
+	}
+	if (!nr_events) {
+		fprintf(stderr, "no cpu_idle or cpu_frequency events\n");
+		return 1;
+	}
+
+	build_jobs(&start, &end);
+	simulate(start, end);
+	report(start, end);
+	return 0;
+}
@@ -0,0 +1,331 @@
+/*
+ * blk-stage-bench: random read IOPS of a block device as the number of
+ * submitting cpus grows, with and without per-cpu request staging.
+ *
+ *	blk-stage-bench [-c max_cpus] [-d depth] [-t seconds] [-b bytes]
+ *			<blockdev>
+ *
+ * For 1 to -c cpus, one thread pinned to each cpu submits batches of -d
+ * random O_DIRECT reads with io_submit() (which plugs around the batch)
+ * and reaps them, for -t seconds. Every step is run with
+ * /sys/block/<disk>/queue/sw_stage set to 0 and then to 1, and the IOPS
+ * of both are reported. Meant for null_blk (modprobe null_blk), where the
+ * block layer is all there is to measure; the sw_stage setting found
+ * before the run is restored at the end.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <linux/aio_abi.h>
+#include <linux/fs.h>
+
+struct worker {
+	pthread_t thread;
+	int cpu;
+	uint64_t ios;
+};
+
+static const char *dev;
+static int max_cpus = 4;
+static int depth = 32;
+static int seconds = 5;
+static size_t block_size = 4096;
+
+static uint64_t dev_size;
+static volatile int stop;
+
+static int io_setup(unsigned nr, aio_context_t *ctx)
+{
+	return syscall(__NR_io_setup, nr, ctx);
+}
+
+static int io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+	return syscall(__NR_io_submit, ctx, nr, iocbpp);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr,
+			struct io_event *events)
+{
+	return syscall(__NR_io_getevents, ctx, min_nr, nr, events, NULL);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t nr_blocks = dev_size / block_size;
+	unsigned int seed = w->cpu + 1;
+	struct iocb *iocbs, **iocbpp;
+	struct io_event *events;
+	aio_context_t ctx = 0;
+	cpu_set_t set;
+	char *bufs;
+	int fd, i, n, done;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		perror("sched_setaffinity");
+		exit(1);
+	}
+
+	iocbs = calloc(depth, sizeof(*iocbs));
+	iocbpp = calloc(depth, sizeof(*iocbpp));
+	events = calloc(depth, sizeof(*events));
+	if (!iocbs || !iocbpp || !events ||
+	    posix_memalign((void **)&bufs, 4096, depth * block_size)) {
+		perror("alloc");
+		exit(1);
+	}
+
+	fd = open(dev, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		perror(dev);
+		exit(1);
+	}
+	if (io_setup(depth, &ctx)) {
+		perror("io_setup");
+		exit(1);
+	}
+
+	while (!stop) {
+		for (i = 0; i < depth; i++) {
+			uint64_t off = ((uint64_t)rand_r(&seed) << 16 ^
+					rand_r(&seed)) % nr_blocks;
+
+			memset(&iocbs[i], 0, sizeof(iocbs[i]));
+			iocbs[i].aio_fildes = fd;
+			iocbs[i].aio_lio_opcode = IOCB_CMD_PREAD;
+			iocbs[i].aio_buf = (uintptr_t)(bufs + i * block_size);
+			iocbs[i].aio_nbytes = block_size;
+			iocbs[i].aio_offset = off * block_size;
+			iocbpp[i] = &iocbs[i];
+		}
+
+		n = io_submit(ctx, depth, iocbpp);
+		if (n != depth) {
+			fprintf(stderr, "io_submit: %s\n",
+				n < 0 ? strerror(errno) : "short submit");
+			exit(1);
+		}
+		for (done = 0; done < depth; done += n) {
+			n = io_getevents(ctx, depth - done, depth - done,
+					 events);
+			if (n < 0) {
+				if (errno == EINTR) {
+					n = 0;
+					continue;
+				}
+				perror("io_getevents");
+				exit(1);
+			}
+		}
+		w->ios += depth;
+	}
+
+	io_destroy(ctx);
+	close(fd);
+	free(bufs);
+	free(events);
+	free(iocbpp);
+	free(iocbs);
+	return NULL;
+}
+
+/* /sys/block/<disk>/queue/sw_stage of the disk holding dev */
+static int get_stage_path(char *path, size_t len)
+{
+	char link[PATH_MAX], real[PATH_MAX], part[PATH_MAX + 16];
+	struct stat st;
+
+	if (stat(dev, &st) || !S_ISBLK(st.st_mode))
+		return -1;
+	snprintf(link, sizeof(link), "/sys/dev/block/%u:%u",
+		 major(st.st_rdev), minor(st.st_rdev));
+	if (!realpath(link, real))
+		return -1;
+
+	/* a partition has no queue of its own */
+	snprintf(part, sizeof(part), "%s/partition", real);
+	if (!access(part, F_OK))
+		*strrchr(real, '/') = '\0';
+
+	snprintf(path, len, "%s/queue/sw_stage", real);
+	return 0;
+}
+
+static int read_stage(const char *path)
+{
+	int val = -1;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%d", &val) != 1)
+		val = -1;
+	fclose(f);
+	return val;
+}
+
+static int write_stage(const char *path, int val)
+{
+	FILE *f;
+
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	fprintf(f, "%d", val);
+	if (fclose(f))
+		return -1;
+	return read_stage(path) == val ? 0 : -1;
+}
+
+static double run(int nr_cpus)
+{
+	struct worker *workers;
+	uint64_t start, elapsed, ios = 0;
+	int i;
+
+	workers = calloc(nr_cpus, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		exit(1);
+	}
+
+	stop = 0;
+	start = now_ns();
+	for (i = 0; i < nr_cpus; i++) {
+		workers[i].cpu = i;
+		errno = pthread_create(&workers[i].thread, NULL,
+				       worker_thread, &workers[i]);
+		if (errno) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < nr_cpus; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ios += workers[i].ios;
+	}
+	elapsed = now_ns() - start;
+
+	free(workers);
+	return ios / (elapsed / 1e9);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-c max_cpus] [-d depth] [-t seconds] [-b bytes] "
+		"<blockdev>\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char stage_path[PATH_MAX + 32];
+	double iops[2];
+	int opt, fd, orig, cpus, stage;
+	long online;
+
+	while ((opt = getopt(argc, argv, "c:d:t:b:")) != -1) {
+		switch (opt) {
+		case 'c':
+			max_cpus = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'b':
+			block_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || max_cpus <= 0 || depth <= 0 ||
+	    seconds <= 0 || !block_size || block_size % 512)
+		usage(argv[0]);
+	dev = argv[optind];
+
+	online = sysconf(_SC_NPROCESSORS_ONLN);
+	if (online > 0 && max_cpus > online)
+		max_cpus = online;
+
+	fd = open(dev, O_RDONLY);
+	if (fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &dev_size)) {
+		perror("BLKGETSIZE64");
+		return 1;
+	}
+	close(fd);
+	if (dev_size < block_size) {
+		fprintf(stderr, "%s: too small\n", dev);
+		return 1;
+	}
+
+	if (get_stage_path(stage_path, sizeof(stage_path)) ||
+	    (orig = read_stage(stage_path)) < 0) {
+		fprintf(stderr, "%s: no queue/sw_stage to switch\n", dev);
+		return 1;
+	}
+
+	printf("%s: %zu byte random reads, %d per io_submit, %d s per run\n",
+	       dev, block_size, depth, seconds);
+	printf("cpus  IOPS sw_stage=0  IOPS sw_stage=1\n");
+
+	for (cpus = 1; cpus <= max_cpus; cpus++) {
+		for (stage = 0; stage < 2; stage++) {
+			if (write_stage(stage_path, stage)) {
+				fprintf(stderr, "%s: cannot set sw_stage\n",
+					stage_path);
+				return 1;
+			}
+			iops[stage] = run(cpus);
+		}
+		printf("%4d  %15.0f  %15.0f\n", cpus, iops[0], iops[1]);
+	}
+
+	if (write_stage(stage_path, orig))
+		fprintf(stderr, "could not restore sw_stage %d\n", orig);
+	return 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * fsync-bench: many threads appending to their own file and fsyncing it,
+ * the way database journals do.
+ *
+ *	fsync-bench [-t threads] [-n fsyncs] [-s bytes] <dir>
+ *
+ * Every thread creates <dir>/fsync-bench.<n>, then appends -s bytes and
+ * calls fsync() on it -n times. Reported are the fsync rate and latency
+ * percentiles over all threads.
+ *
+ * If <dir> is on f2fs and debugfs is mounted, the cache flushes f2fs
+ * issued to the device during the run are read back from the "Flush:"
+ * line of /sys/kernel/debug/f2fs/status, so that the flush_merge mount
+ * option can be compared against the default of one flush per fsync.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+
+#define F2FS_STATUS	"/sys/kernel/debug/f2fs/status"
+
+static const char *dir;
+static int nr_threads = 8;
+static int nr_fsyncs = 1000;
+static size_t write_size = 4096;
+
+static uint64_t *latency;		/* ns, nr_threads * nr_fsyncs */
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *bench_thread(void *arg)
+{
+	long id = (long)arg;
+	uint64_t *lat = latency + id * nr_fsyncs;
+	char path[PATH_MAX];
+	char *buf;
+	uint64_t start;
+	int fd, i;
+
+	buf = malloc(write_size);
+	if (!buf) {
+		perror("malloc");
+		exit(1);
+	}
+	memset(buf, 'a' + id % 26, write_size);
+
+	snprintf(path, sizeof(path), "%s/fsync-bench.%ld", dir, id);
+	fd = open(path, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0644);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+
+	for (i = 0; i < nr_fsyncs; i++) {
+		if (write(fd, buf, write_size) != (ssize_t)write_size) {
+			perror("write");
+			exit(1);
+		}
+		start = now_ns();
+		if (fsync(fd)) {
+			perror("fsync");
+			exit(1);
+		}
+		lat[i] = now_ns() - start;
+	}
+
+	close(fd);
+	unlink(path);
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Find the "Flush: <issued> issued / <requests> requests" line in the
+ * f2fs status section of the device holding dir. Returns 0 on success.
+ */
+static int read_f2fs_flushes(const char *devname, long *issued,
+							long *requests)
+{
+	char line[256], header[128];
+	int in_dev = 0, found = 0;
+	FILE *f;
+
+	f = fopen(F2FS_STATUS, "r");
+	if (!f)
+		return -1;
+
+	snprintf(header, sizeof(header), "partition info(%s)", devname);
+	while (fgets(line, sizeof(line), f)) {
+		if (strstr(line, "partition info(")) {
+			in_dev = strstr(line, header) != NULL;
+			continue;
+		}
+		if (in_dev && sscanf(line, "Flush: %ld issued / %ld requests",
+				     issued, requests) == 2) {
+			found = 1;
+			break;
+		}
+	}
+	fclose(f);
+	return found ? 0 : -1;
+}
+
+/* The name bdevname() gives the block device holding path, e.g. sda1 */
+static int get_devname(const char *path, char *devname, size_t len)
+{
+	char link[PATH_MAX], target[PATH_MAX];
+	struct stat st;
+	ssize_t n;
+
+	if (stat(path, &st))
+		return -1;
+	snprintf(link, sizeof(link), "/sys/dev/block/%u:%u",
+		 major(st.st_dev), minor(st.st_dev));
+	n = readlink(link, target, sizeof(target) - 1);
+	if (n < 0)
+		return -1;
+	target[n] = '\0';
+	snprintf(devname, len, "%s", basename(target));
+	return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(uint64_t *sorted, size_t n, double pct)
+{
+	size_t i = (size_t)(pct / 100.0 * (n - 1) + 0.5);
+
+	return sorted[i] / 1000.0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t threads] [-n fsyncs] [-s bytes] <dir>\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	long issued[2], requests[2];
+	int have_stats = 0;
+	char devname[64];
+	pthread_t *threads;
+	uint64_t start, elapsed;
+	size_t total;
+	long i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:n:s:")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'n':
+			nr_fsyncs = atoi(optarg);
+			break;
+		case 's':
+			write_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || nr_threads <= 0 || nr_fsyncs <= 0 ||
+	    !write_size)
+		usage(argv[0]);
+	dir = argv[optind];
+
+	total = (size_t)nr_threads * nr_fsyncs;
+	latency = calloc(total, sizeof(*latency));
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!latency || !threads) {
+		perror("calloc");
+		return 1;
+	}
+
+	if (!get_devname(dir, devname, sizeof(devname)) &&
+	    !read_f2fs_flushes(devname, &issued[0], &requests[0]))
+		have_stats = 1;
+
+	start = now_ns();
+	for (i = 0; i < nr_threads; i++) {
+		errno = pthread_create(&threads[i], NULL, bench_thread,
+				       (void *)i);
+		if (errno) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	elapsed = now_ns() - start;
+
+	if (have_stats &&
+	    read_f2fs_flushes(devname, &issued[1], &requests[1]))
+		have_stats = 0;
+
+	qsort(latency, total, sizeof(*latency), cmp_u64);
+
+	printf("%d threads x %d fsyncs of %zu byte appends in %.3f s\n",
+	       nr_threads, nr_fsyncs, write_size, elapsed / 1e9);
+	printf("fsync/s: %.0f\n", total / (elapsed / 1e9));
+	printf("latency us: p50 %.0f p90 %.0f p99 %.0f p99.9 %.0f max %.0f\n",
+	       percentile_us(latency, total, 50),
+	       percentile_us(latency, total, 90),
+	       percentile_us(latency, total, 99),
+	       percentile_us(latency, total, 99.9),
+	       latency[total - 1] / 1000.0);
+
+	if (have_stats)
+		printf("f2fs flushes: %ld issued for %ld requests "
+		       "(%zu fsync calls)\n",
+		       issued[1] - issued[0], requests[1] - requests[0],
+		       total);
+	else
+		printf("f2fs flushes: n/a (not f2fs, or %s unavailable)\n",
+		       F2FS_STATUS);
+
+	free(threads);
+	free(latency);
+	return 0;
+}
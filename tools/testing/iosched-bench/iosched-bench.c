@@ -0,0 +1,419 @@
+/*
+ * iosched-bench: read latency under buffered-write background load, for
+ * each of a list of I/O schedulers.
+ *
+ *	iosched-bench [-s schedulers] [-r readers] [-w writers] [-t seconds]
+ *		      [-b bytes] <blockdev>
+ *
+ * ALL DATA ON <blockdev> IS OVERWRITTEN. For every scheduler in the comma
+ * separated list (default flash,deadline,cfq) the device is switched to it
+ * through /sys/block/<disk>/queue/scheduler, then -w threads write the
+ * second half of the device sequentially through the page cache, leaving
+ * writeback to the flusher threads, while -r threads issue random O_DIRECT
+ * reads of -b bytes over the first half and time each of them. Reported
+ * are the read rate and latency percentiles, and the write rate seen by
+ * the writers.
+ *
+ * The device needs a request queue with an elevator: an eMMC partition,
+ * or scsi_debug (modprobe scsi_debug dev_size_mb=256 delay=1) to run
+ * without one. The loop driver bypasses the I/O scheduler. The scheduler
+ * that was selected before the run is restored at the end.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <linux/fs.h>
+
+#define WRITE_CHUNK	(1 << 20)
+#define WARMUP_SECONDS	2
+
+struct reader {
+	pthread_t thread;
+	unsigned int seed;
+	uint64_t *lat;			/* ns */
+	size_t nr, size;
+};
+
+struct writer {
+	pthread_t thread;
+	int id;
+	uint64_t written;		/* bytes */
+};
+
+static const char *dev;
+static int nr_readers = 4;
+static int nr_writers = 2;
+static int seconds = 10;
+static size_t read_size = 4096;
+
+static uint64_t dev_size;
+static volatile int stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *reader_thread(void *arg)
+{
+	struct reader *r = arg;
+	uint64_t nr_blocks = dev_size / 2 / read_size;
+	uint64_t start, off;
+	void *buf;
+	int fd;
+
+	if (posix_memalign(&buf, 4096, read_size)) {
+		perror("posix_memalign");
+		exit(1);
+	}
+	fd = open(dev, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		perror(dev);
+		exit(1);
+	}
+
+	while (!stop) {
+		off = ((uint64_t)rand_r(&r->seed) << 16 ^ rand_r(&r->seed)) %
+								nr_blocks;
+		off *= read_size;
+
+		start = now_ns();
+		if (pread(fd, buf, read_size, off) != (ssize_t)read_size) {
+			perror("pread");
+			exit(1);
+		}
+		if (r->nr == r->size) {
+			r->size = r->size ? r->size * 2 : 4096;
+			r->lat = realloc(r->lat, r->size * sizeof(*r->lat));
+			if (!r->lat) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		r->lat[r->nr++] = now_ns() - start;
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Each writer owns a slice of the second half of the device and rewrites
+ * it over and over; nothing is synced, writeback does the I/O.
+ */
+static void *writer_thread(void *arg)
+{
+	struct writer *w = arg;
+	uint64_t slice = dev_size / 2 / nr_writers / WRITE_CHUNK * WRITE_CHUNK;
+	uint64_t base = dev_size / 2 + w->id * slice, off = 0;
+	char *buf;
+	int fd;
+
+	buf = malloc(WRITE_CHUNK);
+	if (!buf) {
+		perror("malloc");
+		exit(1);
+	}
+	memset(buf, 'a' + w->id % 26, WRITE_CHUNK);
+
+	fd = open(dev, O_WRONLY);
+	if (fd < 0) {
+		perror(dev);
+		exit(1);
+	}
+
+	while (!stop) {
+		if (pwrite(fd, buf, WRITE_CHUNK, base + off) != WRITE_CHUNK) {
+			perror("pwrite");
+			exit(1);
+		}
+		w->written += WRITE_CHUNK;
+		off += WRITE_CHUNK;
+		if (off >= slice)
+			off = 0;
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+/* /sys/block/<disk>/queue/scheduler of the disk holding dev */
+static int get_sched_path(char *path, size_t len)
+{
+	char link[PATH_MAX], real[PATH_MAX], part[PATH_MAX + 16];
+	struct stat st;
+
+	if (stat(dev, &st) || !S_ISBLK(st.st_mode))
+		return -1;
+	snprintf(link, sizeof(link), "/sys/dev/block/%u:%u",
+		 major(st.st_rdev), minor(st.st_rdev));
+	if (!realpath(link, real))
+		return -1;
+
+	/* a partition has no queue of its own */
+	snprintf(part, sizeof(part), "%s/partition", real);
+	if (!access(part, F_OK))
+		*strrchr(real, '/') = '\0';
+
+	snprintf(path, len, "%s/queue/scheduler", real);
+	return 0;
+}
+
+/* the scheduler in brackets, e.g. "noop [deadline] cfq" */
+static int read_sched(const char *path, char *sched, size_t len, char *all,
+								size_t all_len)
+{
+	char line[256], *start, *end;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (!fgets(line, sizeof(line), f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	if (all)
+		snprintf(all, all_len, "%s", line);
+	start = strchr(line, '[');
+	end = strchr(line, ']');
+	if (!start || !end || end < start)
+		return -1;
+	*end = '\0';
+	snprintf(sched, len, "%s", start + 1);
+	return 0;
+}
+
+static int write_sched(const char *path, const char *sched)
+{
+	char cur[64];
+	FILE *f;
+
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	fprintf(f, "%s", sched);
+	if (fclose(f))
+		return -1;
+
+	if (read_sched(path, cur, sizeof(cur), NULL, 0) || strcmp(cur, sched))
+		return -1;
+	return 0;
+}
+
+/* write back and drop what the previous run left in the page cache */
+static void drain(void)
+{
+	int fd = open(dev, O_RDWR);
+
+	if (fd < 0)
+		return;
+	fsync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(uint64_t *sorted, size_t n, double pct)
+{
+	size_t i = (size_t)(pct / 100.0 * (n - 1) + 0.5);
+
+	return sorted[i] / 1000.0;
+}
+
+static void run(const char *sched)
+{
+	struct reader *readers;
+	struct writer *writers;
+	uint64_t *lat, start, elapsed, written = 0;
+	size_t total = 0, n;
+	int i;
+
+	readers = calloc(nr_readers, sizeof(*readers));
+	writers = calloc(nr_writers, sizeof(*writers));
+	if (!readers || !writers) {
+		perror("calloc");
+		exit(1);
+	}
+
+	drain();
+	stop = 0;
+
+	for (i = 0; i < nr_writers; i++) {
+		writers[i].id = i;
+		errno = pthread_create(&writers[i].thread, NULL, writer_thread,
+				       &writers[i]);
+		if (errno) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	/* let the dirty pages pile up so that writeback is going */
+	sleep(WARMUP_SECONDS);
+
+	start = now_ns();
+	for (i = 0; i < nr_readers; i++) {
+		readers[i].seed = i + 1;
+		errno = pthread_create(&readers[i].thread, NULL, reader_thread,
+				       &readers[i]);
+		if (errno) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < nr_readers; i++) {
+		pthread_join(readers[i].thread, NULL);
+		total += readers[i].nr;
+	}
+	elapsed = now_ns() - start;
+	for (i = 0; i < nr_writers; i++) {
+		pthread_join(writers[i].thread, NULL);
+		written += writers[i].written;
+	}
+
+	lat = malloc((total ? total : 1) * sizeof(*lat));
+	if (!lat) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0, n = 0; i < nr_readers; i++) {
+		memcpy(lat + n, readers[i].lat, readers[i].nr * sizeof(*lat));
+		n += readers[i].nr;
+		free(readers[i].lat);
+	}
+
+	printf("%-10s reads/s %8.0f  write MB/s %7.1f", sched,
+	       total / (elapsed / 1e9),
+	       written / (double)(1 << 20) / ((elapsed / 1e9) + WARMUP_SECONDS));
+	if (total) {
+		qsort(lat, total, sizeof(*lat), cmp_u64);
+		printf("  read latency us: p50 %.0f p90 %.0f p99 %.0f "
+		       "p99.9 %.0f max %.0f",
+		       percentile_us(lat, total, 50),
+		       percentile_us(lat, total, 90),
+		       percentile_us(lat, total, 99),
+		       percentile_us(lat, total, 99.9),
+		       lat[total - 1] / 1000.0);
+	}
+	printf("\n");
+
+	free(lat);
+	free(writers);
+	free(readers);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-s schedulers] [-r readers] [-w writers] "
+		"[-t seconds] [-b bytes] <blockdev>\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char sched_path[PATH_MAX + 32], orig[64], avail[256];
+	char *scheds = strdup("flash,deadline,cfq"), *sched, *save;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "s:r:w:t:b:")) != -1) {
+		switch (opt) {
+		case 's':
+			scheds = optarg;
+			break;
+		case 'r':
+			nr_readers = atoi(optarg);
+			break;
+		case 'w':
+			nr_writers = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'b':
+			read_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || nr_readers <= 0 || nr_writers < 0 ||
+	    seconds <= 0 || !read_size || read_size % 512)
+		usage(argv[0]);
+	dev = argv[optind];
+
+	fd = open(dev, O_RDONLY);
+	if (fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &dev_size)) {
+		perror("BLKGETSIZE64");
+		return 1;
+	}
+	close(fd);
+	if (dev_size / 2 < read_size ||
+	    (nr_writers && dev_size / 2 / nr_writers < WRITE_CHUNK)) {
+		fprintf(stderr, "%s: too small\n", dev);
+		return 1;
+	}
+
+	if (get_sched_path(sched_path, sizeof(sched_path)) ||
+	    read_sched(sched_path, orig, sizeof(orig), avail, sizeof(avail))) {
+		fprintf(stderr, "%s: no I/O scheduler to switch\n", dev);
+		return 1;
+	}
+
+	/* do not leave the device on a half set up scheduler */
+	signal(SIGINT, SIG_IGN);
+
+	printf("%s: %d readers x %zu bytes, %d buffered writers, %d s\n",
+	       dev, nr_readers, read_size, nr_writers, seconds);
+
+	for (sched = strtok_r(scheds, ",", &save); sched;
+	     sched = strtok_r(NULL, ",", &save)) {
+		if (write_sched(sched_path, sched)) {
+			fprintf(stderr, "%-10s unavailable (%s)\n", sched,
+				strtok(avail, "\n"));
+			continue;
+		}
+		run(sched);
+	}
+
+	drain();
+	if (write_sched(sched_path, orig))
+		fprintf(stderr, "could not restore scheduler %s\n", orig);
+	return 0;
+}